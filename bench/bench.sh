@@ -0,0 +1,155 @@
+#!/bin/sh
+# Benchmark suite for wee, run by `make bench`.
+#
+# Generates synthetic workloads in bench/data (once, they are reused) and
+# drives the editor headlessly through `wee --script`. Each run appends one
+# JSON line to bench/results.json:
+#
+#   {"workload":"c-1m","file_bytes":N,"stats":{...}}
+#
+# where stats is the report printed by the editor: open and first-frame
+# time, key latency, peak RSS and one segment per measured operation
+# (typing, paste, search, select-all-delete, save-unchanged, save, browse). The cJSON
+# parse throughput is measured by bench/json_bench, with and without SSE2,
+# and the job pool is stress-tested by `wee --pool-bench`. The suite fails
+# if cursor movement or unchanged frames allocate memory (alloc-check).
+#
+# QUICK=1 shrinks every workload by 100x for a fast smoke run.
+# `bench.sh check` (make check) only runs alloc-check, on a 10k-line file.
+
+set -e
+
+cd "$(dirname "$0")/.."
+WEE="$PWD/wee"
+DATA="$PWD/bench/data"
+RESULTS="$PWD/bench/results.json"
+DIV=1
+[ "$QUICK" = "1" ] && DIV=100
+CHECK=0
+if [ "$1" = "check" ]; then
+  CHECK=1
+  DIV=100
+  RESULTS="$DATA/check.json"
+fi
+
+C_LINES=$((1000000 / DIV))
+LOG_LINES=$((10000000 / DIV))     # ~100 bytes per line: 1GB
+JSON_ITEMS=$((400000 / DIV))      # ~50 bytes per item: 20MB
+DIR_ENTRIES=$((500000 / DIV))
+
+mkdir -p "$DATA"
+: > "$RESULTS"
+
+# The editor runs with an empty home directory, so neither the recent-files
+# list nor the sessions of the user leak into the measurements
+export HOME="$DATA/home"
+rm -rf "$HOME"
+mkdir -p "$HOME"
+
+# generate <file> <awk program>: writes the file unless it is already there
+generate() {
+  if [ ! -f "$DATA/$1" ]; then
+    echo "generating $1"
+    awk "BEGIN { $2 }" > "$DATA/$1.tmp"
+    mv "$DATA/$1.tmp" "$DATA/$1"
+  fi
+}
+
+# run <workload> <file> <script>: the file is edited on a scratch copy so the
+# generated data stays untouched
+run() {
+  cp "$DATA/$2" "$DATA/scratch"
+  printf '%s' "$3" > "$DATA/keys"
+  bytes=$(wc -c < "$DATA/scratch")
+  echo "running $1"
+  stats=$("$WEE" --script "$DATA/keys" "$DATA/scratch" 2>&1 >/dev/null | tail -n 1)
+  echo "{\"workload\":\"$1\",\"file_bytes\":$bytes,\"stats\":$stats}" >> "$RESULTS"
+  rm -f "$DATA/scratch"
+}
+
+# Moving the cursor and redrawing an unchanged screen must not allocate once
+# the output buffer has grown to the size of a frame; the run fails otherwise
+alloc_check() {
+  run alloc-check "c-$C_LINES.c" '<Down*1000><Up*1000><mark:cursor-move><Down*1000><Up*1000><mark:unchanged-frames><Up*200>'
+  for seg in cursor-move unchanged-frames; do
+    allocs=$(echo "$stats" | sed -n "s/.*\"name\":\"$seg\",[^}]*\"allocs\":\([0-9]*\).*/\1/p")
+    if [ "$allocs" != "0" ]; then
+      echo "alloc-check: $seg made ${allocs:-an unknown number of} allocations" >&2
+      exit 1
+    fi
+  done
+}
+
+generate "c-$C_LINES.c" "
+  for (i = 0; i < $C_LINES / 10; i++) {
+    printf \"/* function %d */\\nstatic int f%d(int x) {\\n\", i, i
+    printf \"  int y = x * %d;\\n  if (y > 1000) {\\n    return y - %d;\\n\", i, i
+    printf \"  }\\n  /* keep going */\\n  return y + 0x%x;\\n}\\n\\n\", i
+  }
+  printf \"int needle_%d(void) { return 0; }\\n\", $C_LINES"
+
+if [ "$CHECK" = "1" ]; then
+  alloc_check
+  rm -f "$DATA/keys"
+  echo "alloc-check: ok"
+  exit 0
+fi
+
+generate "log-$LOG_LINES.log" "
+  for (i = 0; i < $LOG_LINES; i++)
+    printf \"2024-01-01T00:%02d:%02d.%06dZ INFO worker-%02d request id=%08d status=200 bytes=%d\\n\",
+           (i / 60) % 60, i % 60, i % 1000000, i % 16, i, i % 65536
+  printf \"2024-01-01T00:00:00.000000Z ERROR needle\\n\""
+
+generate "json-$JSON_ITEMS.json" "
+  printf \"[\"
+  for (i = 0; i < $JSON_ITEMS; i++)
+    printf \"%s{\\\"id\\\":%d,\\\"name\\\":\\\"item%d\\\",\\\"ok\\\":true}\", i ? \",\" : \"\", i, i
+  printf \",{\\\"needle\\\":1}]\\n\""
+
+if [ ! -d "$DATA/dir-$DIR_ENTRIES" ]; then
+  echo "generating dir-$DIR_ENTRIES"
+  mkdir -p "$DATA/dir-$DIR_ENTRIES.tmp"
+  (cd "$DATA/dir-$DIR_ENTRIES.tmp" && awk "BEGIN { for (i = 0; i < $DIR_ENTRIES; i++) print \"entry\" i }" | xargs touch)
+  mv "$DATA/dir-$DIR_ENTRIES.tmp" "$DATA/dir-$DIR_ENTRIES"
+fi
+
+# Every file workload first saves the unmodified buffer, which is skipped,
+# then deletes one character and saves (save throughput), then types, searches for the needle at the end, pastes a copied block and
+# finally deletes everything.
+SAVE='<mark:save-unchanged><C-s><mark:save><Del><C-s>'
+EDITS='<mark:typing>int typed = 42;<Enter*20><mark:search><C-f>needle<Enter>'
+PASTE='<mark:paste><Home><C-b><Down*100><C-e><C-w><C-u*20>'
+CLEAR='<mark:select-all-delete><C-a><Del>'
+
+run c-1m "c-$C_LINES.c" "$SAVE$EDITS$PASTE$CLEAR"
+run log-1g "log-$LOG_LINES.log" "$SAVE$EDITS$PASTE$CLEAR"
+run json-20m "json-$JSON_ITEMS.json" "$SAVE<mark:typing><End>xyz<Home>abc<mark:search><C-f>needle<Enter>$CLEAR"
+
+alloc_check
+
+echo "running dir-500k"
+printf '<mark:browse><C-o><Down*10><Esc>' > "$DATA/keys"
+stats=$(cd "$DATA/dir-$DIR_ENTRIES" && "$WEE" --script "$DATA/keys" 2>&1 >/dev/null | tail -n 1)
+echo "{\"workload\":\"dir-500k\",\"file_bytes\":0,\"stats\":$stats}" >> "$RESULTS"
+
+rm -f "$DATA/keys"
+
+# cJSON parse throughput with and without the SSE2 fast paths; the
+# checksums of the re-printed trees must match
+echo "running json-parse"
+simd=$(./bench/json_bench $((100000 / DIV)))
+scalar=$(./bench/json_bench_scalar $((100000 / DIV)))
+echo "$simd" >> "$RESULTS"
+echo "$scalar" >> "$RESULTS"
+if [ "${simd##*checksum}" != "${scalar##*checksum}" ]; then
+  echo "json-parse: SSE2 and scalar parsers disagree" >&2
+  exit 1
+fi
+
+# Job pool stress test with four workers: exits non-zero if a job was lost,
+# delivered twice or computed the wrong result
+echo "running pool-stress"
+"$WEE" --pool-bench $((200000 / DIV))x4 >> "$RESULTS"
+
+cat "$RESULTS"
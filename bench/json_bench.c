@@ -0,0 +1,85 @@
+/* JSON parse throughput benchmark, built by `make bench`.
+ *
+ * Parses a generated document (pretty-printed objects with plain and escaped
+ * strings, numbers and nested arrays) repeatedly and prints one JSON line
+ * with the throughput of the fastest run:
+ *
+ *   {"workload":"json-parse","simd":1,"bytes":N,"runs":N,"mb_per_s":X,"checksum":N}
+ *
+ * The checksum covers the re-printed tree, so builds with and without the
+ * SSE2 fast paths (-DCJSON_NO_SSE2) can be checked against each other.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../cJSON.h"
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *generate(int items, size_t *len) {
+  size_t cap = (size_t)items * 512 + 64;
+  char *buf = malloc(cap);
+  size_t n = 0;
+  n += sprintf(buf + n, "[\n");
+  for (int i = 0; i < items; i++) {
+    n += sprintf(buf + n,
+                 "%s    {\n"
+                 "        \"id\": %d,\n"
+                 "        \"name\": \"item number %d with a reasonably long plain name\",\n"
+                 "        \"path\": \"C:\\\\dir\\\\file%d.txt\",\n"
+                 "        \"note\": \"line one\\nline two \\u00e9\\t\\\"quoted\\\"\",\n"
+                 "        \"values\": [%d, %d.5, -%d, true, null]\n"
+                 "    }",
+                 i ? ",\n" : "", i, i, i, i, i, i);
+  }
+  n += sprintf(buf + n, "\n]\n");
+  *len = n;
+  return buf;
+}
+
+int main(int argc, char *argv[]) {
+  int items = argc > 1 ? atoi(argv[1]) : 100000;
+  size_t len;
+  char *json = generate(items, &len);
+
+  // The fastest run is reported: it is the least disturbed by the machine
+  int runs = 0;
+  double start = now(), best = 0;
+  do {
+    double t = now();
+    cJSON *root = cJSON_ParseWithLength(json, len);
+    t = now() - t;
+    if (!root) {
+      fprintf(stderr, "json_bench: parse error\n");
+      return 1;
+    }
+    cJSON_Delete(root);
+    if (runs++ == 0 || t < best) best = t;
+  } while (now() - start < 2.0 || runs < 3);
+
+  cJSON *root = cJSON_ParseWithLength(json, len);
+  char *printed = cJSON_PrintUnformatted(root);
+  unsigned long checksum = 5381;
+  for (char *p = printed; *p; p++) checksum = checksum * 33 + (unsigned char)*p;
+
+#ifdef CJSON_NO_SSE2
+  int simd = 0;
+#else
+  int simd = 1;
+#endif
+  printf("{\"workload\":\"json-parse\",\"simd\":%d,\"bytes\":%zu,\"runs\":%d,\"mb_per_s\":%.1f,"
+         "\"checksum\":%lu}\n", simd, len, runs, len / best / 1e6, checksum);
+
+  free(printed);
+  cJSON_Delete(root);
+  free(json);
+  return 0;
+}
@@ -49,6 +49,12 @@
 #include <locale.h>
 #endif
 
+/* SSE2 fast paths for whitespace and string scanning; define CJSON_NO_SSE2 to force the scalar code */
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(CJSON_NO_SSE2)
+#define CJSON_SSE2
+#include <emmintrin.h>
+#endif
+
 #if defined(_MSC_VER)
 #pragma warning (pop)
 #endif
@@ -249,8 +255,8 @@ static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
     return node;
 }
 
-/* Delete a cJSON structure. */
-CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
+/* Delete a cJSON structure with the given hooks. */
+static void delete_item(cJSON *item, const internal_hooks * const hooks)
 {
     cJSON *next = NULL;
     while (item != NULL)
@@ -258,23 +264,56 @@ CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
         next = item->next;
         if (!(item->type & cJSON_IsReference) && (item->child != NULL))
         {
-            cJSON_Delete(item->child);
+            delete_item(item->child, hooks);
         }
         if (!(item->type & cJSON_IsReference) && (item->valuestring != NULL))
         {
-            global_hooks.deallocate(item->valuestring);
+            hooks->deallocate(item->valuestring);
             item->valuestring = NULL;
         }
         if (!(item->type & cJSON_StringIsConst) && (item->string != NULL))
         {
-            global_hooks.deallocate(item->string);
+            hooks->deallocate(item->string);
             item->string = NULL;
         }
-        global_hooks.deallocate(item);
+        hooks->deallocate(item);
         item = next;
     }
 }
 
+/* Delete a cJSON structure. */
+CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
+{
+    delete_item(item, &global_hooks);
+}
+
+/* free_fn of an allocator that releases everything at once (e.g. an arena) */
+static void CJSON_CDECL allocator_no_free(void *pointer)
+{
+    (void)pointer;
+}
+
+/* Turn the hooks of an allocator variant into internal hooks. */
+static void allocator_hooks(const cJSON_Hooks * const hooks, internal_hooks * const internal)
+{
+    internal->allocate = (hooks->malloc_fn != NULL) ? hooks->malloc_fn : global_hooks.allocate;
+    internal->deallocate = (hooks->free_fn != NULL) ? hooks->free_fn : allocator_no_free;
+    internal->reallocate = NULL;
+}
+
+CJSON_PUBLIC(void) cJSON_DeleteWithAllocator(cJSON *item, const cJSON_Hooks *hooks)
+{
+    internal_hooks internal;
+
+    if (hooks == NULL)
+    {
+        cJSON_Delete(item);
+        return;
+    }
+    allocator_hooks(hooks, &internal);
+    delete_item(item, &internal);
+}
+
 /* get the decimal point character of the current locale */
 static unsigned char get_decimal_point(void)
 {
@@ -816,6 +855,26 @@ fail:
 }
 
 /* Parse the input text into an unescaped cinput, and populate item. */
+#ifdef CJSON_SSE2
+/* advance over string bytes that are neither a quote nor a backslash, 16 at a time */
+static const unsigned char *skip_plain_string_bytes(const parse_buffer * const input_buffer, const unsigned char *input_end)
+{
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while ((size_t)(input_end - input_buffer->content) + 16 <= input_buffer->length)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(const void *)input_end);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+        if (mask != 0)
+        {
+            return input_end + __builtin_ctz(mask);
+        }
+        input_end += 16;
+    }
+    return input_end;
+}
+#endif
+
 static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_buffer)
 {
     const unsigned char *input_pointer = buffer_at_offset(input_buffer) + 1;
@@ -835,6 +894,13 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
         size_t skipped_bytes = 0;
         while (((size_t)(input_end - input_buffer->content) < input_buffer->length) && (*input_end != '\"'))
         {
+#ifdef CJSON_SSE2
+            input_end = skip_plain_string_bytes(input_buffer, input_end);
+            if (((size_t)(input_end - input_buffer->content) >= input_buffer->length) || (*input_end == '\"'))
+            {
+                break;
+            }
+#endif
             /* is escape sequence */
             if (input_end[0] == '\\')
             {
@@ -868,7 +934,12 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
     {
         if (*input_pointer != '\\')
         {
-            *output_pointer++ = *input_pointer++;
+            /* copy the run up to the next escape sequence in one go */
+            const unsigned char *run_end = (const unsigned char*)memchr(input_pointer, '\\', (size_t)(input_end - input_pointer));
+            size_t run_length = (size_t)(((run_end != NULL) ? run_end : input_end) - input_pointer);
+            memcpy(output_pointer, input_pointer, run_length);
+            output_pointer += run_length;
+            input_pointer += run_length;
         }
         /* escape sequence */
         else
@@ -1094,6 +1165,24 @@ static parse_buffer *buffer_skip_whitespace(parse_buffer * const buffer)
         return buffer;
     }
 
+#ifdef CJSON_SSE2
+    {
+        /* a byte is whitespace (<= 32) when max(byte, 32) == 32 */
+        const __m128i space = _mm_set1_epi8(32);
+        while (buffer->offset + 16 <= buffer->length)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i *)(const void *)buffer_at_offset(buffer));
+            unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(chunk, space), space));
+            if (mask != 0xFFFF)
+            {
+                buffer->offset += (size_t)__builtin_ctz(~mask);
+                return buffer;
+            }
+            buffer->offset += 16;
+        }
+    }
+#endif
+
     while (can_access_at_index(buffer, 0) && (buffer_at_offset(buffer)[0] <= 32))
     {
        buffer->offset++;
@@ -1138,8 +1227,8 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return
     return cJSON_ParseWithLengthOpts(value, buffer_length, return_parse_end, require_null_terminated);
 }
 
-/* Parse an object - create a new root, and populate. */
-CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated)
+/* Parse an object with the given hooks - create a new root, and populate. */
+static cJSON *parse_with_hooks(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated, const internal_hooks * const hooks)
 {
     parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 } };
     cJSON *item = NULL;
@@ -1156,9 +1245,9 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer
     buffer.content = (const unsigned char*)value;
     buffer.length = buffer_length;
     buffer.offset = 0;
-    buffer.hooks = global_hooks;
+    buffer.hooks = *hooks;
 
-    item = cJSON_New_Item(&global_hooks);
+    item = cJSON_New_Item(hooks);
     if (item == NULL) /* memory fail */
     {
         goto fail;
@@ -1189,7 +1278,7 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer
 fail:
     if (item != NULL)
     {
-        cJSON_Delete(item);
+        delete_item(item, hooks);
     }
 
     if (value != NULL)
@@ -1218,6 +1307,24 @@ fail:
     return NULL;
 }
 
+/* Parse an object - create a new root, and populate. */
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated)
+{
+    return parse_with_hooks(value, buffer_length, return_parse_end, require_null_terminated, &global_hooks);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithAllocator(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated, const cJSON_Hooks *hooks)
+{
+    internal_hooks internal;
+
+    if (hooks == NULL)
+    {
+        return cJSON_ParseWithLengthOpts(value, buffer_length, return_parse_end, require_null_terminated);
+    }
+    allocator_hooks(hooks, &internal);
+    return parse_with_hooks(value, buffer_length, return_parse_end, require_null_terminated, &internal);
+}
+
 /* Default options for cJSON_Parse */
 CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value)
 {
@@ -1580,7 +1687,7 @@ success:
 fail:
     if (head != NULL)
     {
-        cJSON_Delete(head);
+        delete_item(head, &input_buffer->hooks);
     }
 
     return false;
@@ -1760,7 +1867,7 @@ success:
 fail:
     if (head != NULL)
     {
-        cJSON_Delete(head);
+        delete_item(head, &input_buffer->hooks);
     }
 
     return false;
@@ -157,6 +157,11 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithLength(const char *value, size_t buffer_len
 /* If you supply a ptr in return_parse_end and parsing fails, then return_parse_end will contain a pointer to the error so will match cJSON_GetErrorPtr(). */
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated);
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated);
+/* ParseWithAllocator allocates every node and string of the tree with hooks->malloc_fn instead of the global hooks.
+ * If hooks->free_fn is NULL nothing is ever freed individually: the allocator (e.g. an arena) releases the whole tree at once.
+ * Otherwise release the tree with cJSON_DeleteWithAllocator and the same hooks, never with cJSON_Delete. */
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithAllocator(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated, const cJSON_Hooks *hooks);
+CJSON_PUBLIC(void) cJSON_DeleteWithAllocator(cJSON *item, const cJSON_Hooks *hooks);
 
 /* Render a cJSON entity to text for transfer/storage. */
 CJSON_PUBLIC(char *) cJSON_Print(const cJSON *item);
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""Generates wee_width.h, the display width tables used by wee.c.
+
+Run with `make width-table` after a Python upgrade brings a newer Unicode
+database. Two sorted range tables are written:
+
+  width_zero: combining marks (Mn, Me), format characters (Cf, except the
+              soft hyphen) and Hangul medial/final jamo, drawn in 0 columns
+  width_wide: East Asian Wide (W) and Fullwidth (F), and unassigned code
+              points in the CJK blocks, drawn in 2 columns
+
+Everything else is 1 column wide.
+"""
+
+import sys
+import unicodedata
+
+
+def ranges(pred):
+    out = []
+    start = None
+    for cp in range(0x110000 + 1):
+        hit = cp <= 0x10FFFF and not 0xD800 <= cp <= 0xDFFF and pred(cp)
+        if hit and start is None:
+            start = cp
+        elif not hit and start is not None:
+            out.append((start, cp - 1))
+            start = None
+    return out
+
+
+def zero(cp):
+    if cp == 0x00AD:
+        return False
+    if 0x1160 <= cp <= 0x11FF:
+        return True
+    return unicodedata.category(chr(cp)) in ("Mn", "Me", "Cf")
+
+
+# Unassigned code points in these blocks default to Wide
+WIDE_DEFAULT = [(0x3400, 0x4DBF), (0x4E00, 0x9FFF), (0xF900, 0xFAFF),
+                (0x20000, 0x2FFFD), (0x30000, 0x3FFFD)]
+
+
+def wide(cp):
+    if unicodedata.category(chr(cp)) == "Cn":
+        return any(a <= cp <= b for a, b in WIDE_DEFAULT)
+    return unicodedata.east_asian_width(chr(cp)) in ("W", "F")
+
+
+def table(name, rs):
+    lines = ["static const struct widthRange %s[] = {" % name]
+    for i in range(0, len(rs), 4):
+        chunk = ", ".join("{0x%05X, 0x%05X}" % r for r in rs[i:i + 4])
+        lines.append("  %s," % chunk)
+    lines.append("};")
+    return "\n".join(lines)
+
+
+def main():
+    out = sys.argv[1] if len(sys.argv) > 1 else "wee_width.h"
+    with open(out, "w") as f:
+        f.write("/* Generated by tools/gen_width.py from Unicode %s. Do not edit. */\n\n"
+                % unicodedata.unidata_version)
+        f.write("struct widthRange {\n  int first, last;\n};\n\n")
+        f.write(table("width_zero", ranges(zero)) + "\n\n")
+        f.write(table("width_wide", ranges(wide)) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -5,26 +5,48 @@
 #define _GNU_SOURCE
 
 #include <ctype.h>
+#include <limits.h>
+#include <malloc.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h> 
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h> 
 #include <stdlib.h> 
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h> 
+#include <sys/syscall.h>
 #include <sys/types.h> 
+#include <sys/un.h>
 #include <termios.h>
 #include <time.h> 
 #include <unistd.h> 
 #include "cJSON.h"
+#include "wee_width.h"
+
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(WEE_NO_SSE2)
+#define WEE_SSE2
+#include <emmintrin.h>
+#endif
 
 /* defines */
 
 #define WEE_VERSION "0.87 Beta"
 #define WEE_TAB_STOP 4
+/* Rows with tabs or multi-byte characters keep a cx/rx checkpoint every
+ * this many bytes */
+#define ROW_CKPT_BYTES 256
 #define WEE_QUIT_TIMES 2
+#define WEE_RECENT_MAX 50
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 
@@ -40,7 +62,21 @@ enum editorKey {
   PAGE_UP,
   PAGE_DOWN,
   ALT_B,
-  ALT_E
+  ALT_E,
+  ALT_N,
+  ALT_P,
+  ALT_X,
+  ALT_L,
+  ALT_S,
+  ALT_V,
+  ALT_W,
+  ALT_Q,
+  ALT_H,
+  ALT_O,
+  ALT_J,
+  ALT_F,
+  ALT_M,
+  ALT_K
 };
 
 enum editorHighlight {
@@ -55,6 +91,130 @@ enum editorHighlight {
   HL_SELECTION
 };
 
+/*
+ * Frame instrumentation for the performance HUD (Alt-H). It only exists in
+ * builds made with `make PROFILE=1`; otherwise the macros expand to nothing.
+ */
+#ifdef WEE_PROFILE
+enum perfPhase {
+  PERF_SCROLL = 0,
+  PERF_DRAW,
+  PERF_HIGHLIGHT,
+  PERF_WRITE,
+  PERF_PHASES
+};
+
+struct perfFrame {
+  long long phase_ns[PERF_PHASES];
+  long long bytes;
+  long long rows_highlighted;
+  long long allocs;
+};
+
+#define PERF_BEGIN(phase) long long perf_##phase = editorNow()
+#define PERF_END(phase) (E.perf_cur.phase_ns[phase] += editorNow() - perf_##phase)
+#define PERF_COUNT(field, n) (E.perf_cur.field += (n))
+#else
+#define PERF_BEGIN(phase) do { } while (0)
+#define PERF_END(phase) do { } while (0)
+#define PERF_COUNT(field, n) do { } while (0)
+#endif
+
+/* Subsystems whose heap usage is accounted by the allocation wrappers */
+enum memSubsystem {
+  MEM_ROWS = 0,
+  MEM_RENDER,
+  MEM_HIGHLIGHT,
+  MEM_CLIPBOARD,
+  MEM_OUTPUT,
+  MEM_SYNTAX,
+  MEM_OUTLINE,
+  MEM_VALIDATE,
+  MEM_FORMAT,
+  MEM_POOL,
+  MEM_SNAPSHOT,
+  MEM_DIFF,
+  MEM_EDITOR,
+  MEM_SUBSYSTEMS
+};
+
+/* Bump allocator: blocks are chained and released together */
+#define ARENA_BLOCK_SIZE 65536
+
+struct arenaBlock {
+  struct arenaBlock *next;
+  size_t used;
+  size_t cap;
+  char data[];
+};
+
+struct arena {
+  struct arenaBlock *head;
+  int sys;
+};
+
+#define ARENA_INIT(sys) {NULL, sys}
+
+struct memCounter {
+  long long allocs;
+  long long frees;
+  long long live_bytes;
+};
+
+/* Live counters served by the stats endpoint (--stats). Histograms have
+ * power-of-two microsecond buckets: bucket i counts durations < 2^i us. */
+#define STATS_BUCKETS 24
+
+struct editorStats {
+  long long frames;
+  long long keys;
+  long long frame_hist[STATS_BUCKETS];
+  long long key_hist[STATS_BUCKETS];
+  long long pane_hits;
+  long long pane_misses;
+  long long numbuffers;
+  long long numrows;
+  long long numwindows;
+  long long pending_loads;
+};
+
+/* JSON outline of .json buffers, built by a resumable tokenizer while idle */
+#define OUTLINE_MAX_NODES 2000000
+#define OUTLINE_CHECKPOINT_BYTES 65536
+#define OUTLINE_SLICE_NS 5000000
+#define OUTLINE_ASIDE_NODES 4096
+
+/* .json buffers are validated by a worker once typing pauses this long */
+#define VALIDATE_DEBOUNCE_NS 300000000LL
+
+/* Change markers are diffed against the saved text once typing pauses
+ * this long; a region costing more edits than DIFF_MAX_COST is left
+ * unaligned, so all its rows are marked changed */
+#define MARKS_DEBOUNCE_NS 100000000LL
+#define DIFF_MAX_COST 4096
+
+/* The histogram diff of diff mode only anchors on lines occurring at most
+ * this many times in the old range */
+#define HISTOGRAM_MAX_CHAIN 64
+
+/* Autosaves stream the text through chunks of this size */
+#define AUTOSAVE_CHUNK 65536
+
+/* The job pool runs one worker per CPU, up to this many */
+#define POOL_MAX_WORKERS 8
+
+/* A daemon client that has not sent its whole handshake after this long
+ * is dropped */
+#define DAEMON_HANDSHAKE_NS 2000000000LL
+
+/* Cooperative tasks run for at most this long between input events */
+#define TASK_SLICE_NS 10000000LL
+
+/* Chrome trace events, recorded only when started with --trace */
+#define TRACE_RING_SIZE 65536
+#define TRACE_BEGIN(name) do { if (E.trace_path) traceEvent(name, 'B', 0); } while (0)
+#define TRACE_END(name) do { if (E.trace_path) traceEvent(name, 'E', 0); } while (0)
+
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
 
@@ -70,6 +230,27 @@ struct editorSyntax {
   int flags;
 };
 
+struct recentEntry {
+  char *path;
+  int cx, cy;
+  int rowoff, coloff;
+  int ckpt_line;
+  long long ckpt_offset;
+  long long size;
+  long long mtime;
+};
+
+/* A character boundary of a row: its index, column and render offset */
+struct rowCkpt {
+  int cx, rx, ri;
+};
+
+enum rowSeek {
+  ROW_SEEK_CX = 0,
+  ROW_SEEK_RX,
+  ROW_SEEK_RI
+};
+
 typedef struct erow {
   int idx;
   int size;
@@ -78,8 +259,441 @@ typedef struct erow {
   char *render;
   unsigned char *hl;
   int hl_open_comment;
+  int ascii;
+  int plain;
+  int eol;
+  struct rowCkpt *ckpt;
+  int numckpt;
+  int text_gen;
+  uint64_t hash;
 } erow;
 
+/* Row hashes of a buffer as last loaded or saved */
+struct savedState {
+  uint64_t *hash;
+  int numrows;
+  int prefix;
+  int checked;
+  int modified;
+};
+
+/* Immutable view of a buffer's text for background readers. Rows point
+ * at the editor's own text: a row edited while a snapshot that may hold
+ * it is alive gets a private copy first (copy-on-write), and the old text
+ * is retired until no such snapshot is left. */
+struct snapRow {
+  const char *chars;
+  int size;
+};
+
+struct bufferSnapshot {
+  int gen;
+  int refs;
+  int numrows;
+  struct snapRow *rows;
+  struct bufferSnapshot *prev, *next;
+};
+
+/* Row text replaced or deleted while snapshots may still read it */
+struct retiredText {
+  struct retiredText *next;
+  int gen;
+  char *chars;
+};
+
+/* One node per JSON value, in document order */
+struct outlineNode {
+  int parent;
+  int ordinal;
+  int depth;
+  int count;
+  int end;
+  int row, col;
+  int key_row, key_col, key_len;
+  char type;
+  char open;
+};
+
+enum outlineExpect {
+  OUTLINE_VALUE = 0,
+  OUTLINE_VALUE_OR_END,
+  OUTLINE_KEY,
+  OUTLINE_KEY_OR_END,
+  OUTLINE_COLON,
+  OUTLINE_NEXT,
+  OUTLINE_DONE
+};
+
+/* Complete tokenizer state: scanning resumes from any saved copy */
+struct outlineScan {
+  int row, col;
+  int numnodes;
+  int cur;
+  int expect;
+  int in_string;
+  int escape;
+  int string_is_key;
+  int in_literal;
+  int str_row, str_col;
+  int key_row, key_col, key_len;
+};
+
+struct jsonOutline {
+  struct outlineNode *nodes;
+  int capnodes;
+  struct outlineScan scan;
+  struct outlineScan *checkpoints;
+  int numcheckpoints;
+  long long since_checkpoint;
+  int error;
+  int truncated;
+  /* Pending resync after an edit: the states saved past the edit and the
+   * one the scan had reached, with its node count (0 when none is pending)
+   * and the rows the edits since moved the text by. Old nodes the rescan
+   * overwrites go to aside; the containers open where it restarted, to
+   * shared. */
+  struct outlineScan *resync;
+  int numresync;
+  struct outlineScan resync_end;
+  int resync_nodes;
+  int resync_rows;
+  struct outlineNode *aside;
+  int aside_start, aside_len, aside_cap;
+  struct outlineNode *shared;
+  int *shared_at;
+  int numshared;
+  /* The edit noted last, whose row delta is applied at the next settle */
+  int edit_pending, edit_row, edit_numrows;
+};
+
+enum jsonCheckState {
+  JSON_UNCHECKED = 0,
+  JSON_VALID,
+  JSON_INVALID
+};
+
+enum jsonFormat {
+  JSON_PRETTY = 0,
+  JSON_MINIFY,
+  JSON_SORT_KEYS
+};
+
+/* Job priorities of the pool: work for what is on screen goes first */
+enum poolPriority {
+  POOL_VISIBLE = 0,
+  POOL_BACKGROUND,
+  POOL_PRIORITIES
+};
+
+/* Cancellation flag shared by the jobs holding a reference to it */
+struct poolToken {
+  int cancelled;
+  int refs;
+};
+
+/* A unit of work: run() is called on a worker, then done() on the main
+ * thread. Jobs are embedded as the first member of a larger struct. */
+struct poolJob {
+  struct poolJob *next;
+  int priority;
+  struct poolToken *token;
+  void (*run)(struct poolJob *job);
+  void (*done)(struct poolJob *job);
+  int cancelled;
+  long long submit_ns;
+  long long start_ns;
+};
+
+/* Each worker owns one queue per priority; idle workers steal from the
+ * others' queues before going to sleep */
+struct poolWorker {
+  pthread_mutex_t lock;
+  pthread_t tid;
+  int started;
+  struct poolJob *head[POOL_PRIORITIES];
+  struct poolJob *tail[POOL_PRIORITIES];
+};
+
+struct threadPool {
+  struct poolWorker *workers;
+  int numworkers;
+  int efd;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int queued;
+  struct poolJob *done;
+  int inflight;
+  unsigned next_worker;
+  int stopping;
+  long long submitted;
+  long long stolen;
+  long long cancelled;
+  long long completed;
+};
+
+enum taskState {
+  TASK_MORE = 0,
+  TASK_DONE
+};
+
+/* Long operation on editor state, run by the main loop in slices between
+ * input events. step() works until the deadline and returns TASK_MORE or
+ * TASK_DONE; progress is done out of total, shown in the status bar.
+ * Embedded as the first member of a larger struct, like poolJob. */
+struct editorTask {
+  struct editorTask *next;
+  const char *name;
+  int (*step)(struct editorTask *task, long long deadline);
+  void (*finish)(struct editorTask *task, int cancelled);
+  long long done, total;
+  int shown;
+};
+
+/* Background loading of the buffers restored from a session. Files are
+ * read SESSION_LOAD_LINES lines at a time; fp is the file of the buffer
+ * being read, the one marked loading, and NULL between buffers. */
+#define SESSION_LOAD_LINES 4096
+
+struct sessionLoad {
+  struct editorTask task;
+  FILE *fp;
+  char *line;
+  size_t linecap;
+};
+
+/* A job of the pool stress benchmark (--pool-bench) */
+struct poolBenchJob {
+  struct poolJob job;
+  int id;
+  unsigned long long sum;
+  int delivered;
+};
+
+/* Validation state of a .json buffer */
+struct jsonCheck {
+  int edits;
+  int checked;
+  long long edit_ns;
+  int state;
+  int row, col;
+  struct validateJob *job;
+};
+
+/* A snapshot of a buffer handed to the pool for validation, and its result */
+struct validateJob {
+  struct poolJob job;
+  struct jsonCheck *owner;
+  int edits;
+  struct bufferSnapshot *snap;
+  int state;
+  int row, col;
+};
+
+/* Change markers of a buffer against its saved text. match holds, for
+ * each row as of the last diff, the index of its saved line or -1.
+ * Since then only rows from edited on and before the last after_edit rows
+ * were edited. Arrays stay NULL until the first diff: every row still
+ * matches its saved line. */
+enum changeMark {
+  MARK_NONE = 0,
+  MARK_ADDED,
+  MARK_MODIFIED,
+  MARK_DELETED
+};
+
+struct changeMarks {
+  int numrows;
+  int savedrows;
+  int *match;
+  unsigned char *mark;
+  int edited;
+  int after_edit;
+  int edits;
+  int synced;
+  long long edit_ns;
+  struct diffJob *job;
+};
+
+/* The rows of an edited region and the saved lines they replace, handed
+ * to the pool to be diffed. Rows [start, start + numnew) of the new text
+ * replace saved lines [old_first, old_first + numold); rows from old_end
+ * on of the previous alignment follow them unchanged. */
+struct diffJob {
+  struct poolJob job;
+  struct changeMarks *owner;
+  int edits;
+  int numrows;
+  int start;
+  int old_end;
+  int old_first;
+  uint64_t *old;
+  int numold;
+  uint64_t *new;
+  int numnew;
+  int *match;
+};
+
+/* Side by side diff of two buffers (wee -d a b). Both panes scroll
+ * through the same display lines: line[side][d] is the row a side shows on
+ * display line d, or -1 for filler where only the other side has lines;
+ * at[side] maps rows back to display lines. */
+enum diffLineKind {
+  DIFF_SAME = 0,
+  DIFF_CHANGED,
+  DIFF_ONLY
+};
+
+struct diffView {
+  int active;
+  int buf[2];
+  int win[2];
+  int *line[2];
+  int *at[2];
+  int numrows[2];
+  unsigned char *kind;
+  int numlines;
+  int hunks;
+  int top;
+  int edits;
+  int synced;
+  long long edit_ns;
+  struct sideDiffJob *job;
+};
+
+/* The row hashes of both sides of a diff, aligned by a pool worker */
+struct sideDiffJob {
+  struct poolJob job;
+  int edits;
+  uint64_t *old;
+  int numold;
+  uint64_t *new;
+  int numnew;
+  int *match;
+};
+
+/* Autosave state of a buffer: the content hash last autosaved and the
+ * write in flight */
+struct autosaveState {
+  uint64_t hash;
+  struct autosaveJob *job;
+};
+
+/* A snapshot of a buffer written to path by a pool worker */
+struct autosaveJob {
+  struct poolJob job;
+  struct autosaveState *owner;
+  struct bufferSnapshot *snap;
+  uint64_t hash;
+  char *path;
+  int inplace;
+  int err;
+};
+
+struct editorBuffer {
+  int cx, cy;
+  int rx;
+  int rowoff;
+  int coloff;
+  int numrows;
+  erow *row;
+  char *filename;
+  int dirty;
+  struct savedState saved;
+  struct editorSyntax *syntax;
+  int hl_row;
+  int hl_start;
+  int hl_end;
+  int selection_start_cx;
+  int selection_start_cy;
+  int selection_end_cx;
+  int selection_end_cy;
+  int selection_active;
+  int mode;
+  int loaded;
+  int loading;
+  int session_entry;
+  struct jsonOutline *outline;
+  struct jsonCheck *json_check;
+  struct changeMarks *marks;
+  struct autosaveState *autosave;
+};
+
+struct editorWindow {
+  int buf;
+  int cx, cy;
+  int rx;
+  int rowoff;
+  int coloff;
+  int top, left;
+  int rows, cols;
+  unsigned long long drawn_sig;
+};
+
+enum layoutType {
+  LAYOUT_FREE = 0,
+  LAYOUT_LEAF,
+  LAYOUT_HSPLIT,
+  LAYOUT_VSPLIT
+};
+
+struct layoutNode {
+  int type;
+  int win;
+  int parent;
+  int child[2];
+  int top, left;
+  int rows, cols;
+  int sep;
+};
+
+struct scriptSegment {
+  char name[32];
+  long long start_ns;
+  long long end_ns;
+  long long keys;
+  long long frames;
+  long long key_max_ns;
+  long long allocs_start;
+  long long allocs;
+};
+
+struct editorScript {
+  int *keys;
+  int numkeys;
+  int pos;
+  char **marks;
+  int nummarks;
+  long long start_ns;
+  long long open_ns;
+  long long first_frame_ns;
+  long long frames;
+  long long bytes;
+  long long key_pending_ns;
+  long long key_count;
+  long long key_sum_ns;
+  long long key_max_ns;
+  struct scriptSegment *segments;
+  int numsegments;
+};
+
+struct traceEvent {
+  const char *name;
+  long long ts_ns;
+  long long dur_ns;
+  long long busy_ns;
+  int calls;
+  char ph;
+};
+
+/* One ring per thread. Only the owning thread writes it; head is published
+ * with release stores so the rings can be serialized without locks. */
+struct traceRing {
+  long tid;
+  unsigned long long head;
+  struct traceEvent ev[TRACE_RING_SIZE];
+  struct traceRing *next;
+};
+
 struct editorConfig {
   int cx, cy;
   int rx;
@@ -87,6 +701,10 @@ struct editorConfig {
   int coloff;
   int screenrows;
   int screencols;
+  int termrows;
+  int termcols;
+  int pane_top;
+  int pane_left;
   int numrows;
   erow *row;
   char *filename;
@@ -94,6 +712,7 @@ struct editorConfig {
   time_t statusmsg_time;
   struct termios orig_termios;
   int dirty;
+  struct savedState saved;
   int linenumbers;
   char *clipboard;
   int clipboard_len;
@@ -107,6 +726,70 @@ struct editorConfig {
   int selection_end_cy;
   int selection_active;
   int mode;
+  struct recentEntry *recent;
+  int numrecent;
+  struct editorBuffer *buffers;
+  int numbuffers;
+  int curbuf;
+  struct editorSyntax *syntaxes;
+  int numsyntaxes;
+  int syntaxes_loaded;
+  struct editorWindow *windows;
+  int numwindows;
+  int curwin;
+  struct layoutNode *layout;
+  int numlayout;
+  int layout_root;
+  int layout_drawn;
+  int ifd;
+  int ofd;
+  int notty;
+  int attached;
+  int detaching;
+  int listen_fd;
+  char *last_query;
+  char *session;
+  unsigned char *session_map;
+  size_t session_len;
+  int background_load;
+  int perf_hud;
+#ifdef WEE_PROFILE
+  struct perfFrame perf_cur;
+  struct perfFrame perf_last;
+  long long perf_allocs_mark;
+#endif
+  struct memCounter mem[MEM_SUBSYSTEMS];
+  struct editorStats stats;
+  struct jsonOutline *outline;
+  struct jsonCheck *json_check;
+  struct changeMarks *marks;
+  struct diffView diff;
+  struct autosaveState *autosave;
+  long long autosave_ns;
+  long long autosave_next;
+  char *autosave_dir;
+  int autosave_inplace;
+  int autosave_edits;
+  int autosave_synced;
+  int idle_busy;
+  int idle_redraw;
+  int key_wait;
+  struct editorTask *tasks;
+  struct sessionLoad session_load;
+  int snap_gen;
+  struct bufferSnapshot *snap_oldest;
+  struct bufferSnapshot *snap_newest;
+  struct retiredText *retired;
+  struct retiredText *retired_tail;
+  struct threadPool pool;
+  char *format_buf;
+  size_t format_cap;
+  long long key_ns;
+  char *stats_path;
+  struct editorScript *script;
+  char *trace_path;
+  long long trace_start_ns;
+  struct traceRing *trace_rings;
 };
 
 enum editorMode {
@@ -123,8 +806,11 @@ struct editorConfig E;
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+char *editorPromptDefault(char *prompt, void (*callback)(char *, int), const char *initial);
 void editorMoveCursor(int key);
 void editorSave();
+void editorWriteFile();
+int editorIsDirty();
 char *editorFileBrowser(const char *initial_path);
 int editorAskToSave();
 void editorNewFile();
@@ -133,2192 +819,8327 @@ void editorDelCharSelection();
 void editorShowHelp();
 void editorUpdateSyntax(erow *row);
 void editorSelectSyntaxHighlight();
-void editorFreeSyntax();
 void editorUpdateSelectionSyntax();
 void editorIndentSelection();
 void editorUnindentSelection();
 void editorMoveSelection(int key);
 void editorJumpToLine();
+void editorRecentRemember();
+struct recentEntry *editorRecentFind(const char *filename);
+void editorRecentRestore(struct recentEntry *re);
+char *editorRecentFiles();
+void editorOpen(char *filename);
+void editorOpenBuffer(char *filename);
+void editorBufferList();
+void editorOutlinePane();
+void editorOutlineJumpToPath();
+void editorWindowStash();
+void editorWindowActivate(int at);
+void editorInvalidateScreen();
+void editorDetach();
+void initEditor();
+void editorSessionApply();
+void editorSessionSave();
+void traceEvent(const char *name, char ph, long long dur_ns);
+void traceSpan(const char *name, long long start_ns);
+void editorStatsFrame(long long frame_start);
+void editorStatsStop();
+int editorScriptKey();
+void editorScriptFrame(int bytes);
+void editorIdle();
+void editorDaemonRefuse();
+int editorSessionLoadStep(struct editorTask *task, long long deadline);
+int editorSessionLoadRead(long long deadline);
+void editorSessionLoadFinish(struct editorTask *task, int cancelled);
+void editorOutlineIdle();
+void editorOutlineFree(struct jsonOutline *o);
+void editorOutlineDropResync(struct jsonOutline *o);
+void editorNoteEdit(int row, int col);
+void editorValidateIdle();
+void editorFormatJson(int mode);
+void editorValidateForget(struct jsonCheck *jc);
+int editorValidateBusy();
+int poolStart(int numworkers);
+void poolStop();
+int poolSubmit(struct poolJob *job, int priority);
+void poolDrain();
+int poolBusy();
+void editorRecentRememberAll();
+int editorRowShared(erow *row);
+void editorRowWritable(erow *row);
+void editorRetireText(char *chars);
+int editorTaskPercent(struct editorTask *task);
+int editorTaskCancel();
+void editorMarksIdle();
+void editorMarksReset();
+void editorMarksForget(struct changeMarks *m);
+int editorMarksBusy();
+int editorRowMark(int at);
+void editorDiffIdle();
+int editorDiffBusy();
+int editorDiffSide();
+void editorDiffScroll();
+void editorDiffEnd();
+int editorDiffCursorLine();
+void editorDiffFollow(int line);
+void editorDiffStart();
+int editorDiffBackground(int side, int y, erow *row, int *start, int *end);
+uint64_t editorDiffLineHash(int side, int y);
+int editorPaneRow(int y);
+int editorPaneCursorRow();
+void editorAutosaveIdle();
+int editorAutosaveBusy();
+void editorAutosaveForget(struct autosaveState *as);
+void editorAutosaveCancel(struct autosaveState *as);
+void editorSnapshotRelease(struct bufferSnapshot *snap);
+struct bufferSnapshot *editorSnapshot();
+
+
+/* profiling */
+
+/**
+ * @brief Returns a monotonic timestamp.
+ * @return The time in nanoseconds.
+ */
+long long editorNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
+/* memory */
 
-/* terminal */
+static const char *mem_names[MEM_SUBSYSTEMS] = {
+  "rows", "render", "highlight", "clipboard", "output", "syntax", "outline", "validate", "format", "pool", "snapshot",
+  "diff", "editor"
+};
 
 /**
- * @brief Clears the screen, prints an error message, and exits the program.
- * @param s The error string to be printed with perror.
+ * @brief Accounts a block that was allocated (sign 1) or freed (sign -1).
+ *        Counters are updated atomically so they can be read from other
+ *        threads without locking.
+ * @param sys The subsystem the block belongs to.
+ * @param p The block.
+ * @param sign 1 for an allocation, -1 for a free.
  */
-void die(const char *s) {
-  write(STDOUT_FILENO, "\x1b[2J", 4);
-  write(STDOUT_FILENO, "\x1b[H", 3);
-  perror(s);
-  exit(1);
+void memAccount(int sys, void *p, int sign) {
+  long long size = malloc_usable_size(p);
+  if (sign > 0) __atomic_fetch_add(&E.mem[sys].allocs, 1, __ATOMIC_RELAXED);
+  else __atomic_fetch_add(&E.mem[sys].frees, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&E.mem[sys].live_bytes, sign * size, __ATOMIC_RELAXED);
 }
 
 /**
- * @brief Restores the original terminal settings on program exit.
+ * @brief malloc() accounted to a subsystem.
+ * @param sys The subsystem.
+ * @param size The size in bytes.
+ * @return The block, or NULL.
  */
-void disableRawMode() {
-  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
-    die("tcsetattr");
+void *memAlloc(int sys, size_t size) {
+  void *p = malloc(size);
+  if (p) memAccount(sys, p, 1);
+  return p;
 }
 
 /**
- * @brief Enables terminal "raw" mode.
- *        This disables character echoing, canonical input, and signals,
- *        allowing the program to handle inputs directly.
+ * @brief calloc() accounted to a subsystem.
+ * @param sys The subsystem.
+ * @param n The number of elements.
+ * @param size The size of an element.
+ * @return The zeroed block, or NULL.
  */
-void enableRawMode() {
-  if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) die("tcgetattr");
-  atexit(disableRawMode);
-  struct termios raw = E.orig_termios;
-  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
-  raw.c_oflag &= ~(OPOST);
-  raw.c_cflag |= (CS8);
-  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-  raw.c_cc[VMIN] = 0;
-  raw.c_cc[VTIME] = 1;
-  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+void *memCalloc(int sys, size_t n, size_t size) {
+  void *p = calloc(n, size);
+  if (p) memAccount(sys, p, 1);
+  return p;
 }
 
 /**
- * @brief Reads a single keypress from the user.
- *        Handles escape sequences for special keys like arrows, Home, End, etc.
- * @return The code of the pressed key (a character or a value from the editorKey enum).
+ * @brief realloc() accounted to a subsystem. Counts as one allocation.
+ * @param sys The subsystem.
+ * @param p The block to resize, or NULL.
+ * @param size The new size in bytes.
+ * @return The resized block, or NULL (p is then left untouched).
  */
-int editorReadKey() {
-  int nread;
-  char c;
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-    if (nread == -1 && errno != EAGAIN) die("read");
-  }
-
-  if (c == '\x1b') {
-    char seq[3];
-    if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-
-    if (seq[0] == '[') {
-      if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
-      if (seq[1] >= '0' && seq[1] <= '9') {
-        if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
-        if (seq[2] == '~') {
-          switch (seq[1]) {
-            case '1': return HOME_KEY;
-            case '3': return DEL_KEY;
-            case '4': return END_KEY;
-            case '5': return PAGE_UP;
-            case '6': return PAGE_DOWN;
-            case '7': return HOME_KEY;
-            case '8': return END_KEY;
-          }
-        }
-      } else {
-        switch (seq[1]) {
-          case 'A': return ARROW_UP;
-          case 'B': return ARROW_DOWN;
-          case 'C': return ARROW_RIGHT;
-          case 'D': return ARROW_LEFT;
-          case 'H': return HOME_KEY;
-          case 'F': return END_KEY;
-        }
-      }
-    } else if (seq[0] == 'O') {
-      if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
-      switch (seq[1]) {
-        case 'H': return HOME_KEY;
-        case 'F': return END_KEY;
-      }
-    } else {
-        if (seq[0] == 'b') return ALT_B;
-        if (seq[0] == 'e') return ALT_E;
-    }
+void *memRealloc(int sys, void *p, size_t size) {
+  long long old = p ? (long long)malloc_usable_size(p) : 0;
+  void *np = realloc(p, size);
+  if (!np) return NULL;
+  __atomic_fetch_add(&E.mem[sys].allocs, 1, __ATOMIC_RELAXED);
+  if (p) __atomic_fetch_add(&E.mem[sys].frees, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&E.mem[sys].live_bytes, (long long)malloc_usable_size(np) - old, __ATOMIC_RELAXED);
+  return np;
+}
 
-    return '\x1b';
-  } else {
-    return c;
-  }
+/**
+ * @brief strdup() accounted to a subsystem.
+ * @param sys The subsystem.
+ * @param s The string to copy.
+ * @return The copy, or NULL.
+ */
+char *memStrdup(int sys, const char *s) {
+  size_t len = strlen(s) + 1;
+  char *p = memAlloc(sys, len);
+  if (p) memcpy(p, s, len);
+  return p;
 }
 
 /**
- * @brief Gets the dimensions (rows and columns) of the terminal window.
- * @param rows Pointer to store the number of rows.
- * @param cols Pointer to store the number of columns.
- * @return 0 on success, -1 on error.
+ * @brief free() of a block allocated with the wrappers of the same subsystem.
+ * @param sys The subsystem.
+ * @param p The block, or NULL.
  */
-int getWindowSize(int *rows, int *cols) {
-  struct winsize ws;
-  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
-    return -1;
-  }
-  else {
-    *cols = ws.ws_col;
-    *rows = ws.ws_row;
-    return 0;
-  }
+void memFree(int sys, void *p) {
+  if (!p) return;
+  memAccount(sys, p, -1);
+  free(p);
 }
 
-/* row operations */
+/**
+ * @brief Allocation hook handed to cJSON, accounted to the syntax subsystem.
+ * @param size The size in bytes.
+ * @return The block, or NULL.
+ */
+void *syntaxMalloc(size_t size) { return memAlloc(MEM_SYNTAX, size); }
 
 /**
- * @brief Converts the cursor position (cx) from character index to render index (rx).
- *        Takes tab characters into account.
- * @param row The text row.
- * @param cx The cursor position based on characters.
- * @return The cursor position based on rendering.
+ * @brief Free hook handed to cJSON.
+ * @param p The block, or NULL.
  */
-int editorRowCxToRx(erow *row, int cx) {
-  int rx = 0;
-  for (int j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t')
-      rx += (WEE_TAB_STOP - 1) - (rx % WEE_TAB_STOP);
-    rx++;
-  }
-  return rx;
+void syntaxFree(void *p) { memFree(MEM_SYNTAX, p); }
+
+/**
+ * @brief Sums the allocations made by all subsystems so far.
+ * @return The number of allocations.
+ */
+long long memTotalAllocs() {
+  long long n = 0;
+  for (int i = 0; i < MEM_SUBSYSTEMS; i++) n += __atomic_load_n(&E.mem[i].allocs, __ATOMIC_RELAXED);
+  return n;
 }
 
 /**
- * @brief Converts the cursor position (rx) from render index to character index (cx).
- *        This is the inverse operation of editorRowCxToRx.
- * @param row The text row.
- * @param rx The cursor position based on rendering.
- * @return The cursor position based on characters.
+ * @brief Adds a duration to a histogram of the live stats.
+ * @param hist The histogram (STATS_BUCKETS buckets).
+ * @param ns The duration in nanoseconds.
  */
-int editorRowRxToCx(erow *row, int rx) {
-  int cur_rx = 0;
-  int cx;
-  for (cx = 0; cx < row->size; cx++) {
-    if (row->chars[cx] == '\t')
-      cur_rx += (WEE_TAB_STOP - 1) - (cur_rx % WEE_TAB_STOP);
-    cur_rx++;
-    if (cur_rx > rx) return cx;
-  }
-  return cx;
+void statsRecord(long long *hist, long long ns) {
+  long long us = ns / 1000;
+  int b = 0;
+  while (b < STATS_BUCKETS - 1 && us >= (1LL << b)) b++;
+  __atomic_fetch_add(&hist[b], 1, __ATOMIC_RELAXED);
 }
 
 /**
- * @brief Updates the rendering representation of a row.
- *        Replaces tab characters with spaces.
- * @param row The row to update.
+ * @brief Publishes a scalar of the live stats.
+ * @param field The counter.
+ * @param value The new value.
  */
-void editorUpdateRow(erow *row) {
-  int tabs = 0;
-  for (int j = 0; j < row->size; j++)
-    if (row->chars[j] == '\t') tabs++;
-  free(row->render);
-  row->render = malloc(row->size + tabs * (WEE_TAB_STOP - 1) + 1);
-  int idx = 0;
-  for (int j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->render[idx++] = ' ';
-      while (idx % WEE_TAB_STOP != 0) row->render[idx++] = ' ';
-    } else {
-      row->render[idx++] = row->chars[j];
-    }
+void statsSet(long long *field, long long value) {
+  __atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+/* arena */
+
+/**
+ * @brief Allocates from an arena. Blocks are taken from the arena's
+ *        subsystem; a request larger than a block gets a block of its own.
+ * @param a The arena.
+ * @param size The size in bytes.
+ * @return 16-byte aligned memory, valid until the arena is reset or
+ *         released, or NULL.
+ */
+void *arenaAlloc(struct arena *a, size_t size) {
+  size = (size + 15) & ~(size_t)15;
+  struct arenaBlock *b = a->head;
+  if (!b || b->cap - b->used < size) {
+    size_t cap = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    b = memAlloc(a->sys, sizeof(struct arenaBlock) + cap);
+    if (!b) return NULL;
+    b->used = 0;
+    b->cap = cap;
+    b->next = a->head;
+    a->head = b;
   }
-  row->render[idx] = '\0';
-  row->rsize = idx;
+  void *p = b->data + b->used;
+  b->used += size;
+  return p;
+}
 
-  editorUpdateSyntax(row);
+/**
+ * @brief Frees everything allocated from an arena except its newest block,
+ *        which is rewound for reuse.
+ * @param a The arena.
+ */
+void arenaReset(struct arena *a) {
+  if (!a->head) return;
+  struct arenaBlock *b = a->head->next;
+  while (b) {
+    struct arenaBlock *next = b->next;
+    memFree(a->sys, b);
+    b = next;
+  }
+  a->head->next = NULL;
+  a->head->used = 0;
 }
 
 /**
- * @brief Inserts a new row of text into the editor at a specific position.
- * @param at The index at which to insert the new row.
- * @param s The text string to insert.
- * @param len The length of the string.
+ * @brief Frees all memory of an arena in one call.
+ * @param a The arena.
  */
-void editorInsertRow(int at, char *s, size_t len) {
-  if (at < 0 || at > E.numrows) return;
+void arenaRelease(struct arena *a) {
+  arenaReset(a);
+  memFree(a->sys, a->head);
+  a->head = NULL;
+}
 
-  E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-  memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+static __thread struct arena *json_arena;
 
-  for (int j = at + 1; j <= E.numrows; j++) E.row[j].idx++;
+/**
+ * @brief cJSON allocation hook used by editorParseJson.
+ * @param size The size in bytes.
+ * @return Memory from the arena of the current parse.
+ */
+void *jsonArenaAlloc(size_t size) { return arenaAlloc(json_arena, size); }
 
-  E.row[at].idx = at;
-  E.row[at].size = len;
-  E.row[at].chars = malloc(len + 1);
-  memcpy(E.row[at].chars, s, len);
-  E.row[at].chars[len] = '\0';
+/**
+ * @brief Parses JSON text into a tree allocated entirely from an arena.
+ *        The tree is not freed with cJSON_Delete: it lives until the arena
+ *        is reset or released.
+ * @param a The arena.
+ * @param text The JSON text.
+ * @param len The length of the text.
+ * @return The tree, or NULL on a syntax error.
+ */
+cJSON *editorParseJson(struct arena *a, const char *text, size_t len) {
+  cJSON_Hooks hooks = { jsonArenaAlloc, NULL };
+  json_arena = a;
+  cJSON *json = cJSON_ParseWithAllocator(text, len, NULL, 0, &hooks);
+  json_arena = NULL;
+  return json;
+}
 
-  E.row[at].rsize = 0;
-  E.row[at].render = NULL;
-  E.row[at].hl = NULL;
-  E.row[at].hl_open_comment = 0;
-  editorUpdateRow(&E.row[at]);
+/* tracing */
 
-  E.numrows++;
-  E.dirty++;
-}
+static __thread struct traceRing *trace_ring;
 
 /**
- * @brief Frees the memory allocated for a row.
- * @param row The row to free.
+ * @brief Records a trace event in the ring of the calling thread. The ring
+ *        is created and registered on the first event of each thread; when
+ *        it is full the oldest events are overwritten.
+ * @param name The span name (a string literal).
+ * @param ph The Chrome phase: 'B' begin, 'E' end or 'X' complete.
+ * @param dur_ns The duration for 'X' events.
  */
-void editorFreeRow(erow *row) {
-  free(row->render);
-  free(row->chars);
-  free(row->hl);
+void traceEvent(const char *name, char ph, long long dur_ns) {
+  struct traceRing *ring = trace_ring;
+  if (!ring) {
+    ring = calloc(1, sizeof(struct traceRing));
+    if (!ring) return;
+    ring->tid = syscall(SYS_gettid);
+    ring->next = __atomic_load_n(&E.trace_rings, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&E.trace_rings, &ring->next, ring, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    trace_ring = ring;
+  }
+  unsigned long long head = ring->head;
+  struct traceEvent *ev = &ring->ev[head % TRACE_RING_SIZE];
+  ev->name = name;
+  ev->ph = ph;
+  ev->dur_ns = dur_ns;
+  ev->busy_ns = dur_ns;
+  ev->calls = 1;
+  ev->ts_ns = editorNow() - dur_ns;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
 }
 
 /**
- * @brief Deletes a row from the editor.
- * @param at The index of the row to delete.
+ * @brief Records a complete span from start_ns to now. When the last event
+ *        of the thread is a span of the same name, it is extended instead,
+ *        so a loop of short calls fills one ring slot rather than one each;
+ *        the event then counts the calls and the time spent inside them.
+ * @param name The span name (a string literal).
+ * @param start_ns The editorNow() time the call started.
  */
-void editorDelRow(int at) {
-  if (at < 0 || at >= E.numrows) return;
-  editorFreeRow(&E.row[at]);
-  memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-  for (int j = at; j < E.numrows - 1; j++) E.row[j].idx--;
-  E.numrows--;
-  E.dirty++;
+void traceSpan(const char *name, long long start_ns) {
+  struct traceRing *ring = trace_ring;
+  long long now = editorNow();
+  if (ring && ring->head) {
+    struct traceEvent *ev = &ring->ev[(ring->head - 1) % TRACE_RING_SIZE];
+    if (ev->ph == 'X' && ev->name == name) {
+      ev->dur_ns = now - ev->ts_ns;
+      ev->busy_ns += now - start_ns;
+      ev->calls++;
+      return;
+    }
+  }
+  traceEvent(name, 'X', now - start_ns);
 }
 
 /**
- * @brief Inserts a character into a row at a specific position.
- * @param row The row to insert the character into.
- * @param at The index at which to insert the character.
- * @param c The character to insert.
+ * @brief Writes all recorded events as a Chrome trace (chrome://tracing,
+ *        Perfetto) to the --trace file. Registered with atexit. End events
+ *        whose begin was overwritten in the ring are dropped.
  */
-void editorRowInsertChar(erow *row, int at, int c) {
-  if (at < 0 || at > row->size) at = row->size;
-  row->chars = realloc(row->chars, row->size + 2);
-  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-  row->size++;
-  row->chars[at] = c;
-  editorUpdateRow(row);
-  E.dirty++;
+void traceWrite() {
+  if (!E.trace_path) return;
+  FILE *fp = fopen(E.trace_path, "w");
+  if (!fp) return;
+  fprintf(fp, "{\"traceEvents\":[\n");
+  int first = 1;
+  long pid = getpid();
+  for (struct traceRing *ring = __atomic_load_n(&E.trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+    unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long long tail = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    int depth = 0;
+    for (unsigned long long i = tail; i < head; i++) {
+      struct traceEvent *ev = &ring->ev[i % TRACE_RING_SIZE];
+      if (ev->ph == 'B') depth++;
+      else if (ev->ph == 'E' && depth-- == 0) {
+        depth = 0;
+        continue;
+      }
+      fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,", first ? "" : ",\n",
+              ev->name, ev->ph, (ev->ts_ns - E.trace_start_ns) / 1e3);
+      if (ev->ph == 'X') fprintf(fp, "\"dur\":%.3f,", ev->dur_ns / 1e3);
+      if (ev->ph == 'X' && ev->calls > 1)
+        fprintf(fp, "\"args\":{\"calls\":%d,\"busy_ms\":%.3f},", ev->calls, ev->busy_ns / 1e6);
+      fprintf(fp, "\"pid\":%ld,\"tid\":%ld}", pid, ring->tid);
+      first = 0;
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
 }
 
+#ifdef WEE_PROFILE
 /**
- * @brief Appends a string to the end of a row.
- * @param row The row to append the string to.
- * @param s The string to append.
- * @param len The length of the string.
+ * @brief Closes the current frame: its counters become the "last frame"
+ *        shown by the HUD and a new frame starts from zero.
  */
-void editorRowAppendString(erow *row, char *s, size_t len) {
-  row->chars = realloc(row->chars, row->size + len + 1);
-  memcpy(&row->chars[row->size], s, len);
-  row->size += len;
-  row->chars[row->size] = '\0';
-  editorUpdateRow(row);
-  E.dirty++;
+void perfEndFrame() {
+  long long allocs = memTotalAllocs();
+  E.perf_cur.allocs = allocs - E.perf_allocs_mark;
+  E.perf_allocs_mark = allocs;
+  E.perf_last = E.perf_cur;
+  memset(&E.perf_cur, 0, sizeof(E.perf_cur));
 }
 
 /**
- * @brief Deletes a character from a row at a specific position.
- * @param row The row to delete the character from.
- * @param at The index of the character to delete.
+ * @brief Reads the resident set size of the process.
+ * @return The RSS in bytes, or 0 if it cannot be read.
  */
-void editorRowDelChar(erow *row, int at) {
-  if (at < 0 || at >= row->size) return;
-  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-  row->size--;
-  editorUpdateRow(row);
-  E.dirty++;
+long long perfRss() {
+  long long pages = 0, resident = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (!fp) return 0;
+  if (fscanf(fp, "%lld %lld", &pages, &resident) != 2) resident = 0;
+  fclose(fp);
+  return resident * sysconf(_SC_PAGESIZE);
 }
+#endif
 
-/* editor operations */
+/* job pool */
+
+static __thread struct poolJob *pool_current;
 
 /**
- * @brief Inserts a character at the current cursor position.
- * @param c The character to insert.
+ * @brief Creates a cancellation token. The reference returned is normally
+ *        handed to a job, which drops it once its done() callback ran.
+ * @return The token, or NULL if out of memory.
  */
-void editorInsertChar(int c) {
-  if (E.cy == E.numrows) {
-    editorInsertRow(E.numrows, "", 0);
-  }
-  editorRowInsertChar(&E.row[E.cy], E.cx, c);
-  E.cx++;
-  char closing_char = 0;
-  switch (c) {
-    case '(': closing_char = ')'; break;
-    case '[': closing_char = ']'; break;
-    case '{': closing_char = '}'; break;
-    case '"': closing_char = '"'; break;
-    case '\'': closing_char = '\''; break;
-  }
-  if (closing_char) {
-    editorRowInsertChar(&E.row[E.cy], E.cx, closing_char);
-  }
+struct poolToken *poolTokenNew() {
+  struct poolToken *t = memCalloc(MEM_POOL, 1, sizeof(struct poolToken));
+  if (t) t->refs = 1;
+  return t;
 }
 
 /**
- * @brief Inserts a newline at the cursor position.
- *        Maintains the indentation of the current line on the new line.
+ * @brief Takes another reference to a token, e.g. to share it between jobs.
+ * @param t The token.
+ * @return The token.
  */
-void editorInsertNewline() {
-  if (E.cx == 0) {
-    editorInsertRow(E.cy, "", 0);
-    E.cy++;
-    E.cx = 0;
-    return;
-  }
-
-  erow *row = &E.row[E.cy];
-  int indent_len = 0;
-  while (indent_len < row->size && isspace(row->chars[indent_len])) {
-    indent_len++;
-  }
-  
-  char *indent_str = malloc(indent_len + 1);
-  if (indent_len > 0) memcpy(indent_str, row->chars, indent_len);
-  indent_str[indent_len] = '\0';
-
-  char* rest_of_line = &row->chars[E.cx];
-  int rest_len = row->size - E.cx;
-  char* new_line_content = malloc(indent_len + rest_len + 1);
-  memcpy(new_line_content, indent_str, indent_len);
-  memcpy(new_line_content + indent_len, rest_of_line, rest_len);
-  new_line_content[indent_len + rest_len] = '\0';
-
-  int old_cx = E.cx;
-  editorInsertRow(E.cy + 1, new_line_content, indent_len + rest_len);
+struct poolToken *poolTokenRetain(struct poolToken *t) {
+  __atomic_fetch_add(&t->refs, 1, __ATOMIC_RELAXED);
+  return t;
+}
 
-  row = &E.row[E.cy];
-  row->size = old_cx;
-  editorUpdateRow(row);
+/**
+ * @brief Drops a reference to a token, freeing it with the last one.
+ * @param t The token, or NULL.
+ */
+void poolTokenRelease(struct poolToken *t) {
+  if (t && __atomic_sub_fetch(&t->refs, 1, __ATOMIC_ACQ_REL) == 0) memFree(MEM_POOL, t);
+}
 
-  E.cy++;
-  E.cx = indent_len;
+/**
+ * @brief Cancels every job holding the token. Queued jobs are not run;
+ *        running jobs notice it through poolCancelled().
+ * @param t The token.
+ */
+void poolTokenCancel(struct poolToken *t) {
+  __atomic_store_n(&t->cancelled, 1, __ATOMIC_RELEASE);
+}
 
-  free(indent_str);
-  free(new_line_content);
+/**
+ * @brief Tells a running job whether it was cancelled. Long jobs call it
+ *        from time to time and give up early.
+ * @return 1 if the job running on this thread was cancelled.
+ */
+int poolCancelled() {
+  struct poolJob *job = pool_current;
+  return job && job->token && __atomic_load_n(&job->token->cancelled, __ATOMIC_ACQUIRE);
 }
 
 /**
- * @brief Deletes the character before the cursor (like the Backspace key).
- *        If the cursor is at the beginning of a line, it joins the current line with the previous one.
+ * @brief Pops the first job of a queue.
+ * @param w The worker owning the queue.
+ * @param prio The priority.
+ * @return The job, or NULL if the queue is empty.
  */
-void editorDelCharSelection() {
-  if (!E.selection_active) {
-    editorSetStatusMessage("editorDelCharSelection: Selection not active.");
-    return;
+struct poolJob *poolPop(struct poolWorker *w, int prio) {
+  pthread_mutex_lock(&w->lock);
+  struct poolJob *job = w->head[prio];
+  if (job) {
+    w->head[prio] = job->next;
+    if (!w->head[prio]) w->tail[prio] = NULL;
   }
+  pthread_mutex_unlock(&w->lock);
+  return job;
+}
 
-  int start_cx = E.selection_start_cx;
-  int start_cy = E.selection_start_cy;
-  int end_cx = E.selection_end_cx;
-  int end_cy = E.selection_end_cy;
+/**
+ * @brief Finds the next job for a worker: its own queue first, then the
+ *        other workers' queues, all of a priority before the next one.
+ * @param self The index of the worker.
+ * @return The job, or NULL if every queue is empty.
+ */
+struct poolJob *poolTake(int self) {
+  struct threadPool *p = &E.pool;
+  for (int prio = 0; prio < POOL_PRIORITIES; prio++) {
+    for (int i = 0; i < p->numworkers; i++) {
+      struct poolJob *job = poolPop(&p->workers[(self + i) % p->numworkers], prio);
+      if (job) {
+        if (i) __atomic_fetch_add(&p->stolen, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&p->queued, 1, __ATOMIC_RELAXED);
+        return job;
+      }
+    }
+  }
+  return NULL;
+}
 
-  editorSetStatusMessage("editorDelCharSelection: start_cx=%d, start_cy=%d, end_cx=%d, end_cy=%d", start_cx, start_cy, end_cx, end_cy);
+/**
+ * @brief Worker thread: runs jobs until the queues are empty, then sleeps
+ *        until the next submission. Finished jobs are queued for poolDrain
+ *        and the main loop is woken through the eventfd.
+ * @param arg The index of the worker (as intptr_t).
+ * @return NULL once poolStop stopped the pool.
+ */
+void *poolThread(void *arg) {
+  struct threadPool *p = &E.pool;
+  int self = (int)(intptr_t)arg;
+  while (!__atomic_load_n(&p->stopping, __ATOMIC_ACQUIRE)) {
+    struct poolJob *job = poolTake(self);
+    if (!job) {
+      pthread_mutex_lock(&p->lock);
+      while (__atomic_load_n(&p->queued, __ATOMIC_RELAXED) == 0 && !p->stopping)
+        pthread_cond_wait(&p->wake, &p->lock);
+      pthread_mutex_unlock(&p->lock);
+      continue;
+    }
 
-  // Ensure start is before end
-  if (start_cy > end_cy || (start_cy == end_cy && start_cx > end_cx)) {
-    int temp_cx = start_cx;
-    int temp_cy = start_cy;
-    start_cx = end_cx;
-    start_cy = end_cy;
-    end_cx = temp_cx;
-    end_cy = temp_cy;
-    editorSetStatusMessage("editorDelCharSelection: Swapped coords: start_cx=%d, start_cy=%d, end_cx=%d, end_cy=%d", start_cx, start_cy, end_cx, end_cy);
+    pool_current = job;
+    job->start_ns = editorNow();
+    if (!poolCancelled()) job->run(job);
+    job->cancelled = poolCancelled();
+    pool_current = NULL;
+    if (job->cancelled) __atomic_fetch_add(&p->cancelled, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&p->completed, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&p->lock);
+    job->next = p->done;
+    p->done = job;
+    pthread_mutex_unlock(&p->lock);
+    // Only the wakeup matters: a saturated counter wakes the loop as well
+    uint64_t one = 1;
+    ssize_t r = write(p->efd, &one, sizeof(one));
+    (void)r;
   }
+  return NULL;
+}
 
-  // If selection is empty (start_cx == end_cx and start_cy == end_cy), do nothing
-  if (start_cy == end_cy && start_cx == end_cx) {
-      E.selection_active = 0;
-      editorSetStatusMessage("editorDelCharSelection: Empty selection.");
-      return;
+/**
+ * @brief Starts the worker threads. Called on the first submission; the
+ *        workers live until poolStop runs at exit.
+ * @param numworkers The number of workers, or 0 for one per CPU.
+ * @return 0 on success, -1 on error.
+ */
+int poolStart(int numworkers) {
+  struct threadPool *p = &E.pool;
+  if (p->numworkers) return 0;
+  if (numworkers <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    numworkers = cpus < 1 ? 1 : cpus > POOL_MAX_WORKERS ? POOL_MAX_WORKERS : (int)cpus;
   }
-
-  // Get the suffix of the end_row before any deletions
-  char *suffix_of_end_row = NULL;
-  int suffix_of_end_row_len = 0;
-  if (end_cx < E.row[end_cy].size) {
-      suffix_of_end_row_len = E.row[end_cy].size - end_cx;
-      suffix_of_end_row = malloc(suffix_of_end_row_len + 1);
-      memcpy(suffix_of_end_row, &E.row[end_cy].chars[end_cx], suffix_of_end_row_len);
-      suffix_of_end_row[suffix_of_end_row_len] = '\0';
-      editorSetStatusMessage("editorDelCharSelection: Suffix len: %d, Suffix: '%s'", suffix_of_end_row_len, suffix_of_end_row);
+  p->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (p->efd == -1) return -1;
+  p->workers = memCalloc(MEM_POOL, numworkers, sizeof(struct poolWorker));
+  if (!p->workers) {
+    close(p->efd);
+    return -1;
+  }
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->wake, NULL);
+  for (int i = 0; i < numworkers; i++) pthread_mutex_init(&p->workers[i].lock, NULL);
+  // Workers index the array as soon as they run, so it is complete first
+  p->numworkers = numworkers;
+  for (int i = 0; i < numworkers; i++) {
+    if (pthread_create(&p->workers[i].tid, NULL, poolThread, (void *)(intptr_t)i) != 0) {
+      if (i > 0) break;  // the others steal the queues of missing workers
+      p->numworkers = 0;
+      memFree(MEM_POOL, p->workers);
+      close(p->efd);
+      return -1;
+    }
+    p->workers[i].started = 1;
   }
+  // main registers traceWrite before anything is submitted, so this runs first
+  atexit(poolStop);
+  return 0;
+}
 
-  // Delete characters from start_cx to end of line in start_cy
-  erow *start_row = &E.row[start_cy];
-  start_row->size = start_cx;
-  editorUpdateRow(start_row);
-  editorSetStatusMessage("editorDelCharSelection: Start row truncated. New size: %d", start_row->size);
+/**
+ * @brief Stops the pool at exit: cancels the queued jobs' tokens, lets the
+ *        running jobs finish and joins the workers. No worker writes to a
+ *        trace ring while traceWrite walks them, and an autosave in flight
+ *        completes its rename instead of leaving its temporary file behind.
+ *        Registered with atexit by poolStart.
+ */
+void poolStop() {
+  struct threadPool *p = &E.pool;
+  if (!p->numworkers || p->stopping) return;
+  for (int i = 0; i < p->numworkers; i++) {
+    struct poolWorker *w = &p->workers[i];
+    pthread_mutex_lock(&w->lock);
+    for (int prio = 0; prio < POOL_PRIORITIES; prio++)
+      for (struct poolJob *job = w->head[prio]; job; job = job->next)
+        if (job->token) poolTokenCancel(job->token);
+    pthread_mutex_unlock(&w->lock);
+  }
+  pthread_mutex_lock(&p->lock);
+  __atomic_store_n(&p->stopping, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+  for (int i = 0; i < p->numworkers; i++)
+    if (p->workers[i].started) pthread_join(p->workers[i].tid, NULL);
+}
 
+/**
+ * @brief Queues a job, starting the pool on first use. job->run and
+ *        job->done must be set; job->token may be NULL. Queues are filled
+ *        round-robin and balanced by stealing.
+ * @param job The job.
+ * @param priority POOL_VISIBLE or POOL_BACKGROUND.
+ * @return 0 on success, -1 if the pool could not be started.
+ */
+int poolSubmit(struct poolJob *job, int priority) {
+  struct threadPool *p = &E.pool;
+  if (poolStart(0) == -1) return -1;
+  job->next = NULL;
+  job->priority = priority;
+  job->cancelled = 0;
+  job->submit_ns = editorNow();
+  struct poolWorker *w = &p->workers[p->next_worker++ % p->numworkers];
+  pthread_mutex_lock(&w->lock);
+  if (w->tail[priority]) w->tail[priority]->next = job;
+  else w->head[priority] = job;
+  w->tail[priority] = job;
+  pthread_mutex_unlock(&w->lock);
+  p->inflight++;
+  __atomic_fetch_add(&p->submitted, 1, __ATOMIC_RELAXED);
+
+  pthread_mutex_lock(&p->lock);
+  __atomic_fetch_add(&p->queued, 1, __ATOMIC_RELAXED);
+  pthread_cond_signal(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+  return 0;
+}
 
-  // Delete full rows between start_cy and end_cy (exclusive of start_cy, inclusive of end_cy)
-  // Iterate from end_cy down to start_cy + 1
-  for (int i = end_cy; i > start_cy; i--) {
-      editorDelRow(i);
-      editorSetStatusMessage("editorDelCharSelection: Deleted row %d. Remaining rows: %d", i, E.numrows);
+/**
+ * @brief Delivers finished jobs on the main thread: calls their done()
+ *        callbacks in completion order, then drops their token references.
+ */
+void poolDrain() {
+  struct threadPool *p = &E.pool;
+  if (!p->numworkers) return;
+  uint64_t n;
+  if (read(p->efd, &n, sizeof(n)) == -1 && errno != EAGAIN) return;
+  pthread_mutex_lock(&p->lock);
+  struct poolJob *done = p->done;
+  p->done = NULL;
+  pthread_mutex_unlock(&p->lock);
+
+  struct poolJob *ordered = NULL;
+  while (done) {
+    struct poolJob *next = done->next;
+    done->next = ordered;
+    ordered = done;
+    done = next;
   }
+  while (ordered) {
+    struct poolJob *next = ordered->next;
+    struct poolToken *token = ordered->token;
+    p->inflight--;
+    ordered->done(ordered);
+    poolTokenRelease(token);
+    ordered = next;
+  }
+}
 
-  // Append the suffix of the original end_row to the modified start_row
-  if (suffix_of_end_row_len > 0) {
-      editorRowAppendString(start_row, suffix_of_end_row, suffix_of_end_row_len);
-      free(suffix_of_end_row);
-      editorSetStatusMessage("editorDelCharSelection: Suffix appended. New row size: %d", start_row->size);
+/**
+ * @brief Tells whether submitted jobs have not been delivered yet.
+ * @return 1 if busy.
+ */
+int poolBusy() {
+  return E.pool.inflight > 0;
+}
+
+/**
+ * @brief Work of a stress benchmark job: a hash loop whose length depends
+ *        on the job, giving up early when cancelled.
+ * @param id The job number.
+ * @param sum Where the hash is stored.
+ * @return 1 if the work completed, 0 if it was cancelled.
+ */
+int poolBenchWork(int id, unsigned long long *sum) {
+  unsigned long long h = 5381;
+  int n = (id % 64 + 1) * 1000;
+  for (int i = 0; i < n; i++) {
+    h = h * 33 + (unsigned)(i ^ id);
+    if (i % 4096 == 0 && poolCancelled()) return 0;
   }
+  *sum = h;
+  return 1;
+}
 
-  E.cx = start_cx; // Move cursor to start of deleted selection
-  E.cy = start_cy;
+/**
+ * @brief run() of the stress benchmark jobs.
+ * @param pj The job.
+ */
+void poolBenchRun(struct poolJob *pj) {
+  struct poolBenchJob *b = (struct poolBenchJob *)pj;
+  poolBenchWork(b->id, &b->sum);
+}
 
-  E.selection_active = 0;
-  E.dirty++; // Mark file as dirty
-  editorSetStatusMessage("editorDelCharSelection: Done.");
+/**
+ * @brief done() of the stress benchmark jobs.
+ * @param pj The job.
+ */
+void poolBenchDone(struct poolJob *pj) {
+  ((struct poolBenchJob *)pj)->delivered++;
 }
 
-void editorDelChar() {
-  if (E.cy == E.numrows) return;
-  if (E.cx == 0 && E.cy == 0) return;
-  erow *row = &E.row[E.cy];
-  if (E.cx > 0) {
-    int is_tab_indent = 1;
-    if (E.cx >= WEE_TAB_STOP) {
-      for (int i = 1; i <= WEE_TAB_STOP; i++) {
-        if (row->chars[E.cx - i] != ' ') {
-          is_tab_indent = 0;
-          break;
-        }
-      }
-    } else {
-      is_tab_indent = 0;
+/**
+ * @brief Stress benchmark of the job pool, run by `make bench`
+ *        (--pool-bench JOBSxWORKERS). Submits jobs of mixed priority in groups
+ *        sharing a token, cancels every fourth group right after queuing
+ *        it and drains through the eventfd like the main loop. Checks that
+ *        every job is delivered exactly once, that only cancelled groups
+ *        lose jobs and that every job that ran computed the right result,
+ *        then prints one JSON line with throughput and queue waits.
+ * @param numjobs The number of jobs.
+ * @param numworkers The number of workers, or 0 for one per CPU.
+ * @return 0 if every check passed, 1 otherwise.
+ */
+int editorPoolBench(int numjobs, int numworkers) {
+  struct poolBenchJob *jobs = calloc(numjobs, sizeof(struct poolBenchJob));
+  if (!jobs || poolStart(numworkers) == -1) {
+    fprintf(stderr, "wee: cannot start the job pool\n");
+    return 1;
+  }
+  long long start = editorNow();
+  struct poolToken *group = NULL;
+  for (int i = 0; i < numjobs; i++) {
+    if (i % 16 == 0) {
+      poolTokenRelease(group);
+      group = poolTokenNew();
     }
-
-    if (is_tab_indent) {
-      for (int i = 0; i < WEE_TAB_STOP; i++) {
-        editorRowDelChar(row, E.cx - 1);
-        E.cx--;
-      }
-    } else {
-      editorRowDelChar(row, E.cx - 1);
-      E.cx--;
+    struct poolBenchJob *b = &jobs[i];
+    b->id = i;
+    b->job.run = poolBenchRun;
+    b->job.done = poolBenchDone;
+    b->job.token = poolTokenRetain(group);
+    poolSubmit(&b->job, i % 4 == 0 ? POOL_VISIBLE : POOL_BACKGROUND);
+    if (i % 16 == 15 && (i / 16) % 4 == 3) poolTokenCancel(group);
+  }
+  poolTokenRelease(group);
+  while (poolBusy()) {
+    struct pollfd pfd = { E.pool.efd, POLLIN, 0 };
+    poll(&pfd, 1, 100);
+    poolDrain();
+  }
+  long long elapsed = editorNow() - start;
+
+  int ok = 1, cancelled = 0;
+  long long wait[POOL_PRIORITIES] = { 0 }, ran[POOL_PRIORITIES] = { 0 };
+  for (int i = 0; i < numjobs; i++) {
+    struct poolBenchJob *b = &jobs[i];
+    unsigned long long sum = 0;
+    if (b->delivered != 1) ok = 0;
+    if (b->job.cancelled) {
+      cancelled++;
+      if ((i / 16) % 4 != 3) ok = 0;
+      continue;
     }
-  } else {
-    E.cx = E.row[E.cy - 1].size;
-    editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-    editorDelRow(E.cy);
-    E.cy--;
+    poolBenchWork(i, &sum);
+    if (b->sum != sum) ok = 0;
+    wait[b->job.priority] += b->job.start_ns - b->job.submit_ns;
+    ran[b->job.priority]++;
   }
+  printf("{\"workload\":\"pool-stress\",\"workers\":%d,\"jobs\":%d,\"cancelled\":%d,"
+         "\"stolen\":%lld,\"jobs_per_s\":%.0f,\"visible_wait_us\":%.1f,"
+         "\"background_wait_us\":%.1f,\"ok\":%d}\n",
+         E.pool.numworkers, numjobs, cancelled, E.pool.stolen, numjobs / (elapsed / 1e9),
+         ran[POOL_VISIBLE] ? wait[POOL_VISIBLE] / 1e3 / ran[POOL_VISIBLE] : 0.0,
+         ran[POOL_BACKGROUND] ? wait[POOL_BACKGROUND] / 1e3 / ran[POOL_BACKGROUND] : 0.0, ok);
+  free(jobs);
+  return !ok;
 }
 
-/* file i/o */
+/* terminal */
 
 /**
- * @brief Converts all text rows of the editor into a single string.
- *        The rows are separated by newline characters.
- * @param buflen Pointer to store the total length of the string.
- * @return A pointer to the dynamically allocated string.
+ * @brief Clears the screen, prints an error message, and exits the program.
+ * @param s The error string to be printed with perror.
  */
-char *editorRowsToString(int *buflen) {
-  int totlen = 0;
-  for (int j = 0; j < E.numrows; j++)
-    totlen += E.row[j].size + 1;
-  *buflen = totlen;
-  char *buf = malloc(totlen);
-  char *p = buf;
-  for (int j = 0; j < E.numrows; j++) {
-    memcpy(p, E.row[j].chars, E.row[j].size);
-    p += E.row[j].size;
-    *p = '\n';
-    p++;
-  }
-  return buf;
+void die(const char *s) {
+  write(E.ofd, "\x1b[2J", 4);
+  write(E.ofd, "\x1b[H", 3);
+  perror(s);
+  exit(1);
 }
 
 /**
- * @brief Asks the user if they want to save unsaved changes.
- *        Waits for an input (Ctrl-S, ESC, Ctrl-D) to decide the action.
- * @return 1 if it can proceed (saved or discarded), 0 if the operation is canceled.
+ * @brief Restores the original terminal settings on program exit.
  */
-int editorAskToSave() {
-  if (!E.dirty) return 1;
-  editorSetStatusMessage(
-      "WARNING! File has unsaved changes. "
-      "Press Ctrl-S to save, ESC to cancel, or Ctrl-D to discard.");
-  editorRefreshScreen();
-  while (1) {
-    int c = editorReadKey();
-    if (c == CTRL_KEY('s')) {
-      editorSave();
-      return !E.dirty;
-    } else if (c == '\x1b') {
-      editorSetStatusMessage("Save aborted.");
-      return 0;
-    } else if (c == CTRL_KEY('d')) {
-      editorSetStatusMessage("Changes discarded.");
-      return 1;
-    }
-  }
+void disableRawMode() {
+  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
+    die("tcsetattr");
 }
 
 /**
- * @brief Opens a file and loads its content into the editor.
- * @param filename The path of the file to open.
+ * @brief Enables terminal "raw" mode.
+ *        This disables character echoing, canonical input, and signals,
+ *        allowing the program to handle inputs directly.
  */
-void editorOpen(char *filename) {
-  FILE *fp = fopen(filename, "r");
-  if (!fp && errno != ENOENT) {
-    editorSetStatusMessage("Error: Could not open file %s: %s", filename, strerror(errno));
-    return;
-  }
+void enableRawMode() {
+  if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) die("tcgetattr");
+  atexit(disableRawMode);
+  struct termios raw = E.orig_termios;
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_oflag &= ~(OPOST);
+  raw.c_cflag |= (CS8);
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 0;
+  raw.c_cc[VTIME] = 1;
+  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+}
 
-  if (!editorAskToSave()) {
-      if (fp) fclose(fp);
-      return;
-  }
+/**
+ * @brief Reads one byte of input, waiting at most 100ms for it (the same
+ *        timeout raw mode gives the terminal with VTIME).
+ * @param c Pointer to store the byte read.
+ * @param timeout The timeout in milliseconds.
+ * @param wake If set, a finished pool job ends the wait early (returning
+ *        0) so its result is delivered at once.
+ * @return 1 if a byte was read, 0 on timeout, -1 on error or when the
+ *         attached client hung up.
+ */
+int editorReadByte(char *c, int timeout, int wake) {
+  struct pollfd pfd[2] = { { E.ifd, POLLIN, 0 }, { E.pool.efd, POLLIN, 0 } };
+  int n = poll(pfd, wake && E.pool.numworkers ? 2 : 1, timeout);
+  if (n == 0 || (n == -1 && errno == EINTR)) return 0;
+  if (n == -1) return -1;
+  if (!(pfd[0].revents & (POLLIN | POLLHUP | POLLERR))) return 0;
+  n = read(E.ifd, c, 1);
+  if (n == 1) return 1;
+  if (n == 0) return E.attached ? -1 : 0;
+  return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+}
 
-  for (int i = 0; i < E.numrows; i++) editorFreeRow(&E.row[i]);
-  free(E.row);
-  E.row = NULL;
-  E.numrows = 0;
-  E.cx = 0; E.cy = 0; E.rowoff = 0; E.coloff = 0;
+/**
+ * @brief Reads a single keypress from the user.
+ *        Handles escape sequences for special keys like arrows, Home, End, etc.
+ * @return The code of the pressed key (a character or a value from the editorKey enum).
+ */
+int editorReadKey() {
+  if (E.script) return editorScriptKey();
+  // A detaching client answers every prompt with Esc until it unwinds
+  if (E.detaching) return '\x1b';
 
-  free(E.filename);
-  E.filename = strdup(filename);
+  int nread;
+  char c;
+  // Pending background work is run between polls that do not wait
+  while ((nread = editorReadByte(&c, E.idle_busy ? 0 : 100, 1)) != 1) {
+    if (nread == -1) {
+      if (!E.attached) die("read");
+      editorDetach();
+      return '\x1b';
+    }
+    editorIdle();
+  }
+  if (!E.key_ns) E.key_ns = editorNow();
 
-  editorFreeSyntax();
-  editorSelectSyntaxHighlight();
+  if (c == '\x1b') {
+    char seq[3];
+    if (editorReadByte(&seq[0], 100, 0) != 1) return '\x1b';
 
-  if (fp) {
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-      while (linelen > 0 &&
-             (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
-        linelen--;
-      editorInsertRow(E.numrows, line, linelen);
-    }
-    free(line);
-    fclose(fp);
-    E.dirty = 0;
-    editorSetStatusMessage("%s opened.", filename);
+    if (seq[0] == '[') {
+      if (editorReadByte(&seq[1], 100, 0) != 1) return '\x1b';
+      if (seq[1] >= '0' && seq[1] <= '9') {
+        if (editorReadByte(&seq[2], 100, 0) != 1) return '\x1b';
+        if (seq[2] == '~') {
+          switch (seq[1]) {
+            case '1': return HOME_KEY;
+            case '3': return DEL_KEY;
+            case '4': return END_KEY;
+            case '5': return PAGE_UP;
+            case '6': return PAGE_DOWN;
+            case '7': return HOME_KEY;
+            case '8': return END_KEY;
+          }
+        }
+      } else {
+        switch (seq[1]) {
+          case 'A': return ARROW_UP;
+          case 'B': return ARROW_DOWN;
+          case 'C': return ARROW_RIGHT;
+          case 'D': return ARROW_LEFT;
+          case 'H': return HOME_KEY;
+          case 'F': return END_KEY;
+        }
+      }
+    } else if (seq[0] == 'O') {
+      if (editorReadByte(&seq[1], 100, 0) != 1) return '\x1b';
+      switch (seq[1]) {
+        case 'H': return HOME_KEY;
+        case 'F': return END_KEY;
+      }
+    } else {
+        if (seq[0] == 'b') return ALT_B;
+        if (seq[0] == 'e') return ALT_E;
+        if (seq[0] == 'n') return ALT_N;
+        if (seq[0] == 'p') return ALT_P;
+        if (seq[0] == 'x') return ALT_X;
+        if (seq[0] == 'l') return ALT_L;
+        if (seq[0] == 's') return ALT_S;
+        if (seq[0] == 'v') return ALT_V;
+        if (seq[0] == 'w') return ALT_W;
+        if (seq[0] == 'q') return ALT_Q;
+        if (seq[0] == 'h') return ALT_H;
+        if (seq[0] == 'o') return ALT_O;
+        if (seq[0] == 'j') return ALT_J;
+        if (seq[0] == 'f') return ALT_F;
+        if (seq[0] == 'm') return ALT_M;
+        if (seq[0] == 'k') return ALT_K;
+    }
+
+    return '\x1b';
   } else {
-    E.dirty = 0;
-    editorSetStatusMessage("New file: %s", filename);
+    // Bytes of UTF-8 sequences come through as 128-255
+    return (unsigned char)c;
   }
 }
 
 /**
- * @brief Saves the current content of the editor to the file.
- *        If the file has no name, it prompts the user for one.
+ * @brief Gets the dimensions (rows and columns) of the terminal window.
+ * @param rows Pointer to store the number of rows.
+ * @param cols Pointer to store the number of columns.
+ * @return 0 on success, -1 on error.
  */
-void editorSave() {
-  if (E.filename == NULL) {
-    E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-    if (E.filename == NULL) {
-      editorSetStatusMessage("Save aborted");
-      return;
-    }
+int getWindowSize(int *rows, int *cols) {
+  struct winsize ws;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+    return -1;
   }
-  int len;
-  char *buf = editorRowsToString(&len);
-  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-  if (fd != -1) {
-    if (ftruncate(fd, len) != -1 && write(fd, buf, len) == len) {
-      close(fd);
-      free(buf);
-      E.dirty = 0;
-      editorSetStatusMessage("%d bytes written to disk", len);
-      return;
-    }
-    close(fd);
+  else {
+    *cols = ws.ws_col;
+    *rows = ws.ws_row;
+    return 0;
   }
-  free(buf);
-  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
 }
 
+/* row operations */
+
 /**
- * @brief Saves the current content with a new file name.
+ * @brief Tells whether text is pure ASCII, checking 16 bytes at a time
+ *        with SSE2 when available.
+ * @param s The text.
+ * @param len The length of the text.
+ * @return 1 if no byte has its high bit set.
  */
-void editorSaveAs() {
-  char *new_filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-  if (new_filename == NULL) {
-    editorSetStatusMessage("Save As aborted");
-    return;
+int editorIsAscii(const char *s, int len) {
+  int i = 0;
+#ifdef WEE_SSE2
+  __m128i acc = _mm_setzero_si128();
+  for (; i + 16 <= len; i += 16) acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(s + i)));
+  if (_mm_movemask_epi8(acc)) return 0;
+#endif
+  for (; i < len; i++)
+    if ((unsigned char)s[i] & 0x80) return 0;
+  return 1;
+}
+
+/**
+ * @brief Decodes one UTF-8 sequence.
+ * @param s The bytes.
+ * @param len The number of bytes available (at least 1).
+ * @param cp Where to store the code point, or -1 for an invalid byte.
+ * @return The length of the sequence; 1 for an invalid byte.
+ */
+int editorUtf8Decode(const char *s, int len, int *cp) {
+  const unsigned char *u = (const unsigned char *)s;
+  int n, c;
+  if (u[0] < 0x80) {
+    *cp = u[0];
+    return 1;
+  } else if (u[0] >= 0xC2 && u[0] <= 0xDF) {
+    n = 2;
+    c = u[0] & 0x1F;
+  } else if ((u[0] & 0xF0) == 0xE0) {
+    n = 3;
+    c = u[0] & 0x0F;
+  } else if (u[0] >= 0xF0 && u[0] <= 0xF4) {
+    n = 4;
+    c = u[0] & 0x07;
+  } else {
+    *cp = -1;
+    return 1;
   }
-  free(E.filename);
-  E.filename = new_filename;
-  editorSave();
+  *cp = -1;
+  if (n > len) return 1;
+  for (int i = 1; i < n; i++) {
+    if ((u[i] & 0xC0) != 0x80) return 1;
+    c = (c << 6) | (u[i] & 0x3F);
+  }
+  // Overlong forms, surrogates and code points past U+10FFFF
+  if ((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > 0x10FFFF)) ||
+      (c >= 0xD800 && c <= 0xDFFF))
+    return 1;
+  *cp = c;
+  return n;
 }
 
 /**
- * @brief Copies the current line to the internal clipboard.
+ * @brief Looks a code point up in a sorted table of ranges.
+ * @param t The table.
+ * @param n The number of ranges.
+ * @param cp The code point.
+ * @return 1 if a range contains it.
  */
-void editorCopySelection() {
-  if (!E.selection_active) return;
+int editorWidthLookup(const struct widthRange *t, int n, int cp) {
+  int lo = 0, hi = n - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (cp < t[mid].first) hi = mid - 1;
+    else if (cp > t[mid].last) lo = mid + 1;
+    else return 1;
+  }
+  return 0;
+}
 
-  int start_cx = E.selection_start_cx;
-  int start_cy = E.selection_start_cy;
-  int end_cx = E.selection_end_cx;
-  int end_cy = E.selection_end_cy;
+/**
+ * @brief Returns the number of terminal columns a character is drawn in.
+ *        Invalid bytes and control characters are drawn as one symbol.
+ * @param cp The code point, or -1 for an invalid byte.
+ * @return 0, 1 or 2.
+ */
+int editorCharWidth(int cp) {
+  if (cp < 0x300) return 1;
+  if (editorWidthLookup(width_zero, sizeof(width_zero) / sizeof(width_zero[0]), cp)) return 0;
+  if (editorWidthLookup(width_wide, sizeof(width_wide) / sizeof(width_wide[0]), cp)) return 2;
+  return 1;
+}
 
-  // Ensure start is before end
-  if (start_cy > end_cy || (start_cy == end_cy && start_cx > end_cx)) {
-    int temp_cx = start_cx;
-    int temp_cy = start_cy;
-    start_cx = end_cx;
-    start_cy = end_cy;
-    end_cx = temp_cx;
-    end_cy = temp_cy;
+/**
+ * @brief Returns the index just past the character at cx, including the
+ *        combining marks that follow it.
+ * @param row The text row.
+ * @param cx The index of a character.
+ * @return The index of the next character.
+ */
+int editorRowNextCx(erow *row, int cx) {
+  if (cx >= row->size) return row->size;
+  if (row->ascii) return cx + 1;
+  int cp;
+  cx += editorUtf8Decode(&row->chars[cx], row->size - cx, &cp);
+  while (cx < row->size) {
+    int n = editorUtf8Decode(&row->chars[cx], row->size - cx, &cp);
+    if (cp < 0 || editorCharWidth(cp) != 0) break;
+    cx += n;
   }
+  return cx;
+}
 
-  free(E.clipboard);
-  E.clipboard = NULL;
-  E.clipboard_len = 0;
-
-  if (start_cy == end_cy) {
-    // Single line selection: copy exact characters
-    int len = end_cx - start_cx;
-    E.clipboard = malloc(len + 1);
-    memcpy(E.clipboard, &E.row[start_cy].chars[start_cx], len);
-    E.clipboard[len] = '\0';
-    E.clipboard_len = len;
-  } else {
-    // Multi-line selection: copy full lines, including newlines
-    // Copy first line from start_cx to end of line
-    int len_first_line = E.row[start_cy].size - start_cx;
-    E.clipboard = malloc(len_first_line + 1);
-    memcpy(E.clipboard, &E.row[start_cy].chars[start_cx], len_first_line);
-    E.clipboard_len = len_first_line;
+/**
+ * @brief Returns the index of the character before cx, skipping back over
+ *        combining marks to the character they belong to.
+ * @param row The text row.
+ * @param cx The index of a character.
+ * @return The index of the previous character.
+ */
+int editorRowPrevCx(erow *row, int cx) {
+  if (cx <= 0) return 0;
+  if (row->ascii) return cx - 1;
+  while (cx > 0) {
+    int start = cx - 1;
+    while (start > 0 && cx - start < 4 && ((unsigned char)row->chars[start] & 0xC0) == 0x80) start--;
+    int cp;
+    if (start + editorUtf8Decode(&row->chars[start], row->size - start, &cp) != cx) {
+      // A stray continuation byte stands for itself
+      start = cx - 1;
+      cp = -1;
+    }
+    cx = start;
+    if (cp < 0 || editorCharWidth(cp) != 0) break;
+  }
+  return cx;
+}
 
-    // Add newline after the first line
-    E.clipboard = realloc(E.clipboard, E.clipboard_len + 1);
-    E.clipboard[E.clipboard_len] = '\n';
-    E.clipboard_len++;
+/**
+ * @brief Measures the character at an index of a row's chars or render.
+ * @param s The text.
+ * @param len The number of bytes left in the text.
+ * @param col The column the character starts at (for tabs).
+ * @param width Where to store the number of columns it takes.
+ * @return The number of bytes of the character.
+ */
+int editorCharSpan(const char *s, int len, int col, int *width) {
+  if (*s == '\t') {
+    *width = WEE_TAB_STOP - col % WEE_TAB_STOP;
+    return 1;
+  }
+  int cp;
+  int n = editorUtf8Decode(s, len, &cp);
+  *width = editorCharWidth(cp);
+  return n;
+}
 
-    // Copy middle lines (full lines)
-    for (int i = start_cy + 1; i < end_cy; i++) {
-      E.clipboard = realloc(E.clipboard, E.clipboard_len + E.row[i].size + 1);
-      memcpy(&E.clipboard[E.clipboard_len], E.row[i].chars, E.row[i].size);
-      E.clipboard_len += E.row[i].size;
-      E.clipboard[E.clipboard_len] = '\n';
-      E.clipboard_len++;
+/**
+ * @brief Finds the last checkpoint of a row at or before a position, so a
+ *        conversion only scans from there. Binary search over the
+ *        checkpoints, which increase in all three coordinates.
+ * @param row The text row.
+ * @param by ROW_SEEK_CX, ROW_SEEK_RX or ROW_SEEK_RI: the coordinate of pos.
+ * @param pos The position.
+ * @return The checkpoint; the start of the row if there is none before pos.
+ */
+struct rowCkpt editorRowSeek(erow *row, int by, int pos) {
+  struct rowCkpt start = { 0, 0, 0 };
+  int lo = 0, hi = row->numckpt - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    struct rowCkpt *c = &row->ckpt[mid];
+    int v = by == ROW_SEEK_CX ? c->cx : by == ROW_SEEK_RX ? c->rx : c->ri;
+    if (v <= pos) {
+      start = *c;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
     }
-
-    // Copy last line from beginning of line to end_cx
-    int len_last_line = end_cx;
-    E.clipboard = realloc(E.clipboard, E.clipboard_len + len_last_line + 1);
-    memcpy(&E.clipboard[E.clipboard_len], E.row[end_cy].chars, len_last_line);
-    E.clipboard_len += len_last_line;
-    E.clipboard[E.clipboard_len] = '\0'; // No newline after the last line
   }
-  E.selection_active = 0; // Deselect after copy
-
-  // Explicitly reset HL_SELECTION for affected rows
-  // int start_cy = E.selection_start_cy;
-  // int end_cy = E.selection_end_cy;
+  return start;
+}
 
-  // Ensure start is before end for iteration
-  if (start_cy > end_cy) {
-    int temp_cy = start_cy;
-    start_cy = end_cy;
-    end_cy = temp_cy;
+/**
+ * @brief Converts the cursor position (cx) from character index to render index (rx).
+ *        Takes tab characters and the display width of UTF-8 characters into account.
+ * @param row The text row.
+ * @param cx The cursor position based on characters.
+ * @return The cursor position based on rendering.
+ */
+int editorRowCxToRx(erow *row, int cx) {
+  if (row->plain) return cx;
+  struct rowCkpt c = editorRowSeek(row, ROW_SEEK_CX, cx);
+  int rx = c.rx;
+  if (row->ascii) {
+    for (int j = c.cx; j < cx; j++) {
+      if (row->chars[j] == '\t')
+        rx += (WEE_TAB_STOP - 1) - (rx % WEE_TAB_STOP);
+      rx++;
+    }
+    return rx;
   }
-
-  for (int i = start_cy; i <= end_cy; i++) {
-    editorUpdateSyntax(&E.row[i]); // Re-evaluate syntax highlighting for the row
+  for (int j = c.cx; j < cx;) {
+    int w;
+    j += editorCharSpan(&row->chars[j], row->size - j, rx, &w);
+    rx += w;
   }
-
-  editorSetStatusMessage("Selection copied.");
-}
-
-void editorCopyLine() {
-
-  if (E.cy >= E.numrows) return;
-  erow *row = &E.row[E.cy];
-  free(E.clipboard);
-  E.clipboard_len = row->size;
-  E.clipboard = malloc(E.clipboard_len + 1);
-  memcpy(E.clipboard, row->chars, E.clipboard_len);
-  E.clipboard[E.clipboard_len] = '\0';
-  editorSetStatusMessage("Line copied.");
+  return rx;
 }
 
 /**
- * @brief Cuts the current line (copies and deletes).
+ * @brief Converts the cursor position (rx) from render index to character index (cx).
+ *        This is the inverse operation of editorRowCxToRx.
+ * @param row The text row.
+ * @param rx The cursor position based on rendering.
+ * @return The cursor position based on characters.
  */
-void editorCutSelection() {
-  if (!E.selection_active) return;
-  
-  // First copy the selection WITHOUT deselecting
-  int start_cx = E.selection_start_cx;
-  int start_cy = E.selection_start_cy;
-  int end_cx = E.selection_end_cx;
-  int end_cy = E.selection_end_cy;
-
-  // Ensure start is before end
-  if (start_cy > end_cy || (start_cy == end_cy && start_cx > end_cx)) {
-    int temp_cx = start_cx;
-    int temp_cy = start_cy;
-    start_cx = end_cx;
-    start_cy = end_cy;
-    end_cx = temp_cx;
-    end_cy = temp_cy;
-  }
-
-  free(E.clipboard);
-  E.clipboard = NULL;
-  E.clipboard_len = 0;
-
-  if (start_cy == end_cy) {
-    // Single line selection: copy exact characters
-    int len = end_cx - start_cx;
-    E.clipboard = malloc(len + 1);
-    memcpy(E.clipboard, &E.row[start_cy].chars[start_cx], len);
-    E.clipboard[len] = '\0';
-    E.clipboard_len = len;
-  } else {
-    // Multi-line selection: copy full lines, including newlines
-    // Copy first line from start_cx to end of line
-    int len_first_line = E.row[start_cy].size - start_cx;
-    E.clipboard = malloc(len_first_line + 1);
-    memcpy(E.clipboard, &E.row[start_cy].chars[start_cx], len_first_line);
-    E.clipboard_len = len_first_line;
-
-    // Add newline after the first line
-    E.clipboard = realloc(E.clipboard, E.clipboard_len + 1);
-    E.clipboard[E.clipboard_len] = '\n';
-    E.clipboard_len++;
-
-    // Copy middle lines (full lines)
-    for (int i = start_cy + 1; i < end_cy; i++) {
-      E.clipboard = realloc(E.clipboard, E.clipboard_len + E.row[i].size + 1);
-      memcpy(&E.clipboard[E.clipboard_len], E.row[i].chars, E.row[i].size);
-      E.clipboard_len += E.row[i].size;
-      E.clipboard[E.clipboard_len] = '\n';
-      E.clipboard_len++;
+int editorRowRxToCx(erow *row, int rx) {
+  if (row->plain) return rx < row->size ? rx : row->size;
+  struct rowCkpt c = editorRowSeek(row, ROW_SEEK_RX, rx);
+  int cur_rx = c.rx;
+  int cx;
+  if (row->ascii) {
+    for (cx = c.cx; cx < row->size; cx++) {
+      if (row->chars[cx] == '\t')
+        cur_rx += (WEE_TAB_STOP - 1) - (cur_rx % WEE_TAB_STOP);
+      cur_rx++;
+      if (cur_rx > rx) return cx;
     }
-
-    // Copy last line from beginning of line to end_cx
-    int len_last_line = end_cx;
-    E.clipboard = realloc(E.clipboard, E.clipboard_len + len_last_line + 1);
-    memcpy(&E.clipboard[E.clipboard_len], E.row[end_cy].chars, len_last_line);
-    E.clipboard_len += len_last_line;
-    E.clipboard[E.clipboard_len] = '\0'; // No newline after the last line
+    return cx;
   }
-  
-  // Now delete the selection (E.selection_active is still 1)
-  editorDelCharSelection();
-  editorSetStatusMessage("Selection cut.");
+  for (cx = c.cx; cx < row->size;) {
+    int w;
+    int n = editorCharSpan(&row->chars[cx], row->size - cx, cur_rx, &w);
+    cur_rx += w;
+    if (cur_rx > rx) return cx;
+    cx += n;
+  }
+  return cx;
 }
 
-void editorCutLine() {
-  if (E.cy >= E.numrows) return;
-  editorCopyLine();
-  editorDelRow(E.cy);
-  if (E.cy >= E.numrows && E.numrows > 0) {
-    E.cy = E.numrows - 1;
-    E.cx = E.row[E.cy].size;
-  } else if (E.numrows == 0) {
-    E.cy = 0;
-    E.cx = 0;
+/**
+ * @brief Converts a character index to a byte offset into the row's
+ *        render. On ASCII rows this is the same as the render column.
+ * @param row The text row.
+ * @param cx The character index.
+ * @return The offset into row->render.
+ */
+int editorRowCxToRender(erow *row, int cx) {
+  if (row->ascii) return editorRowCxToRx(row, cx);
+  struct rowCkpt c = editorRowSeek(row, ROW_SEEK_CX, cx);
+  int rx = c.rx, ri = c.ri;
+  for (int j = c.cx; j < cx;) {
+    int w;
+    int n = editorCharSpan(&row->chars[j], row->size - j, rx, &w);
+    ri += row->chars[j] == '\t' ? w : n;
+    rx += w;
+    j += n;
   }
-  editorSetStatusMessage("Line cut.");
+  return ri;
 }
 
 /**
- * @brief Pastes the clipboard content at the cursor position.
+ * @brief Converts a byte offset into the row's render to the index of the
+ *        character it belongs to. Inverse of editorRowCxToRender.
+ * @param row The text row.
+ * @param ri The offset into row->render.
+ * @return The character index.
  */
-void editorInsertRawNewline() {
-  editorInsertRow(E.cy + 1, "", 0); // Insert empty row below current
-  E.cy++; // Move cursor to new row
-  E.cx = 0; // Move cursor to beginning of new row
+int editorRowRenderToCx(erow *row, int ri) {
+  if (row->ascii) return editorRowRxToCx(row, ri);
+  struct rowCkpt c = editorRowSeek(row, ROW_SEEK_RI, ri);
+  int rx = c.rx, cur = c.ri, cx;
+  for (cx = c.cx; cx < row->size;) {
+    int w;
+    int n = editorCharSpan(&row->chars[cx], row->size - cx, rx, &w);
+    cur += row->chars[cx] == '\t' ? w : n;
+    rx += w;
+    if (cur > ri) return cx;
+    cx += n;
+  }
+  return cx;
 }
 
-void editorPaste() {
-  if (!E.clipboard) return;
-
-  // If there's an active selection, delete it first
-  if (E.selection_active) {
-    editorDelCharSelection();
+/**
+ * @brief Finds the part of a row's render that is visible in a range of
+ *        columns. A wide character cut by the left edge is replaced by
+ *        blank columns.
+ * @param row The text row.
+ * @param coloff The first visible column.
+ * @param cols The number of visible columns.
+ * @param start Where to store the render offset of the first byte drawn.
+ * @param len Where to store the number of bytes drawn.
+ * @param pad Where to store the number of blank columns drawn before them.
+ * @return The number of columns drawn, blanks included.
+ */
+int editorRowRenderSpan(erow *row, int coloff, int cols, int *start, int *len, int *pad) {
+  *pad = 0;
+  if (row->ascii) {
+    *start = coloff < row->rsize ? coloff : row->rsize;
+    *len = row->rsize - *start;
+    if (*len > cols) *len = cols;
+    return *len;
   }
-
-  // Insert clipboard content
-  for (int i = 0; i < E.clipboard_len; i++) {
-    if (E.clipboard[i] == '\n') {
-      editorInsertRawNewline(); // Use raw newline insertion
-    } else {
-      editorInsertChar(E.clipboard[i]);
-    }
+  struct rowCkpt c = editorRowSeek(row, ROW_SEEK_RX, coloff);
+  int i = c.ri, col = c.rx, w;
+  while (i < row->rsize && col < coloff) {
+    i += editorCharSpan(&row->render[i], row->rsize - i, col, &w);
+    col += w;
   }
-  editorSetStatusMessage("Pasted.");
+  if (col > coloff) *pad = col - coloff;
+  *start = i;
+  int used = *pad;
+  while (i < row->rsize) {
+    int n = editorCharSpan(&row->render[i], row->rsize - i, col, &w);
+    if (used + w > cols) break;
+    used += w;
+    col += w;
+    i += n;
+  }
+  *len = i - *start;
+  return used;
 }
 
 /**
- * @brief Creates a new empty file, discarding the current one (after asking to save).
+ * @brief Updates the rendering representation of a row.
+ *        Replaces tab characters with spaces and flags pure ASCII rows,
+ *        whose render offsets are also their columns.
+ * @param row The row to update.
  */
-void editorNewFile() {
-    if (E.dirty && editorAskToSave() == 0) {
-        editorSetStatusMessage("New file aborted.");
-        return;
+void editorUpdateRow(erow *row) {
+  int tabs = 0;
+  uint64_t hash = 1469598103934665603ULL;
+  for (int j = 0; j < row->size; j++) {
+    if (row->chars[j] == '\t') tabs++;
+    hash = (hash ^ (unsigned char)row->chars[j]) * 1099511628211ULL;
+  }
+  row->hash = hash;
+  row->ascii = editorIsAscii(row->chars, row->size);
+  row->plain = row->ascii && tabs == 0;
+  memFree(MEM_RENDER, row->render);
+  row->render = memAlloc(MEM_RENDER, row->size + tabs * (WEE_TAB_STOP - 1) + 1);
+  memFree(MEM_RENDER, row->ckpt);
+  row->ckpt = NULL;
+  row->numckpt = 0;
+  if (!row->plain && row->size >= ROW_CKPT_BYTES)
+    row->ckpt = memAlloc(MEM_RENDER, sizeof(struct rowCkpt) * (row->size / ROW_CKPT_BYTES));
+  int idx = 0;
+  if (row->plain) {
+    memcpy(row->render, row->chars, row->size);
+    idx = row->size;
+  } else if (row->ascii) {
+    for (int j = 0; j < row->size; j++) {
+      if (row->ckpt && j >= (row->numckpt + 1) * ROW_CKPT_BYTES)
+        row->ckpt[row->numckpt++] = (struct rowCkpt){ j, idx, idx };
+      if (row->chars[j] == '\t') {
+        row->render[idx++] = ' ';
+        while (idx % WEE_TAB_STOP != 0) row->render[idx++] = ' ';
+      } else {
+        row->render[idx++] = row->chars[j];
+      }
     }
+  } else {
+    // Tab stops are columns, which multi-byte characters do not match
+    int col = 0;
+    for (int j = 0; j < row->size;) {
+      if (row->ckpt && j >= (row->numckpt + 1) * ROW_CKPT_BYTES)
+        row->ckpt[row->numckpt++] = (struct rowCkpt){ j, col, idx };
+      int w;
+      int n = editorCharSpan(&row->chars[j], row->size - j, col, &w);
+      if (row->chars[j] == '\t') memset(&row->render[idx], ' ', w);
+      else memcpy(&row->render[idx], &row->chars[j], n);
+      idx += row->chars[j] == '\t' ? w : n;
+      col += w;
+      j += n;
+    }
+  }
+  row->render[idx] = '\0';
+  row->rsize = idx;
 
-    for (int i = 0; i < E.numrows; i++) editorFreeRow(&E.row[i]);
-    free(E.row);
-    E.row = NULL;
-    E.numrows = 0;
-    E.cx = 0; E.cy = 0; E.rowoff = 0; E.coloff = 0;
-
-    editorFreeSyntax();
-    free(E.filename);
-    E.filename = NULL;
-    E.dirty = 0;
-
-    editorSetStatusMessage("New empty file. Ctrl-S to save.");
+  editorUpdateSyntax(row);
 }
 
-int is_separator(int c) {
-  return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+/**
+ * @brief Sets the text of an already allocated row slot without rendering
+ *        it; the render, highlight and checkpoint fields are left empty.
+ * @param at The index of the row slot to set.
+ * @param s The text string to store.
+ * @param len The length of the string.
+ */
+void editorSetRowText(int at, const char *s, size_t len) {
+  E.row[at].idx = at;
+  E.row[at].size = len;
+  E.row[at].chars = memAlloc(MEM_ROWS, len + 1);
+  memcpy(E.row[at].chars, s, len);
+  E.row[at].chars[len] = '\0';
+
+  E.row[at].rsize = 0;
+  E.row[at].render = NULL;
+  E.row[at].hl = NULL;
+  E.row[at].hl_open_comment = 0;
+  E.row[at].ckpt = NULL;
+  E.row[at].numckpt = 0;
+  E.row[at].text_gen = E.snap_gen;
+  E.row[at].eol = 1;
 }
 
-int editorSyntaxToColor(int hl) {
-  switch (hl) {
-    case HL_COMMENT:
-    case HL_MLCOMMENT: return 36;
-    case HL_KEYWORD1: return 33;
-    case HL_KEYWORD2: return 32;
-    case HL_STRING: return 35;
-    case HL_NUMBER: return 31;
-    case HL_MATCH: return 34;
-    case HL_SELECTION: return 7; /* Inverse video */
-    default: return 37;
-  }
+/**
+ * @brief Sets the text of an already allocated row slot and renders it.
+ * @param at The index of the row slot to fill.
+ * @param s The text string to store.
+ * @param len The length of the string.
+ */
+void editorFillRow(int at, char *s, size_t len) {
+  editorSetRowText(at, s, len);
+  editorUpdateRow(&E.row[at]);
 }
 
-void editorUpdateSyntax(erow *row) {
-  row->hl = realloc(row->hl, row->rsize);
-  memset(row->hl, HL_NORMAL, row->rsize);
+/**
+ * @brief Inserts a new row of text into the editor at a specific position.
+ * @param at The index at which to insert the new row.
+ * @param s The text string to insert.
+ * @param len The length of the string.
+ */
+void editorInsertRow(int at, char *s, size_t len) {
+  if (at < 0 || at > E.numrows) return;
+  editorNoteEdit(at, 0);
 
-  if (E.syntax == NULL) return;
+  E.row = memRealloc(MEM_ROWS, E.row, sizeof(erow) * (E.numrows + 1));
+  memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
 
-  char **keywords = E.syntax->keywords;
+  for (int j = at + 1; j <= E.numrows; j++) E.row[j].idx++;
 
-  char *scs = E.syntax->singleline_comment_start;
-  char *mcs = E.syntax->multiline_comment_start;
-  char *mce = E.syntax->multiline_comment_end;
+  editorFillRow(at, s, len);
 
-  int scs_len = scs ? strlen(scs) : 0;
-  int mcs_len = mcs ? strlen(mcs) : 0;
-  int mce_len = mce ? strlen(mce) : 0;
+  E.numrows++;
+  E.dirty++;
+}
 
-  int prev_sep = 1;
-  int in_string = 0;
-  int in_comment = (row->hl_open_comment);
+/**
+ * @brief Frees the memory allocated for a row.
+ * @param row The row to free.
+ */
+void editorFreeRow(erow *row) {
+  memFree(MEM_RENDER, row->render);
+  memFree(MEM_RENDER, row->ckpt);
+  if (editorRowShared(row)) editorRetireText(row->chars);
+  else memFree(MEM_ROWS, row->chars);
+  memFree(MEM_HIGHLIGHT, row->hl);
+}
 
-  int i = 0;
-  while (i < row->rsize) {
-    char c = row->render[i];
-    unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
-
-    if (scs_len && !in_string && !in_comment) {
-      if (!strncmp(&row->render[i], scs, scs_len)) {
-        memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-        break;
-      }
-    }
-
-    if (mcs_len && mce_len && !in_string) {
-      if (in_comment) {
-        row->hl[i] = HL_MLCOMMENT;
-        if (!strncmp(&row->render[i], mce, mce_len)) {
-          memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-          i += mce_len;
-          in_comment = 0;
-          prev_sep = 1;
-          continue;
-        } else {
-          i++;
-          continue;
-        }
-      } else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-        memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-        i += mcs_len;
-        in_comment = 1;
-        continue;
-      }
-    }
-
-    if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-      if (in_string) {
-        row->hl[i] = HL_STRING;
-        if (c == '\\' && i + 1 < row->rsize) {
-          row->hl[i + 1] = HL_STRING;
-          i += 2;
-          continue;
-        }
-        if (c == in_string) in_string = 0;
-        i++;
-        prev_sep = 1;
-        continue;
-      } else {
-        if (c == '"' || c == '\'') {
-          in_string = c;
-          row->hl[i] = HL_STRING;
-          i++;
-          continue;
-        }
-      }
-    }
-
-    if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-      if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
-          (c == '.' && prev_hl == HL_NUMBER)) {
-        row->hl[i] = HL_NUMBER;
-        i++;
-        prev_sep = 0;
-        continue;
-      }
-    }
-
-    if (prev_sep) {
-      int j;
-      for (j = 0; keywords[j]; j++) {
-        int klen = strlen(keywords[j]);
-        int kw2 = keywords[j][klen - 1] == '|';
-        if (kw2) klen--;
+/**
+ * @brief Deletes a row from the editor.
+ * @param at The index of the row to delete.
+ */
+void editorDelRow(int at) {
+  if (at < 0 || at >= E.numrows) return;
+  editorNoteEdit(at, 0);
+  editorFreeRow(&E.row[at]);
+  memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
+  for (int j = at; j < E.numrows - 1; j++) E.row[j].idx--;
+  E.numrows--;
+  E.dirty++;
+}
 
-        if (!strncmp(&row->render[i], keywords[j], klen) &&
-            is_separator(row->render[i + klen])) {
-          memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-          i += klen;
-          break;
-        }
-      }
-      if (keywords[j] != NULL) {
-        prev_sep = 0;
-        continue;
-      }
-    }
+/**
+ * @brief Inserts a character into a row at a specific position.
+ * @param row The row to insert the character into.
+ * @param at The index at which to insert the character.
+ * @param c The character to insert.
+ */
+void editorRowInsertChar(erow *row, int at, int c) {
+  if (at < 0 || at > row->size) at = row->size;
+  editorNoteEdit(row->idx, at);
+  editorRowWritable(row);
+  row->chars = memRealloc(MEM_ROWS, row->chars, row->size + 2);
+  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+  row->size++;
+  row->chars[at] = c;
+  editorUpdateRow(row);
+  E.dirty++;
+}
 
-    prev_sep = is_separator(c);
-    i++;
-  }
+/**
+ * @brief Appends a string to the end of a row.
+ * @param row The row to append the string to.
+ * @param s The string to append.
+ * @param len The length of the string.
+ */
+void editorRowAppendString(erow *row, char *s, size_t len) {
+  editorNoteEdit(row->idx, row->size);
+  editorRowWritable(row);
+  row->chars = memRealloc(MEM_ROWS, row->chars, row->size + len + 1);
+  memcpy(&row->chars[row->size], s, len);
+  row->size += len;
+  row->chars[row->size] = '\0';
+  editorUpdateRow(row);
+  E.dirty++;
+}
 
-  int changed = (row->hl_open_comment != in_comment);
-  row->hl_open_comment = in_comment;
-  if (changed && row->idx + 1 < E.numrows)
-    editorUpdateSyntax(&E.row[row->idx + 1]);
+/**
+ * @brief Deletes a character from a row at a specific position.
+ * @param row The row to delete the character from.
+ * @param at The index of the character to delete.
+ */
+void editorRowDelChar(erow *row, int at) {
+  if (at < 0 || at >= row->size) return;
+  editorNoteEdit(row->idx, at);
+  editorRowWritable(row);
+  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+  row->size--;
+  editorUpdateRow(row);
+  E.dirty++;
 }
 
-void editorFreeSyntax() {
-    if (E.syntax == NULL) return;
+/* snapshots */
 
-    free(E.syntax->language);
+/**
+ * @brief Tells whether a live snapshot may hold the text of a row: one
+ *        was taken after the text was allocated.
+ * @param row The row.
+ * @return 1 if the text must not be changed or freed in place.
+ */
+int editorRowShared(erow *row) {
+  return E.snap_newest && E.snap_newest->gen > row->text_gen;
+}
 
-    if (E.syntax->keywords) {
-        for (int i = 0; E.syntax->keywords[i]; i++) {
-            free(E.syntax->keywords[i]);
-        }
-        free(E.syntax->keywords);
-    }
+/**
+ * @brief Called before a row's text is changed in place: if a snapshot
+ *        may hold the text, the row gets a private copy and the old text
+ *        is retired. Truncating a row only lowers its size and needs no
+ *        copy, since snapshots keep their own sizes.
+ * @param row The row.
+ */
+void editorRowWritable(erow *row) {
+  if (!editorRowShared(row)) return;
+  char *copy = memAlloc(MEM_ROWS, row->size + 1);
+  memcpy(copy, row->chars, row->size);
+  copy[row->size] = '\0';
+  editorRetireText(row->chars);
+  row->chars = copy;
+  row->text_gen = E.snap_gen;
+}
 
-    free(E.syntax->singleline_comment_start);
-    free(E.syntax->multiline_comment_start);
-    free(E.syntax->multiline_comment_end);
-    free(E.syntax);
-    E.syntax = NULL;
+/**
+ * @brief Keeps row text that snapshots may still read until the last of
+ *        them is released. The text is tagged with the newest snapshot
+ *        taken so far, so the list stays sorted by tag.
+ * @param chars The text, or NULL.
+ */
+void editorRetireText(char *chars) {
+  if (!chars) return;
+  struct retiredText *rt = memAlloc(MEM_SNAPSHOT, sizeof(struct retiredText));
+  rt->next = NULL;
+  rt->gen = E.snap_gen;
+  rt->chars = chars;
+  if (E.retired_tail) E.retired_tail->next = rt;
+  else E.retired = rt;
+  E.retired_tail = rt;
 }
 
 /**
- * @brief Updates syntax highlighting for rows that were part of a selection
- *        to remove HL_SELECTION highlighting.
+ * @brief Takes a snapshot of the active buffer: an array of pointers to
+ *        the rows' text, no text is copied. Workers read it without
+ *        locks while the editor keeps editing.
+ * @return The snapshot (one reference), or NULL if out of memory.
  */
-void editorUpdateSelectionSyntax() {
-  if (E.numrows == 0) return; 
-  
-  int start_cy = E.selection_start_cy;
-  int end_cy = E.selection_end_cy;
-  
-  // Ensure start is before end for iteration
-  if (start_cy > end_cy) {
-    int temp_cy = start_cy;
-    start_cy = end_cy;
-    end_cy = temp_cy;
+struct bufferSnapshot *editorSnapshot() {
+  struct bufferSnapshot *snap = memAlloc(MEM_SNAPSHOT, sizeof(struct bufferSnapshot));
+  if (!snap) return NULL;
+  snap->rows = memAlloc(MEM_SNAPSHOT, sizeof(struct snapRow) * (E.numrows ? E.numrows : 1));
+  if (!snap->rows) {
+    memFree(MEM_SNAPSHOT, snap);
+    return NULL;
   }
-  
-  // Clamp to valid range
-  if (start_cy < 0) start_cy = 0;
-  if (end_cy >= E.numrows) end_cy = E.numrows - 1;
-  
-  // Update syntax highlighting for all affected rows
-  for (int i = start_cy; i <= end_cy; i++) {
-    editorUpdateSyntax(&E.row[i]);
+  // Rows reserved by a checkpointed open have no text yet
+  for (int i = 0; i < E.numrows; i++) {
+    snap->rows[i].chars = E.row[i].chars ? E.row[i].chars : "";
+    snap->rows[i].size = E.row[i].size;
   }
+  snap->numrows = E.numrows;
+  snap->refs = 1;
+  snap->gen = ++E.snap_gen;
+  snap->next = NULL;
+  snap->prev = E.snap_newest;
+  if (E.snap_newest) E.snap_newest->next = snap;
+  else E.snap_oldest = snap;
+  E.snap_newest = snap;
+  return snap;
 }
 
-void editorSelectSyntaxHighlight() {
-  E.syntax = NULL;
-  if (E.filename == NULL) return;
-
-  char *ext = strrchr(E.filename, '.');
-
-  DIR *d = opendir("syntax");
-  if (!d) return;
-
-  struct dirent *dir;
-  while ((dir = readdir(d)) != NULL) {
-    if (dir->d_name[0] == '.') continue;
-
-    char filepath[1024];
-    snprintf(filepath, sizeof(filepath), "syntax/%s", dir->d_name);
-
-    FILE *fp = fopen(filepath, "r");
-    if (!fp) continue;
-
-    fseek(fp, 0, SEEK_END);
-    long fsize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    char *json_string = malloc(fsize + 1);
-    fread(json_string, 1, fsize, fp);
-    fclose(fp);
-
-    json_string[fsize] = 0;
-
-    cJSON *json = cJSON_Parse(json_string);
-    free(json_string);
+/**
+ * @brief Takes another reference to a snapshot. Main thread only.
+ * @param snap The snapshot.
+ * @return The snapshot.
+ */
+struct bufferSnapshot *editorSnapshotRetain(struct bufferSnapshot *snap) {
+  snap->refs++;
+  return snap;
+}
 
-    if (!json) continue;
+/**
+ * @brief Drops a reference to a snapshot. Main thread only: jobs release
+ *        their snapshot in their done() callback. With the last reference
+ *        the snapshot is freed, and so is retired text that no remaining
+ *        snapshot can hold.
+ * @param snap The snapshot, or NULL.
+ */
+void editorSnapshotRelease(struct bufferSnapshot *snap) {
+  if (!snap || --snap->refs > 0) return;
+  if (snap->prev) snap->prev->next = snap->next;
+  else E.snap_oldest = snap->next;
+  if (snap->next) snap->next->prev = snap->prev;
+  else E.snap_newest = snap->prev;
+  memFree(MEM_SNAPSHOT, snap->rows);
+  memFree(MEM_SNAPSHOT, snap);
+
+  while (E.retired && (!E.snap_oldest || E.snap_oldest->gen > E.retired->gen)) {
+    struct retiredText *rt = E.retired;
+    E.retired = rt->next;
+    memFree(MEM_ROWS, rt->chars);
+    memFree(MEM_SNAPSHOT, rt);
+  }
+  if (!E.retired) E.retired_tail = NULL;
+}
 
-    cJSON *filematch = cJSON_GetObjectItem(json, "filematch");
-    if (!cJSON_IsArray(filematch)) {
-      cJSON_Delete(json);
-      continue;
-    }
+/* change tracking */
 
-    cJSON *fm;
-    cJSON_ArrayForEach(fm, filematch) {
-      if (cJSON_IsString(fm) && (fm->valuestring != NULL)) {
-        if (ext && !strcmp(ext, fm->valuestring)) {
-          E.syntax = malloc(sizeof(struct editorSyntax));
-          cJSON *lang = cJSON_GetObjectItem(json, "language");
-          E.syntax->language = cJSON_IsString(lang) ? strdup(lang->valuestring) : NULL;
-
-          cJSON *kw = cJSON_GetObjectItem(json, "keywords");
-          if (cJSON_IsArray(kw)) {
-            int n = cJSON_GetArraySize(kw);
-            E.syntax->keywords = malloc(sizeof(char*) * (n + 1));
-            int i = 0;
-            cJSON *k;
-            cJSON_ArrayForEach(k, kw) {
-              E.syntax->keywords[i++] = strdup(k->valuestring);
-            }
-            E.syntax->keywords[i] = NULL;
-          } else {
-            E.syntax->keywords = NULL;
-          }
+/**
+ * @brief Remembers the row hashes of the active buffer as its saved
+ *        state, after it was loaded or saved. The modified state and
+ *        per-row changes are computed against it.
+ */
+void editorSavedCapture() {
+  struct savedState *sv = &E.saved;
+  memFree(MEM_ROWS, sv->hash);
+  sv->hash = memAlloc(MEM_ROWS, sizeof(uint64_t) * (E.numrows ? E.numrows : 1));
+  for (int i = 0; i < E.numrows; i++) sv->hash[i] = E.row[i].hash;
+  sv->numrows = E.numrows;
+  sv->prefix = E.numrows;
+  sv->checked = 0;
+  sv->modified = 0;
+  E.dirty = 0;
+  editorMarksReset();
+}
 
-          cJSON *scs = cJSON_GetObjectItem(json, "singleline_comment_start");
-          E.syntax->singleline_comment_start = cJSON_IsString(scs) ? strdup(scs->valuestring) : NULL;
+/**
+ * @brief Tells whether rows differ from their saved state. Rows before
+ *        sv->prefix are known to match, so after an edit the comparison
+ *        starts at the first edited row and usually stops right there.
+ *        The result is cached until the next edit.
+ * @param row The rows.
+ * @param numrows The number of rows.
+ * @param sv The saved state.
+ * @param dirty The edit counter of the buffer.
+ * @return 1 if the text is not the saved text.
+ */
+int editorRowsModified(erow *row, int numrows, struct savedState *sv, int dirty) {
+  if (!dirty) return 0;
+  if (sv->checked == dirty) return sv->modified;
+  sv->checked = dirty;
+  if (numrows != sv->numrows) return sv->modified = 1;
+  while (sv->prefix < numrows && row[sv->prefix].hash == sv->hash[sv->prefix]) sv->prefix++;
+  return sv->modified = sv->prefix < numrows;
+}
 
-          cJSON *mcs = cJSON_GetObjectItem(json, "multiline_comment_start");
-          E.syntax->multiline_comment_start = cJSON_IsString(mcs) ? strdup(mcs->valuestring) : NULL;
+/**
+ * @brief Tells whether the active buffer has unsaved changes. Typing a
+ *        character and deleting it again leaves the buffer unmodified.
+ * @return 1 if modified.
+ */
+int editorIsDirty() {
+  return editorRowsModified(E.row, E.numrows, &E.saved, E.dirty);
+}
 
-          cJSON *mce = cJSON_GetObjectItem(json, "multiline_comment_end");
-          E.syntax->multiline_comment_end = cJSON_IsString(mce) ? strdup(mce->valuestring) : NULL;
+/**
+ * @brief Tells whether a row of the active buffer differs from the saved
+ *        row at the same index.
+ * @param at The row index.
+ * @return 1 if changed.
+ */
+int editorRowChanged(int at) {
+  return at >= E.saved.numrows || E.row[at].hash != E.saved.hash[at];
+}
 
-          cJSON *flags = cJSON_GetObjectItem(json, "flags");
-          E.syntax->flags = cJSON_IsNumber(flags) ? flags->valueint : 0;
+/* editor operations */
 
-          cJSON_Delete(json);
-          closedir(d);
-          return;
-        }
-      }
-    }
-    cJSON_Delete(json);
+/**
+ * @brief Inserts a character at the current cursor position.
+ * @param c The character to insert.
+ */
+void editorInsertChar(int c) {
+  if (E.cy == E.numrows) {
+    editorInsertRow(E.numrows, "", 0);
+  }
+  editorRowInsertChar(&E.row[E.cy], E.cx, c);
+  E.cx++;
+  char closing_char = 0;
+  switch (c) {
+    case '(': closing_char = ')'; break;
+    case '[': closing_char = ']'; break;
+    case '{': closing_char = '}'; break;
+    case '"': closing_char = '"'; break;
+    case '\'': closing_char = '\''; break;
+  }
+  if (closing_char) {
+    editorRowInsertChar(&E.row[E.cy], E.cx, closing_char);
   }
-  closedir(d);
 }
 
-/* find */
-
 /**
- * @brief Callback function for the search. It is called by editorPrompt.
- *        Searches for the `query` text in the buffer and moves to the next/previous match.
- * @param query The string to search for.
- * @param key The key pressed by the user (to navigate between results).
+ * @brief Inserts a newline at the cursor position.
+ *        Maintains the indentation of the current line on the new line.
  */
-void editorFindCallback(char *query, int key) {
-  static int last_match = -1;
-  static int direction = 1;
-
-  // If a previous match was selected, redraw its syntax to remove the highlight
-  if (last_match != -1) {
-    editorUpdateSyntax(&E.row[last_match]);
-  }
-
-  if (key == '\r' || key == '\x1b') {
-    last_match = -1;
-    direction = 1;
-    E.selection_active = 0;
+void editorInsertNewline() {
+  if (E.cx == 0) {
+    editorInsertRow(E.cy, "", 0);
+    E.cy++;
+    E.cx = 0;
     return;
-  } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-    direction = 1;
-  } else if (key == ARROW_LEFT || key == ARROW_UP) {
-    direction = -1;
   }
-  else { // Any other key resets search
-    last_match = -1;
-    direction = 1;
+
+  erow *row = &E.row[E.cy];
+  int indent_len = 0;
+  while (indent_len < row->size && isspace(row->chars[indent_len])) {
+    indent_len++;
   }
+  
+  char* rest_of_line = &row->chars[E.cx];
+  int rest_len = row->size - E.cx;
+  char* new_line_content = memAlloc(MEM_ROWS, indent_len + rest_len + 1);
+  memcpy(new_line_content, row->chars, indent_len);
+  memcpy(new_line_content + indent_len, rest_of_line, rest_len);
+  new_line_content[indent_len + rest_len] = '\0';
 
-  if (last_match == -1) direction = 1;
-  int current = last_match;
-  if (current == -1) current = E.cy;
+  int old_cx = E.cx;
+  editorInsertRow(E.cy + 1, new_line_content, indent_len + rest_len);
 
-  int found = 0;
-  for (int i = 0; i < E.numrows; i++) {
-    current += direction;
-    if (current == -1) current = E.numrows - 1;
-    else if (current == E.numrows) current = 0;
+  row = &E.row[E.cy];
+  editorNoteEdit(E.cy, old_cx);
+  row->size = old_cx;
+  editorUpdateRow(row);
 
-    erow *row = &E.row[current];
-    char *match = strstr(row->render, query);
-    if (match) {
-      last_match = current;
-      E.cy = current;
-      E.cx = editorRowRxToCx(row, match - row->render);
-      E.rowoff = E.numrows;
+  E.cy++;
+  E.cx = indent_len;
 
-      // Activate selection for the found match
-      E.selection_active = 1;
-      E.selection_start_cy = current;
-      E.selection_end_cy = current;
-      E.selection_start_cx = E.cx;
-      E.selection_end_cx = E.cx + strlen(query);
-      found = 1;
-      break;
-    }
+  memFree(MEM_ROWS, new_line_content);
+}
+
+/**
+ * @brief Deletes the character before the cursor (like the Backspace key).
+ *        If the cursor is at the beginning of a line, it joins the current line with the previous one.
+ */
+void editorDelCharSelection() {
+  if (!E.selection_active) {
+    editorSetStatusMessage("editorDelCharSelection: Selection not active.");
+    return;
   }
 
-  // If no match was found from this action, deactivate selection
-  if (!found) {
+  int start_cx = E.selection_start_cx;
+  int start_cy = E.selection_start_cy;
+  int end_cx = E.selection_end_cx;
+  int end_cy = E.selection_end_cy;
+
+  editorSetStatusMessage("editorDelCharSelection: start_cx=%d, start_cy=%d, end_cx=%d, end_cy=%d", start_cx, start_cy, end_cx, end_cy);
+
+  // Ensure start is before end
+  if (start_cy > end_cy || (start_cy == end_cy && start_cx > end_cx)) {
+    int temp_cx = start_cx;
+    int temp_cy = start_cy;
+    start_cx = end_cx;
+    start_cy = end_cy;
+    end_cx = temp_cx;
+    end_cy = temp_cy;
+    editorSetStatusMessage("editorDelCharSelection: Swapped coords: start_cx=%d, start_cy=%d, end_cx=%d, end_cy=%d", start_cx, start_cy, end_cx, end_cy);
+  }
+
+  // If selection is empty (start_cx == end_cx and start_cy == end_cy), do nothing
+  if (start_cy == end_cy && start_cx == end_cx) {
       E.selection_active = 0;
-      last_match = -1;
+      editorSetStatusMessage("editorDelCharSelection: Empty selection.");
+      return;
   }
-}
 
-void editorFind() {
-  int saved_cx = E.cx, saved_cy = E.cy;
-  int saved_coloff = E.coloff, saved_rowoff = E.rowoff;
+  // Get the suffix of the end_row before any deletions
+  char *suffix_of_end_row = NULL;
+  int suffix_of_end_row_len = 0;
+  if (end_cx < E.row[end_cy].size) {
+      suffix_of_end_row_len = E.row[end_cy].size - end_cx;
+      suffix_of_end_row = memAlloc(MEM_ROWS, suffix_of_end_row_len + 1);
+      memcpy(suffix_of_end_row, &E.row[end_cy].chars[end_cx], suffix_of_end_row_len);
+      suffix_of_end_row[suffix_of_end_row_len] = '\0';
+      editorSetStatusMessage("editorDelCharSelection: Suffix len: %d, Suffix: '%s'", suffix_of_end_row_len, suffix_of_end_row);
+  }
+
+  // Delete characters from start_cx to end of line in start_cy
+  erow *start_row = &E.row[start_cy];
+  editorNoteEdit(start_cy, start_cx);
+  start_row->size = start_cx;
+  editorUpdateRow(start_row);
+  editorSetStatusMessage("editorDelCharSelection: Start row truncated. New size: %d", start_row->size);
 
-  char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
 
-  if (query) {
-    free(query);
+  // Delete full rows between start_cy and end_cy (exclusive of start_cy, inclusive of end_cy)
+  // Iterate from end_cy down to start_cy + 1
+  for (int i = end_cy; i > start_cy; i--) {
+      editorDelRow(i);
+      editorSetStatusMessage("editorDelCharSelection: Deleted row %d. Remaining rows: %d", i, E.numrows);
   }
-  else {
-    E.cx = saved_cx; E.cy = saved_cy;
-    E.coloff = saved_coloff; E.rowoff = saved_rowoff;
+
+  // Append the suffix of the original end_row to the modified start_row
+  if (suffix_of_end_row_len > 0) {
+      editorRowAppendString(start_row, suffix_of_end_row, suffix_of_end_row_len);
+      memFree(MEM_ROWS, suffix_of_end_row);
+      editorSetStatusMessage("editorDelCharSelection: Suffix appended. New row size: %d", start_row->size);
   }
-  // Ensure selection is cleared and screen is refreshed when prompt is closed
+
+  E.cx = start_cx; // Move cursor to start of deleted selection
+  E.cy = start_cy;
+
   E.selection_active = 0;
-  editorRefreshScreen();
+  E.dirty++; // Mark file as dirty
+  editorSetStatusMessage("editorDelCharSelection: Done.");
 }
 
-/* append buffer */
+void editorDelChar() {
+  if (E.cy == E.numrows) return;
+  if (E.cx == 0 && E.cy == 0) return;
+  erow *row = &E.row[E.cy];
+  if (E.cx > 0) {
+    int is_tab_indent = 1;
+    if (E.cx >= WEE_TAB_STOP) {
+      for (int i = 1; i <= WEE_TAB_STOP; i++) {
+        if (row->chars[E.cx - i] != ' ') {
+          is_tab_indent = 0;
+          break;
+        }
+      }
+    } else {
+      is_tab_indent = 0;
+    }
 
-struct abuf {
-  char *b;
-  int len;
-};
+    if (is_tab_indent) {
+      for (int i = 0; i < WEE_TAB_STOP; i++) {
+        editorRowDelChar(row, E.cx - 1);
+        E.cx--;
+      }
+    } else {
+      int prev = editorRowPrevCx(row, E.cx);
+      while (E.cx > prev) {
+        editorRowDelChar(row, E.cx - 1);
+        E.cx--;
+      }
+    }
+  } else {
+    E.cx = E.row[E.cy - 1].size;
+    editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
+    editorDelRow(E.cy);
+    E.cy--;
+  }
+}
 
-#define ABUF_INIT {NULL, 0}
+/* file i/o */
 
 /**
- * @brief Appends a string to a dynamic output buffer (append buffer).
- * @param ab The buffer to append to.
- * @param s The string to append.
- * @param len The length of the string.
+ * @brief Converts all text rows of the editor into a single string.
+ *        The rows are separated by newline characters.
+ * @param buflen Pointer to store the total length of the string.
+ * @return A pointer to the dynamically allocated string.
  */
-void abAppend(struct abuf *ab, const char *s, int len) {
-  char *new = realloc(ab->b, ab->len + len);
-  if (new == NULL) return;
-  memcpy(&new[ab->len], s, len);
-  ab->b = new;
-  ab->len += len;
+char *editorRowsToString(int *buflen) {
+  int totlen = 0;
+  for (int j = 0; j < E.numrows; j++)
+    totlen += E.row[j].size + 1;
+  *buflen = totlen;
+  char *buf = memAlloc(MEM_OUTPUT, totlen);
+  char *p = buf;
+  for (int j = 0; j < E.numrows; j++) {
+    memcpy(p, E.row[j].chars, E.row[j].size);
+    p += E.row[j].size;
+    *p = '\n';
+    p++;
+  }
+  return buf;
 }
 
 /**
- * @brief Frees the memory of an append buffer.
- * @param ab The buffer to free.
+ * @brief Asks the user if they want to save unsaved changes.
+ *        Waits for an input (Ctrl-S, ESC, Ctrl-D) to decide the action.
+ * @return 1 if it can proceed (saved or discarded), 0 if the operation is canceled.
  */
-void abFree(struct abuf *ab) { free(ab->b); }
+int editorAskToSave() {
+  if (!editorIsDirty()) return 1;
+  editorSetStatusMessage(
+      "WARNING! File has unsaved changes. "
+      "Press Ctrl-S to save, ESC to cancel, or Ctrl-D to discard.");
+  editorRefreshScreen();
+  while (1) {
+    int c = editorReadKey();
+    if (c == CTRL_KEY('s')) {
+      editorSave();
+      return !editorIsDirty();
+    } else if (c == '\x1b') {
+      editorSetStatusMessage("Save aborted.");
+      return 0;
+    } else if (c == CTRL_KEY('d')) {
+      editorSetStatusMessage("Changes discarded.");
+      return 1;
+    }
+  }
+}
 
-/* output */
+/**
+ * @brief Returns the length of a line read from a file without its line
+ *        ending: a '\n', "\r\n" or any run of those.
+ * @param line The line.
+ * @param len The length of the line as read.
+ * @return The length of its text.
+ */
+ssize_t editorLineLength(const char *line, ssize_t len) {
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) len--;
+  return len;
+}
 
 /**
- * @brief Calculates the number of columns available for text,
- *        considering the space occupied by line numbers if active.
- * @return The number of columns for the text.
+ * @brief Appends a line read from a file to the editor rows, remembering
+ *        how many bytes its line ending took on disk.
+ * @param line The line.
+ * @param len The length of the line as read.
  */
-int editorGetTextCols() {
-    int text_cols = E.screencols;
-    if (E.linenumbers) {
-        int max_linenum_digits = 1;
-        if (E.numrows > 0) {
-            int temp_num = E.numrows;
-            while (temp_num /= 10) max_linenum_digits++;
-        }
-        int linenum_width = max_linenum_digits + 1;
-        if (linenum_width < 4) linenum_width = 4;
-        text_cols -= linenum_width;
-    }
-    return text_cols;
+void editorLoadLine(char *line, ssize_t len) {
+  ssize_t n = editorLineLength(line, len);
+  editorInsertRow(E.numrows, line, n);
+  E.row[E.numrows - 1].eol = len - n;
 }
 
 /**
- * @brief Manages vertical and horizontal scrolling
- *        to keep the cursor visible on the screen.
+ * @brief Records that every row ends with a single '\n' on disk, after the
+ *        buffer was written.
  */
-void editorScroll() {
-  E.rx = 0;
-  if (E.cy < E.numrows) E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
-  if (E.cy < E.rowoff) E.rowoff = E.cy;
-  if (E.cy >= E.rowoff + E.screenrows) E.rowoff = E.cy - E.screenrows + 1;
-  int text_cols = editorGetTextCols();
-  if (E.rx < E.coloff) E.coloff = E.rx;
-  if (E.rx >= E.coloff + text_cols) E.coloff = E.rx - text_cols + 1;
+void editorResetLineEndings() {
+  for (int i = 0; i < E.numrows; i++) E.row[i].eol = 1;
 }
 
 /**
- * @brief Draws the visible text rows on the screen.
- * @param ab The append buffer to add the text to be drawn to.
- * @param linenum_width The width of the line number column.
+ * @brief Appends every remaining line of a file to the editor rows.
+ * @param fp The file to read from.
  */
-void editorDrawRows(struct abuf *ab) {
-  int linenum_width = 0;
-  if (E.linenumbers) {
-    int max_linenum_digits = 1;
-    if (E.numrows > 0) {
-            int temp_num = E.numrows;
-            while (temp_num /= 10) max_linenum_digits++;
-        }
-        linenum_width = max_linenum_digits + 1;
-        if (linenum_width < 4) linenum_width = 4;
-  }
-
-  for (int y = 0; y < E.screenrows; y++) {
-    int filerow = y + E.rowoff;
-    if (filerow >= E.numrows) {
-      if (E.numrows == 0 && y == E.screenrows / 3) {
-        char welcome[80];
-        int welcomelen = snprintf(welcome, sizeof(welcome), "Wee editor -- version %s", WEE_VERSION);
-        int text_cols = editorGetTextCols();
-        if (welcomelen > text_cols) welcomelen = text_cols;
-        int padding = (text_cols - welcomelen) / 2;
-        if (padding) {
-          abAppend(ab, "~", 1);
-          padding--;
-        }
-        while (padding--) abAppend(ab, " ", 1);
-        abAppend(ab, welcome, welcomelen);
-      } else if (E.numrows == 0 && y == E.screenrows / 3 + 1) {
-        char author[80];
-        int authorlen = snprintf(author, sizeof(author), "by anidisc");
-        int text_cols = editorGetTextCols();
-        if (authorlen > text_cols) authorlen = text_cols;
-        int padding = (text_cols - authorlen) / 2;
-        if (padding) {
-          abAppend(ab, "~", 1);
-          padding--;
-        }
-        while (padding--) abAppend(ab, " ", 1);
-        abAppend(ab, author, authorlen);
-      } else if (E.numrows == 0 && y == E.screenrows / 3 + 2) {
-        char site[80];
-        int sitelen = snprintf(site, sizeof(site), "wee.anidisc.it");
-        int text_cols = editorGetTextCols();
-        if (sitelen > text_cols) sitelen = text_cols;
-        int padding = (text_cols - sitelen) / 2;
-        if (padding) {
-          abAppend(ab, "~", 1);
-          padding--;
-        }
-        while (padding--) abAppend(ab, " ", 1);
-        abAppend(ab, site, sitelen);
-      } else {
-        abAppend(ab, "~", 1);
-      }
-    } else {
-      if (E.linenumbers) {
-        char linenum_buf[16];
-        int len = snprintf(linenum_buf, sizeof(linenum_buf), "%*d ", linenum_width - 1, filerow + 1); 
-        abAppend(ab, "\x1b[36m", 5);
-        abAppend(ab, linenum_buf, len);
-        abAppend(ab, "\x1b[m", 3);
-      }
-      int len = E.row[filerow].rsize - E.coloff;
-      if (len < 0) len = 0;
-      if (len > E.screencols - linenum_width) len = E.screencols - linenum_width;
-      char *c = &E.row[filerow].render[E.coloff];
-      unsigned char *hl = &E.row[filerow].hl[E.coloff];
-      int current_color = -1;
+void editorLoadRows(FILE *fp) {
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t linelen;
+  while ((linelen = getline(&line, &linecap, fp)) != -1) editorLoadLine(line, linelen);
+  free(line);
+}
 
-      // Local variables for selection coordinates
-      int local_sel_start_cx = E.selection_start_cx;
-      int local_sel_start_cy = E.selection_start_cy;
-      int local_sel_end_cx = E.selection_end_cx;
-      int local_sel_end_cy = E.selection_end_cy;
+/**
+ * @brief Loads a file starting from a recent-files checkpoint.
+ *        The rows from the checkpoint line onwards are read first and the
+ *        first frame is drawn as soon as a screenful is available; the rows
+ *        above the checkpoint are filled in afterwards. The whole file is
+ *        still read before returning, so keys are only handled once it is
+ *        loaded: the rows above the checkpoint are empty placeholders until
+ *        then, and edits, searches and saves all assume complete rows.
+ * @param fp The file to read from.
+ * @param re The recent-files entry holding the checkpoint.
+ * @return 1 if the file was loaded, 0 if the checkpoint is stale (nothing loaded).
+ */
+int editorOpenAtCheckpoint(FILE *fp, struct recentEntry *re) {
+  struct stat st;
+  if (re->ckpt_line <= 0 || re->ckpt_offset <= 0) return 0;
+  if (fstat(fileno(fp), &st) == -1) return 0;
+  if (st.st_size != re->size || (long long)st.st_mtime != re->mtime) return 0;
+  if (re->ckpt_offset >= st.st_size) return 0;
+  if (fseeko(fp, re->ckpt_offset - 1, SEEK_SET) == -1 || fgetc(fp) != '\n') {
+    rewind(fp);
+    return 0;
+  }
 
-      if (E.selection_active) {
-          // Ensure start is before end for drawing purposes
-          // Ensure start is before end for drawing purposes (already done in editorDelCharSelection and editorCopySelection, but good to be safe)
-          if (local_sel_start_cy > local_sel_end_cy || (local_sel_start_cy == local_sel_end_cy && local_sel_start_cx > local_sel_end_cx)) {
-              int temp_cy = local_sel_start_cy;
-              int temp_cx = local_sel_start_cx;
-              local_sel_start_cy = local_sel_end_cy;
-              local_sel_start_cx = local_sel_end_cx;
-              local_sel_end_cy = temp_cy;
-              local_sel_end_cx = temp_cx;
-          }
+  // Reserve the rows above the checkpoint, they are read after the first frame
+  E.row = memCalloc(MEM_ROWS, re->ckpt_line, sizeof(erow));
+  for (int j = 0; j < re->ckpt_line; j++) E.row[j].idx = j;
+  E.numrows = re->ckpt_line;
+
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t linelen;
+  int painted = 0;
+  while ((linelen = getline(&line, &linecap, fp)) != -1) {
+    editorLoadLine(line, linelen);
+    if (!painted && !E.background_load && E.numrows - re->ckpt_line >= E.screenrows) {
+      editorRecentRestore(re);
+      editorRefreshScreen();
+      painted = 1;
+    }
+  }
 
-          int sel_start_rx = 0;
-          int sel_end_rx = 0;
+  rewind(fp);
+  int j = 0;
+  while (j < re->ckpt_line && (linelen = getline(&line, &linecap, fp)) != -1) {
+    ssize_t n = editorLineLength(line, linelen);
+    editorFillRow(j, line, n);
+    E.row[j].eol = linelen - n;
+    j++;
+  }
+  free(line);
 
-          if (filerow < local_sel_start_cy || filerow > local_sel_end_cy) {
-              // Current row is outside the selection range, no highlighting
-              sel_start_rx = -1; // Indicate no selection for this row
-              sel_end_rx = -1;
-          } else {
-              // Current row is within the selection range
-              if (filerow == local_sel_start_cy) {
-                  sel_start_rx = editorRowCxToRx(&E.row[filerow], local_sel_start_cx);
-              }
-              else {
-                  sel_start_rx = 0; // Start from the beginning of the row
-              }
+  if (j != re->ckpt_line || ftello(fp) != re->ckpt_offset) {
+    // The file changed under the same size and mtime: start over from the top
+    for (int i = 0; i < E.numrows; i++) editorFreeRow(&E.row[i]);
+    memFree(MEM_ROWS, E.row);
+    E.row = NULL;
+    E.numrows = 0;
+    rewind(fp);
+    return 0;
+  }
+  return 1;
+}
 
-              if (filerow == local_sel_end_cy) {
-                  sel_end_rx = editorRowCxToRx(&E.row[filerow], local_sel_end_cx);
-              }
-              else {
-                  sel_end_rx = E.row[filerow].rsize; // Go to the end of the row
-              }
-          }
+/**
+ * @brief Opens a file and loads its content into the editor.
+ *        If the file is in the recent-files list, the cursor and scroll
+ *        position are restored.
+ * @param filename The path of the file to open.
+ */
+void editorOpen(char *filename) {
+  FILE *fp = fopen(filename, "r");
+  if (!fp && errno != ENOENT) {
+    editorSetStatusMessage("Error: Could not open file %s: %s", filename, strerror(errno));
+    return;
+  }
 
-          for (int j = 0; j < len; j++) {
-            int current_render_idx = E.coloff + j; // This is the render index of the character being drawn
-            // Apply selection highlighting
-            if (sel_start_rx != -1) { // Only highlight if this row is part of the selection
-                // Special case for single character selection
-                if (local_sel_start_cy == local_sel_end_cy && local_sel_start_cx == local_sel_end_cx) {
-                    if (current_render_idx == sel_start_rx) {
-                        hl[j] = HL_SELECTION;
-                    }
-                } else {
-                    if (current_render_idx >= sel_start_rx && current_render_idx < sel_end_rx) {
-                        hl[j] = HL_SELECTION;
-                    }
-                }
-            }
-          }
-      }
+  if (!editorAskToSave()) {
+      if (fp) fclose(fp);
+      return;
+  }
+  TRACE_BEGIN("editorOpen");
 
-      for (int j = 0; j < len; j++) {
-        if (filerow == E.hl_row) {
-            int start = E.hl_start > E.coloff ? E.hl_start - E.coloff : 0;
-            int end = E.hl_end > E.coloff ? E.hl_end - E.coloff : 0;
-            if (end > len) end = len;
-            if (j >= start && j < end) {
-                hl[j] = HL_MATCH;
-            }
-        }
+  editorRecentRemember();
 
-        int color = editorSyntaxToColor(hl[j]);
-        // Only consider HL_SELECTION if selection is active
-        int is_selection = (E.selection_active && hl[j] == HL_SELECTION);
+  for (int i = 0; i < E.numrows; i++) editorFreeRow(&E.row[i]);
+  memFree(MEM_ROWS, E.row);
+  E.row = NULL;
+  E.numrows = 0;
+  E.cx = 0; E.cy = 0; E.rowoff = 0; E.coloff = 0;
+  editorOutlineFree(E.outline);
+  E.outline = NULL;
+  editorValidateForget(E.json_check);
+  E.json_check = NULL;
+  editorMarksForget(E.marks);
+  E.marks = NULL;
+  editorAutosaveForget(E.autosave);
+  E.autosave = NULL;
+
+  memFree(MEM_EDITOR, E.filename);
+  E.filename = memStrdup(MEM_EDITOR, filename);
 
-        if (is_selection) {
-            if (current_color != 7) { // If not already in inverse video
-                abAppend(ab, "\x1b[7m", 4); // Set inverse video
-                current_color = 7;
-            }
-        } else {
-            if (current_color == 7) { // If was in inverse video, reset it
-                abAppend(ab, "\x1b[27m", 5); // Reset inverse video
-                current_color = -1; // Reset current_color to force re-evaluation of normal color
-            }
-            if (color != current_color) {
-                current_color = color;
-                char buf[16];
-                int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                abAppend(ab, buf, clen);
-            }
-        }
+  editorSelectSyntaxHighlight();
 
-        if (iscntrl(c[j])) { // Control characters
-          char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-          abAppend(ab, &sym, 1);
-        } else { // Normal characters
-          abAppend(ab, &c[j], 1);
-        }
-      }
-      // Ensure inverse video is reset at the end of the line
-      if (current_color == 7) {
-          abAppend(ab, "\x1b[27m", 5);
-      }
-      abAppend(ab, "\x1b[39m", 5); // Reset foreground color
-    }
-    abAppend(ab, "\x1b[K", 3);
-    abAppend(ab, "\r\n", 2);
+  if (fp) {
+    struct recentEntry *re = editorRecentFind(filename);
+    if (!re || !editorOpenAtCheckpoint(fp, re)) editorLoadRows(fp);
+    fclose(fp);
+    if (re) editorRecentRestore(re);
+    editorSavedCapture();
+    editorSetStatusMessage("%s opened.", filename);
+  } else {
+    editorSavedCapture();
+    editorSetStatusMessage("New file: %s", filename);
   }
+  TRACE_END("editorOpen");
 }
 
 /**
- * @brief Draws the status bar at the bottom of the screen.
- * @param ab The append buffer to add the text to be drawn to.
+ * @brief Saves the current content of the editor to the file.
+ *        If the file has no name, it prompts the user for one. A buffer
+ *        whose text equals the saved text is not written again.
  */
-void editorDrawStatusBar(struct abuf *ab) {
-  abAppend(ab, "\x1b[7m", 4);
-  
-  char *basename = E.filename ? strrchr(E.filename, '/') : NULL;
-  if (basename) {
-    basename++;
-  } else {
-    basename = E.filename;
+void editorSave() {
+  if (E.filename == NULL) {
+    E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+    if (E.filename == NULL) {
+      editorSetStatusMessage("Save aborted");
+      return;
+    }
+  } else if (!editorIsDirty() && access(E.filename, F_OK) == 0) {
+    editorSetStatusMessage("No changes to save");
+    return;
   }
+  editorWriteFile();
+}
 
-  char status[256];
-  int len = 0;
-
-  // File name part
-  abAppend(ab, "\x1b[37;44m", 7);
-  abAppend(ab, "[", 1);
-  abAppend(ab, basename ? basename : "No Name", strlen(basename ? basename : "No Name"));
-  abAppend(ab, "]", 1);
-  abAppend(ab, "\x1b[m", 3);
-  abAppend(ab, "\x1b[7m", 4);
-
-  len = 2 + strlen(basename ? basename : "No Name");
-
-  // Other info
-  int len2 = snprintf(status, sizeof(status), " - %d lines %s", E.numrows, E.dirty ? "(modified)" : "");
-  abAppend(ab, status, len2);
-  len += len2;
-
-  char rstatus[80];
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", E.syntax ? E.syntax->language : "no ft", E.cy + 1, E.numrows);
-  
-  while (len < E.screencols) {
-    if (E.screencols - len == rlen) {
-      abAppend(ab, rstatus, rlen);
-      break;
-    } else {
-      abAppend(ab, " ", 1);
-      len++;
+/**
+ * @brief Writes the current content of the editor to its file.
+ */
+void editorWriteFile() {
+  TRACE_BEGIN("editorSave");
+  editorAutosaveCancel(E.autosave);
+  int len;
+  char *buf = editorRowsToString(&len);
+  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+  if (fd != -1) {
+    if (ftruncate(fd, len) != -1 && write(fd, buf, len) == len) {
+      close(fd);
+      memFree(MEM_OUTPUT, buf);
+      editorResetLineEndings();
+      editorSavedCapture();
+      editorSetStatusMessage("%d bytes written to disk", len);
+      TRACE_END("editorSave");
+      return;
     }
+    close(fd);
   }
-  abAppend(ab, "\x1b[m", 3);
-  abAppend(ab, "\r\n", 2);
+  memFree(MEM_OUTPUT, buf);
+  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+  TRACE_END("editorSave");
 }
 
 /**
- * @brief Draws the message bar, below the status bar.
- * @param ab The append buffer to add the text to be drawn to.
+ * @brief Saves the current content with a new file name.
  */
-void editorDrawMessageBar(struct abuf *ab) {
-  abAppend(ab, "\x1b[K", 3);
-  int msglen = strlen(E.statusmsg);
-  if (msglen > E.screencols) msglen = E.screencols;
-  if (msglen && time(NULL) - E.statusmsg_time < 5)
-    abAppend(ab, E.statusmsg, msglen);
+void editorSaveAs() {
+  char *new_filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+  if (new_filename == NULL) {
+    editorSetStatusMessage("Save As aborted");
+    return;
+  }
+  memFree(MEM_EDITOR, E.filename);
+  E.filename = new_filename;
+  editorWriteFile();
 }
 
 /**
- * @brief Refreshes the entire screen, redrawing all components.
+ * @brief Copies the current line to the internal clipboard.
  */
-void editorRefreshScreen() {
-  editorScroll();
-  struct abuf ab = ABUF_INIT;
-  abAppend(&ab, "\x1b[?25l", 6);
-  abAppend(&ab, "\x1b[H", 3);
-  editorDrawRows(&ab);
-  editorDrawStatusBar(&ab);
-  editorDrawMessageBar(&ab);
-  char buf[32];
-  int linenum_width = 0;
-  if (E.linenumbers) {
-      int max_linenum_digits = 1;
-      if (E.numrows > 0) {
-          int temp_num = E.numrows;
-          while (temp_num /= 10) max_linenum_digits++;
-      }
-      linenum_width = max_linenum_digits + 1;
-      if (linenum_width < 4) linenum_width = 4;
+void editorCopySelection() {
+  if (!E.selection_active) return;
+
+  int start_cx = E.selection_start_cx;
+  int start_cy = E.selection_start_cy;
+  int end_cx = E.selection_end_cx;
+  int end_cy = E.selection_end_cy;
+
+  // Ensure start is before end
+  if (start_cy > end_cy || (start_cy == end_cy && start_cx > end_cx)) {
+    int temp_cx = start_cx;
+    int temp_cy = start_cy;
+    start_cx = end_cx;
+    start_cy = end_cy;
+    end_cx = temp_cx;
+    end_cy = temp_cy;
   }
-  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
-           (E.rx - E.coloff) + 1 + linenum_width);
-  abAppend(&ab, buf, strlen(buf));
-  abAppend(&ab, "\x1b[?25h", 6);
-  write(STDOUT_FILENO, ab.b, ab.len);
-  abFree(&ab);
+
+  memFree(MEM_CLIPBOARD, E.clipboard);
+  E.clipboard = NULL;
+  E.clipboard_len = 0;
+
+  if (start_cy == end_cy) {
+    // Single line selection: copy exact characters
+    int len = end_cx - start_cx;
+    E.clipboard = memAlloc(MEM_CLIPBOARD, len + 1);
+    memcpy(E.clipboard, &E.row[start_cy].chars[start_cx], len);
+    E.clipboard[len] = '\0';
+    E.clipboard_len = len;
+  } else {
+    // Multi-line selection: copy full lines, including newlines
+    // Copy first line from start_cx to end of line
+    int len_first_line = E.row[start_cy].size - start_cx;
+    E.clipboard = memAlloc(MEM_CLIPBOARD, len_first_line + 1);
+    memcpy(E.clipboard, &E.row[start_cy].chars[start_cx], len_first_line);
+    E.clipboard_len = len_first_line;
+
+    // Add newline after the first line
+    E.clipboard = memRealloc(MEM_CLIPBOARD, E.clipboard, E.clipboard_len + 1);
+    E.clipboard[E.clipboard_len] = '\n';
+    E.clipboard_len++;
+
+    // Copy middle lines (full lines)
+    for (int i = start_cy + 1; i < end_cy; i++) {
+      E.clipboard = memRealloc(MEM_CLIPBOARD, E.clipboard, E.clipboard_len + E.row[i].size + 1);
+      memcpy(&E.clipboard[E.clipboard_len], E.row[i].chars, E.row[i].size);
+      E.clipboard_len += E.row[i].size;
+      E.clipboard[E.clipboard_len] = '\n';
+      E.clipboard_len++;
+    }
+
+    // Copy last line from beginning of line to end_cx
+    int len_last_line = end_cx;
+    E.clipboard = memRealloc(MEM_CLIPBOARD, E.clipboard, E.clipboard_len + len_last_line + 1);
+    memcpy(&E.clipboard[E.clipboard_len], E.row[end_cy].chars, len_last_line);
+    E.clipboard_len += len_last_line;
+    E.clipboard[E.clipboard_len] = '\0'; // No newline after the last line
+  }
+  E.selection_active = 0; // Deselect after copy
+
+  // Explicitly reset HL_SELECTION for affected rows
+  // int start_cy = E.selection_start_cy;
+  // int end_cy = E.selection_end_cy;
+
+  // Ensure start is before end for iteration
+  if (start_cy > end_cy) {
+    int temp_cy = start_cy;
+    start_cy = end_cy;
+    end_cy = temp_cy;
+  }
+
+  for (int i = start_cy; i <= end_cy; i++) {
+    editorUpdateSyntax(&E.row[i]); // Re-evaluate syntax highlighting for the row
+  }
+
+  editorSetStatusMessage("Selection copied.");
+}
+
+void editorCopyLine() {
+
+  if (E.cy >= E.numrows) return;
+  erow *row = &E.row[E.cy];
+  memFree(MEM_CLIPBOARD, E.clipboard);
+  E.clipboard_len = row->size;
+  E.clipboard = memAlloc(MEM_CLIPBOARD, E.clipboard_len + 1);
+  memcpy(E.clipboard, row->chars, E.clipboard_len);
+  E.clipboard[E.clipboard_len] = '\0';
+  editorSetStatusMessage("Line copied.");
 }
 
 /**
- * @brief Sets a message to be displayed in the message bar.
- * @param fmt The format string (like in printf).
- * @param ... Variable arguments for the format string.
+ * @brief Cuts the current line (copies and deletes).
  */
-void editorSetStatusMessage(const char *fmt, ...) {
-  va_list ap;
-  va_start(ap, fmt);
-  vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
-  va_end(ap);
-  E.statusmsg_time = time(NULL);
+void editorCutSelection() {
+  if (!E.selection_active) return;
+  
+  // First copy the selection WITHOUT deselecting
+  int start_cx = E.selection_start_cx;
+  int start_cy = E.selection_start_cy;
+  int end_cx = E.selection_end_cx;
+  int end_cy = E.selection_end_cy;
+
+  // Ensure start is before end
+  if (start_cy > end_cy || (start_cy == end_cy && start_cx > end_cx)) {
+    int temp_cx = start_cx;
+    int temp_cy = start_cy;
+    start_cx = end_cx;
+    start_cy = end_cy;
+    end_cx = temp_cx;
+    end_cy = temp_cy;
+  }
+
+  memFree(MEM_CLIPBOARD, E.clipboard);
+  E.clipboard = NULL;
+  E.clipboard_len = 0;
+
+  if (start_cy == end_cy) {
+    // Single line selection: copy exact characters
+    int len = end_cx - start_cx;
+    E.clipboard = memAlloc(MEM_CLIPBOARD, len + 1);
+    memcpy(E.clipboard, &E.row[start_cy].chars[start_cx], len);
+    E.clipboard[len] = '\0';
+    E.clipboard_len = len;
+  } else {
+    // Multi-line selection: copy full lines, including newlines
+    // Copy first line from start_cx to end of line
+    int len_first_line = E.row[start_cy].size - start_cx;
+    E.clipboard = memAlloc(MEM_CLIPBOARD, len_first_line + 1);
+    memcpy(E.clipboard, &E.row[start_cy].chars[start_cx], len_first_line);
+    E.clipboard_len = len_first_line;
+
+    // Add newline after the first line
+    E.clipboard = memRealloc(MEM_CLIPBOARD, E.clipboard, E.clipboard_len + 1);
+    E.clipboard[E.clipboard_len] = '\n';
+    E.clipboard_len++;
+
+    // Copy middle lines (full lines)
+    for (int i = start_cy + 1; i < end_cy; i++) {
+      E.clipboard = memRealloc(MEM_CLIPBOARD, E.clipboard, E.clipboard_len + E.row[i].size + 1);
+      memcpy(&E.clipboard[E.clipboard_len], E.row[i].chars, E.row[i].size);
+      E.clipboard_len += E.row[i].size;
+      E.clipboard[E.clipboard_len] = '\n';
+      E.clipboard_len++;
+    }
+
+    // Copy last line from beginning of line to end_cx
+    int len_last_line = end_cx;
+    E.clipboard = memRealloc(MEM_CLIPBOARD, E.clipboard, E.clipboard_len + len_last_line + 1);
+    memcpy(&E.clipboard[E.clipboard_len], E.row[end_cy].chars, len_last_line);
+    E.clipboard_len += len_last_line;
+    E.clipboard[E.clipboard_len] = '\0'; // No newline after the last line
+  }
+  
+  // Now delete the selection (E.selection_active is still 1)
+  editorDelCharSelection();
+  editorSetStatusMessage("Selection cut.");
 }
 
-/* input */
+void editorCutLine() {
+  if (E.cy >= E.numrows) return;
+  editorCopyLine();
+  editorDelRow(E.cy);
+  if (E.cy >= E.numrows && E.numrows > 0) {
+    E.cy = E.numrows - 1;
+    E.cx = E.row[E.cy].size;
+  } else if (E.numrows == 0) {
+    E.cy = 0;
+    E.cx = 0;
+  }
+  editorSetStatusMessage("Line cut.");
+}
 
 /**
- * @brief Displays a prompt in the message bar and waits for user input.
- * @param prompt The prompt string to display.
- * @param callback An optional function to call on each keypress.
- * @return The string entered by the user (must be freed by the caller), or NULL if canceled.
+ * @brief Pastes the clipboard content at the cursor position.
  */
-char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
-  size_t bufsize = 128;
-  char *buf = malloc(bufsize);
-  size_t buflen = 0;
-  buf[0] = '\0';
-  while (1) {
-    editorSetStatusMessage(prompt, buf);
-    editorRefreshScreen();
-    int c = editorReadKey();
-    if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
-      if (buflen != 0) buf[--buflen] = '\0';
-    } else if (c == '\x1b') {
-      editorSetStatusMessage("");
-      if (callback) callback(buf, c);
-      free(buf);
-      return NULL;
-    } else if (c == '\r') {
-      if (buflen != 0) {
-        editorSetStatusMessage("");
-        if (callback) callback(buf, c);
-        return buf;
-      }
-    } else if (!iscntrl(c) && c < 128) {
-      if (buflen == bufsize - 1) {
-        bufsize *= 2;
-        buf = realloc(buf, bufsize);
-      }
-      buf[buflen++] = c;
-      buf[buflen] = '\0';
+void editorInsertRawNewline() {
+  editorInsertRow(E.cy + 1, "", 0); // Insert empty row below current
+  E.cy++; // Move cursor to new row
+  E.cx = 0; // Move cursor to beginning of new row
+}
+
+void editorPaste() {
+  if (!E.clipboard) return;
+
+  // If there's an active selection, delete it first
+  if (E.selection_active) {
+    editorDelCharSelection();
+  }
+
+  // Insert clipboard content
+  for (int i = 0; i < E.clipboard_len; i++) {
+    if (E.clipboard[i] == '\n') {
+      editorInsertRawNewline(); // Use raw newline insertion
+    } else {
+      editorInsertChar(E.clipboard[i]);
     }
-    if (callback) callback(buf, c);
   }
+  editorSetStatusMessage("Pasted.");
 }
 
+/* buffers */
+
 /**
- * @brief Moves the cursor based on the pressed key (arrows).
- * @param key The pressed key (e.g., ARROW_UP).
+ * @brief Copies the state of the active buffer from E back into its slot
+ *        in the buffer list.
  */
-void editorMoveCursor(int key) {
-  erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
-  switch (key) {
-    case ARROW_LEFT:
-      if (E.cx != 0) E.cx--;
-      else if (E.cy > 0) { E.cy--; E.cx = E.row[E.cy].size; }
-      break;
-    case ARROW_RIGHT:
-      if (row && E.cx < row->size) E.cx++;
-      else if (row && E.cx == row->size) { E.cy++; E.cx = 0; }
-      break;
-    case ARROW_UP:
-      if (E.cy != 0) E.cy--;
-      break;
-    case ARROW_DOWN:
-      if (E.cy < E.numrows) E.cy++;
-      break;
-  }
-  row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
-  int rowlen = row ? row->size : 0;
-  if (E.cx > rowlen) E.cx = rowlen;
+void editorBufferStash() {
+  struct editorBuffer *b = &E.buffers[E.curbuf];
+  b->cx = E.cx;
+  b->cy = E.cy;
+  b->rx = E.rx;
+  b->rowoff = E.rowoff;
+  b->coloff = E.coloff;
+  b->numrows = E.numrows;
+  b->row = E.row;
+  b->filename = E.filename;
+  b->dirty = E.dirty;
+  b->syntax = E.syntax;
+  b->hl_row = E.hl_row;
+  b->hl_start = E.hl_start;
+  b->hl_end = E.hl_end;
+  b->selection_start_cx = E.selection_start_cx;
+  b->selection_start_cy = E.selection_start_cy;
+  b->selection_end_cx = E.selection_end_cx;
+  b->selection_end_cy = E.selection_end_cy;
+  b->selection_active = E.selection_active;
+  b->mode = E.mode;
+  b->outline = E.outline;
+  b->json_check = E.json_check;
+  b->marks = E.marks;
+  b->autosave = E.autosave;
+  b->saved = E.saved;
 }
 
 /**
- * @brief Processes a single keypress from the user and calls the corresponding function.
+ * @brief Makes a buffer slot the active buffer by copying its state into E.
+ *        The previously active buffer must have been stashed already.
+ * @param at The index of the buffer in the buffer list.
  */
-void editorProcessKeypress() {
-  static int quit_times = WEE_QUIT_TIMES;
-  int c = editorReadKey();
+void editorBufferRestore(int at) {
+  struct editorBuffer *b = &E.buffers[at];
+  E.curbuf = at;
+  E.cx = b->cx;
+  E.cy = b->cy;
+  E.rx = b->rx;
+  E.rowoff = b->rowoff;
+  E.coloff = b->coloff;
+  E.numrows = b->numrows;
+  E.row = b->row;
+  E.filename = b->filename;
+  E.dirty = b->dirty;
+  E.syntax = b->syntax;
+  E.hl_row = b->hl_row;
+  E.hl_start = b->hl_start;
+  E.hl_end = b->hl_end;
+  E.selection_start_cx = b->selection_start_cx;
+  E.selection_start_cy = b->selection_start_cy;
+  E.selection_end_cx = b->selection_end_cx;
+  E.selection_end_cy = b->selection_end_cy;
+  E.selection_active = b->selection_active;
+  E.mode = b->mode;
+  E.outline = b->outline;
+  E.json_check = b->json_check;
+  E.marks = b->marks;
+  E.autosave = b->autosave;
+  E.saved = b->saved;
+}
 
-  if (E.mode == SELECTION_MODE) {
-    switch (c) {
-      case '\x1b': // ESC - Cancel selection
-        editorUpdateSelectionSyntax(); // Update syntax highlighting to remove selection
-        E.selection_active = 0;
-        E.mode = NORMAL_MODE;
-        editorSetStatusMessage("Selection cancelled.");
-        break;
-      case '\t':
-        editorIndentSelection();
-        break;
-      case BACKSPACE:
-        editorUnindentSelection();
-        break;
-      case DEL_KEY: // Delete selection
-        editorDelCharSelection();
-        E.mode = NORMAL_MODE;
-        editorSetStatusMessage("Selection deleted.");
-        editorRefreshScreen(); // Add this
-        break;
-      case ARROW_UP:
-      case ARROW_DOWN:
-      case ARROW_LEFT:
-      case ARROW_RIGHT:
-        editorMoveSelection(c);
-        break;
-      case CTRL_KEY('w'): // Copy selection
-        editorCopySelection(); // This already sets E.selection_active = 0
-        E.mode = NORMAL_MODE;
-        // editorSetStatusMessage("Selection copied."); // Redundant, editorCopySelection sets it
-        editorRefreshScreen(); // Add this
-        break;
-      case CTRL_KEY('k'): // Cut selection
-        editorSetStatusMessage("Mode: SELECTION_MODE. Cutting selection.");
-        editorCutSelection();
-        E.mode = NORMAL_MODE;
-        editorSetStatusMessage("Selection cut.");
-        editorRefreshScreen(); // Add this
-        break;
-      default:
-        if (!iscntrl(c) && c < 128) { // Check if it's a printable ASCII character
-          editorDelCharSelection(); // Delete the selected text (sets E.selection_active = 0)
-          editorInsertChar(c);      // Insert the new character
-          E.mode = NORMAL_MODE;     // Exit selection mode
-          editorSetStatusMessage(""); // Clear status message
-          editorRefreshScreen();    // Refresh screen
-        }
-        break;
+/**
+ * @brief Reads the file of the active buffer if it was added lazily
+ *        (e.g. from the command line) and has not been loaded yet.
+ */
+void editorBufferEnsureLoaded() {
+  struct editorBuffer *b = &E.buffers[E.curbuf];
+  if (b->loaded) return;
+  if (b->loading) {
+    // Partly read by the session loader: the rest is read right away
+    editorSessionLoadRead(LLONG_MAX);
+    return;
+  }
+  b->loaded = 1;
+  char *filename = E.filename;
+  E.filename = NULL;
+  editorOpen(filename);
+  memFree(MEM_EDITOR, filename);
+  if (E.buffers[E.curbuf].session_entry >= 0) editorSessionApply();
+}
+
+/**
+ * @brief Appends a new buffer to the buffer list without activating it.
+ * @param filename The file of the buffer, loaded on first activation,
+ *                 or NULL for an empty unnamed buffer.
+ * @return The index of the new buffer.
+ */
+int editorAddBuffer(const char *filename) {
+  E.buffers = memRealloc(MEM_EDITOR, E.buffers, sizeof(struct editorBuffer) * (E.numbuffers + 1));
+  struct editorBuffer *b = &E.buffers[E.numbuffers];
+  memset(b, 0, sizeof(*b));
+  b->filename = filename ? memStrdup(MEM_EDITOR, filename) : NULL;
+  b->hl_row = -1;
+  b->hl_start = -1;
+  b->hl_end = -1;
+  b->selection_start_cx = -1;
+  b->selection_start_cy = -1;
+  b->selection_end_cx = -1;
+  b->selection_end_cy = -1;
+  b->mode = NORMAL_MODE;
+  b->loaded = filename == NULL;
+  b->session_entry = -1;
+  return E.numbuffers++;
+}
+
+/**
+ * @brief Switches to another buffer. Only the buffer state is swapped,
+ *        so switching costs the same regardless of the buffer sizes.
+ * @param at The index of the buffer to activate.
+ */
+void editorSwitchBuffer(int at) {
+  if (at < 0 || at >= E.numbuffers) return;
+  editorBufferStash();
+  editorBufferRestore(at);
+  editorBufferEnsureLoaded();
+}
+
+/**
+ * @brief Opens a file in a buffer: switches to it if it is already open,
+ *        reuses the active buffer if it is empty, otherwise adds a new buffer.
+ * @param filename The path of the file to open.
+ */
+void editorOpenBuffer(char *filename) {
+  char *full = realpath(filename, NULL);
+  editorBufferStash();
+  for (int i = 0; full && i < E.numbuffers; i++) {
+    if (E.buffers[i].filename == NULL) continue;
+    char *other = realpath(E.buffers[i].filename, NULL);
+    int same = other && !strcmp(full, other);
+    free(other);
+    if (same) {
+      free(full);
+      editorSwitchBuffer(i);
+      editorSetStatusMessage("Switched to %s", E.filename);
+      return;
     }
-  } else { // NORMAL_MODE
-    switch (c) {
-      case '\r': editorInsertNewline(); break;
-      case '\t':
-        for (int i = 0; i < 4; i++) editorInsertChar(' ');
+  }
+  free(full);
+
+  if (E.filename != NULL || E.numrows > 0 || editorIsDirty())
+    editorSwitchBuffer(editorAddBuffer(NULL));
+  editorOpen(filename);
+}
+
+/**
+ * @brief Closes the active buffer (after asking to save) and activates
+ *        the next one. Closing the last buffer leaves an empty buffer.
+ */
+void editorCloseBuffer() {
+  if (!editorAskToSave()) {
+    editorSetStatusMessage("Close aborted.");
+    return;
+  }
+  editorRecentRemember();
+
+  for (int i = 0; i < E.numrows; i++) editorFreeRow(&E.row[i]);
+  memFree(MEM_ROWS, E.row);
+  memFree(MEM_EDITOR, E.filename);
+  editorOutlineFree(E.outline);
+  editorValidateForget(E.json_check);
+  editorMarksForget(E.marks);
+  editorAutosaveForget(E.autosave);
+  memFree(MEM_ROWS, E.saved.hash);
+  editorDiffEnd();
+
+  int closed = E.curbuf;
+  memmove(&E.buffers[closed], &E.buffers[closed + 1],
+          sizeof(struct editorBuffer) * (E.numbuffers - closed - 1));
+  E.numbuffers--;
+  if (E.numbuffers == 0) editorAddBuffer(NULL);
+  int at = closed < E.numbuffers ? closed : E.numbuffers - 1;
+
+  // Windows showing the closed buffer move to the one taking its place
+  for (int i = 0; i < E.numwindows; i++) {
+    struct editorWindow *w = &E.windows[i];
+    if (w->buf == closed) {
+      w->buf = at;
+      w->cx = E.buffers[at].cx;
+      w->cy = E.buffers[at].cy;
+      w->rowoff = E.buffers[at].rowoff;
+      w->coloff = E.buffers[at].coloff;
+    } else if (w->buf > closed) {
+      w->buf--;
+    }
+  }
+  editorBufferRestore(at);
+  editorBufferEnsureLoaded();
+  editorSetStatusMessage("Buffer closed.");
+}
+
+/**
+ * @brief Checks whether any buffer has unsaved changes.
+ * @return 1 if at least one buffer is modified, 0 otherwise.
+ */
+int editorAnyDirty() {
+  editorBufferStash();
+  for (int i = 0; i < E.numbuffers; i++) {
+    struct editorBuffer *b = &E.buffers[i];
+    if (b->loaded && editorRowsModified(b->row, b->numrows, &b->saved, b->dirty)) return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Records every loaded buffer in the recent-files list.
+ */
+void editorRecentRememberAll() {
+  int cur = E.curbuf;
+  editorBufferStash();
+  for (int i = E.numbuffers - 1; i >= 0; i--) {
+    if (!E.buffers[i].loaded) continue;
+    editorBufferRestore(i);
+    editorRecentRemember();
+  }
+  editorBufferRestore(cur);
+}
+
+/* windows */
+
+/**
+ * @brief Copies the view of the active window (buffer, cursor and scroll
+ *        offsets) from E back into its slot, and stashes its buffer.
+ */
+void editorWindowStash() {
+  struct editorWindow *w = &E.windows[E.curwin];
+  editorBufferStash();
+  w->buf = E.curbuf;
+  w->cx = E.cx;
+  w->cy = E.cy;
+  w->rx = E.rx;
+  w->rowoff = E.rowoff;
+  w->coloff = E.coloff;
+}
+
+/**
+ * @brief Loads a window into E: its buffer, its own view of the buffer and
+ *        its pane geometry. The active window must have been stashed already.
+ * @param at The index of the window.
+ */
+void editorWindowActivate(int at) {
+  struct editorWindow *w = &E.windows[at];
+  editorBufferRestore(w->buf);
+  E.curwin = at;
+  E.cx = w->cx;
+  E.cy = w->cy;
+  E.rx = w->rx;
+  E.rowoff = w->rowoff;
+  E.coloff = w->coloff;
+  E.pane_top = w->top;
+  E.pane_left = w->left;
+  E.screenrows = w->rows;
+  E.screencols = w->cols;
+  if (E.numwindows > 1 && E.screenrows > 1) E.screenrows--;
+
+  // Another window may have shortened the shared buffer
+  if (E.cy > E.numrows) E.cy = E.numrows;
+  int rowlen = E.cy < E.numrows ? E.row[E.cy].size : 0;
+  if (E.cx > rowlen) E.cx = rowlen;
+  if (E.rowoff > E.cy) E.rowoff = E.cy;
+}
+
+/**
+ * @brief Forces the next refresh to redraw every window and separator,
+ *        e.g. after a full-screen dialog cleared the terminal.
+ */
+void editorInvalidateScreen() {
+  for (int i = 0; i < E.numwindows; i++) E.windows[i].drawn_sig = 0;
+  E.layout_drawn = 0;
+}
+
+/**
+ * @brief Assigns screen regions to the windows of a layout subtree.
+ * @param node The layout node.
+ * @param top The first screen row of the region.
+ * @param left The first screen column of the region.
+ * @param rows The number of rows of the region.
+ * @param cols The number of columns of the region.
+ */
+void editorLayoutNode(int node, int top, int left, int rows, int cols) {
+  struct layoutNode *n = &E.layout[node];
+  n->top = top;
+  n->left = left;
+  n->rows = rows;
+  n->cols = cols;
+  if (n->type == LAYOUT_LEAF) {
+    struct editorWindow *w = &E.windows[n->win];
+    w->top = top;
+    w->left = left;
+    w->rows = rows;
+    w->cols = cols;
+  } else if (n->type == LAYOUT_HSPLIT) {
+    int first = rows / 2;
+    editorLayoutNode(n->child[0], top, left, first, cols);
+    editorLayoutNode(E.layout[node].child[1], top + first, left, rows - first, cols);
+  } else {
+    int first = (cols - 1) / 2;
+    n->sep = left + first;
+    editorLayoutNode(n->child[0], top, left, rows, first);
+    editorLayoutNode(E.layout[node].child[1], top, left + first + 1, rows, cols - first - 1);
+  }
+}
+
+/**
+ * @brief Recomputes the geometry of every window after the layout changed
+ *        and reloads the active window into E.
+ */
+void editorLayoutWindows() {
+  editorLayoutNode(E.layout_root, 0, 0, E.termrows, E.termcols);
+  editorInvalidateScreen();
+  editorWindowActivate(E.curwin);
+}
+
+/**
+ * @brief Allocates a layout node.
+ * @param type LAYOUT_LEAF, LAYOUT_HSPLIT or LAYOUT_VSPLIT.
+ * @param win The window of a leaf node.
+ * @param parent The parent node, or -1 for the root.
+ * @return The index of the node.
+ */
+int editorNewLayoutNode(int type, int win, int parent) {
+  int at;
+  for (at = 0; at < E.numlayout; at++)
+    if (E.layout[at].type == LAYOUT_FREE) break;
+  if (at == E.numlayout) {
+    E.layout = memRealloc(MEM_EDITOR, E.layout, sizeof(struct layoutNode) * (E.numlayout + 1));
+    E.numlayout++;
+  }
+  memset(&E.layout[at], 0, sizeof(struct layoutNode));
+  E.layout[at].type = type;
+  E.layout[at].win = win;
+  E.layout[at].parent = parent;
+  return at;
+}
+
+/**
+ * @brief Finds the layout leaf holding a window.
+ * @param win The index of the window.
+ * @return The index of the layout node.
+ */
+int editorWindowNode(int win) {
+  for (int i = 0; i < E.numlayout; i++)
+    if (E.layout[i].type == LAYOUT_LEAF && E.layout[i].win == win) return i;
+  return -1;
+}
+
+/**
+ * @brief Splits the active window in two. The new window shows the same
+ *        buffer at the same position and becomes the active window.
+ * @param type LAYOUT_HSPLIT (one above the other) or LAYOUT_VSPLIT (side by side).
+ */
+void editorSplitWindow(int type) {
+  editorWindowStash();
+  struct editorWindow *cur = &E.windows[E.curwin];
+  if ((type == LAYOUT_HSPLIT && cur->rows < 4) || (type == LAYOUT_VSPLIT && cur->cols < 9)) {
+    editorSetStatusMessage("Window too small to split.");
+    return;
+  }
+
+  E.windows = memRealloc(MEM_EDITOR, E.windows, sizeof(struct editorWindow) * (E.numwindows + 1));
+  E.windows[E.numwindows] = E.windows[E.curwin];
+  int win = E.numwindows++;
+
+  int leaf = editorWindowNode(E.curwin);
+  int parent = E.layout[leaf].parent;
+  int split = editorNewLayoutNode(type, -1, parent);
+  int a = editorNewLayoutNode(LAYOUT_LEAF, E.curwin, split);
+  int b = editorNewLayoutNode(LAYOUT_LEAF, win, split);
+  E.layout[split].child[0] = a;
+  E.layout[split].child[1] = b;
+  if (parent == -1) E.layout_root = split;
+  else if (E.layout[parent].child[0] == leaf) E.layout[parent].child[0] = split;
+  else E.layout[parent].child[1] = split;
+  E.layout[leaf].type = LAYOUT_FREE;
+
+  E.curwin = win;
+  editorLayoutWindows();
+}
+
+/**
+ * @brief Closes the active window; its sibling takes over the freed space.
+ */
+void editorCloseWindow() {
+  if (E.numwindows == 1) {
+    editorSetStatusMessage("Cannot close the last window.");
+    return;
+  }
+  editorDiffEnd();
+  editorWindowStash();
+  int win = E.curwin;
+  int leaf = editorWindowNode(win);
+  int parent = E.layout[leaf].parent;
+  int sibling = E.layout[parent].child[0] == leaf ? E.layout[parent].child[1] : E.layout[parent].child[0];
+  int grand = E.layout[parent].parent;
+
+  E.layout[sibling].parent = grand;
+  if (grand == -1) E.layout_root = sibling;
+  else if (E.layout[grand].child[0] == parent) E.layout[grand].child[0] = sibling;
+  else E.layout[grand].child[1] = sibling;
+  E.layout[leaf].type = LAYOUT_FREE;
+  E.layout[parent].type = LAYOUT_FREE;
+
+  memmove(&E.windows[win], &E.windows[win + 1], sizeof(struct editorWindow) * (E.numwindows - win - 1));
+  E.numwindows--;
+  for (int i = 0; i < E.numlayout; i++)
+    if (E.layout[i].type == LAYOUT_LEAF && E.layout[i].win > win) E.layout[i].win--;
+
+  E.curwin = win < E.numwindows ? win : E.numwindows - 1;
+  editorLayoutWindows();
+}
+
+/**
+ * @brief Makes the next window the active one.
+ */
+void editorNextWindow() {
+  if (E.numwindows == 1) return;
+  int line = editorDiffCursorLine();
+  editorWindowStash();
+  editorWindowActivate((E.curwin + 1) % E.numwindows);
+  editorBufferEnsureLoaded();
+  // Diff panes keep their cursors on the same display line
+  if (line >= 0) editorDiffFollow(line);
+}
+
+/**
+ * @brief Creates the initial single window covering the whole text area.
+ */
+void editorInitWindows() {
+  E.windows = memCalloc(MEM_EDITOR, 1, sizeof(struct editorWindow));
+  E.numwindows = 1;
+  E.curwin = 0;
+  E.layout = NULL;
+  E.numlayout = 0;
+  E.layout_root = editorNewLayoutNode(LAYOUT_LEAF, 0, -1);
+  editorLayoutWindows();
+}
+
+/**
+ * @brief Creates a new empty buffer and switches to it.
+ */
+void editorNewFile() {
+    editorSwitchBuffer(editorAddBuffer(NULL));
+    editorSetStatusMessage("New empty file. Ctrl-S to save.");
+}
+
+int is_separator(int c) {
+  return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+int editorSyntaxToColor(int hl) {
+  switch (hl) {
+    case HL_COMMENT:
+    case HL_MLCOMMENT: return 36;
+    case HL_KEYWORD1: return 33;
+    case HL_KEYWORD2: return 32;
+    case HL_STRING: return 35;
+    case HL_NUMBER: return 31;
+    case HL_MATCH: return 34;
+    case HL_SELECTION: return 7; /* Inverse video */
+    default: return 37;
+  }
+}
+
+void editorUpdateSyntax(erow *row) {
+  // A row and the rows its comment state cascades into form one batch,
+  // traced by the outermost call; consecutive batches merge into one span
+  static int depth = 0;
+  long long batch_start = E.trace_path && depth == 0 ? editorNow() : 0;
+  PERF_BEGIN(PERF_HIGHLIGHT);
+  PERF_COUNT(rows_highlighted, 1);
+  row->hl = memRealloc(MEM_HIGHLIGHT, row->hl, row->rsize);
+  memset(row->hl, HL_NORMAL, row->rsize);
+
+  if (E.syntax == NULL) {
+    PERF_END(PERF_HIGHLIGHT);
+    if (batch_start) traceSpan("editorUpdateSyntax", batch_start);
+    return;
+  }
+
+  char **keywords = E.syntax->keywords;
+
+  char *scs = E.syntax->singleline_comment_start;
+  char *mcs = E.syntax->multiline_comment_start;
+  char *mce = E.syntax->multiline_comment_end;
+
+  int scs_len = scs ? strlen(scs) : 0;
+  int mcs_len = mcs ? strlen(mcs) : 0;
+  int mce_len = mce ? strlen(mce) : 0;
+
+  int prev_sep = 1;
+  int in_string = 0;
+  int in_comment = (row->hl_open_comment);
+
+  int i = 0;
+  while (i < row->rsize) {
+    char c = row->render[i];
+    unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+
+    if (scs_len && !in_string && !in_comment) {
+      if (!strncmp(&row->render[i], scs, scs_len)) {
+        memset(&row->hl[i], HL_COMMENT, row->rsize - i);
         break;
-      case CTRL_KEY('q'):
-        if (E.dirty && quit_times > 0) {
-          editorSetStatusMessage("WARNING!!! File has unsaved changes. "
-                                 "Press Ctrl-Q %d more times to quit.",
-                                 quit_times);
-          quit_times--;
-          return;
+      }
+    }
+
+    if (mcs_len && mce_len && !in_string) {
+      if (in_comment) {
+        row->hl[i] = HL_MLCOMMENT;
+        if (!strncmp(&row->render[i], mce, mce_len)) {
+          memset(&row->hl[i], HL_MLCOMMENT, mce_len);
+          i += mce_len;
+          in_comment = 0;
+          prev_sep = 1;
+          continue;
+        } else {
+          i++;
+          continue;
         }
-        write(STDOUT_FILENO, "\x1b[2J", 4);
-        write(STDOUT_FILENO, "\x1b[H", 3);
-        exit(0);
-        break;
-      case CTRL_KEY('s'): editorSave(); break;
-      case CTRL_KEY('y'): editorSaveAs(); break;
-      case CTRL_KEY('w'):
-        editorCopyLine(); // Only copy line in normal mode
-        break;
-      case CTRL_KEY('k'):
-        if (E.selection_active) { // If a selection is active, cut the selection
-          editorSetStatusMessage("Mode: NORMAL_MODE. Selection active. Cutting selection.");
-          editorCutSelection();
-          E.mode = NORMAL_MODE; // Exit selection mode after cutting
-          editorSetStatusMessage("Selection cut.");
-        } else { // Otherwise, cut the current line
-          editorSetStatusMessage("Mode: NORMAL_MODE. No selection active. Cutting line.");
-          editorCutLine();
+      } else if (!strncmp(&row->render[i], mcs, mcs_len)) {
+        memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
+        i += mcs_len;
+        in_comment = 1;
+        continue;
+      }
+    }
+
+    if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
+      if (in_string) {
+        row->hl[i] = HL_STRING;
+        if (c == '\\' && i + 1 < row->rsize) {
+          row->hl[i + 1] = HL_STRING;
+          i += 2;
+          continue;
         }
-        break;
-      case CTRL_KEY('u'): editorPaste(); break;
-      case CTRL_KEY('n'): E.linenumbers = !E.linenumbers; break;
-      case CTRL_KEY('t'): editorNewFile(); break;
-      case CTRL_KEY('g'): editorShowHelp(); break;
-      case CTRL_KEY('f'): editorFind(); break;
-      case CTRL_KEY('j'): editorJumpToLine(); break;
-      case HOME_KEY:
-      case ALT_B:
-        E.cx = 0;
-        break;
-      case END_KEY:
-      case ALT_E:
-        if (E.cy < E.numrows)
-          E.cx = E.row[E.cy].size;
-        break;
-      case BACKSPACE:
-      case CTRL_KEY('h'):
-      case DEL_KEY:
-        if (c == DEL_KEY) editorMoveCursor(ARROW_RIGHT);
-        editorDelChar();
-        break;
-      case PAGE_UP:
-      case PAGE_DOWN:
-        {
-          if (c == PAGE_UP) E.cy = E.rowoff;
-          else if (c == PAGE_DOWN) {
-            E.cy = E.rowoff + E.screenrows - 1;
-            if (E.cy > E.numrows) E.cy = E.numrows;
-          }
-          int times = E.screenrows;
-          while (times--) editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-        } break;
-      case ARROW_UP:
-      case ARROW_DOWN:
-      case ARROW_LEFT:
-      case ARROW_RIGHT:
-        editorMoveCursor(c);
-        break;
-      case CTRL_KEY('o'): {
-        char *path = editorFileBrowser(".");
-        if (path) {
-          editorOpen(path);
-          free(path);
+        if (c == in_string) in_string = 0;
+        i++;
+        prev_sep = 1;
+        continue;
+      } else {
+        if (c == '"' || c == '\'') {
+          in_string = c;
+          row->hl[i] = HL_STRING;
+          i++;
+          continue;
         }
-        break;
       }
-      case CTRL_KEY('l'):
-      case '\x1b':
-        // This is now handled in SELECTION_MODE
-        break;
-      case CTRL_KEY('b'):
-        E.selection_start_cx = E.cx;
-        E.selection_start_cy = E.cy;
-        E.selection_end_cx = E.cx; // Initialize end to start
-        E.selection_end_cy = E.cy; // Initialize end to start
-        E.selection_active = 1;
-        editorSetStatusMessage("Selection start set");
-        break;
-      case CTRL_KEY('e'):
-        E.selection_end_cx = E.cx;
-        E.selection_end_cy = E.cy;
-        editorSetStatusMessage("Selection end set. Entering SELECTION_MODE.");
-        E.mode = SELECTION_MODE; // Enter selection mode
-        break;
-      case CTRL_KEY('a'): // Select all text
-        if (E.numrows > 0) {
-          E.selection_start_cx = 0;
-          E.selection_start_cy = 0;
-          E.selection_end_cx = E.row[E.numrows - 1].size;
-          E.selection_end_cy = E.numrows - 1;
-          E.selection_active = 1;
-          E.mode = SELECTION_MODE;
-          editorSetStatusMessage("All text selected.");
-        } else {
-          editorSetStatusMessage("No text to select.");
-        }
-        break;
-      default:
-        if (E.selection_active && !iscntrl(c) && c < 128) { // If a selection is active (Ctrl+B pressed, but not Ctrl+E) and a printable char is typed
-          editorSetStatusMessage("Selection cancelled (typed character). Deleting selection.");
-          editorDelCharSelection(); // Delete the selected text
-          editorInsertChar(c);      // Insert the new character
-          E.mode = NORMAL_MODE;     // Exit selection mode
-        } else if (E.selection_active) { // If a selection is active and a non-printable char is typed (e.g., arrow keys)
-            // Do nothing, allow cursor movement within selection mode
-        } else { // No selection active, insert character normally
-            editorInsertChar(c);
+    }
+
+    if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+      if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
+          (c == '.' && prev_hl == HL_NUMBER)) {
+        row->hl[i] = HL_NUMBER;
+        i++;
+        prev_sep = 0;
+        continue;
+      }
+    }
+
+    if (prev_sep) {
+      int j;
+      for (j = 0; keywords[j]; j++) {
+        int klen = strlen(keywords[j]);
+        int kw2 = keywords[j][klen - 1] == '|';
+        if (kw2) klen--;
+
+        if (!strncmp(&row->render[i], keywords[j], klen) &&
+            is_separator(row->render[i + klen])) {
+          memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+          i += klen;
+          break;
         }
-        break;
+      }
+      if (keywords[j] != NULL) {
+        prev_sep = 0;
+        continue;
+      }
+    }
+
+    prev_sep = is_separator(c);
+    i++;
+  }
+
+  int changed = (row->hl_open_comment != in_comment);
+  row->hl_open_comment = in_comment;
+  PERF_END(PERF_HIGHLIGHT);
+  if (changed && row->idx + 1 < E.numrows) {
+    depth++;
+    editorUpdateSyntax(&E.row[row->idx + 1]);
+    depth--;
+  }
+  if (batch_start) traceSpan("editorUpdateSyntax", batch_start);
+}
+
+/**
+ * @brief Updates syntax highlighting for rows that were part of a selection
+ *        to remove HL_SELECTION highlighting.
+ */
+void editorUpdateSelectionSyntax() {
+  if (E.numrows == 0) return; 
+  
+  int start_cy = E.selection_start_cy;
+  int end_cy = E.selection_end_cy;
+  
+  // Ensure start is before end for iteration
+  if (start_cy > end_cy) {
+    int temp_cy = start_cy;
+    start_cy = end_cy;
+    end_cy = temp_cy;
+  }
+  
+  // Clamp to valid range
+  if (start_cy < 0) start_cy = 0;
+  if (end_cy >= E.numrows) end_cy = E.numrows - 1;
+  
+  // Update syntax highlighting for all affected rows
+  for (int i = start_cy; i <= end_cy; i++) {
+    editorUpdateSyntax(&E.row[i]);
+  }
+}
+
+/**
+ * @brief Copies a string into a syntax string pool.
+ * @param pool The pool cursor, advanced past the copy.
+ * @param str The string to copy.
+ * @return The copy.
+ */
+char *editorSyntaxPoolCopy(char **pool, const char *str) {
+  size_t len = strlen(str) + 1;
+  char *copy = *pool;
+  memcpy(copy, str, len);
+  *pool += len;
+  return copy;
+}
+
+/**
+ * @brief Parses a syntax definition file into a new registry entry. The
+ *        parse tree lives in the caller's arena; the entry itself is one
+ *        allocation holding the filematch and keyword arrays followed by a
+ *        contiguous pool with all of its strings.
+ * @param a The arena for the parse tree.
+ * @param json The JSON text of the definition.
+ * @param len The length of the text.
+ * @return 1 if an entry was added, 0 if the definition is invalid.
+ */
+int editorAddSyntax(struct arena *a, const char *json, size_t len) {
+  cJSON *root = editorParseJson(a, json, len);
+  if (!root) return 0;
+
+  cJSON *filematch = cJSON_GetObjectItem(root, "filematch");
+  if (!cJSON_IsArray(filematch)) return 0;
+  cJSON *kw = cJSON_GetObjectItem(root, "keywords");
+  if (!cJSON_IsArray(kw)) kw = NULL;
+  cJSON *lang = cJSON_GetObjectItem(root, "language");
+  cJSON *scs = cJSON_GetObjectItem(root, "singleline_comment_start");
+  cJSON *mcs = cJSON_GetObjectItem(root, "multiline_comment_start");
+  cJSON *mce = cJSON_GetObjectItem(root, "multiline_comment_end");
+  cJSON *flags = cJSON_GetObjectItem(root, "flags");
+
+  // Size one block holding both pointer arrays followed by every string
+  int nfm = 0, nkw = 0;
+  size_t chars = 0;
+  cJSON *item;
+  cJSON_ArrayForEach(item, filematch)
+    if (cJSON_IsString(item)) { nfm++; chars += strlen(item->valuestring) + 1; }
+  if (kw) cJSON_ArrayForEach(item, kw)
+    if (cJSON_IsString(item) && item->valuestring[0]) { nkw++; chars += strlen(item->valuestring) + 1; }
+  cJSON *singles[] = { lang, scs, mcs, mce };
+  for (int i = 0; i < 4; i++)
+    if (cJSON_IsString(singles[i])) chars += strlen(singles[i]->valuestring) + 1;
+
+  char **ptrs = memAlloc(MEM_SYNTAX, sizeof(char *) * (nfm + 1 + nkw + 1) + chars);
+  if (!ptrs) return 0;
+  char *pool = (char *)(ptrs + nfm + 1 + nkw + 1);
+
+  E.syntaxes = memRealloc(MEM_SYNTAX, E.syntaxes, sizeof(struct editorSyntax) * (E.numsyntaxes + 1));
+  struct editorSyntax *syn = &E.syntaxes[E.numsyntaxes++];
+  syn->filematch = ptrs;
+  syn->keywords = ptrs + nfm + 1;
+
+  int i = 0;
+  cJSON_ArrayForEach(item, filematch)
+    if (cJSON_IsString(item)) syn->filematch[i++] = editorSyntaxPoolCopy(&pool, item->valuestring);
+  syn->filematch[i] = NULL;
+  i = 0;
+  if (kw) cJSON_ArrayForEach(item, kw)
+    if (cJSON_IsString(item) && item->valuestring[0]) syn->keywords[i++] = editorSyntaxPoolCopy(&pool, item->valuestring);
+  syn->keywords[i] = NULL;
+
+  syn->language = cJSON_IsString(lang) ? editorSyntaxPoolCopy(&pool, lang->valuestring) : NULL;
+  syn->singleline_comment_start = cJSON_IsString(scs) ? editorSyntaxPoolCopy(&pool, scs->valuestring) : NULL;
+  syn->multiline_comment_start = cJSON_IsString(mcs) ? editorSyntaxPoolCopy(&pool, mcs->valuestring) : NULL;
+  syn->multiline_comment_end = cJSON_IsString(mce) ? editorSyntaxPoolCopy(&pool, mce->valuestring) : NULL;
+  syn->flags = cJSON_IsNumber(flags) ? flags->valueint : 0;
+  return 1;
+}
+
+/**
+ * @brief Loads every definition in the syntax/ directory into the shared
+ *        registry. This happens once; all buffers point into the registry.
+ */
+void editorLoadSyntaxRegistry() {
+  if (E.syntaxes_loaded) return;
+  E.syntaxes_loaded = 1;
+
+  DIR *d = opendir("syntax");
+  if (!d) return;
+  struct arena a = ARENA_INIT(MEM_SYNTAX);
+
+  struct dirent *dir;
+  while ((dir = readdir(d)) != NULL) {
+    if (dir->d_name[0] == '.') continue;
+
+    char filepath[1024];
+    snprintf(filepath, sizeof(filepath), "syntax/%s", dir->d_name);
+
+    FILE *fp = fopen(filepath, "r");
+    if (!fp) continue;
+
+    fseek(fp, 0, SEEK_END);
+    long fsize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    // The file text and its parse tree share one arena, rewound per file
+    char *json = arenaAlloc(&a, fsize + 1);
+    if (json) {
+      fsize = fread(json, 1, fsize, fp);
+      json[fsize] = 0;
+      editorAddSyntax(&a, json, fsize);
+    }
+    fclose(fp);
+    arenaReset(&a);
+  }
+  closedir(d);
+  arenaRelease(&a);
+}
+
+/**
+ * @brief Picks the syntax definition of the current buffer from the shared
+ *        registry, based on the file name extension.
+ */
+void editorSelectSyntaxHighlight() {
+  E.syntax = NULL;
+  if (E.filename == NULL) return;
+
+  char *ext = strrchr(E.filename, '.');
+  if (!ext) return;
+
+  editorLoadSyntaxRegistry();
+  for (int i = 0; i < E.numsyntaxes; i++) {
+    for (int j = 0; E.syntaxes[i].filematch[j]; j++) {
+      if (!strcmp(ext, E.syntaxes[i].filematch[j])) {
+        E.syntax = &E.syntaxes[i];
+        return;
+      }
+    }
+  }
+}
+
+/* find */
+
+/**
+ * @brief Callback function for the search. It is called by editorPrompt.
+ *        Searches for the `query` text in the buffer and moves to the next/previous match.
+ * @param query The string to search for.
+ * @param key The key pressed by the user (to navigate between results).
+ */
+void editorFindCallback(char *query, int key) {
+  static int last_match = -1;
+  static int direction = 1;
+
+  // If a previous match was selected, redraw its syntax to remove the highlight
+  if (last_match != -1) {
+    editorUpdateSyntax(&E.row[last_match]);
+  }
+
+  if (key == '\r' || key == '\x1b') {
+    last_match = -1;
+    direction = 1;
+    E.selection_active = 0;
+    return;
+  } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+    direction = 1;
+  } else if (key == ARROW_LEFT || key == ARROW_UP) {
+    direction = -1;
+  }
+  else { // Any other key resets search
+    last_match = -1;
+    direction = 1;
+  }
+
+  if (last_match == -1) direction = 1;
+  TRACE_BEGIN("search");
+  int current = last_match;
+  if (current == -1) current = E.cy;
+
+  int found = 0;
+  for (int i = 0; i < E.numrows; i++) {
+    current += direction;
+    if (current == -1) current = E.numrows - 1;
+    else if (current == E.numrows) current = 0;
+
+    erow *row = &E.row[current];
+    char *match = strstr(row->render, query);
+    if (match) {
+      last_match = current;
+      E.cy = current;
+      E.cx = editorRowRenderToCx(row, match - row->render);
+      E.rowoff = E.numrows;
+
+      // Activate selection for the found match
+      E.selection_active = 1;
+      E.selection_start_cy = current;
+      E.selection_end_cy = current;
+      E.selection_start_cx = E.cx;
+      E.selection_end_cx = E.cx + strlen(query);
+      found = 1;
+      break;
+    }
+  }
+
+  // If no match was found from this action, deactivate selection
+  if (!found) {
+      E.selection_active = 0;
+      last_match = -1;
+  }
+  TRACE_END("search");
+}
+
+void editorFind() {
+  int saved_cx = E.cx, saved_cy = E.cy;
+  int saved_coloff = E.coloff, saved_rowoff = E.rowoff;
+
+  char *query = editorPromptDefault("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback, E.last_query);
+
+  if (query) {
+    memFree(MEM_EDITOR, E.last_query);
+    E.last_query = query;
+  }
+  else {
+    E.cx = saved_cx; E.cy = saved_cy;
+    E.coloff = saved_coloff; E.rowoff = saved_rowoff;
+  }
+  // Ensure selection is cleared and screen is refreshed when prompt is closed
+  E.selection_active = 0;
+  editorRefreshScreen();
+}
+
+/* append buffer */
+
+struct abuf {
+  char *b;
+  int len;
+  int cap;
+};
+
+#define ABUF_INIT {NULL, 0, 0}
+
+/**
+ * @brief Appends a string to a dynamic output buffer (append buffer).
+ * @param ab The buffer to append to.
+ * @param s The string to append.
+ * @param len The length of the string.
+ */
+void abAppend(struct abuf *ab, const char *s, int len) {
+  if (ab->len + len > ab->cap) {
+    int cap = ab->cap ? ab->cap * 2 : 1024;
+    while (cap < ab->len + len) cap *= 2;
+    char *new = memRealloc(MEM_OUTPUT, ab->b, cap);
+    if (new == NULL) return;
+    ab->b = new;
+    ab->cap = cap;
+  }
+  memcpy(&ab->b[ab->len], s, len);
+  ab->len += len;
+}
+
+/**
+ * @brief Frees the memory of an append buffer.
+ * @param ab The buffer to free.
+ */
+void abFree(struct abuf *ab) { memFree(MEM_OUTPUT, ab->b); }
+
+/* output */
+
+/**
+ * @brief Calculates the number of columns available for text,
+ *        considering the space occupied by line numbers if active.
+ * @return The number of columns for the text.
+ */
+int editorGetTextCols() {
+    int text_cols = E.screencols;
+    if (E.linenumbers) {
+        int max_linenum_digits = 1;
+        if (E.numrows > 0) {
+            int temp_num = E.numrows;
+            while (temp_num /= 10) max_linenum_digits++;
+        }
+        int linenum_width = max_linenum_digits + 1;
+        if (linenum_width < 4) linenum_width = 4;
+        text_cols -= linenum_width;
+    }
+    return text_cols;
+}
+
+/**
+ * @brief Manages vertical and horizontal scrolling
+ *        to keep the cursor visible on the screen.
+ */
+void editorScroll() {
+  E.rx = 0;
+  if (E.cy < E.numrows) E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+  int side = editorDiffSide();
+  if (side >= 0) {
+    // Diff panes scroll together (editorDiffScroll); rowoff follows the
+    // first row shown so paging still starts from the top of the pane
+    struct diffView *dv = &E.diff;
+    int d = dv->top;
+    while (d < dv->numlines && dv->line[side][d] < 0) d++;
+    E.rowoff = d < dv->numlines ? dv->line[side][d] : E.numrows;
+    if (E.rowoff > E.numrows) E.rowoff = E.numrows;
+  } else {
+    if (E.cy < E.rowoff) E.rowoff = E.cy;
+    if (E.cy >= E.rowoff + E.screenrows) E.rowoff = E.cy - E.screenrows + 1;
+  }
+  int text_cols = editorGetTextCols();
+  if (E.rx < E.coloff) E.coloff = E.rx;
+  if (E.rx >= E.coloff + text_cols) E.coloff = E.rx - text_cols + 1;
+}
+
+/**
+ * @brief Ends a line drawn inside the current pane. Panes that reach the right
+ *        border of the terminal are cleared with an escape sequence, the others
+ *        are padded with spaces so the pane on their right is left untouched.
+ * @param ab The append buffer to add the text to be drawn to.
+ * @param drawn The number of columns already drawn on the line.
+ */
+void editorDrawEol(struct abuf *ab, int drawn) {
+  if (E.pane_left + E.screencols >= E.termcols) {
+    abAppend(ab, "\x1b[K", 3);
+    return;
+  }
+  while (drawn++ < E.screencols) abAppend(ab, " ", 1);
+}
+
+/**
+ * @brief Draws the visible text rows of the current pane.
+ * @param ab The append buffer to add the text to be drawn to.
+ */
+void editorDrawRows(struct abuf *ab) {
+  int linenum_width = 0;
+  if (E.linenumbers) {
+    int max_linenum_digits = 1;
+    if (E.numrows > 0) {
+            int temp_num = E.numrows;
+            while (temp_num /= 10) max_linenum_digits++;
+        }
+        linenum_width = max_linenum_digits + 1;
+        if (linenum_width < 4) linenum_width = 4;
+  }
+
+  int side = editorDiffSide();
+  for (int y = 0; y < E.screenrows; y++) {
+    int filerow = editorPaneRow(y);
+    int drawn = 0, bg = 0;
+    char pos[32];
+    int poslen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", E.pane_top + y + 1, E.pane_left + 1);
+    abAppend(ab, pos, poslen);
+    if (filerow == -1) {
+      // Filler where only the other side of a diff has rows
+      for (; drawn < linenum_width; drawn++) abAppend(ab, " ", 1);
+      abAppend(ab, "\x1b[36m", 5);
+      for (; drawn < E.screencols; drawn++) abAppend(ab, "-", 1);
+      abAppend(ab, "\x1b[39m", 5);
+    } else if (filerow >= E.numrows) {
+      if (E.numrows == 0 && y == E.screenrows / 3) {
+        char welcome[80];
+        int welcomelen = snprintf(welcome, sizeof(welcome), "Wee editor -- version %s", WEE_VERSION);
+        int text_cols = editorGetTextCols();
+        if (welcomelen > text_cols) welcomelen = text_cols;
+        int padding = (text_cols - welcomelen) / 2;
+        drawn = padding + welcomelen;
+        if (padding) {
+          abAppend(ab, "~", 1);
+          padding--;
+        }
+        while (padding--) abAppend(ab, " ", 1);
+        abAppend(ab, welcome, welcomelen);
+      } else if (E.numrows == 0 && y == E.screenrows / 3 + 1) {
+        char author[80];
+        int authorlen = snprintf(author, sizeof(author), "by anidisc");
+        int text_cols = editorGetTextCols();
+        if (authorlen > text_cols) authorlen = text_cols;
+        int padding = (text_cols - authorlen) / 2;
+        drawn = padding + authorlen;
+        if (padding) {
+          abAppend(ab, "~", 1);
+          padding--;
+        }
+        while (padding--) abAppend(ab, " ", 1);
+        abAppend(ab, author, authorlen);
+      } else if (E.numrows == 0 && y == E.screenrows / 3 + 2) {
+        char site[80];
+        int sitelen = snprintf(site, sizeof(site), "wee.anidisc.it");
+        int text_cols = editorGetTextCols();
+        if (sitelen > text_cols) sitelen = text_cols;
+        int padding = (text_cols - sitelen) / 2;
+        drawn = padding + sitelen;
+        if (padding) {
+          abAppend(ab, "~", 1);
+          padding--;
+        }
+        while (padding--) abAppend(ab, " ", 1);
+        abAppend(ab, site, sitelen);
+      } else {
+        abAppend(ab, "~", 1);
+        drawn = 1;
+      }
+    } else {
+      if (E.linenumbers) {
+        char linenum_buf[16];
+        int len = snprintf(linenum_buf, sizeof(linenum_buf), "%*d", linenum_width - 1, filerow + 1); 
+        // The row of a JSON syntax error gets a red gutter
+        if (E.json_check && E.json_check->state == JSON_INVALID && E.json_check->row == filerow)
+          abAppend(ab, "\x1b[37;41m", 8);
+        else
+          abAppend(ab, "\x1b[36m", 5);
+        abAppend(ab, linenum_buf, len);
+        abAppend(ab, "\x1b[m", 3);
+        // Rows changed since the last save are marked next to their number
+        static const char *markers[] = { " ", "\x1b[32m+\x1b[m", "\x1b[33m~\x1b[m", "\x1b[31m-\x1b[m" };
+        const char *marker = markers[editorRowMark(filerow)];
+        abAppend(ab, marker, strlen(marker));
+      }
+      erow *row = &E.row[filerow];
+      // Rows of a diff hunk get its background, and the span differing
+      // from the paired row a brighter one
+      int diff_start = 0, diff_end = 0, current_bg = 0;
+      if (side >= 0) bg = editorDiffBackground(side, y, row, &diff_start, &diff_end);
+      int rstart, len, pad;
+      drawn = linenum_width +
+              editorRowRenderSpan(row, E.coloff, E.screencols - linenum_width, &rstart, &len, &pad);
+      if (bg) {
+        char buf[16];
+        int blen = snprintf(buf, sizeof(buf), "\x1b[%dm", bg);
+        abAppend(ab, buf, blen);
+        current_bg = bg;
+      }
+      while (pad-- > 0) abAppend(ab, " ", 1);
+      char *c = &row->render[rstart];
+      unsigned char *hl = &row->hl[rstart];
+      int current_color = -1;
+
+      // Local variables for selection coordinates
+      int local_sel_start_cx = E.selection_start_cx;
+      int local_sel_start_cy = E.selection_start_cy;
+      int local_sel_end_cx = E.selection_end_cx;
+      int local_sel_end_cy = E.selection_end_cy;
+
+      if (E.selection_active) {
+          // Ensure start is before end for drawing purposes
+          // Ensure start is before end for drawing purposes (already done in editorDelCharSelection and editorCopySelection, but good to be safe)
+          if (local_sel_start_cy > local_sel_end_cy || (local_sel_start_cy == local_sel_end_cy && local_sel_start_cx > local_sel_end_cx)) {
+              int temp_cy = local_sel_start_cy;
+              int temp_cx = local_sel_start_cx;
+              local_sel_start_cy = local_sel_end_cy;
+              local_sel_start_cx = local_sel_end_cx;
+              local_sel_end_cy = temp_cy;
+              local_sel_end_cx = temp_cx;
+          }
+
+          int sel_start_rx = 0;
+          int sel_end_rx = 0;
+
+          if (filerow < local_sel_start_cy || filerow > local_sel_end_cy) {
+              // Current row is outside the selection range, no highlighting
+              sel_start_rx = -1; // Indicate no selection for this row
+              sel_end_rx = -1;
+          } else {
+              // Current row is within the selection range
+              if (filerow == local_sel_start_cy) {
+                  sel_start_rx = editorRowCxToRender(row, local_sel_start_cx);
+              }
+              else {
+                  sel_start_rx = 0; // Start from the beginning of the row
+              }
+
+              if (filerow == local_sel_end_cy) {
+                  sel_end_rx = editorRowCxToRender(row, local_sel_end_cx);
+              }
+              else {
+                  sel_end_rx = E.row[filerow].rsize; // Go to the end of the row
+              }
+          }
+
+          for (int j = 0; j < len; j++) {
+            int current_render_idx = rstart + j; // This is the render index of the character being drawn
+            // Apply selection highlighting
+            if (sel_start_rx != -1) { // Only highlight if this row is part of the selection
+                // Special case for single character selection
+                if (local_sel_start_cy == local_sel_end_cy && local_sel_start_cx == local_sel_end_cx) {
+                    if (current_render_idx == sel_start_rx) {
+                        hl[j] = HL_SELECTION;
+                    }
+                } else {
+                    if (current_render_idx >= sel_start_rx && current_render_idx < sel_end_rx) {
+                        hl[j] = HL_SELECTION;
+                    }
+                }
+            }
+          }
+      }
+
+      for (int j = 0; j < len; j++) {
+        if (bg) {
+          int want = rstart + j >= diff_start && rstart + j < diff_end ? 41 : bg;
+          if (want != current_bg) {
+            char buf[16];
+            int blen = snprintf(buf, sizeof(buf), "\x1b[%dm", want);
+            abAppend(ab, buf, blen);
+            current_bg = want;
+          }
+        }
+        if (filerow == E.hl_row) {
+            int start = E.hl_start > rstart ? E.hl_start - rstart : 0;
+            int end = E.hl_end > rstart ? E.hl_end - rstart : 0;
+            if (end > len) end = len;
+            if (j >= start && j < end) {
+                hl[j] = HL_MATCH;
+            }
+        }
+
+        int color = editorSyntaxToColor(hl[j]);
+        // Only consider HL_SELECTION if selection is active
+        int is_selection = (E.selection_active && hl[j] == HL_SELECTION);
+
+        if (is_selection) {
+            if (current_color != 7) { // If not already in inverse video
+                abAppend(ab, "\x1b[7m", 4); // Set inverse video
+                current_color = 7;
+            }
+        } else {
+            if (current_color == 7) { // If was in inverse video, reset it
+                abAppend(ab, "\x1b[27m", 5); // Reset inverse video
+                current_color = -1; // Reset current_color to force re-evaluation of normal color
+            }
+            if (color != current_color) {
+                current_color = color;
+                char buf[16];
+                int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+                abAppend(ab, buf, clen);
+            }
+        }
+
+        if ((unsigned char)c[j] >= 0x80) { // UTF-8 sequences are drawn whole
+          int cp;
+          int n = editorUtf8Decode(&c[j], len - j, &cp);
+          if (cp < 0xA0) abAppend(ab, "?", 1); // Invalid bytes and C1 controls
+          else abAppend(ab, &c[j], n);
+          j += n - 1;
+        } else if (iscntrl(c[j])) { // Control characters
+          char sym = (c[j] <= 26) ? '@' + c[j] : '?';
+          abAppend(ab, &sym, 1);
+        } else { // Normal characters
+          abAppend(ab, &c[j], 1);
+        }
+      }
+      // Ensure inverse video is reset at the end of the line
+      if (current_color == 7) {
+          abAppend(ab, "\x1b[27m", 5);
+      }
+      abAppend(ab, "\x1b[39m", 5); // Reset foreground color
+      if (current_bg != bg) {
+        char buf[16];
+        int blen = snprintf(buf, sizeof(buf), "\x1b[%dm", bg);
+        abAppend(ab, buf, blen);
+      }
+    }
+    editorDrawEol(ab, drawn);
+    if (bg) abAppend(ab, "\x1b[49m", 5);
+  }
+}
+
+/**
+ * @brief Draws the status bar at the bottom of the screen.
+ * @param ab The append buffer to add the text to be drawn to.
+ */
+void editorDrawStatusBar(struct abuf *ab) {
+  abAppend(ab, "\x1b[7m", 4);
+  
+  char *basename = E.filename ? strrchr(E.filename, '/') : NULL;
+  if (basename) {
+    basename++;
+  } else {
+    basename = E.filename;
+  }
+
+  char status[256];
+  int len = 0;
+
+  // File name part
+  abAppend(ab, "\x1b[37;44m", 8);
+  abAppend(ab, "[", 1);
+  abAppend(ab, basename ? basename : "No Name", strlen(basename ? basename : "No Name"));
+  abAppend(ab, "]", 1);
+  abAppend(ab, "\x1b[m", 3);
+  abAppend(ab, "\x1b[7m", 4);
+
+  len = 2 + strlen(basename ? basename : "No Name");
+
+  char rstatus[160];
+  int rlen;
+#ifdef WEE_PROFILE
+  if (E.perf_hud) {
+    // The HUD takes the place of the line count and the right-hand info.
+    // Highlighting and allocations counted so far in this frame are those of
+    // the key just handled; drawing and writing are timed only once the
+    // frame is out, so those are shown for the previous frame.
+    struct perfFrame *key = &E.perf_cur, *pf = &E.perf_last;
+    long long allocs = memTotalAllocs() - E.perf_allocs_mark;
+    rlen = snprintf(rstatus, sizeof(rstatus),
+                    "key hl %.2fms %lldhl %lldalloc | prev scr %.2f drw %.2f wr %.2f ms %lldB | rss %.1fM",
+                    key->phase_ns[PERF_HIGHLIGHT] / 1e6, key->rows_highlighted, allocs,
+                    pf->phase_ns[PERF_SCROLL] / 1e6, pf->phase_ns[PERF_DRAW] / 1e6,
+                    pf->phase_ns[PERF_WRITE] / 1e6, pf->bytes, perfRss() / 1048576.0);
+    if (rlen > E.termcols - len) rlen = E.termcols - len > 0 ? E.termcols - len : 0;
+    abAppend(ab, " ", 1);
+    len++;
+    if (rlen > E.termcols - len) rlen = E.termcols - len;
+    while (len < E.termcols - rlen) {
+      abAppend(ab, " ", 1);
+      len++;
+    }
+    abAppend(ab, rstatus, rlen);
+    abAppend(ab, "\x1b[m", 3);
+    abAppend(ab, "\r\n", 2);
+    return;
+  }
+#endif
+
+  // Other info
+  int len2 = snprintf(status, sizeof(status), " - %d lines %s", E.numrows, editorIsDirty() ? "(modified)" : "");
+  abAppend(ab, status, len2);
+  len += len2;
+
+  char json[80] = "";
+  int jlen = 0;
+  if (E.tasks)
+    jlen = snprintf(json, sizeof(json), "%s %d%% | ", E.tasks->name, editorTaskPercent(E.tasks));
+  if (E.json_check && E.json_check->state == JSON_VALID)
+    snprintf(json + jlen, sizeof(json) - jlen, "json ok | ");
+  else if (E.json_check && E.json_check->state == JSON_INVALID)
+    snprintf(json + jlen, sizeof(json) - jlen, "json error %d:%d | ",
+             E.json_check->row + 1, E.json_check->col + 1);
+
+  if (E.numbuffers > 1)
+    rlen = snprintf(rstatus, sizeof(rstatus), "buf %d/%d | %s%s | %d/%d", E.curbuf + 1, E.numbuffers,
+                    json, E.syntax ? E.syntax->language : "no ft", E.cy + 1, E.numrows);
+  else
+    rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | %d/%d", json,
+                    E.syntax ? E.syntax->language : "no ft", E.cy + 1, E.numrows);
+  
+  while (len < E.termcols) {
+    if (E.termcols - len == rlen) {
+      abAppend(ab, rstatus, rlen);
+      break;
+    } else {
+      abAppend(ab, " ", 1);
+      len++;
+    }
+  }
+  abAppend(ab, "\x1b[m", 3);
+  abAppend(ab, "\r\n", 2);
+}
+
+/**
+ * @brief Draws the message bar, below the status bar.
+ * @param ab The append buffer to add the text to be drawn to.
+ */
+void editorDrawMessageBar(struct abuf *ab) {
+  abAppend(ab, "\x1b[K", 3);
+  int msglen = strlen(E.statusmsg);
+  if (msglen > E.termcols) msglen = E.termcols;
+  if (msglen && time(NULL) - E.statusmsg_time < 5)
+    abAppend(ab, E.statusmsg, msglen);
+}
+
+/**
+ * @brief Draws the one-line title of the current pane (only used when the
+ *        screen is split), below the pane rows.
+ * @param ab The append buffer to add the text to be drawn to.
+ * @param active Whether the pane is the active window.
+ */
+void editorDrawWindowStatus(struct abuf *ab, int active) {
+  char pos[32];
+  int poslen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", E.pane_top + E.screenrows + 1, E.pane_left + 1);
+  abAppend(ab, pos, poslen);
+  abAppend(ab, active ? "\x1b[37;44m" : "\x1b[7m", active ? 8 : 4);
+
+  char title[256];
+  int len = snprintf(title, sizeof(title), " %s%s  %d/%d",
+                     E.filename ? E.filename : "[No Name]", editorIsDirty() ? " +" : "",
+                     E.cy + 1, E.numrows);
+  if (len > E.screencols) len = E.screencols;
+  abAppend(ab, title, len);
+  while (len++ < E.screencols) abAppend(ab, " ", 1);
+  abAppend(ab, "\x1b[m", 3);
+}
+
+/**
+ * @brief Computes a signature of everything the current pane would draw:
+ *        geometry, view, selection and the visible render/highlight bytes.
+ *        Panes whose signature did not change since the last frame are not
+ *        redrawn.
+ * @param active Whether the pane is the active window.
+ * @return The signature.
+ */
+unsigned long long editorPaneSignature(int active) {
+  unsigned long long h = 1469598103934665603ULL;
+  int view[] = { E.pane_top, E.pane_left, E.screenrows, E.screencols, active,
+                 E.curbuf, E.rowoff, E.coloff, E.numrows, E.linenumbers, E.dirty,
+                 E.selection_active, E.selection_start_cx, E.selection_start_cy,
+                 E.selection_end_cx, E.selection_end_cy, E.hl_row, E.hl_start,
+                 E.hl_end, E.numwindows > 1 ? E.cy : 0,
+                 E.json_check && E.json_check->state == JSON_INVALID ? E.json_check->row : -1,
+                 editorDiffSide() >= 0 ? E.diff.top : -1 };
+  const unsigned char *p = (const unsigned char *)view;
+  for (size_t i = 0; i < sizeof(view); i++) h = (h ^ p[i]) * 1099511628211ULL;
+  for (const char *f = E.filename; f && *f; f++) h = (h ^ (unsigned char)*f) * 1099511628211ULL;
+
+  int side = editorDiffSide();
+  for (int y = 0; y < E.screenrows; y++) {
+    int filerow = editorPaneRow(y);
+    if (side < 0 && filerow >= E.numrows) break;
+    h = (h ^ (unsigned)filerow) * 1099511628211ULL;
+    if (side >= 0) h = (h ^ editorDiffLineHash(side, y)) * 1099511628211ULL;
+    if (filerow < 0 || filerow >= E.numrows) continue;
+    erow *row = &E.row[filerow];
+    int start, len, pad;
+    editorRowRenderSpan(row, E.coloff, E.screencols, &start, &len, &pad);
+    h = (h ^ pad) * 1099511628211ULL;
+    if (E.linenumbers) h = (h ^ editorRowMark(filerow)) * 1099511628211ULL;
+    for (int j = 0; j < len; j++) {
+      h = (h ^ (unsigned char)row->render[start + j]) * 1099511628211ULL;
+      h = (h ^ row->hl[start + j]) * 1099511628211ULL;
+    }
+    h = (h ^ 0xff) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/**
+ * @brief Draws the separators between side by side windows.
+ * @param ab The append buffer to add the text to be drawn to.
+ * @param node The layout node to draw.
+ */
+void editorDrawSeparators(struct abuf *ab, int node) {
+  struct layoutNode *n = &E.layout[node];
+  if (n->type == LAYOUT_LEAF) return;
+  if (n->type == LAYOUT_VSPLIT) {
+    for (int y = 0; y < n->rows; y++) {
+      char pos[32];
+      int poslen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH|", n->top + y + 1, n->sep + 1);
+      abAppend(ab, pos, poslen);
+    }
+  }
+  editorDrawSeparators(ab, n->child[0]);
+  editorDrawSeparators(ab, n->child[1]);
+}
+
+/**
+ * @brief Refreshes the screen. All windows are composed into a single frame
+ *        and written at once; windows whose content did not change are skipped.
+ */
+void editorRefreshScreen() {
+  long long frame_start = editorNow();
+  editorWindowStash();
+  editorDiffScroll();
+  int active = E.curwin;
+
+  // The frame buffer is kept across frames so redraws do not allocate
+  static struct abuf ab = ABUF_INIT;
+  ab.len = 0;
+  abAppend(&ab, "\x1b[?25l", 6);
+  if (!E.layout_drawn) {
+    editorDrawSeparators(&ab, E.layout_root);
+    E.layout_drawn = 1;
+  }
+  for (int i = 0; i < E.numwindows; i++) {
+    editorWindowActivate(i);
+    PERF_BEGIN(PERF_SCROLL);
+    editorScroll();
+    PERF_END(PERF_SCROLL);
+    E.windows[i].rx = E.rx;
+    E.windows[i].rowoff = E.rowoff;
+    E.windows[i].coloff = E.coloff;
+    unsigned long long sig = editorPaneSignature(i == active);
+    if (sig == E.windows[i].drawn_sig) {
+      __atomic_fetch_add(&E.stats.pane_hits, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+    __atomic_fetch_add(&E.stats.pane_misses, 1, __ATOMIC_RELAXED);
+    E.windows[i].drawn_sig = sig;
+    PERF_BEGIN(PERF_DRAW);
+    TRACE_BEGIN("editorDrawRows");
+    editorDrawRows(&ab);
+    TRACE_END("editorDrawRows");
+    PERF_END(PERF_DRAW);
+    if (E.numwindows > 1) editorDrawWindowStatus(&ab, i == active);
+  }
+  editorWindowActivate(active);
+
+  char buf[32];
+  snprintf(buf, sizeof(buf), "\x1b[%d;1H", E.termrows + 1);
+  abAppend(&ab, buf, strlen(buf));
+  editorDrawStatusBar(&ab);
+  editorDrawMessageBar(&ab);
+  int linenum_width = 0;
+  if (E.linenumbers) {
+      int max_linenum_digits = 1;
+      if (E.numrows > 0) {
+          int temp_num = E.numrows;
+          while (temp_num /= 10) max_linenum_digits++;
+      }
+      linenum_width = max_linenum_digits + 1;
+      if (linenum_width < 4) linenum_width = 4;
+  }
+  snprintf(buf, sizeof(buf), "\x1b[%d;%dH", E.pane_top + editorPaneCursorRow() + 1,
+           E.pane_left + (E.rx - E.coloff) + 1 + linenum_width);
+  abAppend(&ab, buf, strlen(buf));
+  abAppend(&ab, "\x1b[?25h", 6);
+  PERF_BEGIN(PERF_WRITE);
+  TRACE_BEGIN("write");
+  write(E.ofd, ab.b, ab.len);
+  TRACE_END("write");
+  PERF_END(PERF_WRITE);
+  PERF_COUNT(bytes, ab.len);
+  if (E.script) editorScriptFrame(ab.len);
+  editorStatsFrame(frame_start);
+#ifdef WEE_PROFILE
+  perfEndFrame();
+#endif
+}
+
+/**
+ * @brief Sets a message to be displayed in the message bar.
+ * @param fmt The format string (like in printf).
+ * @param ... Variable arguments for the format string.
+ */
+void editorSetStatusMessage(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
+  va_end(ap);
+  E.statusmsg_time = time(NULL);
+}
+
+/* input */
+
+/**
+ * @brief Tells whether a key is text to insert: a printable ASCII character
+ *        or a byte of a UTF-8 sequence.
+ * @param c The key.
+ * @return 1 for text.
+ */
+int editorIsTextKey(int c) {
+  return (c >= 32 && c < 127) || (c >= 128 && c < 256);
+}
+
+/**
+ * @brief Displays a prompt in the message bar and waits for user input.
+ * @param prompt The prompt string to display.
+ * @param callback An optional function to call on each keypress.
+ * @return The string entered by the user (to be freed with memFree(MEM_EDITOR)), or NULL if canceled.
+ */
+char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
+  return editorPromptDefault(prompt, callback, NULL);
+}
+
+/**
+ * @brief Like editorPrompt, but the input starts with the given text.
+ *        The callback is run once on the initial text.
+ * @param prompt The prompt string to display.
+ * @param callback An optional function to call on each keypress.
+ * @param initial The initial input, or NULL.
+ * @return The string entered by the user (to be freed with memFree(MEM_EDITOR)), or NULL if canceled.
+ */
+char *editorPromptDefault(char *prompt, void (*callback)(char *, int), const char *initial) {
+  size_t buflen = initial ? strlen(initial) : 0;
+  size_t bufsize = buflen < 128 ? 128 : buflen + 1;
+  char *buf = memAlloc(MEM_EDITOR, bufsize);
+  if (buflen) memcpy(buf, initial, buflen);
+  buf[buflen] = '\0';
+  if (buflen && callback) callback(buf, 0);
+  while (1) {
+    editorSetStatusMessage(prompt, buf);
+    editorRefreshScreen();
+    int c = editorReadKey();
+    if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+      // A UTF-8 character goes as a whole
+      while (buflen != 0 && ((unsigned char)buf[--buflen] & 0xC0) == 0x80) buf[buflen] = '\0';
+      buf[buflen] = '\0';
+    } else if (c == '\x1b') {
+      editorSetStatusMessage("");
+      if (callback) callback(buf, c);
+      memFree(MEM_EDITOR, buf);
+      return NULL;
+    } else if (c == '\r') {
+      if (buflen != 0) {
+        editorSetStatusMessage("");
+        if (callback) callback(buf, c);
+        return buf;
+      }
+    } else if (editorIsTextKey(c)) {
+      if (buflen == bufsize - 1) {
+        bufsize *= 2;
+        buf = memRealloc(MEM_EDITOR, buf, bufsize);
+      }
+      buf[buflen++] = c;
+      buf[buflen] = '\0';
+    }
+    if (callback) callback(buf, c);
+  }
+}
+
+/**
+ * @brief Moves the cursor based on the pressed key (arrows). Up and down
+ *        keep the display column; only rows with tabs or multi-byte
+ *        characters need converting, elsewhere it equals the byte index.
+ * @param key The pressed key (e.g., ARROW_UP).
+ */
+void editorMoveCursor(int key) {
+  erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+  erow *from = (key == ARROW_UP || key == ARROW_DOWN) ? row : NULL;
+  switch (key) {
+    case ARROW_LEFT:
+      if (E.cx != 0) E.cx = editorRowPrevCx(row, E.cx);
+      else if (E.cy > 0) { E.cy--; E.cx = E.row[E.cy].size; }
+      break;
+    case ARROW_RIGHT:
+      if (row && E.cx < row->size) E.cx = editorRowNextCx(row, E.cx);
+      else if (row && E.cx == row->size) { E.cy++; E.cx = 0; }
+      break;
+    case ARROW_UP:
+      if (E.cy != 0) E.cy--;
+      break;
+    case ARROW_DOWN:
+      if (E.cy < E.numrows) E.cy++;
+      break;
+  }
+  row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+  if (from && row && row != from && (!from->plain || !row->plain))
+    E.cx = editorRowRxToCx(row, editorRowCxToRx(from, E.cx));
+  int rowlen = row ? row->size : 0;
+  if (E.cx > rowlen) E.cx = rowlen;
+}
+
+/**
+ * @brief Processes a single keypress from the user and calls the corresponding function.
+ */
+void editorProcessKeypress() {
+  static int quit_times = WEE_QUIT_TIMES;
+  E.key_wait = 1;
+  int c = editorReadKey();
+  E.key_wait = 0;
+  if (E.detaching) return;
+
+  // Esc cancels a running task before anything else
+  if (c == '\x1b' && editorTaskCancel()) return;
+
+  if (E.mode == SELECTION_MODE) {
+    switch (c) {
+      case '\x1b': // ESC - Cancel selection
+        editorUpdateSelectionSyntax(); // Update syntax highlighting to remove selection
+        E.selection_active = 0;
+        E.mode = NORMAL_MODE;
+        editorSetStatusMessage("Selection cancelled.");
+        break;
+      case '\t':
+        editorIndentSelection();
+        break;
+      case BACKSPACE:
+        editorUnindentSelection();
+        break;
+      case DEL_KEY: // Delete selection
+        editorDelCharSelection();
+        E.mode = NORMAL_MODE;
+        editorSetStatusMessage("Selection deleted.");
+        editorRefreshScreen(); // Add this
+        break;
+      case ARROW_UP:
+      case ARROW_DOWN:
+      case ARROW_LEFT:
+      case ARROW_RIGHT:
+        editorMoveSelection(c);
+        break;
+      case CTRL_KEY('w'): // Copy selection
+        editorCopySelection(); // This already sets E.selection_active = 0
+        E.mode = NORMAL_MODE;
+        // editorSetStatusMessage("Selection copied."); // Redundant, editorCopySelection sets it
+        editorRefreshScreen(); // Add this
+        break;
+      case CTRL_KEY('k'): // Cut selection
+        editorSetStatusMessage("Mode: SELECTION_MODE. Cutting selection.");
+        editorCutSelection();
+        E.mode = NORMAL_MODE;
+        editorSetStatusMessage("Selection cut.");
+        editorRefreshScreen(); // Add this
+        break;
+      case ALT_F:
+      case ALT_M:
+      case ALT_K:
+        editorFormatJson(c == ALT_F ? JSON_PRETTY : c == ALT_M ? JSON_MINIFY : JSON_SORT_KEYS);
+        E.mode = NORMAL_MODE;
+        break;
+      default:
+        if (editorIsTextKey(c)) { // Check if it's a printable character or UTF-8 byte
+          editorDelCharSelection(); // Delete the selected text (sets E.selection_active = 0)
+          editorInsertChar(c);      // Insert the new character
+          E.mode = NORMAL_MODE;     // Exit selection mode
+          editorSetStatusMessage(""); // Clear status message
+          editorRefreshScreen();    // Refresh screen
+        }
+        break;
+    }
+  } else { // NORMAL_MODE
+    switch (c) {
+      case '\r': editorInsertNewline(); break;
+      case '\t':
+        for (int i = 0; i < 4; i++) editorInsertChar(' ');
+        break;
+      case CTRL_KEY('q'):
+        if (E.attached) {
+          // Buffers stay loaded in the daemon, unsaved changes included
+          editorRecentRememberAll();
+          editorSessionSave();
+          editorDetach();
+          return;
+        }
+        if (editorAnyDirty() && quit_times > 0) {
+          editorSetStatusMessage("WARNING!!! File has unsaved changes. "
+                                 "Press Ctrl-Q %d more times to quit.",
+                                 quit_times);
+          quit_times--;
+          return;
+        }
+        editorRecentRememberAll();
+        editorSessionSave();
+        write(E.ofd, "\x1b[2J", 4);
+        write(E.ofd, "\x1b[H", 3);
+        exit(0);
+        break;
+      case CTRL_KEY('s'): editorSave(); break;
+      case CTRL_KEY('y'): editorSaveAs(); break;
+      case CTRL_KEY('w'):
+        editorCopyLine(); // Only copy line in normal mode
+        break;
+      case CTRL_KEY('k'):
+        if (E.selection_active) { // If a selection is active, cut the selection
+          editorSetStatusMessage("Mode: NORMAL_MODE. Selection active. Cutting selection.");
+          editorCutSelection();
+          E.mode = NORMAL_MODE; // Exit selection mode after cutting
+          editorSetStatusMessage("Selection cut.");
+        } else { // Otherwise, cut the current line
+          editorSetStatusMessage("Mode: NORMAL_MODE. No selection active. Cutting line.");
+          editorCutLine();
+        }
+        break;
+      case CTRL_KEY('u'): editorPaste(); break;
+      case CTRL_KEY('n'): E.linenumbers = !E.linenumbers; break;
+      case CTRL_KEY('t'): editorNewFile(); break;
+      case CTRL_KEY('g'): editorShowHelp(); break;
+      case CTRL_KEY('f'): editorFind(); break;
+      case CTRL_KEY('j'): editorJumpToLine(); break;
+      case HOME_KEY:
+      case ALT_B:
+        E.cx = 0;
+        break;
+      case END_KEY:
+      case ALT_E:
+        if (E.cy < E.numrows)
+          E.cx = E.row[E.cy].size;
+        break;
+      case BACKSPACE:
+      case CTRL_KEY('h'):
+      case DEL_KEY:
+        if (c == DEL_KEY) editorMoveCursor(ARROW_RIGHT);
+        editorDelChar();
+        break;
+      case PAGE_UP:
+      case PAGE_DOWN:
+        {
+          if (c == PAGE_UP) E.cy = E.rowoff;
+          else if (c == PAGE_DOWN) {
+            E.cy = E.rowoff + E.screenrows - 1;
+            if (E.cy > E.numrows) E.cy = E.numrows;
+          }
+          int times = E.screenrows;
+          while (times--) editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+        } break;
+      case ARROW_UP:
+      case ARROW_DOWN:
+      case ARROW_LEFT:
+      case ARROW_RIGHT:
+        editorMoveCursor(c);
+        break;
+      case CTRL_KEY('o'): {
+        char *path = editorFileBrowser(".");
+        if (path) {
+          editorOpenBuffer(path);
+          free(path);
+        }
+        break;
+      }
+      case CTRL_KEY('r'): {
+        char *path = editorRecentFiles();
+        if (path) {
+          editorOpenBuffer(path);
+          free(path);
+        }
+        break;
+      }
+      case ALT_N:
+        editorSwitchBuffer((E.curbuf + 1) % E.numbuffers);
+        break;
+      case ALT_P:
+        editorSwitchBuffer((E.curbuf + E.numbuffers - 1) % E.numbuffers);
+        break;
+      case ALT_X: editorCloseBuffer(); break;
+      case ALT_L: editorBufferList(); break;
+      case ALT_S: editorSplitWindow(LAYOUT_HSPLIT); break;
+      case ALT_V: editorSplitWindow(LAYOUT_VSPLIT); break;
+      case ALT_W: editorNextWindow(); break;
+      case ALT_Q: editorCloseWindow(); break;
+      case ALT_O: editorOutlinePane(); break;
+      case ALT_J: editorOutlineJumpToPath(); break;
+      case ALT_F: editorFormatJson(JSON_PRETTY); break;
+      case ALT_M: editorFormatJson(JSON_MINIFY); break;
+      case ALT_K: editorFormatJson(JSON_SORT_KEYS); break;
+      case ALT_H:
+#ifdef WEE_PROFILE
+        E.perf_hud = !E.perf_hud;
+#else
+        editorSetStatusMessage("Performance HUD not available: rebuild with make PROFILE=1");
+#endif
+        break;
+      case CTRL_KEY('l'):
+      case '\x1b':
+        // This is now handled in SELECTION_MODE
+        break;
+      case CTRL_KEY('b'):
+        E.selection_start_cx = E.cx;
+        E.selection_start_cy = E.cy;
+        E.selection_end_cx = E.cx; // Initialize end to start
+        E.selection_end_cy = E.cy; // Initialize end to start
+        E.selection_active = 1;
+        editorSetStatusMessage("Selection start set");
+        break;
+      case CTRL_KEY('e'):
+        E.selection_end_cx = E.cx;
+        E.selection_end_cy = E.cy;
+        editorSetStatusMessage("Selection end set. Entering SELECTION_MODE.");
+        E.mode = SELECTION_MODE; // Enter selection mode
+        break;
+      case CTRL_KEY('a'): // Select all text
+        if (E.numrows > 0) {
+          E.selection_start_cx = 0;
+          E.selection_start_cy = 0;
+          E.selection_end_cx = E.row[E.numrows - 1].size;
+          E.selection_end_cy = E.numrows - 1;
+          E.selection_active = 1;
+          E.mode = SELECTION_MODE;
+          editorSetStatusMessage("All text selected.");
+        } else {
+          editorSetStatusMessage("No text to select.");
+        }
+        break;
+      default:
+        if (E.selection_active && editorIsTextKey(c)) { // If a selection is active (Ctrl+B pressed, but not Ctrl+E) and a printable char is typed
+          editorSetStatusMessage("Selection cancelled (typed character). Deleting selection.");
+          editorDelCharSelection(); // Delete the selected text
+          editorInsertChar(c);      // Insert the new character
+          E.mode = NORMAL_MODE;     // Exit selection mode
+        } else if (E.selection_active) { // If a selection is active and a non-printable char is typed (e.g., arrow keys)
+            // Do nothing, allow cursor movement within selection mode
+        } else { // No selection active, insert character normally
+            editorInsertChar(c);
+        }
+        break;
+    }
+  }
+  quit_times = WEE_QUIT_TIMES;
+}
+
+void editorIndentSelection() {
+  if (!E.selection_active) return;
+  int start_cy = E.selection_start_cy;
+  int end_cy = E.selection_end_cy;
+
+  if (start_cy > end_cy) {
+    int temp = start_cy;
+    start_cy = end_cy;
+    end_cy = temp;
+  }
+
+  for (int i = start_cy; i <= end_cy; i++) {
+    erow *row = &E.row[i];
+    for (int j = 0; j < WEE_TAB_STOP; j++) {
+      editorRowInsertChar(row, 0, ' ');
+    }
+  }
+
+  E.selection_start_cx += WEE_TAB_STOP;
+  E.selection_end_cx += WEE_TAB_STOP;
+
+  E.dirty++;
+}
+
+void editorUnindentSelection() {
+  if (!E.selection_active) return;
+  int start_cy = E.selection_start_cy;
+  int end_cy = E.selection_end_cy;
+
+  if (start_cy > end_cy) {
+    int temp = start_cy;
+    start_cy = end_cy;
+    end_cy = temp;
+  }
+
+  for (int i = start_cy; i <= end_cy; i++) {
+    erow *row = &E.row[i];
+    int chars_deleted_count = 0;
+    for (int j = 0; j < WEE_TAB_STOP; j++) {
+      if (row->size > 0 && row->chars[0] == ' ') {
+        editorRowDelChar(row, 0);
+        chars_deleted_count++;
+      } else {
+        break;
+      }
+    }
+    if (i == E.selection_start_cy) {
+        E.selection_start_cx -= chars_deleted_count;
+        if (E.selection_start_cx < 0) E.selection_start_cx = 0;
+    }
+    if (i == E.selection_end_cy) {
+        E.selection_end_cx -= chars_deleted_count;
+        if (E.selection_end_cx < 0) E.selection_end_cx = 0;
+    }
+  }
+  E.dirty++;
+}
+
+void editorMoveSelection(int key) {
+  // Get current selection bounds and normalize them
+  int start_cx = E.selection_start_cx;
+  int start_cy = E.selection_start_cy;
+  int end_cx = E.selection_end_cx;
+  int end_cy = E.selection_end_cy;
+
+  if (start_cy > end_cy || (start_cy == end_cy && start_cx > end_cx)) {
+    int temp_cx = start_cx;
+    int temp_cy = start_cy;
+    start_cx = end_cx;
+    start_cy = end_cy;
+    end_cx = temp_cx;
+    end_cy = temp_cy;
+  }
+
+  switch (key) {
+    case ARROW_LEFT: {
+      for (int i = start_cy; i <= end_cy; i++) {
+        erow *row = &E.row[i];
+        if (row->size > 0 && row->chars[0] == ' ') {
+          editorRowDelChar(row, 0);
+          if (i == E.selection_start_cy) {
+            if (E.selection_start_cx > 0) E.selection_start_cx--;
+          }
+          if (i == E.selection_end_cy) {
+            if (E.selection_end_cx > 0) E.selection_end_cx--;
+          }
+        }
+      }
+      E.dirty++;
+      break;
+    }
+    case ARROW_RIGHT: {
+      for (int i = start_cy; i <= end_cy; i++) {
+        erow *row = &E.row[i];
+        editorRowInsertChar(row, 0, ' ');
+      }
+      E.selection_start_cx++;
+      E.selection_end_cx++;
+      E.dirty++;
+      break;
+    }
+    case ARROW_UP: {
+      if (start_cy == 0) return; // Cannot move further up
+
+      // Preserve user's clipboard
+      char *temp_clipboard = E.clipboard;
+      int temp_clipboard_len = E.clipboard_len;
+      E.clipboard = NULL;
+      E.clipboard_len = 0;
+
+      editorCutSelection(); // Cuts the normalized selection into E.clipboard
+
+      // Move cursor to the line above the original selection start
+      E.cy = start_cy - 1;
+      E.cx = 0;
+
+      // Store the starting point for the new selection
+      E.selection_start_cy = E.cy;
+      E.selection_start_cx = E.cx;
+
+      editorPaste(); // Paste content, E.cx and E.cy will be at the end
+
+      // The new selection end is the current cursor position
+      E.selection_end_cy = E.cy;
+      E.selection_end_cx = E.cx;
+
+      // Reactivate selection mode
+      E.selection_active = 1;
+      E.mode = SELECTION_MODE;
+
+      // Restore user's clipboard
+      memFree(MEM_CLIPBOARD, E.clipboard); // Free the clipboard used for the move operation
+      E.clipboard = temp_clipboard;
+      E.clipboard_len = temp_clipboard_len;
+      break;
+    }
+    case ARROW_DOWN: {
+      if (end_cy >= E.numrows - 1) return; // Cannot move further down
+
+      // Preserve user's clipboard
+      char *temp_clipboard = E.clipboard;
+      int temp_clipboard_len = E.clipboard_len;
+      E.clipboard = NULL;
+      E.clipboard_len = 0;
+
+      editorCutSelection(); // Cuts the normalized selection into E.clipboard
+
+      // Move cursor to the line that was below the original selection
+      // After cut, E.cy is original start_cy. The line below original end_cy is now at E.cy + 1
+      E.cy = start_cy + 1;
+      E.cx = 0;
+
+      // Store the starting point for the new selection
+      E.selection_start_cy = E.cy;
+      E.selection_start_cx = E.cx;
+
+      editorPaste(); // Paste content, E.cx and E.cy will be at the end
+
+      // The new selection end is the current cursor position
+      E.selection_end_cy = E.cy;
+      E.selection_end_cx = E.cx;
+
+      // Reactivate selection mode
+      E.selection_active = 1;
+      E.mode = SELECTION_MODE;
+
+      // Restore user's clipboard
+      memFree(MEM_CLIPBOARD, E.clipboard); // Free the clipboard used for the move operation
+      E.clipboard = temp_clipboard;
+      E.clipboard_len = temp_clipboard_len;
+      break;
+    }
+  }
+}
+
+void editorJumpToLine() {
+  char *line_str = editorPrompt("Go to line: %s (ESC to cancel)", NULL);
+  if (line_str == NULL) {
+    editorSetStatusMessage("Jump cancelled.");
+    return;
+  }
+
+  // Convert string to integer
+  int target_line = atoi(line_str);
+  memFree(MEM_EDITOR, line_str);
+
+  // Validate the line number
+  if (target_line <= 0 || target_line > E.numrows) {
+    editorSetStatusMessage("Invalid line number: %d. Total lines: %d.", target_line, E.numrows);
+    return;
+  }
+
+  // Adjust for 0-based indexing (user input is usually 1-based)
+  E.cy = target_line - 1;
+  E.cx = 0; // Move cursor to the beginning of the target line
+
+  // Ensure cursor is visible
+  editorScroll();
+  editorSetStatusMessage("Jumped to line %d.", target_line);
+}
+
+
+/* file browser */
+
+/**
+ * @brief Comparison function for qsort. Sorts files and directories.
+ *        Directories come before files, then sorting is alphabetical (case-insensitive).
+ * @param a Pointer to the first element.
+ * @param b Pointer to the second element.
+ * @return <0 if a<b, 0 if a==b, >0 if a>b.
+ */
+int file_compare(const void *a, const void *b) {
+    const char *a_str = *(const char **)a;
+    const char *b_str = *(const char **)b;
+    struct stat st_a, st_b;
+    stat(a_str, &st_a);
+    stat(b_str, &st_b);
+    if (S_ISDIR(st_a.st_mode) && !S_ISDIR(st_b.st_mode)) return -1;
+    if (!S_ISDIR(st_a.st_mode) && S_ISDIR(st_b.st_mode)) return 1;
+    return strcasecmp(a_str, b_str);
+}
+
+/**
+ * @brief Displays a simple file browser to open files.
+ * @param initial_path The initial path to start browsing from.
+ * @return The full path of the selected file (to be freed), or NULL if canceled.
+ */
+char *editorFileBrowser(const char *initial_path) {
+    char *path = realpath(initial_path, NULL);
+    if (!path) {
+        editorSetStatusMessage("Cannot open directory: %s", strerror(errno));
+        return NULL;
+    }
+
+    int num_items = 0;
+    char **items = NULL;
+    int selected = 0;
+    int offset = 0;
+
+    while (1) {
+        num_items = 0;
+        items = NULL;
+
+        DIR *dir = opendir(path);
+        if (!dir) {
+            editorSetStatusMessage("Cannot open directory: %s", strerror(errno));
+            free(path);
+            return NULL;
+        }
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0) continue;
+            items = realloc(items, sizeof(char *) * (num_items + 1));
+            char full_path[1024];
+            snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+            items[num_items++] = strdup(full_path);
+        }
+        closedir(dir);
+
+        qsort(items, num_items, sizeof(char *), file_compare);
+
+        struct abuf ab = ABUF_INIT;
+        abAppend(&ab, "\x1b[?25l", 6);
+        abAppend(&ab, "\x1b[2J", 4);
+        abAppend(&ab, "\x1b[H", 3);
+
+        char header[1024];
+        snprintf(header, sizeof(header), "File Browser: %s", path);
+        int header_len = strlen(header);
+        if (header_len > E.termcols) header_len = E.termcols;
+        abAppend(&ab, header, header_len);
+        for (int i = header_len; i < E.termcols; i++) abAppend(&ab, " ", 1);
+        abAppend(&ab, "\x1b[m", 3);
+        abAppend(&ab, "\r\n", 2);
+
+        int display_rows = E.termrows - 2;
+        if (selected >= offset + display_rows) offset = selected - display_rows + 1;
+        if (selected < offset) offset = selected;
+
+        for (int i = 0; i < display_rows; i++) {
+            int index = i + offset;
+            if (index >= num_items) break;
+
+            char *item_path = items[index];
+            char *item_name = strrchr(item_path, '/');
+            item_name = item_name ? item_name + 1 : item_path;
+
+            struct stat st;
+            stat(item_path, &st);
+
+            char display_str[256];
+            snprintf(display_str, sizeof(display_str), "%s%s", item_name, S_ISDIR(st.st_mode) ? "/" : "");
+
+            int len = strlen(display_str);
+            if (len > E.termcols) len = E.termcols;
+
+            if (index == selected) abAppend(&ab, "\x1b[7m", 4);
+            abAppend(&ab, display_str, len);
+            if (index == selected) abAppend(&ab, "\x1b[m", 3);
+            abAppend(&ab, "\x1b[K", 3);
+            abAppend(&ab, "\r\n", 2);
+        }
+
+        write(E.ofd, ab.b, ab.len);
+        abFree(&ab);
+        editorInvalidateScreen();
+
+        int c = editorReadKey();
+
+        // Get selected_path before freeing items
+        char *current_selected_path = NULL;
+        if (c == '\r' && selected < num_items) {
+            current_selected_path = realpath(items[selected], NULL);
+        }
+
+        for (int i = 0; i < num_items; i++) free(items[i]);
+        free(items);
+
+        switch (c) {
+            case '\r': {
+                if (current_selected_path) {
+                    struct stat st;
+                    stat(current_selected_path, &st);
+                    if (S_ISDIR(st.st_mode)) {
+                        free(path);
+                        path = current_selected_path;
+                        selected = 0;
+                        offset = 0;
+                    } else {
+                        free(path);
+                        return current_selected_path;
+                    }
+                } else {
+                    // Handle case where realpath failed or selected was out of bounds
+                    editorSetStatusMessage("Error: Could not resolve path.");
+                }
+                break;
+            }
+            case ARROW_UP:
+                if (selected > 0) selected--;
+                break;
+            case ARROW_DOWN:
+                if (selected < num_items - 1) selected++;
+                break;
+            case '\x1b':
+                free(path);
+                return NULL;
+        }
+    }
+}
+
+void editorShowHelp() {
+    // Create a temporary buffer to hold the help text
+    const char *help_text[] = {
+        "Wee Editor Help",
+        "",
+        "Ctrl-S: Save",
+        "Ctrl-Y: Save As",
+        "Ctrl-Q: Quit",
+        "Ctrl-F: Find",
+        "Ctrl-O: Open File Browser",
+        "Ctrl-R: Recent Files",
+        "Ctrl-N: Toggle Line Numbers",
+        "Ctrl-T: New File (in a new buffer)",
+        "Alt-N / Alt-P: Next / Previous Buffer",
+        "Alt-L: Buffer List",
+        "Alt-X: Close Buffer",
+        "Alt-S / Alt-V: Split Window Horizontally / Vertically",
+        "Alt-W: Next Window",
+        "Alt-Q: Close Window",
+        "Alt-H: Toggle Performance HUD (PROFILE=1 builds)",
+        "Alt-O: JSON Outline (.json files)",
+        "Alt-J: Jump to JSON Path (e.g. a.b[3].c)",
+        "Alt-F / Alt-M / Alt-K: Pretty-print / Minify / Sort Keys of JSON",
+        "Ctrl-G: Show this Help",
+        "",
+        "Ctrl-J: Jump to Line",
+        "",
+        "Ctrl-B: Start Selection",
+        "Ctrl-E: End Selection & Enter Selection Mode",
+        "Ctrl-A: Select All",
+        "ESC (in Sel. Mode): Cancel Selection",
+        "Ctrl-W (in Sel. Mode): Copy Selection",
+        "Ctrl-K (in Sel. Mode): Cut Selection",
+        "DEL (in Sel. Mode): Delete Selection",
+        "Arrows (in Sel. Mode): Move Selection (Up/Down/Left/Right)",
+        "",
+        "Ctrl-W: Copy Line",
+        "Ctrl-K: Cut Line",
+        "Ctrl-U: Paste",
+        NULL
+    };
+
+    struct abuf ab = ABUF_INIT;
+    abAppend(&ab, "\x1b[2J", 4); // Clear screen
+    abAppend(&ab, "\x1b[H", 3);  // Go to home
+
+    int y = 0;
+    for (y = 0; help_text[y] != NULL; y++) {
+        abAppend(&ab, help_text[y], strlen(help_text[y]));
+        abAppend(&ab, "\r\n", 2);
+    }
+
+    // Add a prompt to press any key to continue
+    const char *prompt = "Press any key to continue...";
+    int padding = (E.termcols - strlen(prompt)) / 2;
+    for (int i = 0; i < padding; i++) abAppend(&ab, " ", 1);
+    abAppend(&ab, prompt, strlen(prompt));
+
+    write(E.ofd, ab.b, ab.len);
+    abFree(&ab);
+    editorInvalidateScreen();
+
+    // Wait for a keypress before returning to the editor
+    editorReadKey();
+}
+
+
+/**
+ * @brief Displays the buffer list and lets the user switch to a buffer.
+ */
+void editorBufferList() {
+    editorBufferStash();
+    int selected = E.curbuf;
+    int offset = 0;
+
+    while (1) {
+        struct abuf ab = ABUF_INIT;
+        abAppend(&ab, "\x1b[?25l", 6);
+        abAppend(&ab, "\x1b[2J", 4);
+        abAppend(&ab, "\x1b[H", 3);
+
+        const char *header = "Buffers";
+        int header_len = strlen(header);
+        if (header_len > E.termcols) header_len = E.termcols;
+        abAppend(&ab, header, header_len);
+        abAppend(&ab, "\r\n", 2);
+
+        int display_rows = E.termrows - 2;
+        if (selected >= offset + display_rows) offset = selected - display_rows + 1;
+        if (selected < offset) offset = selected;
+
+        for (int i = 0; i < display_rows; i++) {
+            int index = i + offset;
+            if (index >= E.numbuffers) break;
+
+            struct editorBuffer *b = &E.buffers[index];
+            char display_str[1100];
+            snprintf(display_str, sizeof(display_str), "%d: %s%s%s", index + 1,
+                     b->filename ? b->filename : "[No Name]",
+                     b->dirty ? " (modified)" : "",
+                     b->loaded ? "" : " (not loaded)");
+
+            int len = strlen(display_str);
+            if (len > E.termcols) len = E.termcols;
+
+            if (index == selected) abAppend(&ab, "\x1b[7m", 4);
+            abAppend(&ab, display_str, len);
+            if (index == selected) abAppend(&ab, "\x1b[m", 3);
+            abAppend(&ab, "\x1b[K", 3);
+            abAppend(&ab, "\r\n", 2);
+        }
+
+        write(E.ofd, ab.b, ab.len);
+        abFree(&ab);
+        editorInvalidateScreen();
+
+        int c = editorReadKey();
+        switch (c) {
+            case '\r':
+                editorSwitchBuffer(selected);
+                return;
+            case ARROW_UP:
+                if (selected > 0) selected--;
+                break;
+            case ARROW_DOWN:
+                if (selected < E.numbuffers - 1) selected++;
+                break;
+            case '\x1b':
+                return;
+        }
+    }
+}
+
+/* recent files */
+
+/**
+ * @brief Builds the path of a file inside the per-user state directory (~/.wee).
+ *        The directory is created if it does not exist yet.
+ * @param buf The buffer receiving the path.
+ * @param bufsize The size of the buffer.
+ * @param name The file name inside the state directory.
+ * @return 0 on success, -1 if HOME is not set.
+ */
+int editorStatePath(char *buf, size_t bufsize, const char *name) {
+  const char *home = getenv("HOME");
+  if (!home || !*home) return -1;
+  snprintf(buf, bufsize, "%s/.wee", home);
+  mkdir(buf, 0700);
+  snprintf(buf, bufsize, "%s/.wee/%s", home, name);
+  return 0;
+}
+
+/**
+ * @brief Loads the recent-files list from ~/.wee/recent. Headless runs
+ *        neither read nor write it, so that they are reproducible.
+ *        Each line holds: cy cx rowoff coloff ckpt_line ckpt_offset size mtime path
+ */
+void editorRecentLoad() {
+  char path[1024];
+  if (E.script) return;
+  if (editorStatePath(path, sizeof(path), "recent") == -1) return;
+  FILE *fp = fopen(path, "r");
+  if (!fp) return;
+
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t linelen;
+  while ((linelen = getline(&line, &linecap, fp)) != -1 && E.numrecent < WEE_RECENT_MAX) {
+    if (linelen > 0 && line[linelen - 1] == '\n') line[--linelen] = '\0';
+    struct recentEntry re;
+    int consumed = 0;
+    if (sscanf(line, "%d %d %d %d %d %lld %lld %lld %n", &re.cy, &re.cx,
+               &re.rowoff, &re.coloff, &re.ckpt_line, &re.ckpt_offset,
+               &re.size, &re.mtime, &consumed) < 8 || consumed == 0 ||
+        line[consumed] == '\0')
+      continue;
+    re.path = strdup(&line[consumed]);
+    E.recent = memRealloc(MEM_EDITOR, E.recent, sizeof(struct recentEntry) * (E.numrecent + 1));
+    E.recent[E.numrecent++] = re;
+  }
+  free(line);
+  fclose(fp);
+}
+
+/**
+ * @brief Writes the recent-files list back to ~/.wee/recent.
+ */
+void editorRecentSave() {
+  char path[1024], tmp[1100];
+  if (E.script) return;
+  if (editorStatePath(path, sizeof(path), "recent") == -1) return;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *fp = fopen(tmp, "w");
+  if (!fp) return;
+  for (int i = 0; i < E.numrecent; i++) {
+    struct recentEntry *re = &E.recent[i];
+    fprintf(fp, "%d %d %d %d %d %lld %lld %lld %s\n", re->cy, re->cx,
+            re->rowoff, re->coloff, re->ckpt_line, re->ckpt_offset,
+            re->size, re->mtime, re->path);
+  }
+  if (fclose(fp) == 0) rename(tmp, path);
+  else unlink(tmp);
+}
+
+/**
+ * @brief Looks up a file in the recent-files list.
+ * @param filename The path of the file (resolved with realpath).
+ * @return The matching entry, or NULL if the file is not in the list.
+ */
+struct recentEntry *editorRecentFind(const char *filename) {
+  char *full = realpath(filename, NULL);
+  if (!full) return NULL;
+  struct recentEntry *found = NULL;
+  for (int i = 0; i < E.numrecent; i++) {
+    if (!strcmp(E.recent[i].path, full)) {
+      found = &E.recent[i];
+      break;
+    }
+  }
+  free(full);
+  return found;
+}
+
+/**
+ * @brief Records the current file, cursor and scroll position at the top of
+ *        the recent-files list. When the buffer matches the file on disk, the
+ *        byte offset of the first visible line is stored as a checkpoint so
+ *        that the next open can start reading from there.
+ */
+void editorRecentRemember() {
+  if (E.filename == NULL) return;
+  char *full = realpath(E.filename, NULL);
+  if (!full) return;
+
+  struct recentEntry re;
+  re.path = full;
+  re.cx = E.cx;
+  re.cy = E.cy;
+  re.rowoff = E.rowoff;
+  re.coloff = E.coloff;
+  re.ckpt_line = 0;
+  re.ckpt_offset = 0;
+  re.size = -1;
+  re.mtime = 0;
+
+  struct stat st;
+  if (stat(full, &st) == 0) {
+    re.size = st.st_size;
+    re.mtime = st.st_mtime;
+    if (!editorIsDirty() && E.rowoff > 0 && E.rowoff < E.numrows) {
+      long long offset = 0;
+      for (int j = 0; j < E.rowoff; j++) offset += E.row[j].size + E.row[j].eol;
+      re.ckpt_line = E.rowoff;
+      re.ckpt_offset = offset;
+    }
+  }
+
+  int at = E.numrecent;
+  for (int i = 0; i < E.numrecent; i++) {
+    if (!strcmp(E.recent[i].path, full)) {
+      at = i;
+      break;
+    }
+  }
+  if (at == E.numrecent) {
+    if (E.numrecent < WEE_RECENT_MAX) {
+      E.recent = memRealloc(MEM_EDITOR, E.recent, sizeof(struct recentEntry) * (E.numrecent + 1));
+      E.numrecent++;
+    } else {
+      at = E.numrecent - 1;
+      free(E.recent[at].path);
+    }
+  } else {
+    free(E.recent[at].path);
+  }
+  memmove(&E.recent[1], &E.recent[0], sizeof(struct recentEntry) * at);
+  E.recent[0] = re;
+
+  editorRecentSave();
+}
+
+/**
+ * @brief Moves the cursor and viewport to the position stored in a
+ *        recent-files entry, clamped to the rows currently loaded.
+ * @param re The recent-files entry.
+ */
+void editorRecentRestore(struct recentEntry *re) {
+  E.cy = re->cy;
+  if (E.cy > E.numrows) E.cy = E.numrows;
+  if (E.cy < 0) E.cy = 0;
+  int rowlen = E.cy < E.numrows ? E.row[E.cy].size : 0;
+  E.cx = re->cx;
+  if (E.cx > rowlen) E.cx = rowlen;
+  if (E.cx < 0) E.cx = 0;
+  E.rowoff = re->rowoff;
+  if (E.rowoff > E.cy) E.rowoff = E.cy;
+  if (E.rowoff < 0) E.rowoff = 0;
+  E.coloff = re->coloff < 0 ? 0 : re->coloff;
+}
+
+/**
+ * @brief Displays the recent-files list and lets the user pick one.
+ * @return The path of the selected file (to be freed), or NULL if canceled.
+ */
+char *editorRecentFiles() {
+    if (E.numrecent == 0) {
+        editorSetStatusMessage("No recent files.");
+        return NULL;
+    }
+
+    int selected = 0;
+    int offset = 0;
+
+    while (1) {
+        struct abuf ab = ABUF_INIT;
+        abAppend(&ab, "\x1b[?25l", 6);
+        abAppend(&ab, "\x1b[2J", 4);
+        abAppend(&ab, "\x1b[H", 3);
+
+        const char *header = "Recent Files";
+        int header_len = strlen(header);
+        if (header_len > E.termcols) header_len = E.termcols;
+        abAppend(&ab, header, header_len);
+        abAppend(&ab, "\r\n", 2);
+
+        int display_rows = E.termrows - 2;
+        if (selected >= offset + display_rows) offset = selected - display_rows + 1;
+        if (selected < offset) offset = selected;
+
+        for (int i = 0; i < display_rows; i++) {
+            int index = i + offset;
+            if (index >= E.numrecent) break;
+
+            char display_str[1100];
+            snprintf(display_str, sizeof(display_str), "%s:%d", E.recent[index].path, E.recent[index].cy + 1);
+
+            int len = strlen(display_str);
+            if (len > E.termcols) len = E.termcols;
+
+            if (index == selected) abAppend(&ab, "\x1b[7m", 4);
+            abAppend(&ab, display_str, len);
+            if (index == selected) abAppend(&ab, "\x1b[m", 3);
+            abAppend(&ab, "\x1b[K", 3);
+            abAppend(&ab, "\r\n", 2);
+        }
+
+        write(E.ofd, ab.b, ab.len);
+        abFree(&ab);
+        editorInvalidateScreen();
+
+        int c = editorReadKey();
+        switch (c) {
+            case '\r':
+                return strdup(E.recent[selected].path);
+            case ARROW_UP:
+                if (selected > 0) selected--;
+                break;
+            case ARROW_DOWN:
+                if (selected < E.numrecent - 1) selected++;
+                break;
+            case '\x1b':
+                return NULL;
+        }
+    }
+}
+
+
+/* json outline */
+
+/**
+ * @brief Tells whether the active buffer holds JSON, which gets an outline
+ *        and background validation.
+ * @return 1 for .json files.
+ */
+int editorIsJsonBuffer() {
+  if (!E.filename) return 0;
+  char *ext = strrchr(E.filename, '.');
+  return ext && !strcmp(ext, ".json");
+}
+
+/**
+ * @brief Frees an outline.
+ * @param o The outline, or NULL.
+ */
+void editorOutlineFree(struct jsonOutline *o) {
+  if (!o) return;
+  editorOutlineDropResync(o);
+  memFree(MEM_OUTLINE, o->nodes);
+  memFree(MEM_OUTLINE, o->checkpoints);
+  memFree(MEM_OUTLINE, o);
+}
+
+/**
+ * @brief Forgets a pending resync: the rescan then runs to the end.
+ * @param o The outline.
+ */
+void editorOutlineDropResync(struct jsonOutline *o) {
+  memFree(MEM_OUTLINE, o->resync);
+  memFree(MEM_OUTLINE, o->aside);
+  memFree(MEM_OUTLINE, o->shared);
+  memFree(MEM_OUTLINE, o->shared_at);
+  o->resync = NULL;
+  o->aside = NULL;
+  o->shared = NULL;
+  o->shared_at = NULL;
+  o->numresync = 0;
+  o->resync_nodes = 0;
+  o->resync_rows = 0;
+  o->aside_len = 0;
+  o->aside_cap = 0;
+  o->numshared = 0;
+  o->edit_pending = 0;
+}
+
+/**
+ * @brief Copies the old nodes from the end of the aside array through index
+ *        at, and up to OUTLINE_ASIDE_NODES more, to the aside array before
+ *        the rescan overwrites them.
+ * @param o The outline.
+ * @param at The index the rescan is about to write.
+ */
+void editorOutlineSaveAside(struct jsonOutline *o, int at) {
+  int from = o->aside_start + o->aside_len;
+  int to = o->resync_nodes - at > OUTLINE_ASIDE_NODES ? at + OUTLINE_ASIDE_NODES : o->resync_nodes;
+  if (to - o->aside_start > o->aside_cap) {
+    int cap = o->aside_cap * 2 > to - o->aside_start ? o->aside_cap * 2 : to - o->aside_start;
+    struct outlineNode *aside = memRealloc(MEM_OUTLINE, o->aside, sizeof(struct outlineNode) * cap);
+    if (!aside) {
+      editorOutlineDropResync(o);
+      return;
+    }
+    o->aside = aside;
+    o->aside_cap = cap;
+  }
+  memcpy(&o->aside[o->aside_len], &o->nodes[from], sizeof(struct outlineNode) * (to - from));
+  o->aside_len = to - o->aside_start;
+}
+
+/**
+ * @brief Returns a node as the scan before the edits of the pending resync
+ *        left it.
+ * @param o The outline.
+ * @param i The node index in that scan.
+ * @return The node.
+ */
+struct outlineNode *editorOutlineOldNode(struct jsonOutline *o, int i) {
+  for (int k = 0; k < o->numshared; k++)
+    if (o->shared_at[k] == i) return &o->shared[k];
+  if (i >= o->aside_start && i < o->aside_start + o->aside_len) return &o->aside[i - o->aside_start];
+  return &o->nodes[i];
+}
+
+/**
+ * @brief Appends a node for a value starting at (row, col) to the outline.
+ *        The pending member name, if any, becomes the node's key.
+ * @param o The outline.
+ * @param type The value type: '{', '[', '"', '0', 't', 'f' or 'n'.
+ * @param row The row of the first character of the value.
+ * @param col The column of the first character of the value.
+ * @return 1 on success, 0 when the node limit is reached.
+ */
+int editorOutlineAddNode(struct jsonOutline *o, char type, int row, int col) {
+  struct outlineScan *sc = &o->scan;
+  if (sc->numnodes == OUTLINE_MAX_NODES) return 0;
+  if (sc->numnodes == o->capnodes) {
+    int cap = o->capnodes ? o->capnodes * 2 : 1024;
+    struct outlineNode *nodes = memRealloc(MEM_OUTLINE, o->nodes, sizeof(struct outlineNode) * cap);
+    if (!nodes) return 0;
+    o->nodes = nodes;
+    o->capnodes = cap;
+  }
+  if (sc->numnodes < o->resync_nodes && sc->numnodes >= o->aside_start + o->aside_len)
+    editorOutlineSaveAside(o, sc->numnodes);
+  struct outlineNode *n = &o->nodes[sc->numnodes];
+  n->parent = sc->cur;
+  n->ordinal = sc->cur >= 0 ? o->nodes[sc->cur].count++ : 0;
+  n->depth = sc->cur >= 0 ? o->nodes[sc->cur].depth + 1 : 0;
+  n->count = 0;
+  n->row = row;
+  n->col = col;
+  n->key_row = sc->key_row;
+  n->key_col = sc->key_col;
+  n->key_len = sc->key_len;
+  n->type = type;
+  n->open = type == '{' || type == '[';
+  n->end = sc->numnodes + 1;
+  sc->key_len = -1;
+  if (n->open) {
+    sc->cur = sc->numnodes;
+    sc->expect = type == '{' ? OUTLINE_KEY_OR_END : OUTLINE_VALUE_OR_END;
+  } else {
+    sc->expect = OUTLINE_NEXT;
+  }
+  sc->numnodes++;
+  return 1;
+}
+
+/**
+ * @brief Closes the innermost open container.
+ * @param o The outline.
+ */
+void editorOutlineClose(struct jsonOutline *o) {
+  struct outlineScan *sc = &o->scan;
+  struct outlineNode *n = &o->nodes[sc->cur];
+  n->open = 0;
+  n->end = sc->numnodes;
+  sc->cur = n->parent;
+  sc->expect = sc->cur >= 0 ? OUTLINE_NEXT : OUTLINE_DONE;
+}
+
+/**
+ * @brief Feeds one character to the outline tokenizer. Rows are separated
+ *        by an implicit newline.
+ * @param o The outline.
+ * @param c The character.
+ * @param row The row of the character.
+ * @param col The column of the character.
+ * @return 1 to continue, 0 on a syntax error or when the node limit is hit.
+ */
+int editorOutlineFeed(struct jsonOutline *o, char c, int row, int col) {
+  struct outlineScan *sc = &o->scan;
+  if (sc->in_string) {
+    if (sc->escape) sc->escape = 0;
+    else if (c == '\\') sc->escape = 1;
+    else if (c == '"') {
+      sc->in_string = 0;
+      if (sc->string_is_key) {
+        sc->key_row = sc->str_row;
+        sc->key_col = sc->str_col + 1;
+        sc->key_len = row == sc->str_row ? col - sc->str_col - 1 : 0;
+        sc->expect = OUTLINE_COLON;
+      }
+    }
+    return 1;
+  }
+  if (sc->in_literal) {
+    if (isalnum((unsigned char)c) || c == '.' || c == '+' || c == '-') return 1;
+    sc->in_literal = 0;
+  }
+  if (c == ' ' || c == '\t' || c == '\n' || c == '\r') return 1;
+
+  switch (sc->expect) {
+    case OUTLINE_VALUE_OR_END:
+      if (c == ']') {
+        editorOutlineClose(o);
+        return 1;
+      }
+      /* fall through */
+    case OUTLINE_VALUE:
+      if (c == '{' || c == '[') return editorOutlineAddNode(o, c, row, col);
+      if (c == '"') {
+        sc->in_string = 1;
+        sc->string_is_key = 0;
+        sc->str_row = row;
+        sc->str_col = col;
+        return editorOutlineAddNode(o, '"', row, col);
+      }
+      if (c == '-' || isdigit((unsigned char)c) || c == 't' || c == 'f' || c == 'n') {
+        sc->in_literal = 1;
+        return editorOutlineAddNode(o, c == '-' || isdigit((unsigned char)c) ? '0' : c, row, col);
+      }
+      return 0;
+    case OUTLINE_KEY_OR_END:
+      if (c == '}') {
+        editorOutlineClose(o);
+        return 1;
+      }
+      /* fall through */
+    case OUTLINE_KEY:
+      if (c != '"') return 0;
+      sc->in_string = 1;
+      sc->string_is_key = 1;
+      sc->str_row = row;
+      sc->str_col = col;
+      return 1;
+    case OUTLINE_COLON:
+      if (c != ':') return 0;
+      sc->expect = OUTLINE_VALUE;
+      return 1;
+    case OUTLINE_NEXT: {
+      char type = o->nodes[sc->cur].type;
+      if (c == ',') {
+        sc->expect = type == '{' ? OUTLINE_KEY : OUTLINE_VALUE;
+        return 1;
+      }
+      if ((c == '}' && type == '{') || (c == ']' && type == '[')) {
+        editorOutlineClose(o);
+        return 1;
+      }
+      return 0;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Resets the tokenizer to the top of the buffer.
+ * @param o The outline.
+ */
+void editorOutlineRestart(struct jsonOutline *o) {
+  memset(&o->scan, 0, sizeof(o->scan));
+  o->scan.cur = -1;
+  o->scan.key_len = -1;
+  o->numcheckpoints = 0;
+  o->since_checkpoint = 0;
+  o->error = 0;
+  o->truncated = 0;
+}
+
+/**
+ * @brief Moves a saved tokenizer state by the rows an edit inserted or
+ *        deleted. A state on the edited rows, or inside a string or after a
+ *        key that starts there, no longer holds.
+ * @param s The state.
+ * @param row The first row the edit changed.
+ * @param delta The number of rows it inserted, negative if it deleted.
+ * @return 1 if the state still holds, 0 if it must be dropped.
+ */
+int editorOutlineShiftState(struct outlineScan *s, int row, int delta) {
+  if (s->row <= row || s->row + delta <= row) return 0;
+  if (s->in_string && s->str_row <= row) return 0;
+  if (s->key_len >= 0 && s->key_row <= row) return 0;
+  s->row += delta;
+  s->str_row += delta;
+  s->key_row += delta;
+  return 1;
+}
+
+/**
+ * @brief Applies the row delta of the edit noted last, now that it is done,
+ *        to the states of the pending resync.
+ * @param o The outline.
+ */
+void editorOutlineSettle(struct jsonOutline *o) {
+  if (!o->edit_pending) return;
+  o->edit_pending = 0;
+  int delta = E.numrows - o->edit_numrows, kept = 0;
+  for (int i = 0; i < o->numresync; i++)
+    if (editorOutlineShiftState(&o->resync[i], o->edit_row, delta)) o->resync[kept++] = o->resync[i];
+  o->numresync = kept;
+  if (!kept || !editorOutlineShiftState(&o->resync_end, o->edit_row, delta)) editorOutlineDropResync(o);
+  else o->resync_rows += delta;
+}
+
+/**
+ * @brief Maps a tokenizer state of the scan before the edits onto the
+ *        spliced node array.
+ * @param s The state.
+ * @param oldc The node count where the rescan caught up.
+ * @param dn How many more nodes the rescan produced up to there.
+ * @param was The old open container at each depth there.
+ * @param now The new open container at each depth there.
+ * @param depth The number of open containers there.
+ */
+void editorOutlineMapState(struct outlineScan *s, int oldc, int dn, int *was, int *now, int depth) {
+  s->numnodes += dn;
+  if (s->cur >= oldc) {
+    s->cur += dn;
+    return;
+  }
+  for (int d = 0; d < depth; d++)
+    if (s->cur == was[d]) s->cur = now[d];
+}
+
+/**
+ * @brief Splices the nodes scanned before the edits back in once the rescan
+ *        reaches the first state of the pending resync in the same state:
+ *        the same token, string and key, and open containers of the same
+ *        types. The old nodes after that point move by the difference in
+ *        node count and rows, children of the open containers renumber by
+ *        the difference in their child count, and scanning resumes where
+ *        the old scan had got to.
+ * @param o The outline.
+ * @return 1 if the nodes were spliced, 0 if the states differ.
+ */
+int editorOutlineResync(struct jsonOutline *o) {
+  struct outlineScan *sc = &o->scan, *cp = &o->resync[0];
+  if (sc->expect != cp->expect || sc->in_string != cp->in_string || sc->escape != cp->escape ||
+      sc->string_is_key != cp->string_is_key || sc->in_literal != cp->in_literal ||
+      sc->key_len != cp->key_len)
+    return 0;
+  if (sc->in_string && (sc->str_row != cp->str_row || sc->str_col != cp->str_col)) return 0;
+  if (sc->key_len >= 0 && (sc->key_row != cp->key_row || sc->key_col != cp->key_col)) return 0;
+  int depth = sc->cur >= 0 ? o->nodes[sc->cur].depth + 1 : 0;
+  if (depth != (cp->cur >= 0 ? editorOutlineOldNode(o, cp->cur)->depth + 1 : 0)) return 0;
+  int oldc = cp->numnodes, newc = sc->numnodes, dn = newc - oldc;
+  int total = o->resync_nodes + dn;
+  if (total > OUTLINE_MAX_NODES) return 0;
+
+  // Per depth: the old and the new open container, the difference in their
+  // child counts so far and the old container as the old scan left it
+  int *was = memAlloc(MEM_OUTLINE, sizeof(int) * 3 * depth + 1);
+  struct outlineNode *fin = memAlloc(MEM_OUTLINE, sizeof(struct outlineNode) * depth + 1);
+  struct outlineScan *cps = memRealloc(MEM_OUTLINE, o->checkpoints,
+                                       sizeof(struct outlineScan) * (o->numcheckpoints + o->numresync));
+  if (cps) o->checkpoints = cps;
+  int ok = was && fin && cps;
+  int *now = was + depth, *diff = was + 2 * depth;
+  for (int c = sc->cur, oc = cp->cur; ok && c >= 0; c = o->nodes[c].parent) {
+    struct outlineNode *on = editorOutlineOldNode(o, oc);
+    int d = o->nodes[c].depth;
+    if (on->type != o->nodes[c].type) ok = 0;
+    was[d] = oc;
+    now[d] = c;
+    diff[d] = o->nodes[c].count;
+    fin[d] = *on;
+    oc = on->parent;
+  }
+  for (int n = oldc - 1; ok && n >= 0;) {
+    struct outlineNode *on = editorOutlineOldNode(o, n);
+    if (on->parent < 0) break;
+    if (on->depth - 1 < depth && was[on->depth - 1] == on->parent) diff[on->depth - 1] -= on->ordinal + 1;
+    n = on->parent;
+  }
+  if (ok && total > o->capnodes) {
+    struct outlineNode *nodes = memRealloc(MEM_OUTLINE, o->nodes, sizeof(struct outlineNode) * total);
+    if (nodes) {
+      o->nodes = nodes;
+      o->capnodes = total;
+    } else {
+      ok = 0;
+    }
+  }
+  if (!ok) {
+    memFree(MEM_OUTLINE, was);
+    memFree(MEM_OUTLINE, fin);
+    return 0;
+  }
+
+  // Old nodes the rescan overwrote come from aside, the rest are in place
+  int aside_end = o->aside_start + o->aside_len;
+  int from = oldc > aside_end ? oldc : aside_end;
+  if (from < o->resync_nodes)
+    memmove(&o->nodes[from + dn], &o->nodes[from], sizeof(struct outlineNode) * (o->resync_nodes - from));
+  if (oldc < aside_end)
+    memcpy(&o->nodes[newc], &o->aside[oldc - o->aside_start], sizeof(struct outlineNode) * (aside_end - oldc));
+  int moved = dn || o->resync_rows;
+  for (int d = 0; d < depth; d++)
+    if (was[d] != now[d] || diff[d]) moved = 1;
+  for (int i = newc; moved && i < total; i++) {
+    struct outlineNode *n = &o->nodes[i];
+    if (n->parent >= oldc) {
+      n->parent += dn;
+    } else if (n->parent >= 0) {
+      n->parent = now[n->depth - 1];
+      n->ordinal += diff[n->depth - 1];
+    }
+    n->end += dn;
+    n->row += o->resync_rows;
+    n->key_row += o->resync_rows;
+  }
+  for (int d = 0; d < depth; d++) {
+    struct outlineNode *n = &o->nodes[now[d]];
+    n->open = fin[d].open;
+    n->end = fin[d].end + dn;
+    n->count = fin[d].count + diff[d];
+  }
+
+  o->checkpoints[o->numcheckpoints++] = *sc;
+  for (int i = 1; i < o->numresync; i++) {
+    editorOutlineMapState(&o->resync[i], oldc, dn, was, now, depth);
+    o->checkpoints[o->numcheckpoints++] = o->resync[i];
+  }
+  *sc = o->resync_end;
+  editorOutlineMapState(sc, oldc, dn, was, now, depth);
+  o->since_checkpoint = 0;
+  memFree(MEM_OUTLINE, was);
+  memFree(MEM_OUTLINE, fin);
+  editorOutlineDropResync(o);
+  return 1;
+}
+
+/**
+ * @brief Checks the rescan against the pending resync: states it went past
+ *        are dropped, and at the next one it tries to splice the old nodes
+ *        back in.
+ * @param o The outline.
+ * @return 1 if the scan moved on to where the old scan had got to.
+ */
+int editorOutlineResyncAt(struct jsonOutline *o) {
+  struct outlineScan *sc = &o->scan;
+  int skip = 0;
+  while (skip < o->numresync && (o->resync[skip].row < sc->row ||
+                                 (o->resync[skip].row == sc->row && o->resync[skip].col < sc->col)))
+    skip++;
+  struct outlineScan *cp = &o->resync[skip];
+  if (skip < o->numresync && cp->row == sc->row && cp->col == sc->col) {
+    memmove(o->resync, cp, sizeof(struct outlineScan) * (o->numresync - skip));
+    o->numresync -= skip;
+    if (editorOutlineResync(o)) return 1;
+    skip = 1;
+  }
+  memmove(o->resync, &o->resync[skip], sizeof(struct outlineScan) * (o->numresync - skip));
+  o->numresync -= skip;
+  if (!o->numresync) editorOutlineDropResync(o);
+  return 0;
+}
+
+/**
+ * @brief Resumes the outline from the last checkpoint before (row, col):
+ *        nodes after the checkpoint are dropped and the containers still
+ *        open there are reopened with their child counts recomputed from
+ *        the surviving nodes. The states and nodes scanned past the edit
+ *        are kept for a resync unless one is already pending.
+ * @param o The outline.
+ * @param row The first changed row.
+ * @param col The first changed column in that row.
+ */
+void editorOutlineRewind(struct jsonOutline *o, int row, int col) {
+  struct outlineScan *sc = &o->scan;
+  int had = o->numcheckpoints;
+  while (o->numcheckpoints > 0) {
+    struct outlineScan *cp = &o->checkpoints[o->numcheckpoints - 1];
+    if (cp->row < row || (cp->row == row && cp->col <= col)) break;
+    o->numcheckpoints--;
+  }
+  int keep = o->numcheckpoints;
+  int start = keep ? o->checkpoints[keep - 1].numnodes : 0;
+  int resync = 0;
+  if (o->resync_nodes) {
+    // Going back further would overwrite old nodes that were never set aside
+    if (start < o->aside_start) editorOutlineDropResync(o);
+  } else if (!o->error && !o->truncated && keep < had) {
+    o->resync = memAlloc(MEM_OUTLINE, sizeof(struct outlineScan) * (had - keep));
+    if (o->resync) {
+      memcpy(o->resync, &o->checkpoints[keep], sizeof(struct outlineScan) * (had - keep));
+      o->numresync = had - keep;
+      o->resync_end = *sc;
+      o->resync_nodes = sc->numnodes;
+      o->resync_rows = 0;
+      o->aside_start = start;
+      resync = 1;
+    }
+  }
+  editorOutlineRestart(o);
+  if (keep == 0) return;
+  o->numcheckpoints = keep;
+  *sc = o->checkpoints[keep - 1];
+
+  if (resync) {
+    int depth = sc->cur >= 0 ? o->nodes[sc->cur].depth + 1 : 0;
+    o->shared = memAlloc(MEM_OUTLINE, sizeof(struct outlineNode) * depth + 1);
+    o->shared_at = memAlloc(MEM_OUTLINE, sizeof(int) * depth + 1);
+    if (!o->shared || !o->shared_at) editorOutlineDropResync(o);
+    for (int c = sc->cur; o->shared && c >= 0; c = o->nodes[c].parent) {
+      o->shared[o->numshared] = o->nodes[c];
+      o->shared_at[o->numshared++] = c;
+    }
+  }
+  for (int c = sc->cur; c >= 0; c = o->nodes[c].parent) {
+    o->nodes[c].open = 1;
+    o->nodes[c].count = 0;
+  }
+  // The newest node descends from every open container: its ancestor
+  // chain gives the last surviving child of each
+  for (int n = sc->numnodes - 1; n >= 0 && o->nodes[n].parent >= 0; n = o->nodes[n].parent) {
+    struct outlineNode *p = &o->nodes[o->nodes[n].parent];
+    if (p->open && p->count == 0) p->count = o->nodes[n].ordinal + 1;
+  }
+}
+
+/**
+ * @brief Called for every change of the buffer text at (row, col). It
+ *        restarts the validation debounce, and if the outline already
+ *        scanned past that point, rewinds the outline to the last
+ *        checkpoint before it. The rescan stops at the first later
+ *        checkpoint it reaches in the same state.
+ * @param row The first changed row.
+ * @param col The first changed column in that row.
+ */
+void editorNoteEdit(int row, int col) {
+  if (row < E.saved.prefix) E.saved.prefix = row;
+  if (E.marks) {
+    if (row < E.marks->edited) E.marks->edited = row;
+    int after = E.numrows - row - 1 > 0 ? E.numrows - row - 1 : 0;
+    if (after < E.marks->after_edit) E.marks->after_edit = after;
+    E.marks->edits++;
+    E.marks->edit_ns = editorNow();
+  }
+  E.autosave_edits++;
+  if (E.diff.active && (E.curbuf == E.diff.buf[0] || E.curbuf == E.diff.buf[1])) {
+    E.diff.edits++;
+    E.diff.edit_ns = editorNow();
+  }
+  if (E.json_check) {
+    E.json_check->edits++;
+    E.json_check->edit_ns = editorNow();
+  }
+  struct jsonOutline *o = E.outline;
+  if (!o) return;
+  editorOutlineSettle(o);
+  struct outlineScan *sc = &o->scan;
+  if (sc->expect == OUTLINE_DONE || o->error || o->truncated ||
+      row < sc->row || (row == sc->row && col < sc->col))
+    editorOutlineRewind(o, row, col);
+  if (o->resync_nodes) {
+    o->edit_pending = 1;
+    o->edit_row = row;
+    o->edit_numrows = E.numrows;
+  }
+}
+
+/**
+ * @brief Advances the outline of the active buffer for at most
+ *        OUTLINE_SLICE_NS, saving a checkpoint every
+ *        OUTLINE_CHECKPOINT_BYTES of scanned text.
+ */
+void editorOutlineIdle() {
+  if (!E.outline) {
+    if (!editorIsJsonBuffer()) return;
+    E.outline = memCalloc(MEM_OUTLINE, 1, sizeof(struct jsonOutline));
+    if (!E.outline) return;
+    editorOutlineRestart(E.outline);
+  }
+  struct jsonOutline *o = E.outline;
+  struct outlineScan *sc = &o->scan;
+  editorOutlineSettle(o);
+  if (sc->expect == OUTLINE_DONE || o->error || o->truncated) return;
+
+  TRACE_BEGIN("outline");
+  long long start = editorNow();
+  int budget = 0;
+  while (sc->row < E.numrows) {
+    erow *row = &E.row[sc->row];
+    while (sc->col <= row->size) {
+      if (o->numresync && sc->row >= o->resync[0].row && editorOutlineResyncAt(o)) {
+        if (sc->expect == OUTLINE_DONE) break;
+        row = &E.row[sc->row];
+        continue;
+      }
+      if (o->since_checkpoint >= OUTLINE_CHECKPOINT_BYTES) {
+        o->checkpoints = memRealloc(MEM_OUTLINE, o->checkpoints,
+                                    sizeof(struct outlineScan) * (o->numcheckpoints + 1));
+        o->checkpoints[o->numcheckpoints++] = *sc;
+        o->since_checkpoint = 0;
+      }
+      char c = sc->col < row->size ? row->chars[sc->col] : '\n';
+      if (!editorOutlineFeed(o, c, sc->row, sc->col)) {
+        if (sc->numnodes == OUTLINE_MAX_NODES) o->truncated = 1;
+        else o->error = 1;
+        TRACE_END("outline");
+        return;
+      }
+      sc->col++;
+      o->since_checkpoint++;
+      if (sc->expect == OUTLINE_DONE) break;
+      if (++budget == 4096) {
+        budget = 0;
+        if (editorNow() - start >= OUTLINE_SLICE_NS) {
+          E.idle_busy = 1;
+          TRACE_END("outline");
+          return;
+        }
+      }
+    }
+    if (sc->expect == OUTLINE_DONE) break;
+    sc->row++;
+    sc->col = 0;
+  }
+  // Running out of rows inside a value means the text is incomplete
+  if (sc->expect != OUTLINE_DONE) o->error = 1;
+  TRACE_END("outline");
+}
+
+/**
+ * @brief Finishes the outline of the active buffer in the foreground.
+ * @return The outline, or NULL if the buffer is not a JSON file.
+ */
+struct jsonOutline *editorOutlineComplete() {
+  if (!E.outline && !editorIsJsonBuffer()) return NULL;
+  do {
+    E.idle_busy = 0;
+    editorOutlineIdle();
+  } while (E.idle_busy);
+  return E.outline;
+}
+
+/**
+ * @brief Formats the label of an outline node: its member name or array
+ *        index, then a container size or a snippet of a scalar value.
+ * @param o The outline.
+ * @param i The node index.
+ * @param buf The output buffer.
+ * @param size The size of the output buffer.
+ */
+void editorOutlineLabel(struct jsonOutline *o, int i, char *buf, int size) {
+  struct outlineNode *n = &o->nodes[i];
+  int len = snprintf(buf, size, "%*s", n->depth * 2, "");
+  if (n->key_len >= 0 && n->key_row < E.numrows) {
+    int klen = n->key_len < 40 ? n->key_len : 40;
+    len += snprintf(buf + len, size - len, "%.*s: ", klen, &E.row[n->key_row].chars[n->key_col]);
+  } else if (n->parent >= 0) {
+    len += snprintf(buf + len, size - len, "[%d]: ", n->ordinal);
+  }
+  if (len >= size) return;
+  if (n->type == '{') snprintf(buf + len, size - len, "{%d}%s", n->count, n->open ? " ..." : "");
+  else if (n->type == '[') snprintf(buf + len, size - len, "[%d]%s", n->count, n->open ? " ..." : "");
+  else if (n->row < E.numrows) {
+    erow *row = &E.row[n->row];
+    int vlen = row->size - n->col;
+    if (vlen > 40) vlen = 40;
+    const char *v = &row->chars[n->col];
+    int j = 0;
+    // Scalars end at the first delimiter outside of a string
+    if (n->type == '"') {
+      for (j = 1; j < vlen && !(v[j] == '"' && v[j - 1] != '\\'); j++);
+      if (j < vlen) j++;
+    } else {
+      while (j < vlen && v[j] != ',' && v[j] != '}' && v[j] != ']' && !isspace((unsigned char)v[j])) j++;
+    }
+    snprintf(buf + len, size - len, "%.*s", j, v);
+  }
+}
+
+/**
+ * @brief Lists the nodes shown by the outline pane: every node up to a
+ *        depth, skipping deeper subtrees as a whole.
+ * @param o The outline.
+ * @param maxdepth The deepest level shown.
+ * @param count Receives the number of visible nodes.
+ * @return The node indexes (free with memFree(MEM_OUTLINE, ...)).
+ */
+int *editorOutlineVisible(struct jsonOutline *o, int maxdepth, int *count) {
+  int n = 0, cap = 1024;
+  int *vis = memAlloc(MEM_OUTLINE, sizeof(int) * cap);
+  for (int i = 0; vis && i < o->scan.numnodes;) {
+    if (n == cap) {
+      cap *= 2;
+      int *grown = memRealloc(MEM_OUTLINE, vis, sizeof(int) * cap);
+      if (!grown) break;
+      vis = grown;
+    }
+    vis[n++] = i;
+    struct outlineNode *node = &o->nodes[i];
+    i = node->depth < maxdepth ? i + 1 : (node->open ? o->scan.numnodes : node->end);
+  }
+  *count = n;
+  return vis;
+}
+
+/**
+ * @brief Moves the cursor to the value of an outline node.
+ * @param o The outline.
+ * @param i The node index.
+ */
+void editorOutlineGoto(struct jsonOutline *o, int i) {
+  struct outlineNode *n = &o->nodes[i];
+  if (n->row >= E.numrows) return;
+  E.cy = n->row;
+  E.cx = n->col;
+  E.rowoff = E.cy > E.screenrows / 2 ? E.cy - E.screenrows / 2 : 0;
+}
+
+/**
+ * @brief Shows the JSON outline of the active buffer: keys and array
+ *        elements with the size of each object and array. The outline keeps
+ *        growing while the pane is open. Left/Right change the depth shown,
+ *        Enter jumps to the selected value, '/' jumps to a path.
+ */
+void editorOutlinePane() {
+  if (!editorIsJsonBuffer()) {
+    editorSetStatusMessage("The outline is only available for .json files");
+    return;
+  }
+  editorOutlineIdle();
+  int selected = 0, offset = 0, maxdepth = 2;
+  int numvis = 0, built_nodes = -1, built_depth = -1;
+  int *vis = NULL;
+
+  while (1) {
+    struct jsonOutline *o = E.outline;
+    if (!o) return;
+    if (o->scan.numnodes != built_nodes || maxdepth != built_depth) {
+      memFree(MEM_OUTLINE, vis);
+      vis = editorOutlineVisible(o, maxdepth, &numvis);
+      built_nodes = o->scan.numnodes;
+      built_depth = maxdepth;
+    }
+    if (selected >= numvis) selected = numvis ? numvis - 1 : 0;
+
+    struct abuf ab = ABUF_INIT;
+    abAppend(&ab, "\x1b[?25l", 6);
+    abAppend(&ab, "\x1b[2J", 4);
+    abAppend(&ab, "\x1b[H", 3);
+
+    char header[128], progress[16] = "";
+    const char *state = "complete";
+    if (o->error) state = "invalid JSON";
+    else if (o->truncated) state = "too large, truncated";
+    else if (o->scan.expect != OUTLINE_DONE) {
+      state = "scanning";
+      snprintf(progress, sizeof(progress), " %d%%", E.numrows ? (int)(100LL * o->scan.row / E.numrows) : 0);
+    }
+    snprintf(header, sizeof(header), "JSON outline: %d values, depth %d (%s%s)",
+             o->scan.numnodes, maxdepth, state, progress);
+    int header_len = strlen(header);
+    if (header_len > E.termcols) header_len = E.termcols;
+    abAppend(&ab, header, header_len);
+    abAppend(&ab, "\r\n", 2);
+
+    int display_rows = E.termrows - 2;
+    if (selected >= offset + display_rows) offset = selected - display_rows + 1;
+    if (selected < offset) offset = selected;
+
+    for (int i = 0; i < display_rows && i + offset < numvis; i++) {
+      int index = i + offset;
+      char label[256];
+      editorOutlineLabel(o, vis[index], label, sizeof(label));
+      int len = strlen(label);
+      if (len > E.termcols) len = E.termcols;
+      if (index == selected) abAppend(&ab, "\x1b[7m", 4);
+      abAppend(&ab, label, len);
+      if (index == selected) abAppend(&ab, "\x1b[m", 3);
+      abAppend(&ab, "\x1b[K", 3);
+      abAppend(&ab, "\r\n", 2);
+    }
+
+    write(E.ofd, ab.b, ab.len);
+    abFree(&ab);
+    editorInvalidateScreen();
+
+    int c = editorReadKey();
+    switch (c) {
+      case '\r':
+        if (numvis) editorOutlineGoto(o, vis[selected]);
+        memFree(MEM_OUTLINE, vis);
+        return;
+      case '/':
+        memFree(MEM_OUTLINE, vis);
+        editorOutlineJumpToPath();
+        return;
+      case ARROW_UP:
+        if (selected > 0) selected--;
+        break;
+      case ARROW_DOWN:
+        if (selected < numvis - 1) selected++;
+        break;
+      case PAGE_UP:
+        selected = selected > display_rows ? selected - display_rows : 0;
+        break;
+      case PAGE_DOWN:
+        selected += display_rows;
+        break;
+      case HOME_KEY:
+        selected = 0;
+        break;
+      case END_KEY:
+        selected = numvis ? numvis - 1 : 0;
+        break;
+      case ARROW_LEFT:
+        if (maxdepth > 0) maxdepth--;
+        break;
+      case ARROW_RIGHT:
+        maxdepth++;
+        break;
+      case '\x1b':
+        memFree(MEM_OUTLINE, vis);
+        return;
+    }
+    if (numvis && (c == ARROW_LEFT || c == ARROW_RIGHT)) {
+      // Keep the selection on the same node, or its nearest visible ancestor
+      int node = vis[selected];
+      while (o->nodes[node].depth > maxdepth) node = o->nodes[node].parent;
+      memFree(MEM_OUTLINE, vis);
+      vis = editorOutlineVisible(o, maxdepth, &numvis);
+      built_depth = maxdepth;
+      for (selected = 0; selected < numvis - 1 && vis[selected] < node; selected++);
+    }
+  }
+}
+
+/**
+ * @brief Finds the node of a path such as a.b[3].c or $.a["key"][0].
+ * @param o A complete outline.
+ * @param path The path.
+ * @return The node index, or -1 if there is no such value.
+ */
+int editorOutlineFind(struct jsonOutline *o, const char *path) {
+  if (o->scan.numnodes == 0) return -1;
+  int node = 0;
+  const char *p = path;
+  if (*p == '$') p++;
+  while (*p) {
+    struct outlineNode *n = &o->nodes[node];
+    int child = node + 1, want = -1;
+    char key[256];
+    int keylen = -1;
+    if (*p == '.') p++;
+    if (*p == '[' && isdigit((unsigned char)p[1])) {
+      want = atoi(p + 1);
+      while (*p && *p != ']') p++;
+      if (*p) p++;
+    } else if (*p == '[' && p[1] == '"') {
+      p += 2;
+      for (keylen = 0; *p && *p != '"' && keylen < (int)sizeof(key) - 1; p++) key[keylen++] = *p;
+      while (*p && *p != ']') p++;
+      if (*p) p++;
+    } else {
+      for (keylen = 0; *p && *p != '.' && *p != '[' && keylen < (int)sizeof(key) - 1; p++)
+        key[keylen++] = *p;
+    }
+    if (n->type != (want >= 0 ? '[' : '{')) return -1;
+    // Children are consecutive subtrees: hop from one to the next
+    int found = -1;
+    for (; child < n->end && child < o->scan.numnodes; child = o->nodes[child].end) {
+      struct outlineNode *ch = &o->nodes[child];
+      if (want >= 0 ? ch->ordinal == want :
+          ch->key_len == keylen && !memcmp(&E.row[ch->key_row].chars[ch->key_col], key, keylen)) {
+        found = child;
+        break;
+      }
+    }
+    if (found == -1) return -1;
+    node = found;
+  }
+  return node;
+}
+
+/**
+ * @brief Prompts for a JSON path and moves the cursor to its value.
+ */
+void editorOutlineJumpToPath() {
+  if (!editorIsJsonBuffer()) {
+    editorSetStatusMessage("JSON paths are only available for .json files");
+    return;
+  }
+  char *path = editorPrompt("JSON path: %s (e.g. a.b[3].c, ESC to cancel)", NULL);
+  if (!path) return;
+  struct jsonOutline *o = editorOutlineComplete();
+  int node = o && !o->error ? editorOutlineFind(o, path) : -1;
+  if (node >= 0) {
+    editorOutlineGoto(o, node);
+    editorSetStatusMessage("%s", path);
+  } else if (o && o->error) {
+    editorSetStatusMessage("Cannot resolve %s: the file is not valid JSON", path);
+  } else {
+    editorSetStatusMessage("No value at %s", path);
+  }
+  memFree(MEM_EDITOR, path);
+}
+
+
+/* json validation */
+
+/**
+ * @brief cJSON allocation hook of validation jobs. Fails every allocation
+ *        once the job is cancelled, which makes the parser give up right
+ *        away.
+ * @param size The size in bytes.
+ * @return Memory from the job's arena, or NULL.
+ */
+void *validateAlloc(size_t size) {
+  if (poolCancelled()) return NULL;
+  return jsonArenaAlloc(size);
+}
+
+/**
+ * @brief Frees a validation job and releases its snapshot.
+ * @param job The job.
+ */
+void editorValidateJobFree(struct validateJob *job) {
+  editorSnapshotRelease(job->snap);
+  memFree(MEM_VALIDATE, job);
+}
+
+/**
+ * @brief Runs on a pool worker: joins the snapshot's rows into one
+ *        NUL-terminated string, parses it and maps the error position
+ *        back to a row and column through the row offsets.
+ * @param pj The job.
+ */
+void editorValidateRun(struct poolJob *pj) {
+  struct validateJob *job = (struct validateJob *)pj;
+  struct bufferSnapshot *snap = job->snap;
+  TRACE_BEGIN("validate");
+  size_t len = 0;
+  for (int i = 0; i < snap->numrows; i++) len += snap->rows[i].size + 1;
+  char *text = memAlloc(MEM_VALIDATE, len + 1);
+  size_t *starts = memAlloc(MEM_VALIDATE, sizeof(size_t) * snap->numrows);
+  if (!text || !starts) {
+    memFree(MEM_VALIDATE, text);
+    memFree(MEM_VALIDATE, starts);
+    TRACE_END("validate");
+    return;
+  }
+  size_t at = 0;
+  for (int i = 0; i < snap->numrows; i++) {
+    starts[i] = at;
+    memcpy(text + at, snap->rows[i].chars, snap->rows[i].size);
+    at += snap->rows[i].size;
+    text[at++] = '\n';
+  }
+  text[at] = '\0';
+
+  struct arena arena = ARENA_INIT(MEM_VALIDATE);
+  json_arena = &arena;
+  cJSON_Hooks hooks = { validateAlloc, NULL };
+  // The terminating NUL is part of the input, so trailing garbage is an error
+  const char *end = NULL;
+  cJSON *root = cJSON_ParseWithAllocator(text, len + 1, &end, 1, &hooks);
+  if (root) {
+    job->state = JSON_VALID;
+  } else if (!poolCancelled()) {
+    size_t off = end ? (size_t)(end - text) : 0;
+    if (off >= len) off = len - 1;
+    int lo = 0, hi = snap->numrows - 1;
+    while (lo < hi) {
+      int mid = (lo + hi + 1) / 2;
+      if (starts[mid] <= off) lo = mid;
+      else hi = mid - 1;
+    }
+    job->state = JSON_INVALID;
+    job->row = lo;
+    job->col = (int)(off - starts[lo]);
+  }
+  arenaRelease(&arena);
+  json_arena = NULL;
+  memFree(MEM_VALIDATE, text);
+  memFree(MEM_VALIDATE, starts);
+  TRACE_END("validate");
+}
+
+/**
+ * @brief Runs on the main thread when a validation job finished: the
+ *        result is stored in its buffer's state unless the buffer changed
+ *        or was closed meanwhile.
+ * @param pj The job.
+ */
+void editorValidateDone(struct poolJob *pj) {
+  struct validateJob *job = (struct validateJob *)pj;
+  struct jsonCheck *jc = job->owner;
+  if (jc && jc->job == job) jc->job = NULL;
+  if (jc && job->job.cancelled) {
+    // Redo a cancelled check unless a newer snapshot was submitted since
+    if (jc->checked == job->edits) jc->checked = -1;
+  } else if (jc && job->edits == jc->edits) {
+    if (jc == E.json_check &&
+        (jc->state != job->state || jc->row != job->row || jc->col != job->col))
+      E.idle_redraw = 1;
+    jc->state = job->state;
+    jc->row = job->row;
+    jc->col = job->col;
+  }
+  editorValidateJobFree(job);
+}
+
+/**
+ * @brief Creates a validation job for a snapshot of the active buffer.
+ *        Only row pointers are copied here; the text is joined on the
+ *        worker.
+ * @return The job, or NULL if out of memory.
+ */
+struct validateJob *editorValidateSnapshot() {
+  struct validateJob *job = memCalloc(MEM_VALIDATE, 1, sizeof(struct validateJob));
+  if (!job) return NULL;
+  job->snap = editorSnapshot();
+  job->job.token = poolTokenNew();
+  if (!job->snap || !job->job.token) {
+    poolTokenRelease(job->job.token);
+    editorValidateJobFree(job);
+    return NULL;
+  }
+  job->job.run = editorValidateRun;
+  job->job.done = editorValidateDone;
+  return job;
+}
+
+/**
+ * @brief Once typing paused for VALIDATE_DEBOUNCE_NS, submits a snapshot of
+ *        the active .json buffer if it changed since it was last checked.
+ *        The buffer's previous job is cancelled: only the newest snapshot
+ *        matters.
+ */
+void editorValidateIdle() {
+  struct jsonCheck *jc = E.json_check;
+  if (!jc) {
+    if (!editorIsJsonBuffer()) return;
+    jc = E.json_check = memCalloc(MEM_VALIDATE, 1, sizeof(struct jsonCheck));
+    if (!jc) return;
+    jc->checked = -1;
+  }
+  if (jc->checked == jc->edits || editorNow() - jc->edit_ns < VALIDATE_DEBOUNCE_NS) return;
+  jc->checked = jc->edits;
+  if (E.numrows == 0) {
+    jc->state = JSON_UNCHECKED;
+    return;
+  }
+  struct validateJob *job = editorValidateSnapshot();
+  if (!job) return;
+  job->owner = jc;
+  job->edits = jc->edits;
+  if (poolSubmit(&job->job, POOL_VISIBLE) == -1) {
+    poolTokenRelease(job->job.token);
+    editorValidateJobFree(job);
+    return;
+  }
+  if (jc->job) poolTokenCancel(jc->job->job.token);
+  jc->job = job;
+}
+
+/**
+ * @brief Frees the validation state of a buffer that is closed or reloaded.
+ *        Its job, if any, is cancelled and delivers nowhere.
+ * @param jc The validation state, or NULL.
+ */
+void editorValidateForget(struct jsonCheck *jc) {
+  if (!jc) return;
+  if (jc->job) {
+    jc->job->owner = NULL;
+    poolTokenCancel(jc->job->job.token);
+  }
+  memFree(MEM_VALIDATE, jc);
+}
+
+/**
+ * @brief Tells whether a debounced check of the active buffer is pending.
+ *        Jobs already submitted are covered by poolBusy.
+ * @return 1 if busy.
+ */
+int editorValidateBusy() {
+  struct jsonCheck *jc = E.json_check;
+  return jc && jc->checked != jc->edits;
+}
+
+/* json formatting */
+
+/**
+ * @brief Merge-sorts a list of sibling items by key.
+ * @param head The first item; prev pointers are not maintained.
+ * @return The new first item.
+ */
+cJSON *editorJsonSortList(cJSON *head) {
+  if (!head || !head->next) return head;
+  cJSON *slow = head, *fast = head->next;
+  while (fast && fast->next) {
+    slow = slow->next;
+    fast = fast->next->next;
+  }
+  cJSON *b = slow->next;
+  slow->next = NULL;
+  cJSON *a = editorJsonSortList(head);
+  b = editorJsonSortList(b);
+
+  cJSON merged, *tail = &merged;
+  while (a && b) {
+    // Stable: equal keys keep their order
+    if (strcmp(a->string, b->string) <= 0) {
+      tail->next = a;
+      a = a->next;
+    } else {
+      tail->next = b;
+      b = b->next;
+    }
+    tail = tail->next;
+  }
+  tail->next = a ? a : b;
+  return merged.next;
+}
+
+/**
+ * @brief Sorts the members of every object in a tree by key.
+ * @param item The root of the tree.
+ */
+void editorJsonSortKeys(cJSON *item) {
+  for (cJSON *c = item->child; c; c = c->next) editorJsonSortKeys(c);
+  if (!cJSON_IsObject(item) || !item->child) return;
+  item->child = editorJsonSortList(item->child);
+  // cJSON keeps the last child in the first child's prev
+  cJSON *prev = NULL;
+  for (cJSON *c = item->child; c; c = c->next) {
+    if (prev) c->prev = prev;
+    prev = c;
+  }
+  item->child->prev = prev;
+}
+
+/**
+ * @brief Removes the rows [at, at + n) in one move of the row array.
+ * @param at The index of the first row.
+ * @param n The number of rows.
+ */
+void editorDelRows(int at, int n) {
+  if (at < 0 || n <= 0 || at + n > E.numrows) return;
+  editorNoteEdit(at, 0);
+  for (int j = at; j < at + n; j++) editorFreeRow(&E.row[j]);
+  memmove(&E.row[at], &E.row[at + n], sizeof(erow) * (E.numrows - at - n));
+  E.numrows -= n;
+  for (int j = at; j < E.numrows; j++) E.row[j].idx = j;
+  E.dirty++;
+}
+
+/**
+ * @brief Inserts text as rows at a position, one row per line. The row
+ *        array is grown and shifted once and every row is filled straight
+ *        from the text; the rows are rendered only once all of them are in
+ *        place, since highlighting one can cascade into the next.
+ * @param at The index of the first new row.
+ * @param s The text; lines are separated by '\n'.
+ * @param len The length of the text.
+ * @return The number of rows inserted, or -1 if the row array could not be
+ *         grown (the buffer is unchanged).
+ */
+int editorInsertRows(int at, const char *s, size_t len) {
+  if (at < 0 || at > E.numrows) return 0;
+  int n = 1;
+  for (const char *p = s; (p = memchr(p, '\n', s + len - p)); p++) n++;
+  erow *rows = memRealloc(MEM_ROWS, E.row, sizeof(erow) * (E.numrows + n));
+  if (!rows) return -1;
+  E.row = rows;
+  editorNoteEdit(at, 0);
+
+  memmove(&E.row[at + n], &E.row[at], sizeof(erow) * (E.numrows - at));
+  for (int j = at + n; j < E.numrows + n; j++) E.row[j].idx = j;
+
+  const char *line = s;
+  for (int i = 0; i < n; i++) {
+    const char *nl = memchr(line, '\n', s + len - line);
+    size_t linelen = nl ? (size_t)(nl - line) : (size_t)(s + len - line);
+    editorSetRowText(at + i, line, linelen);
+    line += linelen + 1;
+  }
+  E.numrows += n;
+  for (int i = 0; i < n; i++) editorUpdateRow(&E.row[at + i]);
+  E.dirty++;
+  return n;
+}
+
+/**
+ * @brief Reformats the selection, or the whole buffer, as JSON. The text is
+ *        parsed into an arena and printed by cJSON into a buffer that is
+ *        kept between calls, after the unchanged text before the range and
+ *        followed by the text after it; the rows of the range are then
+ *        replaced by the lines of that buffer in one bulk insertion.
+ * @param mode JSON_PRETTY, JSON_MINIFY or JSON_SORT_KEYS.
+ */
+void editorFormatJson(int mode) {
+  if (E.numrows == 0) return;
+  int sx = 0, sy = 0, ey = E.numrows - 1, ex = E.row[ey].size;
+  int selection = E.selection_active && (E.selection_start_cx != E.selection_end_cx ||
+                                         E.selection_start_cy != E.selection_end_cy);
+  if (selection) {
+    sx = E.selection_start_cx;
+    sy = E.selection_start_cy;
+    ex = E.selection_end_cx;
+    ey = E.selection_end_cy;
+    if (sy > ey || (sy == ey && sx > ex)) {
+      int t = sx; sx = ex; ex = t;
+      t = sy; sy = ey; ey = t;
+    }
+  }
+
+  size_t len = 0;
+  for (int i = sy; i <= ey; i++) len += E.row[i].size + 1;
+  char *text = memAlloc(MEM_FORMAT, len);
+  if (!text) return;
+  size_t at = 0;
+  for (int i = sy; i <= ey; i++) {
+    int from = i == sy ? sx : 0, to = i == ey ? ex : E.row[i].size;
+    memcpy(text + at, E.row[i].chars + from, to - from);
+    at += to - from;
+    if (i < ey) text[at++] = '\n';
+  }
+
+  TRACE_BEGIN("editorFormatJson");
+  struct arena arena = ARENA_INIT(MEM_FORMAT);
+  cJSON *root = editorParseJson(&arena, text, at);
+  memFree(MEM_FORMAT, text);
+  if (!root) {
+    arenaRelease(&arena);
+    TRACE_END("editorFormatJson");
+    editorSetStatusMessage("Not valid JSON%s.", selection ? " in the selection" : "");
+    return;
+  }
+  if (mode == JSON_SORT_KEYS) editorJsonSortKeys(root);
+
+  // prefix | printed JSON | suffix, grown until cJSON's output fits
+  size_t prefix = sx, suffix = E.row[ey].size - ex;
+  size_t need = prefix + suffix + (mode == JSON_MINIFY ? at : at * 2) + 64;
+  size_t outlen = 0;
+  while (1) {
+    if (E.format_cap < need) {
+      char *buf = memRealloc(MEM_FORMAT, E.format_buf, need);
+      if (!buf) break;
+      E.format_buf = buf;
+      E.format_cap = need;
+    }
+    size_t room = E.format_cap - prefix - suffix;
+    if (room > INT_MAX) room = INT_MAX;
+    if (cJSON_PrintPreallocated(root, E.format_buf + prefix, (int)room, mode != JSON_MINIFY)) {
+      outlen = strlen(E.format_buf + prefix);
+      break;
+    }
+    if (room == INT_MAX) break;
+    need = E.format_cap * 2;
+  }
+  arenaRelease(&arena);
+  if (!outlen) {
+    TRACE_END("editorFormatJson");
+    editorSetStatusMessage("JSON too large to format.");
+    return;
+  }
+  memcpy(E.format_buf, E.row[sy].chars, prefix);
+  memcpy(E.format_buf + prefix + outlen, E.row[ey].chars + ex, suffix);
+
+  // Room for the new rows is made before the old ones are deleted, so the
+  // text is left alone if it cannot be; the insertion then only shrinks it
+  char *end = E.format_buf + prefix + outlen + suffix;
+  int lines = 1;
+  for (char *p = E.format_buf; (p = memchr(p, '\n', end - p)); p++) lines++;
+  erow *rows = memRealloc(MEM_ROWS, E.row, sizeof(erow) * (E.numrows + lines));
+  if (!rows) {
+    TRACE_END("editorFormatJson");
+    editorSetStatusMessage("Out of memory formatting JSON.");
+    return;
+  }
+  E.row = rows;
+  E.selection_active = 0;
+  editorDelRows(sy, ey - sy + 1);
+  int n = editorInsertRows(sy, E.format_buf, prefix + outlen + suffix);
+  TRACE_END("editorFormatJson");
+
+  E.cy = sy;
+  E.cx = sx;
+  static const char *names[] = { "Pretty-printed", "Minified", "Sorted keys of" };
+  editorSetStatusMessage("%s JSON: %d lines.", names[mode], n);
+}
+
+/* change markers */
+
+/**
+ * @brief Finds the middle snake of two ranges of line hashes, as in
+ *        Myers' linear space diff: the forward and backward searches
+ *        meet on a diagonal run of equal lines halfway along the shortest
+ *        edit script.
+ * @param a The old lines.
+ * @param n The number of old lines.
+ * @param b The new lines.
+ * @param m The number of new lines.
+ * @param vf Forward furthest-reaching x per diagonal, offset by DIFF_MAX_COST + 1.
+ * @param vb Backward furthest-reaching distances, offset the same way.
+ * @param snake Set to the start and end of the snake: x, y, u, v.
+ * @return 0 if found, -1 if the edit cost exceeds DIFF_MAX_COST or the
+ *         job was cancelled.
+ */
+int diffMiddleSnake(const uint64_t *a, int n, const uint64_t *b, int m, int *vf, int *vb, int snake[4]) {
+  int off = DIFF_MAX_COST + 1;
+  int delta = n - m, odd = delta & 1;
+  int dmax = (n + m + 1) / 2;
+  if (dmax > DIFF_MAX_COST) dmax = DIFF_MAX_COST;
+  vf[off + 1] = 0;
+  vb[off + 1] = 0;
+  for (int d = 0; d <= dmax; d++) {
+    if (poolCancelled()) return -1;
+    for (int k = -d; k <= d; k += 2) {
+      int x = (k == -d || (k != d && vf[off + k - 1] < vf[off + k + 1])) ? vf[off + k + 1]
+                                                                          : vf[off + k - 1] + 1;
+      int y = x - k, x0 = x, y0 = y;
+      while (x < n && y < m && a[x] == b[y]) x++, y++;
+      vf[off + k] = x;
+      int c = delta - k;
+      if (odd && c >= -(d - 1) && c <= d - 1 && x + vb[off + c] >= n) {
+        snake[0] = x0, snake[1] = y0, snake[2] = x, snake[3] = y;
+        return 0;
+      }
+    }
+    for (int c = -d; c <= d; c += 2) {
+      int x = (c == -d || (c != d && vb[off + c - 1] < vb[off + c + 1])) ? vb[off + c + 1]
+                                                                          : vb[off + c - 1] + 1;
+      int y = x - c, x0 = x, y0 = y;
+      while (x < n && y < m && a[n - 1 - x] == b[m - 1 - y]) x++, y++;
+      vb[off + c] = x;
+      int k = delta - c;
+      if (!odd && k >= -d && k <= d && x + vf[off + k] >= n) {
+        snake[0] = n - x, snake[1] = m - y, snake[2] = n - x0, snake[3] = m - y0;
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Aligns two ranges of line hashes: every new line equal to an old
+ *        line of the longest common subsequence gets its index. Common
+ *        heads and tails are matched directly, the rest is split at its
+ *        middle snake. A range that costs more than DIFF_MAX_COST edits is
+ *        left unmatched.
+ * @param a The old lines.
+ * @param a0 The start of the old range.
+ * @param a1 The end of the old range.
+ * @param b The new lines.
+ * @param b0 The start of the new range.
+ * @param b1 The end of the new range.
+ * @param match Set for each matched new line to its old index; the others
+ *        keep -1.
+ * @param vf Work vector of 2 * DIFF_MAX_COST + 3 ints.
+ * @param vb Work vector of the same size.
+ */
+void diffLines(const uint64_t *a, int a0, int a1, const uint64_t *b, int b0, int b1,
+               int *match, int *vf, int *vb) {
+  while (a0 < a1 && b0 < b1 && a[a0] == b[b0]) match[b0++] = a0++;
+  while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1]) match[--b1] = --a1;
+  if (a0 == a1 || b0 == b1) return;
+
+  int snake[4];
+  if (diffMiddleSnake(a + a0, a1 - a0, b + b0, b1 - b0, vf, vb, snake) == -1) return;
+  diffLines(a, a0, a0 + snake[0], b, b0, b0 + snake[1], match, vf, vb);
+  for (int i = 0; i < snake[2] - snake[0]; i++) match[b0 + snake[1] + i] = a0 + snake[0] + i;
+  diffLines(a, a0 + snake[2], a1, b, b0 + snake[3], b1, match, vf, vb);
+}
+
+/**
+ * @brief Runs on a pool worker: diffs the old and new lines of the job's
+ *        region.
+ * @param pj The job.
+ */
+void editorDiffRun(struct poolJob *pj) {
+  struct diffJob *job = (struct diffJob *)pj;
+  int *vf = memAlloc(MEM_DIFF, sizeof(int) * (4 * DIFF_MAX_COST + 6));
+  if (!vf) return;
+  TRACE_BEGIN("diff");
+  for (int i = 0; i < job->numnew; i++) job->match[i] = -1;
+  diffLines(job->old, 0, job->numold, job->new, 0, job->numnew, job->match, vf,
+            vf + 2 * DIFF_MAX_COST + 3);
+  TRACE_END("diff");
+  memFree(MEM_DIFF, vf);
+}
+
+/**
+ * @brief Frees a diff job.
+ * @param job The job.
+ */
+void editorDiffJobFree(struct diffJob *job) {
+  memFree(MEM_DIFF, job->old);
+  memFree(MEM_DIFF, job->new);
+  memFree(MEM_DIFF, job->match);
+  memFree(MEM_DIFF, job);
+}
+
+/**
+ * @brief Sets the markers of the rows between two aligned rows, hunk by
+ *        hunk. In a hunk the first rows replacing old lines are modified,
+ *        the rest are added; a hunk with old lines but no rows marks the
+ *        row below it (the last row at the end of the buffer) as having
+ *        lines deleted.
+ * @param m The markers.
+ * @param from An aligned row, or -1 for the start of the buffer.
+ * @param to The last row to update.
+ */
+void editorMarksHunks(struct changeMarks *m, int from, int to) {
+  int a = from;
+  while (a < m->numrows && a <= to) {
+    int b = a + 1;
+    while (b < m->numrows && m->match[b] < 0) b++;
+    int rows = b - a - 1;
+    int old = (b < m->numrows ? m->match[b] : m->savedrows) - (a >= 0 ? m->match[a] : -1) - 1;
+    for (int i = 0; i < rows; i++) m->mark[a + 1 + i] = i < old ? MARK_MODIFIED : MARK_ADDED;
+    if (b < m->numrows) m->mark[b] = rows == 0 && old > 0 ? MARK_DELETED : MARK_NONE;
+    else if (rows == 0 && old > 0 && m->numrows > 0) m->mark[m->numrows - 1] = MARK_DELETED;
+    a = b;
+  }
+}
+
+/**
+ * @brief Runs on the main thread when a diff finished: splices its
+ *        alignment into the buffer's markers, unless the buffer was
+ *        edited meanwhile, in which case the region is diffed again.
+ * @param pj The job.
+ */
+void editorDiffDone(struct poolJob *pj) {
+  struct diffJob *job = (struct diffJob *)pj;
+  struct changeMarks *m = job->owner;
+  if (m) m->job = NULL;
+  if (!m || job->job.cancelled || job->edits != m->edits) {
+    editorDiffJobFree(job);
+    return;
+  }
+  int n = job->numrows, tail = m->numrows - job->old_end;
+  int *match = memAlloc(MEM_DIFF, sizeof(int) * (n ? n : 1));
+  unsigned char *mark = memAlloc(MEM_DIFF, n ? n : 1);
+  if (!match || !mark) {
+    memFree(MEM_DIFF, match);
+    memFree(MEM_DIFF, mark);
+    editorDiffJobFree(job);
+    return;
+  }
+  memcpy(match, m->match, sizeof(int) * job->start);
+  memcpy(mark, m->mark, job->start);
+  for (int i = 0; i < job->numnew; i++)
+    match[job->start + i] = job->match[i] < 0 ? -1 : job->old_first + job->match[i];
+  memcpy(match + n - tail, m->match + job->old_end, sizeof(int) * tail);
+  memcpy(mark + n - tail, m->mark + job->old_end, tail);
+  memFree(MEM_DIFF, m->match);
+  memFree(MEM_DIFF, m->mark);
+  m->match = match;
+  m->mark = mark;
+  m->numrows = n;
+  m->edited = INT_MAX;
+  m->after_edit = INT_MAX;
+  m->synced = job->edits;
+  editorMarksHunks(m, job->start - 1, n - tail);
+  E.idle_redraw = 1;
+  editorDiffJobFree(job);
+}
+
+/**
+ * @brief Once typing paused for MARKS_DEBOUNCE_NS, diffs the region of the
+ *        active buffer edited since the markers were last updated. The
+ *        region grows from the edited rows to the nearest aligned rows
+ *        before and after it, so only those rows and the old lines between
+ *        their old counterparts are diffed, on the job pool.
+ */
+void editorMarksIdle() {
+  struct changeMarks *m = E.marks;
+  if (!m || m->job || m->synced == m->edits) return;
+  if (editorNow() - m->edit_ns < MARKS_DEBOUNCE_NS) return;
+
+  if (!m->match) {
+    // Markers start out aligned with the saved text, row for row
+    m->match = memAlloc(MEM_DIFF, sizeof(int) * (m->numrows ? m->numrows : 1));
+    m->mark = memCalloc(MEM_DIFF, m->numrows ? m->numrows : 1, 1);
+    if (!m->match || !m->mark) return;
+    for (int i = 0; i < m->numrows; i++) m->match[i] = i;
+  }
+
+  // Rows before the first edit and after the last one kept their
+  // alignment; the region spans the aligned rows around the rest
+  int base = m->numrows, n = E.numrows;
+  int lo = m->edited < base ? m->edited : base;
+  if (lo > n) lo = n;
+  int tail = m->after_edit < base - lo ? m->after_edit : base - lo;
+  if (tail > n - lo) tail = n - lo;
+  int ks = lo - 1;
+  while (ks >= 0 && m->match[ks] < 0) ks--;
+  int ke = base - tail;
+  while (ke < base && m->match[ke] < 0) ke++;
+
+  struct diffJob *job = memCalloc(MEM_DIFF, 1, sizeof(struct diffJob));
+  if (!job) return;
+  job->owner = m;
+  job->edits = m->edits;
+  job->numrows = n;
+  job->start = ks + 1;
+  job->old_end = ke;
+  job->old_first = ks >= 0 ? m->match[ks] + 1 : 0;
+  job->numold = (ke < base ? m->match[ke] : m->savedrows) - job->old_first;
+  job->numnew = n - (base - ke) - job->start;
+  job->old = memAlloc(MEM_DIFF, sizeof(uint64_t) * (job->numold ? job->numold : 1));
+  job->new = memAlloc(MEM_DIFF, sizeof(uint64_t) * (job->numnew ? job->numnew : 1));
+  job->match = memAlloc(MEM_DIFF, sizeof(int) * (job->numnew ? job->numnew : 1));
+  job->job.token = poolTokenNew();
+  if (!job->old || !job->new || !job->match || !job->job.token) {
+    poolTokenRelease(job->job.token);
+    editorDiffJobFree(job);
+    return;
+  }
+  memcpy(job->old, E.saved.hash + job->old_first, sizeof(uint64_t) * job->numold);
+  for (int i = 0; i < job->numnew; i++) job->new[i] = E.row[job->start + i].hash;
+  job->job.run = editorDiffRun;
+  job->job.done = editorDiffDone;
+  if (poolSubmit(&job->job, POOL_VISIBLE) == -1) {
+    poolTokenRelease(job->job.token);
+    editorDiffJobFree(job);
+    return;
+  }
+  m->job = job;
+  m->synced = m->edits;
+}
+
+/**
+ * @brief Resets the markers of the active buffer after it was loaded or
+ *        saved: every row is aligned with its saved line again.
+ */
+void editorMarksReset() {
+  editorMarksForget(E.marks);
+  E.marks = memCalloc(MEM_DIFF, 1, sizeof(struct changeMarks));
+  if (!E.marks) return;
+  E.marks->numrows = E.numrows;
+  E.marks->savedrows = E.numrows;
+  E.marks->edited = INT_MAX;
+  E.marks->after_edit = INT_MAX;
+}
+
+/**
+ * @brief Frees the markers of a buffer that is closed or reset. Its diff
+ *        job, if any, is cancelled and delivers nowhere.
+ * @param m The markers, or NULL.
+ */
+void editorMarksForget(struct changeMarks *m) {
+  if (!m) return;
+  if (m->job) {
+    m->job->owner = NULL;
+    poolTokenCancel(m->job->job.token);
+  }
+  memFree(MEM_DIFF, m->match);
+  memFree(MEM_DIFF, m->mark);
+  memFree(MEM_DIFF, m);
+}
+
+/**
+ * @brief Returns the change marker of a row of the active buffer. Rows
+ *        edited since the last diff keep their previous marker until the
+ *        next one.
+ * @param at The row index.
+ * @return MARK_NONE, MARK_ADDED, MARK_MODIFIED or MARK_DELETED.
+ */
+int editorRowMark(int at) {
+  struct changeMarks *m = E.marks;
+  if (!m || !m->mark || !E.filename || at >= m->numrows) return MARK_NONE;
+  return m->mark[at];
+}
+
+/**
+ * @brief Tells whether the markers of the active buffer are behind its
+ *        text: edits not diffed yet or a diff still running.
+ * @return 1 if busy.
+ */
+int editorMarksBusy() {
+  struct changeMarks *m = E.marks;
+  return m && (m->job || m->synced != m->edits);
+}
+
+/* diff mode */
+
+/**
+ * @brief Finds the slot of a line hash in the occurrence table of
+ *        diffHistogram().
+ * @param key The line hashes of the slots.
+ * @param count The occurrences of each slot, 0 for a free slot.
+ * @param size The number of slots, a power of two.
+ * @param h The line hash.
+ * @return The slot holding h, or the free slot where it belongs.
+ */
+int diffSlot(const uint64_t *key, const int *count, int size, uint64_t h) {
+  int at = (int)((h ^ (h >> 29)) & (uint64_t)(size - 1));
+  while (count[at] && key[at] != h) at = (at + 1) & (size - 1);
+  return at;
+}
+
+/**
+ * @brief Aligns two lists of line hashes with the histogram diff. In each
+ *        range the common region seeded by the line occurring least often
+ *        in the old range (the longest one on ties) is matched, then the
+ *        ranges before and after it are aligned the same way. Ranges
+ *        where every line occurs more than HISTOGRAM_MAX_CHAIN times fall
+ *        back to diffLines(). Ranges wait on an explicit stack, so long
+ *        files cannot overflow the worker's stack.
+ * @param a The old lines.
+ * @param numa The number of old lines.
+ * @param b The new lines.
+ * @param numb The number of new lines.
+ * @param match Set for each matched new line to its old index; the others
+ *        keep -1.
+ * @return 0 on success, -1 if out of memory or cancelled.
+ */
+int diffHistogram(const uint64_t *a, int numa, const uint64_t *b, int numb, int *match) {
+  int cap = 2;
+  while (cap < 2 * numa) cap <<= 1;
+  int stackcap = 64, numstack = 0, ret = 0;
+  uint64_t *key = memAlloc(MEM_DIFF, sizeof(uint64_t) * cap);
+  int *count = memAlloc(MEM_DIFF, sizeof(int) * cap);
+  int *head = memAlloc(MEM_DIFF, sizeof(int) * cap);
+  int *next = memAlloc(MEM_DIFF, sizeof(int) * (numa ? numa : 1));
+  int *vf = memAlloc(MEM_DIFF, sizeof(int) * (4 * DIFF_MAX_COST + 6));
+  int *stack = memAlloc(MEM_DIFF, sizeof(int) * 4 * stackcap);
+  if (!key || !count || !head || !next || !vf || !stack) {
+    ret = -1;
+    goto out;
+  }
+  stack[0] = 0, stack[1] = numa, stack[2] = 0, stack[3] = numb;
+  numstack = 1;
+
+  while (numstack > 0) {
+    numstack--;
+    int a0 = stack[numstack * 4], a1 = stack[numstack * 4 + 1];
+    int b0 = stack[numstack * 4 + 2], b1 = stack[numstack * 4 + 3];
+    if (poolCancelled()) {
+      ret = -1;
+      break;
+    }
+    while (a0 < a1 && b0 < b1 && a[a0] == b[b0]) match[b0++] = a0++;
+    while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1]) match[--b1] = --a1;
+    if (a0 == a1 || b0 == b1) continue;
+
+    // Occurrences of each old line, chained from the last one back
+    int size = 2;
+    while (size < 2 * (a1 - a0)) size <<= 1;
+    memset(count, 0, sizeof(int) * size);
+    for (int i = a0; i < a1; i++) {
+      int at = diffSlot(key, count, size, a[i]);
+      if (!count[at]) key[at] = a[i], head[at] = -1;
+      count[at]++;
+      next[i] = head[at];
+      head[at] = i;
+    }
+
+    int best = HISTOGRAM_MAX_CHAIN + 1, best_len = 0, as = 0, bs = 0;
+    for (int j = b0; j < b1;) {
+      int at = diffSlot(key, count, size, b[j]);
+      int nj = j + 1;
+      if (count[at] && count[at] <= best) {
+        for (int i = head[at]; i >= 0; i = next[i]) {
+          int ra = i, rb = j, ea = i + 1, eb = j + 1, low = count[at];
+          while (ra > a0 && rb > b0 && a[ra - 1] == b[rb - 1]) {
+            ra--, rb--;
+            int c = count[diffSlot(key, count, size, a[ra])];
+            if (c < low) low = c;
+          }
+          while (ea < a1 && eb < b1 && a[ea] == b[eb]) {
+            int c = count[diffSlot(key, count, size, a[ea])];
+            if (c < low) low = c;
+            ea++, eb++;
+          }
+          if (eb > nj) nj = eb;
+          if (low < best || (low == best && ea - ra > best_len)) {
+            best = low;
+            best_len = ea - ra;
+            as = ra;
+            bs = rb;
+          }
+        }
+      }
+      j = nj;
+    }
+
+    if (!best_len) {
+      diffLines(a, a0, a1, b, b0, b1, match, vf, vf + 2 * DIFF_MAX_COST + 3);
+      continue;
+    }
+    for (int k = 0; k < best_len; k++) match[bs + k] = as + k;
+    if (numstack + 2 > stackcap) {
+      int *ns = memRealloc(MEM_DIFF, stack, sizeof(int) * 4 * stackcap * 2);
+      if (!ns) {
+        ret = -1;
+        break;
+      }
+      stack = ns;
+      stackcap *= 2;
+    }
+    int *r = &stack[numstack * 4];
+    r[0] = as + best_len, r[1] = a1, r[2] = bs + best_len, r[3] = b1;
+    r[4] = a0, r[5] = as, r[6] = b0, r[7] = bs;
+    numstack += 2;
+  }
+
+out:
+  memFree(MEM_DIFF, key);
+  memFree(MEM_DIFF, count);
+  memFree(MEM_DIFF, head);
+  memFree(MEM_DIFF, next);
+  memFree(MEM_DIFF, vf);
+  memFree(MEM_DIFF, stack);
+  return ret;
+}
+
+/**
+ * @brief Returns the rows of one side of the diff, wherever its buffer
+ *        is currently kept.
+ * @param side 0 for the left buffer, 1 for the right one.
+ * @param numrows Set to the number of rows.
+ * @return The rows.
+ */
+erow *editorDiffRows(int side, int *numrows) {
+  int b = E.diff.buf[side];
+  if (b == E.curbuf) {
+    *numrows = E.numrows;
+    return E.row;
+  }
+  *numrows = E.buffers[b].numrows;
+  return E.buffers[b].row;
+}
+
+/**
+ * @brief Runs on a pool worker: aligns the two sides of the diff.
+ * @param pj The job.
+ */
+void editorSideDiffRun(struct poolJob *pj) {
+  struct sideDiffJob *job = (struct sideDiffJob *)pj;
+  TRACE_BEGIN("diff");
+  for (int i = 0; i < job->numnew; i++) job->match[i] = -1;
+  diffHistogram(job->old, job->numold, job->new, job->numnew, job->match);
+  TRACE_END("diff");
+}
+
+/**
+ * @brief Frees a side by side diff job.
+ * @param job The job.
+ */
+void editorSideDiffFree(struct sideDiffJob *job) {
+  memFree(MEM_DIFF, job->old);
+  memFree(MEM_DIFF, job->new);
+  memFree(MEM_DIFF, job->match);
+  memFree(MEM_DIFF, job);
+}
+
+/**
+ * @brief Runs on the main thread when the sides were aligned: lays out
+ *        the display lines. Each hunk pairs its rows of both sides line by
+ *        line and pads the shorter side with filler, so the matched rows
+ *        after it are drawn side by side again.
+ * @param pj The job.
+ */
+void editorSideDiffDone(struct poolJob *pj) {
+  struct sideDiffJob *job = (struct sideDiffJob *)pj;
+  struct diffView *dv = &E.diff;
+  if (dv->job == job) dv->job = NULL;
+  if (job->job.cancelled || !dv->active || job->edits != dv->edits) {
+    editorSideDiffFree(job);
+    return;
+  }
+  int na = job->numold, nb = job->numnew, cap = na + nb ? na + nb : 1;
+  int *line0 = memAlloc(MEM_DIFF, sizeof(int) * cap);
+  int *line1 = memAlloc(MEM_DIFF, sizeof(int) * cap);
+  int *at0 = memAlloc(MEM_DIFF, sizeof(int) * (na + 1));
+  int *at1 = memAlloc(MEM_DIFF, sizeof(int) * (nb + 1));
+  unsigned char *kind = memAlloc(MEM_DIFF, cap);
+  if (!line0 || !line1 || !at0 || !at1 || !kind) {
+    memFree(MEM_DIFF, line0);
+    memFree(MEM_DIFF, line1);
+    memFree(MEM_DIFF, at0);
+    memFree(MEM_DIFF, at1);
+    memFree(MEM_DIFF, kind);
+    editorSideDiffFree(job);
+    return;
+  }
+
+  int d = 0, i = 0, jn = 0, hunks = 0;
+  for (int j = 0; j <= nb; j++) {
+    if (j < nb && job->match[j] < 0) continue;
+    int ai = j < nb ? job->match[j] : na;
+    int u = ai - i, v = j - jn;
+    if (u || v) hunks++;
+    for (int k = 0; k < u || k < v; k++, d++) {
+      line0[d] = k < u ? i + k : -1;
+      line1[d] = k < v ? jn + k : -1;
+      kind[d] = k < u && k < v ? DIFF_CHANGED : DIFF_ONLY;
+      if (k < u) at0[i + k] = d;
+      if (k < v) at1[jn + k] = d;
+    }
+    i = ai;
+    jn = j;
+    if (j < nb) {
+      line0[d] = i;
+      line1[d] = j;
+      kind[d] = DIFF_SAME;
+      at0[i++] = d;
+      at1[jn++] = d++;
+    }
+  }
+  at0[na] = d;
+  at1[nb] = d;
+
+  int first = dv->line[0] == NULL;
+  memFree(MEM_DIFF, dv->line[0]);
+  memFree(MEM_DIFF, dv->line[1]);
+  memFree(MEM_DIFF, dv->at[0]);
+  memFree(MEM_DIFF, dv->at[1]);
+  memFree(MEM_DIFF, dv->kind);
+  dv->line[0] = line0;
+  dv->line[1] = line1;
+  dv->at[0] = at0;
+  dv->at[1] = at1;
+  dv->kind = kind;
+  dv->numrows[0] = na;
+  dv->numrows[1] = nb;
+  dv->numlines = d;
+  dv->hunks = hunks;
+  if (dv->top >= d) dv->top = d ? d - 1 : 0;
+  E.idle_redraw = 1;
+  if (first) editorSetStatusMessage("%d hunk%s", hunks, hunks == 1 ? "" : "s");
+  editorSideDiffFree(job);
+}
+
+/**
+ * @brief Once typing paused, aligns the two sides of the diff again on the
+ *        job pool if either changed. The first alignment starts right away.
+ */
+void editorDiffIdle() {
+  struct diffView *dv = &E.diff;
+  if (!dv->active) return;
+  if (dv->job || dv->synced == dv->edits) return;
+  if (editorNow() - dv->edit_ns < MARKS_DEBOUNCE_NS) return;
+  if (!E.buffers[dv->buf[0]].loaded || !E.buffers[dv->buf[1]].loaded) return;
+
+  struct sideDiffJob *job = memCalloc(MEM_DIFF, 1, sizeof(struct sideDiffJob));
+  if (!job) return;
+  erow *old = editorDiffRows(0, &job->numold), *new = editorDiffRows(1, &job->numnew);
+  job->edits = dv->edits;
+  job->old = memAlloc(MEM_DIFF, sizeof(uint64_t) * (job->numold ? job->numold : 1));
+  job->new = memAlloc(MEM_DIFF, sizeof(uint64_t) * (job->numnew ? job->numnew : 1));
+  job->match = memAlloc(MEM_DIFF, sizeof(int) * (job->numnew ? job->numnew : 1));
+  job->job.token = poolTokenNew();
+  if (!job->old || !job->new || !job->match || !job->job.token) {
+    poolTokenRelease(job->job.token);
+    editorSideDiffFree(job);
+    return;
+  }
+  for (int i = 0; i < job->numold; i++) job->old[i] = old[i].hash;
+  for (int i = 0; i < job->numnew; i++) job->new[i] = new[i].hash;
+  job->job.run = editorSideDiffRun;
+  job->job.done = editorSideDiffDone;
+  if (poolSubmit(&job->job, POOL_VISIBLE) == -1) {
+    poolTokenRelease(job->job.token);
+    editorSideDiffFree(job);
+    return;
+  }
+  dv->job = job;
+  dv->synced = dv->edits;
+}
+
+/**
+ * @brief Tells whether the diff is behind the text of its buffers.
+ * @return 1 if busy.
+ */
+int editorDiffBusy() {
+  struct diffView *dv = &E.diff;
+  return dv->active && (dv->job || dv->synced != dv->edits);
+}
+
+/**
+ * @brief Shows the first two buffers side by side as a diff: the window is
+ *        split vertically with the first buffer on the left and the second
+ *        on the right.
+ */
+void editorDiffStart() {
+  editorSplitWindow(LAYOUT_VSPLIT);
+  editorSwitchBuffer(1);
+  struct diffView *dv = &E.diff;
+  dv->active = 1;
+  dv->buf[0] = 0;
+  dv->buf[1] = 1;
+  dv->win[0] = 0;
+  dv->win[1] = 1;
+  dv->edits = 1;
+  editorNextWindow();
+}
+
+/**
+ * @brief Leaves diff mode, e.g. when one of its windows or buffers is
+ *        closed. Both panes become ordinary windows.
+ */
+void editorDiffEnd() {
+  struct diffView *dv = &E.diff;
+  if (!dv->active) return;
+  if (dv->job) poolTokenCancel(dv->job->job.token);
+  for (int s = 0; s < 2; s++) {
+    memFree(MEM_DIFF, dv->line[s]);
+    memFree(MEM_DIFF, dv->at[s]);
+  }
+  memFree(MEM_DIFF, dv->kind);
+  memset(dv, 0, sizeof(*dv));
+}
+
+/**
+ * @brief Tells which side of the diff the current pane shows.
+ * @return 0 or 1, or -1 if the pane is not a diff pane (or the sides were
+ *         not aligned yet).
+ */
+int editorDiffSide() {
+  struct diffView *dv = &E.diff;
+  if (!dv->active || !dv->line[0]) return -1;
+  for (int s = 0; s < 2; s++)
+    if (E.curwin == dv->win[s] && E.curbuf == dv->buf[s]) return s;
+  return -1;
+}
+
+/**
+ * @brief Returns the display line of a row of one side. Rows added since
+ *        the last alignment map past its end.
+ * @param side The side.
+ * @param row The row.
+ * @return The display line.
+ */
+int editorDiffLineOf(int side, int row) {
+  struct diffView *dv = &E.diff;
+  return row <= dv->numrows[side] ? dv->at[side][row] : dv->numlines;
+}
+
+/**
+ * @brief Scrolls both diff panes together so the cursor of the active one
+ *        stays visible. Called with the active window loaded.
+ */
+void editorDiffScroll() {
+  int side = editorDiffSide();
+  if (side < 0) return;
+  int line = editorDiffLineOf(side, E.cy);
+  if (line < E.diff.top) E.diff.top = line;
+  if (line >= E.diff.top + E.screenrows) E.diff.top = line - E.screenrows + 1;
+}
+
+/**
+ * @brief Returns the display line of the cursor in a diff pane.
+ * @return The line, or -1 outside diff panes.
+ */
+int editorDiffCursorLine() {
+  int side = editorDiffSide();
+  return side < 0 ? -1 : editorDiffLineOf(side, E.cy);
+}
+
+/**
+ * @brief Moves the cursor of a diff pane to the row on a display line, or
+ *        the next row below it if the line is filler on this side.
+ * @param line The display line.
+ */
+void editorDiffFollow(int line) {
+  int side = editorDiffSide();
+  if (side < 0) return;
+  struct diffView *dv = &E.diff;
+  while (line < dv->numlines && dv->line[side][line] < 0) line++;
+  E.cy = line < dv->numlines ? dv->line[side][line] : dv->numrows[side];
+  if (E.cy > E.numrows) E.cy = E.numrows;
+  int rowlen = E.cy < E.numrows ? E.row[E.cy].size : 0;
+  if (E.cx > rowlen) E.cx = rowlen;
+}
+
+/**
+ * @brief Returns the row drawn on a line of the current pane.
+ * @param y The line of the pane.
+ * @return The row, E.numrows or more past the end, or -1 for diff filler.
+ */
+int editorPaneRow(int y) {
+  int side = editorDiffSide();
+  if (side < 0) return y + E.rowoff;
+  struct diffView *dv = &E.diff;
+  int d = dv->top + y;
+  if (d >= dv->numlines) return E.numrows;
+  int row = dv->line[side][d];
+  return row < E.numrows ? row : E.numrows;
+}
+
+/**
+ * @brief Returns the pane line of the cursor.
+ * @return The line.
+ */
+int editorPaneCursorRow() {
+  int side = editorDiffSide();
+  if (side < 0) return E.cy - E.rowoff;
+  return editorDiffLineOf(side, E.cy) - E.diff.top;
+}
+
+/**
+ * @brief Returns the background of a diff pane line and, for a changed
+ *        row, the render span that differs from the row paired with it.
+ *        The span is the part left once the common head and tail of both
+ *        rows are taken off, worked out only for the rows drawn.
+ * @param side The side of the pane.
+ * @param y The line of the pane.
+ * @param row The row drawn on it.
+ * @param start Set to the render index where the changed span starts.
+ * @param end Set to the render index where it ends.
+ * @return The SGR background code, or 0 for unchanged rows.
+ */
+int editorDiffBackground(int side, int y, erow *row, int *start, int *end) {
+  struct diffView *dv = &E.diff;
+  int d = dv->top + y;
+  *start = *end = 0;
+  if (d >= dv->numlines || dv->kind[d] == DIFF_SAME) return 0;
+  if (dv->kind[d] == DIFF_ONLY) return side ? 42 : 41;
+
+  int numother, r = dv->line[1 - side][d];
+  erow *other = editorDiffRows(1 - side, &numother);
+  if (r < 0 || r >= numother) return 44;
+  other = &other[r];
+  int min = row->size < other->size ? row->size : other->size;
+  int head = 0, tail = 0;
+  while (head < min && row->chars[head] == other->chars[head]) head++;
+  while (head > 0 && ((unsigned char)row->chars[head] & 0xC0) == 0x80) head--;
+  while (tail < min - head && row->chars[row->size - 1 - tail] == other->chars[other->size - 1 - tail]) tail++;
+  int stop = row->size - tail;
+  while (stop < row->size && ((unsigned char)row->chars[stop] & 0xC0) == 0x80) stop++;
+  *start = editorRowCxToRender(row, head);
+  *end = editorRowCxToRender(row, stop);
+  return 44;
+}
+
+/**
+ * @brief Returns what a diff pane line adds to the pane signature: its
+ *        kind and, for a changed row, the text of the row paired with it.
+ * @param side The side of the pane.
+ * @param y The line of the pane.
+ * @return The value to hash.
+ */
+uint64_t editorDiffLineHash(int side, int y) {
+  struct diffView *dv = &E.diff;
+  int d = dv->top + y;
+  if (d >= dv->numlines) return 0;
+  if (dv->kind[d] != DIFF_CHANGED) return dv->kind[d];
+  int numother, r = dv->line[1 - side][d];
+  erow *other = editorDiffRows(1 - side, &numother);
+  return r >= 0 && r < numother ? other[r].hash : DIFF_CHANGED;
+}
+
+/* autosave */
+
+/* Held by a worker while it replaces a file and by the main thread while
+ * it cancels the writes of a buffer, so a file saved explicitly is never
+ * replaced afterwards by an autosave of older text */
+static pthread_mutex_t autosave_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Hashes the text of the active buffer from its row hashes.
+ * @return The hash.
+ */
+uint64_t editorContentHash() {
+  uint64_t h = 1469598103934665603ULL ^ (uint64_t)E.numrows;
+  for (int i = 0; i < E.numrows; i++) h = (h ^ E.row[i].hash) * 1099511628211ULL;
+  return h;
+}
+
+/**
+ * @brief Writes the rows of a snapshot to a file descriptor, one line per
+ *        row, through a fixed-size chunk: memory use does not grow with
+ *        the buffer and rows longer than a chunk are written directly.
+ * @param fd The file descriptor.
+ * @param snap The snapshot.
+ * @return 0 on success, -1 on error (errno is set) or when cancelled.
+ */
+int editorWriteSnapshot(int fd, struct bufferSnapshot *snap) {
+  char chunk[AUTOSAVE_CHUNK];
+  size_t used = 0;
+  for (int i = 0; i <= snap->numrows; i++) {
+    const char *p = i < snap->numrows ? snap->rows[i].chars : NULL;
+    size_t len = i < snap->numrows ? (size_t)snap->rows[i].size : 0;
+    if (i == snap->numrows || used + len + 1 > sizeof(chunk)) {
+      for (size_t off = 0; off < used;) {
+        ssize_t n = write(fd, chunk + off, used - off);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        off += n;
+      }
+      used = 0;
+      if (i == snap->numrows) break;
+      if (poolCancelled()) return -1;
+    }
+    if (len + 1 > sizeof(chunk)) {
+      for (size_t off = 0; off < len;) {
+        ssize_t n = write(fd, p + off, len - off);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        off += n;
+      }
+      p = "";
+      len = 0;
+    }
+    memcpy(chunk + used, p, len);
+    used += len;
+    chunk[used++] = '\n';
+  }
+  return 0;
+}
+
+/**
+ * @brief Writes a snapshot over the content of an existing file, keeping
+ *        its inode: used for files with several hard links or that belong
+ *        to someone else, which a rename would split off or take over.
+ * @param path The file.
+ * @param snap The snapshot.
+ * @return 0 on success, -1 on error (errno is set) or when cancelled.
+ */
+int editorAutosaveOverwrite(const char *path, struct bufferSnapshot *snap) {
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd == -1) return -1;
+  int ret = editorWriteSnapshot(fd, snap);
+  off_t len = lseek(fd, 0, SEEK_CUR);
+  if (ret == 0 && (len == -1 || ftruncate(fd, len) == -1 || fsync(fd) == -1)) ret = -1;
+  int saved = errno;
+  close(fd);
+  errno = saved;
+  return ret;
+}
+
+/**
+ * @brief Runs on a pool worker: writes the snapshot to a temporary file
+ *        next to the target, syncs it and renames it over the target, so
+ *        a crash never leaves a half-written file behind. A file autosaved
+ *        in place is resolved through symlinks first and keeps its mode
+ *        and owner; one that cannot be replaced that way is overwritten.
+ *        Nothing is replaced once the job was cancelled by a save.
+ * @param pj The job.
+ */
+void editorAutosaveRun(struct poolJob *pj) {
+  struct autosaveJob *job = (struct autosaveJob *)pj;
+  TRACE_BEGIN("autosave");
+  char target[PATH_MAX], tmp[PATH_MAX + 16];
+  struct stat st;
+  int exists = 0;
+  if (!job->inplace || !realpath(job->path, target)) snprintf(target, sizeof(target), "%s", job->path);
+  else exists = stat(target, &st) == 0;
+
+  snprintf(tmp, sizeof(tmp), "%s.autosave~", target);
+  int fd = -1;
+  if (!exists || st.st_nlink == 1) {
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, exists ? st.st_mode & 07777 : 0600);
+    if (fd != -1 && exists && (st.st_uid != geteuid() || st.st_gid != getegid()) &&
+        fchown(fd, st.st_uid, st.st_gid) == -1) {
+      close(fd);
+      unlink(tmp);
+      fd = -1;
+    } else if (fd != -1 && exists && fchmod(fd, st.st_mode & 07777) == -1) {
+      job->err = errno;
+    } else if (fd == -1 && !exists) {
+      job->err = errno;
+    }
+  }
+
+  if (fd == -1 && !job->err) {
+    pthread_mutex_lock(&autosave_lock);
+    if (!poolCancelled() && editorAutosaveOverwrite(target, job->snap) == -1) job->err = errno ? errno : EINTR;
+    pthread_mutex_unlock(&autosave_lock);
+  } else if (fd != -1) {
+    if (!job->err && (editorWriteSnapshot(fd, job->snap) == -1 || fsync(fd) == -1))
+      job->err = errno ? errno : EINTR;
+    if (close(fd) == -1 && !job->err) job->err = errno;
+    pthread_mutex_lock(&autosave_lock);
+    int replaced = !job->err && !poolCancelled();
+    if (replaced && rename(tmp, target) == -1) {
+      job->err = errno;
+      replaced = 0;
+    }
+    pthread_mutex_unlock(&autosave_lock);
+    if (!replaced) unlink(tmp);
+  }
+  TRACE_END("autosave");
+}
+
+/**
+ * @brief Marks a buffer autosaved in place as saved, if its text is still
+ *        the text that was written.
+ * @param as The autosave state of the buffer.
+ * @param hash The content hash of the text written.
+ */
+void editorAutosaveSaved(struct autosaveState *as, uint64_t hash) {
+  if (E.autosave == as) {
+    if (editorContentHash() == hash) {
+      editorResetLineEndings();
+      editorSavedCapture();
+    }
+    return;
+  }
+  for (int i = 0; i < E.numbuffers; i++) {
+    if (E.buffers[i].autosave != as) continue;
+    int cur = E.curbuf;
+    editorBufferStash();
+    editorBufferRestore(i);
+    if (editorContentHash() == hash) {
+      editorResetLineEndings();
+      editorSavedCapture();
+    }
+    editorBufferStash();
+    editorBufferRestore(cur);
+    return;
+  }
+}
+
+/**
+ * @brief Runs on the main thread when an autosave finished: releases its
+ *        snapshot and remembers what was written.
+ * @param pj The job.
+ */
+void editorAutosaveDone(struct poolJob *pj) {
+  struct autosaveJob *job = (struct autosaveJob *)pj;
+  struct autosaveState *as = job->owner;
+  if (as) as->job = NULL;
+  if (job->err && !job->job.cancelled) {
+    editorSetStatusMessage("Autosave of %s failed: %s", job->path, strerror(job->err));
+  } else if (as && !job->job.cancelled) {
+    as->hash = job->hash;
+    if (job->inplace) editorAutosaveSaved(as, job->hash);
+  }
+  editorSnapshotRelease(job->snap);
+  memFree(MEM_SNAPSHOT, job->path);
+  memFree(MEM_SNAPSHOT, job);
+}
+
+/**
+ * @brief Cancels the write in flight of a buffer, if any. Once this
+ *        returns the write no longer replaces its file.
+ * @param as The autosave state, or NULL.
+ */
+void editorAutosaveCancel(struct autosaveState *as) {
+  if (!as || !as->job) return;
+  pthread_mutex_lock(&autosave_lock);
+  poolTokenCancel(as->job->job.token);
+  pthread_mutex_unlock(&autosave_lock);
+}
+
+/**
+ * @brief Frees the autosave state of a buffer that is closed or reloaded.
+ *        A write still running completes but is not remembered.
+ * @param as The autosave state, or NULL.
+ */
+void editorAutosaveForget(struct autosaveState *as) {
+  if (!as) return;
+  if (as->job) as->job->owner = NULL;
+  memFree(MEM_SNAPSHOT, as);
+}
+
+/**
+ * @brief Returns where the active buffer is autosaved: the file itself, or
+ *        a file in the backup directory named after its absolute path with
+ *        '/' replaced by '%'.
+ * @return The path (freed with memFree(MEM_SNAPSHOT)), or NULL if it
+ *         cannot be built.
+ */
+char *editorAutosavePath() {
+  if (E.autosave_inplace) return memStrdup(MEM_SNAPSHOT, E.filename);
+  char dir[PATH_MAX], abs[2 * PATH_MAX + 2];
+  if (E.autosave_dir) snprintf(dir, sizeof(dir), "%s", E.autosave_dir);
+  else if (editorStatePath(dir, sizeof(dir), "autosave") == -1) return NULL;
+  mkdir(dir, 0700);
+  if (E.filename[0] == '/') snprintf(abs, sizeof(abs), "%s", E.filename);
+  else {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) return NULL;
+    snprintf(abs, sizeof(abs), "%s/%s", cwd, E.filename);
+  }
+  for (char *p = abs; *p; p++)
+    if (*p == '/') *p = '%';
+  size_t len = strlen(dir) + strlen(abs) + 2;
+  char *path = memAlloc(MEM_SNAPSHOT, len);
+  if (path) snprintf(path, len, "%s/%s", dir, abs);
+  return path;
+}
+
+/**
+ * @brief Autosaves the active buffer if it is modified and its text
+ *        differs from what was autosaved last. Only a snapshot is taken
+ *        here; the text is written by a pool worker.
+ * @return 0 if done or nothing to do, -1 if an earlier write of the buffer
+ *         is still running.
+ */
+int editorAutosaveBuffer() {
+  if (!E.filename || !editorIsDirty()) return 0;
+  if (E.autosave && E.autosave->job) return -1;
+  uint64_t hash = editorContentHash();
+  if (E.autosave && E.autosave->hash == hash) return 0;
+  if (!E.autosave && !(E.autosave = memCalloc(MEM_SNAPSHOT, 1, sizeof(struct autosaveState)))) return 0;
+
+  struct autosaveJob *job = memCalloc(MEM_SNAPSHOT, 1, sizeof(struct autosaveJob));
+  if (!job) return 0;
+  job->path = editorAutosavePath();
+  job->snap = editorSnapshot();
+  if (!job->path || !job->snap) {
+    if (job->snap) editorSnapshotRelease(job->snap);
+    memFree(MEM_SNAPSHOT, job->path);
+    memFree(MEM_SNAPSHOT, job);
+    return 0;
+  }
+  job->owner = E.autosave;
+  job->hash = hash;
+  job->inplace = E.autosave_inplace;
+  job->job.run = editorAutosaveRun;
+  job->job.done = editorAutosaveDone;
+  job->job.token = poolTokenNew();
+  if (!job->job.token || poolSubmit(&job->job, POOL_BACKGROUND) == -1) {
+    poolTokenRelease(job->job.token);
+    editorSnapshotRelease(job->snap);
+    memFree(MEM_SNAPSHOT, job->path);
+    memFree(MEM_SNAPSHOT, job);
+    return 0;
+  }
+  E.autosave->job = job;
+  return 0;
+}
+
+/**
+ * @brief Every autosave period, autosaves the buffers edited since the
+ *        last period. Without edits in between the period costs nothing.
+ */
+void editorAutosaveIdle() {
+  if (!E.autosave_ns) return;
+  long long now = editorNow();
+  if (now < E.autosave_next) return;
+  E.autosave_next = now + E.autosave_ns;
+  if (E.autosave_synced == E.autosave_edits) return;
+
+  int cur = E.curbuf, again = 0;
+  editorBufferStash();
+  for (int i = 0; i < E.numbuffers; i++) {
+    if (!E.buffers[i].loaded) continue;
+    editorBufferRestore(i);
+    if (editorAutosaveBuffer() == -1) again = 1;
+    editorBufferStash();
+  }
+  editorBufferRestore(cur);
+  if (!again) E.autosave_synced = E.autosave_edits;
+}
+
+/**
+ * @brief Tells whether edits are waiting for the next autosave period.
+ * @return 1 if busy.
+ */
+int editorAutosaveBusy() {
+  return E.autosave_ns && E.autosave_synced != E.autosave_edits;
+}
+
+/* tasks */
+
+/**
+ * @brief Queues a task; it runs in slices while the editor waits for
+ *        input. The caller keeps ownership of the task until its finish()
+ *        callback ran.
+ * @param task The task, with name, step and finish set.
+ */
+void editorTaskStart(struct editorTask *task) {
+  task->next = NULL;
+  task->shown = -1;
+  struct editorTask **p = &E.tasks;
+  while (*p) p = &(*p)->next;
+  *p = task;
+}
+
+/**
+ * @brief Removes a task from the queue and calls its finish() callback.
+ * @param task The task.
+ * @param cancelled 1 if the task was cancelled.
+ */
+void editorTaskFinish(struct editorTask *task, int cancelled) {
+  for (struct editorTask **p = &E.tasks; *p; p = &(*p)->next) {
+    if (*p == task) {
+      *p = task->next;
+      break;
+    }
+  }
+  if (task->finish) task->finish(task, cancelled);
+}
+
+/**
+ * @brief Runs queued tasks for at most TASK_SLICE_NS. Tasks take turns:
+ *        the one that just ran goes to the back of the queue. While tasks
+ *        are left E.idle_busy is set, and a redraw is requested when the
+ *        progress shown in the status bar changed.
+ */
+void editorTasksRun() {
+  if (!E.tasks) return;
+  long long deadline = editorNow() + TASK_SLICE_NS;
+  do {
+    struct editorTask *task = E.tasks;
+    TRACE_BEGIN(task->name);
+    int state = task->step(task, deadline);
+    TRACE_END(task->name);
+    if (state == TASK_DONE) {
+      editorTaskFinish(task, 0);
+    } else if (task->next) {
+      E.tasks = task->next;
+      task->next = NULL;
+      struct editorTask *last = E.tasks;
+      while (last->next) last = last->next;
+      last->next = task;
+    }
+  } while (E.tasks && editorNow() < deadline);
+  if (E.tasks) E.idle_busy = 1;
+
+  int percent = E.tasks ? editorTaskPercent(E.tasks) : -1;
+  if (!E.tasks || percent != E.tasks->shown) {
+    if (E.tasks) E.tasks->shown = percent;
+    E.idle_redraw = 1;
+  }
+}
+
+/**
+ * @brief Returns the progress of a task.
+ * @param task The task.
+ * @return The progress in percent.
+ */
+int editorTaskPercent(struct editorTask *task) {
+  if (task->total <= 0) return 0;
+  return (int)(task->done * 100 / task->total);
+}
+
+/**
+ * @brief Cancels the newest task, when Esc is pressed while tasks run.
+ * @return 1 if a task was cancelled, 0 if there was none.
+ */
+int editorTaskCancel() {
+  struct editorTask *task = E.tasks;
+  if (!task) return 0;
+  while (task->next) task = task->next;
+  editorSetStatusMessage("%s cancelled", task->name);
+  editorTaskFinish(task, 1);
+  return 1;
+}
+
+/* sessions */
+
+#define WEE_SESSION_MAGIC "WSES"
+#define WEE_SESSION_VERSION 1
+
+/*
+ * A session file is a header, a table of fixed-size buffer entries and a
+ * string pool. Offsets are relative to the start of the file. The file is
+ * mmapped on restore and each entry is only decoded when its buffer loads.
+ */
+struct sessionHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t numentries;
+  uint32_t active;
+  uint32_t linenumbers;
+  uint32_t clipboard_off, clipboard_len;
+  uint32_t query_off, query_len;
+};
+
+struct sessionEntry {
+  uint32_t path_off, path_len;
+  int32_t cx, cy;
+  int32_t rowoff, coloff;
+  int32_t selection_start_cx, selection_start_cy;
+  int32_t selection_end_cx, selection_end_cy;
+  int32_t selection_active;
+};
+
+/**
+ * @brief Builds the path of a session file (~/.wee/sessions/<name>.wss).
+ * @param buf The buffer receiving the path.
+ * @param bufsize The size of the buffer.
+ * @param name The session name.
+ * @return 0 on success, -1 if HOME is not set.
+ */
+int editorSessionPath(char *buf, size_t bufsize, const char *name) {
+  if (editorStatePath(buf, bufsize, "sessions") == -1) return -1;
+  mkdir(buf, 0700);
+  size_t len = strlen(buf);
+  snprintf(buf + len, bufsize - len, "/%s.wss", name);
+  return 0;
+}
+
+/**
+ * @brief Returns the entry of a buffer in the mapped session file.
+ * @param at The index of the entry.
+ * @return A pointer into the mapping.
+ */
+struct sessionEntry *editorSessionEntry(int at) {
+  return (struct sessionEntry *)(E.session_map + sizeof(struct sessionHeader)) + at;
+}
+
+/**
+ * @brief Unmaps the session file once no buffer needs it anymore.
+ */
+void editorSessionRelease() {
+  if (!E.session_map) return;
+  for (int i = 0; i < E.numbuffers; i++)
+    if (E.buffers[i].session_entry >= 0) return;
+  munmap(E.session_map, E.session_len);
+  E.session_map = NULL;
+  E.session_len = 0;
+}
+
+/**
+ * @brief Restores the cursor, scroll offsets and selection of the active
+ *        buffer from its session entry, right after the buffer was loaded.
+ */
+void editorSessionApply() {
+  struct editorBuffer *b = &E.buffers[E.curbuf];
+  struct sessionEntry *se = editorSessionEntry(b->session_entry);
+  b->session_entry = -1;
+
+  E.cy = se->cy;
+  if (E.cy > E.numrows) E.cy = E.numrows;
+  if (E.cy < 0) E.cy = 0;
+  int rowlen = E.cy < E.numrows ? E.row[E.cy].size : 0;
+  E.cx = se->cx;
+  if (E.cx > rowlen) E.cx = rowlen;
+  if (E.cx < 0) E.cx = 0;
+  E.rowoff = se->rowoff < 0 || se->rowoff > E.cy ? E.cy : se->rowoff;
+  E.coloff = se->coloff < 0 ? 0 : se->coloff;
+
+  if (se->selection_active && se->selection_start_cy < E.numrows && se->selection_end_cy < E.numrows &&
+      se->selection_start_cy >= 0 && se->selection_end_cy >= 0) {
+    E.selection_start_cx = se->selection_start_cx;
+    E.selection_start_cy = se->selection_start_cy;
+    E.selection_end_cx = se->selection_end_cx;
+    E.selection_end_cy = se->selection_end_cy;
+    if (E.selection_start_cx > E.row[E.selection_start_cy].size) E.selection_start_cx = E.row[E.selection_start_cy].size;
+    if (E.selection_end_cx > E.row[E.selection_end_cy].size) E.selection_end_cx = E.row[E.selection_end_cy].size;
+    E.selection_active = 1;
+    E.mode = SELECTION_MODE;
+  }
+  editorSessionRelease();
+}
+
+/**
+ * @brief Appends a string to the session string pool.
+ * @param pool The string pool.
+ * @param base The file offset of the string pool.
+ * @param s The string (may be NULL).
+ * @param len The length of the string.
+ * @param off Pointer to store the file offset of the string.
+ * @param outlen Pointer to store the length of the string.
+ */
+void editorSessionString(struct abuf *pool, uint32_t base, const char *s, int len, uint32_t *off, uint32_t *outlen) {
+  *off = base + pool->len;
+  *outlen = s ? len : 0;
+  if (s && len) abAppend(pool, s, len);
+}
+
+/**
+ * @brief Writes the buffer list, cursors, scroll offsets, selections, the
+ *        last search and the clipboard to the session file, if a session
+ *        name was given with --session. Headless runs only read sessions.
+ */
+void editorSessionSave() {
+  if (!E.session || E.script) return;
+  char path[1024], tmp[1100];
+  if (editorSessionPath(path, sizeof(path), E.session) == -1) return;
+
+  editorBufferStash();
+  int n = 0;
+  for (int i = 0; i < E.numbuffers; i++)
+    if (E.buffers[i].filename) n++;
+
+  struct sessionHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, WEE_SESSION_MAGIC, 4);
+  hdr.version = WEE_SESSION_VERSION;
+  hdr.numentries = n;
+  hdr.linenumbers = E.linenumbers;
+
+  struct sessionEntry *entries = calloc(n ? n : 1, sizeof(struct sessionEntry));
+  struct abuf pool = ABUF_INIT;
+  uint32_t base = sizeof(hdr) + sizeof(struct sessionEntry) * n;
+  int j = 0;
+  for (int i = 0; i < E.numbuffers; i++) {
+    struct editorBuffer *b = &E.buffers[i];
+    if (!b->filename) continue;
+    if (i == E.curbuf) hdr.active = j;
+    struct sessionEntry *se = &entries[j++];
+    char *full = realpath(b->filename, NULL);
+    const char *name = full ? full : b->filename;
+    editorSessionString(&pool, base, name, strlen(name), &se->path_off, &se->path_len);
+    free(full);
+    if (b->session_entry >= 0) {
+      // Never loaded: keep the state from the previous session
+      struct sessionEntry *old = editorSessionEntry(b->session_entry);
+      uint32_t off = se->path_off, len = se->path_len;
+      *se = *old;
+      se->path_off = off;
+      se->path_len = len;
+      continue;
     }
+    se->cx = b->cx;
+    se->cy = b->cy;
+    se->rowoff = b->rowoff;
+    se->coloff = b->coloff;
+    se->selection_start_cx = b->selection_start_cx;
+    se->selection_start_cy = b->selection_start_cy;
+    se->selection_end_cx = b->selection_end_cx;
+    se->selection_end_cy = b->selection_end_cy;
+    se->selection_active = b->selection_active;
   }
-  quit_times = WEE_QUIT_TIMES;
-}
-
-void editorIndentSelection() {
-  if (!E.selection_active) return;
-  int start_cy = E.selection_start_cy;
-  int end_cy = E.selection_end_cy;
+  editorSessionString(&pool, base, E.clipboard, E.clipboard_len, &hdr.clipboard_off, &hdr.clipboard_len);
+  editorSessionString(&pool, base, E.last_query, E.last_query ? (int)strlen(E.last_query) : 0,
+                      &hdr.query_off, &hdr.query_len);
 
-  if (start_cy > end_cy) {
-    int temp = start_cy;
-    start_cy = end_cy;
-    end_cy = temp;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd != -1) {
+    ssize_t want = sizeof(hdr) + sizeof(struct sessionEntry) * n + pool.len;
+    ssize_t done = write(fd, &hdr, sizeof(hdr));
+    done += write(fd, entries, sizeof(struct sessionEntry) * n);
+    if (pool.len) done += write(fd, pool.b, pool.len);
+    if (close(fd) == 0 && done == want) rename(tmp, path);
+    else unlink(tmp);
   }
+  free(entries);
+  abFree(&pool);
+}
 
-  for (int i = start_cy; i <= end_cy; i++) {
-    erow *row = &E.row[i];
-    for (int j = 0; j < WEE_TAB_STOP; j++) {
-      editorRowInsertChar(row, 0, ' ');
+/**
+ * @brief Restores a session: maps the session file, creates one buffer per
+ *        entry and loads only the active one. The other buffers are loaded
+ *        in the background while the editor waits for input.
+ * @param name The session name.
+ * @return 0 on success, -1 if there is no valid session file.
+ */
+int editorSessionRestore(const char *name) {
+  char path[1024];
+  if (editorSessionPath(path, sizeof(path), name) == -1) return -1;
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return -1;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct sessionHeader)) {
+    close(fd);
+    return -1;
+  }
+  unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return -1;
+
+  struct sessionHeader *hdr = (struct sessionHeader *)map;
+  size_t len = st.st_size;
+  if (memcmp(hdr->magic, WEE_SESSION_MAGIC, 4) || hdr->version != WEE_SESSION_VERSION ||
+      hdr->numentries == 0 || hdr->active >= hdr->numentries ||
+      sizeof(*hdr) + sizeof(struct sessionEntry) * (size_t)hdr->numentries > len ||
+      (size_t)hdr->clipboard_off + hdr->clipboard_len > len ||
+      (size_t)hdr->query_off + hdr->query_len > len) {
+    munmap(map, len);
+    return -1;
+  }
+  E.session_map = map;
+  E.session_len = len;
+
+  E.linenumbers = hdr->linenumbers;
+  if (hdr->clipboard_len) {
+    memFree(MEM_CLIPBOARD, E.clipboard);
+    E.clipboard = memAlloc(MEM_CLIPBOARD, hdr->clipboard_len + 1);
+    memcpy(E.clipboard, map + hdr->clipboard_off, hdr->clipboard_len);
+    E.clipboard[hdr->clipboard_len] = '\0';
+    E.clipboard_len = hdr->clipboard_len;
+  }
+  if (hdr->query_len) {
+    memFree(MEM_EDITOR, E.last_query);
+    E.last_query = memAlloc(MEM_EDITOR, hdr->query_len + 1);
+    if (E.last_query) {
+      memcpy(E.last_query, (char *)map + hdr->query_off, hdr->query_len);
+      E.last_query[hdr->query_len] = '\0';
     }
   }
 
-  E.selection_start_cx += WEE_TAB_STOP;
-  E.selection_end_cx += WEE_TAB_STOP;
-
-  E.dirty++;
-}
-
-void editorUnindentSelection() {
-  if (!E.selection_active) return;
-  int start_cy = E.selection_start_cy;
-  int end_cy = E.selection_end_cy;
+  editorBufferStash();
+  int first = E.numbuffers;
+  for (uint32_t i = 0; i < hdr->numentries; i++) {
+    struct sessionEntry *se = editorSessionEntry(i);
+    char *file = (size_t)se->path_off + se->path_len <= len
+                     ? strndup((char *)map + se->path_off, se->path_len) : strdup("");
+    int at = editorAddBuffer(file);
+    E.buffers[at].session_entry = i;
+    free(file);
+  }
 
-  if (start_cy > end_cy) {
-    int temp = start_cy;
-    start_cy = end_cy;
-    end_cy = temp;
+  // The initial empty buffer is replaced by the session
+  if (first == 1 && E.buffers[0].filename == NULL && E.buffers[0].numrows == 0) {
+    memmove(&E.buffers[0], &E.buffers[1], sizeof(struct editorBuffer) * (E.numbuffers - 1));
+    E.numbuffers--;
+    first = 0;
+  }
+  editorBufferRestore(first + hdr->active);
+  editorBufferEnsureLoaded();
+  editorWindowStash();
+
+  int pending = 0;
+  for (int i = 0; i < E.numbuffers; i++)
+    if (!E.buffers[i].loaded && E.buffers[i].session_entry >= 0) pending++;
+  if (pending) {
+    memset(&E.session_load, 0, sizeof(E.session_load));
+    E.session_load.task.name = "loading session";
+    E.session_load.task.step = editorSessionLoadStep;
+    E.session_load.task.finish = editorSessionLoadFinish;
+    E.session_load.task.total = pending;
+    editorTaskStart(&E.session_load.task);
   }
+  editorSetStatusMessage("Session %s restored (%u buffers).", name, hdr->numentries);
+  return 0;
+}
 
-  for (int i = start_cy; i <= end_cy; i++) {
-    erow *row = &E.row[i];
-    int chars_deleted_count = 0;
-    for (int j = 0; j < WEE_TAB_STOP; j++) {
-      if (row->size > 0 && row->chars[0] == ' ') {
-        editorRowDelChar(row, 0);
-        chars_deleted_count++;
-      } else {
-        break;
-      }
-    }
-    if (i == E.selection_start_cy) {
-        E.selection_start_cx -= chars_deleted_count;
-        if (E.selection_start_cx < 0) E.selection_start_cx = 0;
-    }
-    if (i == E.selection_end_cy) {
-        E.selection_end_cx -= chars_deleted_count;
-        if (E.selection_end_cx < 0) E.selection_end_cx = 0;
-    }
+/**
+ * @brief Runs background work while the editor waits for input: finished
+ *        pool jobs are delivered, cooperative tasks get a slice, then the
+ *        JSON outline of the active buffer is advanced. Each of them works
+ *        in short slices; while any has work left E.idle_busy is set and
+ *        input is polled without waiting. Work that changed what is on
+ *        screen sets E.idle_redraw, and the screen is redrawn once at the
+ *        end; only the main loop's own screen, never a picker's.
+ */
+void editorIdle() {
+  E.idle_busy = 0;
+  if (E.attached) editorDaemonRefuse();
+  poolDrain();
+  editorTasksRun();
+  editorOutlineIdle();
+  editorValidateIdle();
+  editorMarksIdle();
+  editorDiffIdle();
+  editorAutosaveIdle();
+  if (E.idle_redraw) {
+    E.idle_redraw = 0;
+    if (E.key_wait) editorRefreshScreen();
   }
-  E.dirty++;
 }
 
-void editorMoveSelection(int key) {
-  // Get current selection bounds and normalize them
-  int start_cx = E.selection_start_cx;
-  int start_cy = E.selection_start_cy;
-  int end_cx = E.selection_end_cx;
-  int end_cy = E.selection_end_cy;
+/**
+ * @brief Starts reading the file of the active buffer for the session
+ *        loader. A file that cannot be opened leaves the buffer empty.
+ */
+void editorSessionLoadBegin() {
+  struct sessionLoad *sl = &E.session_load;
+  sl->fp = fopen(E.filename, "r");
+  editorSelectSyntaxHighlight();
+  E.buffers[E.curbuf].loading = 1;
+  if (!sl->fp && errno != ENOENT)
+    editorSetStatusMessage("Error: Could not open file %s: %s", E.filename, strerror(errno));
+}
 
-  if (start_cy > end_cy || (start_cy == end_cy && start_cx > end_cx)) {
-    int temp_cx = start_cx;
-    int temp_cy = start_cy;
-    start_cx = end_cx;
-    start_cy = end_cy;
-    end_cx = temp_cx;
-    end_cy = temp_cy;
+/**
+ * @brief Reads more lines of the active buffer, which the session loader
+ *        is reading, at least SESSION_LOAD_LINES of them and more until the
+ *        deadline. At the end of the file the buffer is marked loaded and
+ *        its session entry applied.
+ * @param deadline The end of the slice, or LLONG_MAX to read all of it.
+ * @return 1 if the whole file was read, 0 otherwise.
+ */
+int editorSessionLoadRead(long long deadline) {
+  struct sessionLoad *sl = &E.session_load;
+  struct editorBuffer *b = &E.buffers[E.curbuf];
+  TRACE_BEGIN("sessionLoad");
+  ssize_t linelen = -1;
+  int n = 0;
+  while (sl->fp && (linelen = getline(&sl->line, &sl->linecap, sl->fp)) != -1) {
+    editorLoadLine(sl->line, linelen);
+    if (++n % SESSION_LOAD_LINES == 0 && deadline != LLONG_MAX && editorNow() >= deadline) break;
   }
+  TRACE_END("sessionLoad");
+  if (sl->fp && linelen != -1) return 0;
+
+  if (sl->fp) fclose(sl->fp);
+  sl->fp = NULL;
+  free(sl->line);
+  sl->line = NULL;
+  sl->linecap = 0;
+  b->loading = 0;
+  b->loaded = 1;
+  editorSavedCapture();
+  if (b->session_entry >= 0) editorSessionApply();
+  return 1;
+}
 
-  switch (key) {
-    case ARROW_LEFT: {
-      for (int i = start_cy; i <= end_cy; i++) {
-        erow *row = &E.row[i];
-        if (row->size > 0 && row->chars[0] == ' ') {
-          editorRowDelChar(row, 0);
-          if (i == E.selection_start_cy) {
-            if (E.selection_start_cx > 0) E.selection_start_cx--;
-          }
-          if (i == E.selection_end_cy) {
-            if (E.selection_end_cx > 0) E.selection_end_cx--;
-          }
-        }
-      }
-      E.dirty++;
+/**
+ * @brief Step of the session loading task: reads the buffers restored from
+ *        a session one after the other, in slices of lines, until the
+ *        deadline; every step makes progress. Buffers left when the task
+ *        is cancelled load on first activation.
+ * @param task The task.
+ * @param deadline The end of the slice.
+ * @return TASK_MORE while buffers are left, then TASK_DONE.
+ */
+int editorSessionLoadStep(struct editorTask *task, long long deadline) {
+  int cur = E.curbuf;
+  char statusmsg[sizeof(E.statusmsg)];
+  time_t statusmsg_time = E.statusmsg_time;
+  memcpy(statusmsg, E.statusmsg, sizeof(statusmsg));
+
+  editorBufferStash();
+  E.background_load = 1;
+  int state = TASK_DONE, progress = 0;
+  while (1) {
+    int at = -1;
+    for (int i = 0; i < E.numbuffers && at == -1; i++)
+      if (E.buffers[i].loading) at = i;
+    for (int i = 0; i < E.numbuffers && at == -1; i++)
+      if (!E.buffers[i].loaded && E.buffers[i].session_entry >= 0) at = i;
+    if (at == -1) break;
+    if (progress && editorNow() >= deadline) {
+      state = TASK_MORE;
       break;
     }
-    case ARROW_RIGHT: {
-      for (int i = start_cy; i <= end_cy; i++) {
-        erow *row = &E.row[i];
-        editorRowInsertChar(row, 0, ' ');
-      }
-      E.selection_start_cx++;
-      E.selection_end_cx++;
-      E.dirty++;
+    editorBufferRestore(at);
+    if (!E.buffers[at].loading) editorSessionLoadBegin();
+    int finished = editorSessionLoadRead(deadline);
+    editorBufferStash();
+    progress = 1;
+    if (!finished) {
+      state = TASK_MORE;
       break;
     }
-    case ARROW_UP: {
-      if (start_cy == 0) return; // Cannot move further up
+    task->done++;
+  }
+  E.background_load = 0;
+  editorBufferRestore(cur);
 
-      // Preserve user's clipboard
-      char *temp_clipboard = E.clipboard;
-      int temp_clipboard_len = E.clipboard_len;
-      E.clipboard = NULL;
-      E.clipboard_len = 0;
+  memcpy(E.statusmsg, statusmsg, sizeof(statusmsg));
+  E.statusmsg_time = statusmsg_time;
+  return state;
+}
 
-      editorCutSelection(); // Cuts the normalized selection into E.clipboard
+/**
+ * @brief Ends the session loading task. When it is cancelled, the rows
+ *        read so far of a partly read buffer are dropped, so that the
+ *        buffer loads from the start on first activation.
+ * @param task The task.
+ * @param cancelled 1 if the task was cancelled.
+ */
+void editorSessionLoadFinish(struct editorTask *task, int cancelled) {
+  struct sessionLoad *sl = (struct sessionLoad *)task;
+  if (!cancelled || !sl->fp) return;
+  int cur = E.curbuf;
+  editorBufferStash();
+  for (int i = 0; i < E.numbuffers; i++) {
+    if (!E.buffers[i].loading) continue;
+    editorBufferRestore(i);
+    for (int j = 0; j < E.numrows; j++) editorFreeRow(&E.row[j]);
+    memFree(MEM_ROWS, E.row);
+    E.row = NULL;
+    E.numrows = 0;
+    E.dirty = 0;
+    editorMarksForget(E.marks);
+    E.marks = NULL;
+    E.buffers[i].loading = 0;
+    editorBufferStash();
+  }
+  editorBufferRestore(cur);
+  fclose(sl->fp);
+  sl->fp = NULL;
+  free(sl->line);
+  sl->line = NULL;
+  sl->linecap = 0;
+}
 
-      // Move cursor to the line above the original selection start
-      E.cy = start_cy - 1;
-      E.cx = 0;
 
-      // Store the starting point for the new selection
-      E.selection_start_cy = E.cy;
-      E.selection_start_cx = E.cx;
+/* headless scripts */
 
-      editorPaste(); // Paste content, E.cx and E.cy will be at the end
+/*
+ * A key script is plain text typed as-is, plus <...> tokens for other keys:
+ * <Enter> <Esc> <Tab> <BS> <Del> <Up> <Down> <Left> <Right> <Home> <End>
+ * <PgUp> <PgDn> <lt> (a literal '<'), <C-x> (Ctrl-x), <A-x> (Alt-x), and a
+ * single character such as <x>. Any token can be repeated with *N, as in
+ * <Down*1000>. <mark:name> starts a named timing segment and <idle> runs
+ * the background work the editor would do while waiting for input, until
+ * there is none left. Newlines in the script are ignored so long scripts
+ * can be wrapped.
+ */
 
-      // The new selection end is the current cursor position
-      E.selection_end_cy = E.cy;
-      E.selection_end_cx = E.cx;
+#define SCRIPT_IDLE INT_MIN
 
-      // Reactivate selection mode
-      E.selection_active = 1;
-      E.mode = SELECTION_MODE;
+/**
+ * @brief Translates the name of a script token into a key code.
+ * @param name The token, without the angle brackets and repeat count.
+ * @return The key code, or -1 if the token is unknown.
+ */
+int editorScriptKeyCode(const char *name) {
+  static const struct { const char *name; int key; } named[] = {
+    { "Enter", '\r' }, { "Esc", '\x1b' }, { "Tab", '\t' }, { "BS", BACKSPACE },
+    { "Del", DEL_KEY }, { "Up", ARROW_UP }, { "Down", ARROW_DOWN },
+    { "Left", ARROW_LEFT }, { "Right", ARROW_RIGHT }, { "Home", HOME_KEY },
+    { "End", END_KEY }, { "PgUp", PAGE_UP }, { "PgDn", PAGE_DOWN }, { "lt", '<' },
+    { NULL, 0 }
+  };
+  static const struct { char c; int key; } alts[] = {
+    { 'b', ALT_B }, { 'e', ALT_E }, { 'n', ALT_N }, { 'p', ALT_P }, { 'x', ALT_X },
+    { 'l', ALT_L }, { 's', ALT_S }, { 'v', ALT_V }, { 'w', ALT_W }, { 'q', ALT_Q },
+    { 'h', ALT_H }, { 'o', ALT_O }, { 'j', ALT_J },
+    { 'f', ALT_F }, { 'm', ALT_M }, { 'k', ALT_K }, { 0, 0 }
+  };
+  for (int i = 0; named[i].name; i++)
+    if (!strcmp(name, named[i].name)) return named[i].key;
+  if (name[0] == 'C' && name[1] == '-' && name[2] && !name[3]) return CTRL_KEY(name[2]);
+  if (name[0] == 'A' && name[1] == '-' && name[2] && !name[3]) {
+    for (int i = 0; alts[i].c; i++)
+      if (alts[i].c == name[2]) return alts[i].key;
+    return -1;
+  }
+  if (name[0] && !name[1]) return (unsigned char)name[0];
+  return -1;
+}
 
-      // Restore user's clipboard
-      free(E.clipboard); // Free the clipboard used for the move operation
-      E.clipboard = temp_clipboard;
-      E.clipboard_len = temp_clipboard_len;
-      break;
+/**
+ * @brief Loads and parses a key script.
+ * @param path The script file.
+ * @return 0 on success, -1 on error (a message is printed).
+ */
+int editorScriptLoad(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, "wee: cannot open script %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  struct editorScript *sc = calloc(1, sizeof(struct editorScript));
+  int cap = 0;
+  int c;
+  while ((c = fgetc(fp)) != EOF) {
+    int key = c, repeat = 1;
+    if (c == '\n' || c == '\r') continue;
+    if (c == '<') {
+      char tok[64];
+      int len = 0;
+      while ((c = fgetc(fp)) != EOF && c != '>' && len < (int)sizeof(tok) - 1) tok[len++] = c;
+      tok[len] = '\0';
+      if (!strcmp(tok, "idle")) {
+        key = SCRIPT_IDLE;
+      } else if (!strncmp(tok, "mark:", 5)) {
+        sc->marks = realloc(sc->marks, sizeof(char *) * (sc->nummarks + 1));
+        sc->marks[sc->nummarks] = strdup(tok + 5);
+        key = -1 - sc->nummarks++;
+      } else {
+        char *star = strrchr(tok, '*');
+        if (star && star != tok) {
+          repeat = atoi(star + 1);
+          *star = '\0';
+        }
+        key = editorScriptKeyCode(tok);
+        if (key == -1) {
+          fprintf(stderr, "wee: unknown key <%s> in script %s\n", tok, path);
+          fclose(fp);
+          return -1;
+        }
+      }
     }
-    case ARROW_DOWN: {
-      if (end_cy >= E.numrows - 1) return; // Cannot move further down
-
-      // Preserve user's clipboard
-      char *temp_clipboard = E.clipboard;
-      int temp_clipboard_len = E.clipboard_len;
-      E.clipboard = NULL;
-      E.clipboard_len = 0;
-
-      editorCutSelection(); // Cuts the normalized selection into E.clipboard
-
-      // Move cursor to the line that was below the original selection
-      // After cut, E.cy is original start_cy. The line below original end_cy is now at E.cy + 1
-      E.cy = start_cy + 1;
-      E.cx = 0;
-
-      // Store the starting point for the new selection
-      E.selection_start_cy = E.cy;
-      E.selection_start_cx = E.cx;
-
-      editorPaste(); // Paste content, E.cx and E.cy will be at the end
-
-      // The new selection end is the current cursor position
-      E.selection_end_cy = E.cy;
-      E.selection_end_cx = E.cx;
+    while (repeat-- > 0) {
+      if (sc->numkeys == cap) {
+        cap = cap ? cap * 2 : 1024;
+        sc->keys = realloc(sc->keys, sizeof(int) * cap);
+      }
+      sc->keys[sc->numkeys++] = key;
+    }
+  }
+  fclose(fp);
+  E.script = sc;
+  return 0;
+}
 
-      // Reactivate selection mode
-      E.selection_active = 1;
-      E.mode = SELECTION_MODE;
+/**
+ * @brief Closes the current timing segment, if any.
+ * @param now The current timestamp.
+ */
+void editorScriptCloseSegment(long long now) {
+  struct editorScript *sc = E.script;
+  struct scriptSegment *seg = sc->numsegments ? &sc->segments[sc->numsegments - 1] : NULL;
+  if (seg && seg->end_ns == 0) {
+    seg->end_ns = now;
+    seg->allocs = memTotalAllocs() - seg->allocs_start;
+  }
+}
 
-      // Restore user's clipboard
-      free(E.clipboard); // Free the clipboard used for the move operation
-      E.clipboard = temp_clipboard;
-      E.clipboard_len = temp_clipboard_len;
-      break;
+/**
+ * @brief Returns the next key of the script. At the end of the script the
+ *        editor exits, which prints the statistics.
+ * @return The key code.
+ */
+int editorScriptKey() {
+  struct editorScript *sc = E.script;
+  long long now = editorNow();
+  while (sc->pos < sc->numkeys && sc->keys[sc->pos] < 0) {
+    if (sc->keys[sc->pos] == SCRIPT_IDLE) {
+      do {
+        editorIdle();
+        if (!E.idle_busy && (editorValidateBusy() || editorMarksBusy() || editorDiffBusy() || editorAutosaveBusy() || poolBusy())) usleep(1000);
+      } while (E.idle_busy || editorValidateBusy() || editorMarksBusy() || editorDiffBusy() || editorAutosaveBusy() || poolBusy());
+      now = editorNow();
+      sc->pos++;
+      continue;
     }
+    editorScriptCloseSegment(now);
+    sc->segments = realloc(sc->segments, sizeof(struct scriptSegment) * (sc->numsegments + 1));
+    struct scriptSegment *seg = &sc->segments[sc->numsegments++];
+    memset(seg, 0, sizeof(*seg));
+    snprintf(seg->name, sizeof(seg->name), "%s", sc->marks[-1 - sc->keys[sc->pos]]);
+    seg->start_ns = now;
+    seg->allocs_start = memTotalAllocs();
+    sc->pos++;
   }
+  if (sc->pos == sc->numkeys) exit(0);
+  if (sc->key_pending_ns == 0) sc->key_pending_ns = now;
+  if (!E.key_ns) E.key_ns = now;
+  if (sc->numsegments) sc->segments[sc->numsegments - 1].keys++;
+  return sc->keys[sc->pos++];
 }
 
-void editorJumpToLine() {
-  char *line_str = editorPrompt("Go to line: %s (ESC to cancel)", NULL);
-  if (line_str == NULL) {
-    editorSetStatusMessage("Jump cancelled.");
-    return;
+/**
+ * @brief Accounts a frame written in script mode. The latency of a key is
+ *        measured from the moment it was read to the end of the next frame.
+ * @param bytes The number of bytes written for the frame.
+ */
+void editorScriptFrame(int bytes) {
+  struct editorScript *sc = E.script;
+  long long now = editorNow();
+  sc->frames++;
+  sc->bytes += bytes;
+  if (sc->first_frame_ns == 0) sc->first_frame_ns = now;
+  struct scriptSegment *seg = sc->numsegments ? &sc->segments[sc->numsegments - 1] : NULL;
+  if (seg) seg->frames++;
+  if (sc->key_pending_ns) {
+    long long lat = now - sc->key_pending_ns;
+    sc->key_pending_ns = 0;
+    sc->key_count++;
+    sc->key_sum_ns += lat;
+    if (lat > sc->key_max_ns) sc->key_max_ns = lat;
+    if (seg && lat > seg->key_max_ns) seg->key_max_ns = lat;
   }
+}
 
-  // Convert string to integer
-  int target_line = atoi(line_str);
-  free(line_str); // Free the allocated string
-
-  // Validate the line number
-  if (target_line <= 0 || target_line > E.numrows) {
-    editorSetStatusMessage("Invalid line number: %d. Total lines: %d.", target_line, E.numrows);
-    return;
+/**
+ * @brief Prints the statistics of the script run as one JSON object on
+ *        stderr. Registered with atexit in script mode.
+ */
+void editorScriptReport() {
+  struct editorScript *sc = E.script;
+  if (!sc) return;
+  long long now = editorNow();
+  editorScriptCloseSegment(now);
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+
+  fprintf(stderr, "{\"keys\":%d,\"frames\":%lld,\"open_ms\":%.3f,\"first_frame_ms\":%.3f,"
+          "\"total_ms\":%.3f,\"key_avg_us\":%.1f,\"key_max_us\":%.1f,\"bytes_written\":%lld,"
+          "\"max_rss_kb\":%ld",
+          sc->pos, sc->frames, (sc->open_ns - sc->start_ns) / 1e6,
+          sc->first_frame_ns ? (sc->first_frame_ns - sc->start_ns) / 1e6 : 0.0,
+          (now - sc->start_ns) / 1e6,
+          sc->key_count ? sc->key_sum_ns / 1e3 / sc->key_count : 0.0,
+          sc->key_max_ns / 1e3, sc->bytes, ru.ru_maxrss);
+  fprintf(stderr, ",\"allocs\":%lld,\"mem\":{", memTotalAllocs());
+  for (int i = 0; i < MEM_SUBSYSTEMS; i++)
+    fprintf(stderr, "%s\"%s\":{\"allocs\":%lld,\"frees\":%lld,\"live_bytes\":%lld}",
+            i ? "," : "", mem_names[i], E.mem[i].allocs, E.mem[i].frees, E.mem[i].live_bytes);
+  fprintf(stderr, "},\"segments\":[");
+  for (int i = 0; i < sc->numsegments; i++) {
+    struct scriptSegment *seg = &sc->segments[i];
+    fprintf(stderr, "%s{\"name\":\"%s\",\"ms\":%.3f,\"keys\":%lld,\"frames\":%lld,"
+            "\"key_max_us\":%.1f,\"allocs\":%lld}",
+            i ? "," : "", seg->name, (seg->end_ns - seg->start_ns) / 1e6, seg->keys, seg->frames,
+            seg->key_max_ns / 1e3, seg->allocs);
   }
+  fprintf(stderr, "]}\n");
+}
 
-  // Adjust for 0-based indexing (user input is usually 1-based)
-  E.cy = target_line - 1;
-  E.cx = 0; // Move cursor to the beginning of the target line
 
-  // Ensure cursor is visible
-  editorScroll();
-  editorSetStatusMessage("Jumped to line %d.", target_line);
+/* stats endpoint */
+
+/**
+ * @brief Publishes the counters of a finished frame: frame time, the
+ *        latency of the key that caused it and the buffer and job sizes.
+ * @param frame_start The timestamp at which the frame started.
+ */
+void editorStatsFrame(long long frame_start) {
+  long long now = editorNow();
+  __atomic_fetch_add(&E.stats.frames, 1, __ATOMIC_RELAXED);
+  statsRecord(E.stats.frame_hist, now - frame_start);
+  if (E.key_ns) {
+    __atomic_fetch_add(&E.stats.keys, 1, __ATOMIC_RELAXED);
+    statsRecord(E.stats.key_hist, now - E.key_ns);
+    E.key_ns = 0;
+  }
+  int pending = 0;
+  for (int i = 0; i < E.numbuffers; i++)
+    if (!E.buffers[i].loaded && E.buffers[i].session_entry >= 0) pending++;
+  statsSet(&E.stats.numbuffers, E.numbuffers);
+  statsSet(&E.stats.numrows, E.numrows);
+  statsSet(&E.stats.numwindows, E.numwindows);
+  statsSet(&E.stats.pending_loads, pending);
 }
 
+/**
+ * @brief Writes a histogram of the live stats as a JSON array.
+ * @param fp The output stream.
+ * @param name The JSON key.
+ * @param hist The histogram.
+ */
+void editorStatsWriteHist(FILE *fp, const char *name, long long *hist) {
+  fprintf(fp, ",\"%s\":[", name);
+  for (int i = 0; i < STATS_BUCKETS; i++)
+    fprintf(fp, "%s%lld", i ? "," : "", __atomic_load_n(&hist[i], __ATOMIC_RELAXED));
+  fprintf(fp, "]");
+}
 
-/* file browser */
+/**
+ * @brief Writes a snapshot of the live counters as one JSON object. Runs on
+ *        the stats thread: every counter is read with an atomic load, the
+ *        editor state itself is never touched.
+ * @param fp The output stream.
+ */
+void editorStatsWrite(FILE *fp) {
+  struct editorStats *st = &E.stats;
+  struct threadPool *p = &E.pool;
+  long long hits = __atomic_load_n(&st->pane_hits, __ATOMIC_RELAXED);
+  long long misses = __atomic_load_n(&st->pane_misses, __ATOMIC_RELAXED);
+  fprintf(fp, "{\"pid\":%ld,\"frames\":%lld,\"keys\":%lld,"
+          "\"buffers\":{\"count\":%lld,\"active_rows\":%lld,\"windows\":%lld},"
+          "\"jobs\":{\"pending_session_loads\":%lld,\"pool_workers\":%d,\"queued\":%d,"
+          "\"submitted\":%lld,\"completed\":%lld,\"cancelled\":%lld,\"stolen\":%lld},"
+          "\"pane_cache\":{\"hits\":%lld,\"misses\":%lld,\"hit_rate\":%.3f},\"memory\":{",
+          (long)getpid(), __atomic_load_n(&st->frames, __ATOMIC_RELAXED),
+          __atomic_load_n(&st->keys, __ATOMIC_RELAXED),
+          __atomic_load_n(&st->numbuffers, __ATOMIC_RELAXED),
+          __atomic_load_n(&st->numrows, __ATOMIC_RELAXED),
+          __atomic_load_n(&st->numwindows, __ATOMIC_RELAXED),
+          __atomic_load_n(&st->pending_loads, __ATOMIC_RELAXED),
+          __atomic_load_n(&p->numworkers, __ATOMIC_RELAXED),
+          __atomic_load_n(&p->queued, __ATOMIC_RELAXED),
+          __atomic_load_n(&p->submitted, __ATOMIC_RELAXED),
+          __atomic_load_n(&p->completed, __ATOMIC_RELAXED),
+          __atomic_load_n(&p->cancelled, __ATOMIC_RELAXED),
+          __atomic_load_n(&p->stolen, __ATOMIC_RELAXED),
+          hits, misses, hits + misses ? (double)hits / (hits + misses) : 0.0);
+  for (int i = 0; i < MEM_SUBSYSTEMS; i++)
+    fprintf(fp, "%s\"%s\":{\"allocs\":%lld,\"frees\":%lld,\"live_bytes\":%lld}", i ? "," : "",
+            mem_names[i], __atomic_load_n(&E.mem[i].allocs, __ATOMIC_RELAXED),
+            __atomic_load_n(&E.mem[i].frees, __ATOMIC_RELAXED),
+            __atomic_load_n(&E.mem[i].live_bytes, __ATOMIC_RELAXED));
+  fprintf(fp, "}");
+  editorStatsWriteHist(fp, "frame_us_log2", st->frame_hist);
+  editorStatsWriteHist(fp, "key_latency_us_log2", st->key_hist);
+  fprintf(fp, "}\n");
+}
 
 /**
- * @brief Comparison function for qsort. Sorts files and directories.
- *        Directories come before files, then sorting is alphabetical (case-insensitive).
- * @param a Pointer to the first element.
- * @param b Pointer to the second element.
- * @return <0 if a<b, 0 if a==b, >0 if a>b.
+ * @brief Stats thread: answers every connection to the stats socket with a
+ *        JSON snapshot and closes it.
+ * @param arg The listening socket (as intptr_t).
+ * @return Never returns.
  */
-int file_compare(const void *a, const void *b) {
-    const char *a_str = *(const char **)a;
-    const char *b_str = *(const char **)b;
-    struct stat st_a, st_b;
-    stat(a_str, &st_a);
-    stat(b_str, &st_b);
-    if (S_ISDIR(st_a.st_mode) && !S_ISDIR(st_b.st_mode)) return -1;
-    if (!S_ISDIR(st_a.st_mode) && S_ISDIR(st_b.st_mode)) return 1;
-    return strcasecmp(a_str, b_str);
+void *editorStatsThread(void *arg) {
+  int lfd = (int)(intptr_t)arg;
+  while (1) {
+    int fd = accept(lfd, NULL, NULL);
+    if (fd == -1) continue;
+    FILE *fp = fdopen(fd, "w");
+    if (!fp) {
+      close(fd);
+      continue;
+    }
+    editorStatsWrite(fp);
+    fclose(fp);
+  }
+  return NULL;
 }
 
 /**
- * @brief Displays a simple file browser to open files.
- * @param initial_path The initial path to start browsing from.
- * @return The full path of the selected file (to be freed), or NULL if canceled.
+ * @brief Starts the stats endpoint on a Unix domain socket. Read it with
+ *        e.g. `socat - UNIX-CONNECT:path`.
+ * @param path The socket path; a stale socket is replaced, but any other
+ *        kind of file there is left alone and the endpoint not started.
+ * @return 0 on success, -1 on error (errno is set).
  */
-char *editorFileBrowser(const char *initial_path) {
-    char *path = realpath(initial_path, NULL);
-    if (!path) {
-        editorSetStatusMessage("Cannot open directory: %s", strerror(errno));
-        return NULL;
+int editorStatsStart(const char *path) {
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  struct stat st;
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      errno = EEXIST;
+      return -1;
     }
+    unlink(path);
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) return -1;
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 4) == -1) {
+    close(fd);
+    return -1;
+  }
+  // A client hanging up early must not kill the editor
+  signal(SIGPIPE, SIG_IGN);
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, editorStatsThread, (void *)(intptr_t)fd) != 0) {
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+  pthread_detach(tid);
+  E.stats_path = strdup(path);
+  atexit(editorStatsStop);
+  return 0;
+}
 
-    int num_items = 0;
-    char **items = NULL;
-    int selected = 0;
-    int offset = 0;
-
-    while (1) {
-        num_items = 0;
-        items = NULL;
-
-        DIR *dir = opendir(path);
-        if (!dir) {
-            editorSetStatusMessage("Cannot open directory: %s", strerror(errno));
-            free(path);
-            return NULL;
-        }
-
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0) continue;
-            items = realloc(items, sizeof(char *) * (num_items + 1));
-            char full_path[1024];
-            snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
-            items[num_items++] = strdup(full_path);
-        }
-        closedir(dir);
-
-        qsort(items, num_items, sizeof(char *), file_compare);
+/**
+ * @brief Removes the stats socket. Registered with atexit.
+ */
+void editorStatsStop() {
+  if (E.stats_path) unlink(E.stats_path);
+}
 
-        struct abuf ab = ABUF_INIT;
-        abAppend(&ab, "\x1b[?25l", 6);
-        abAppend(&ab, "\x1b[2J", 4);
-        abAppend(&ab, "\x1b[H", 3);
 
-        char header[1024];
-        snprintf(header, sizeof(header), "File Browser: %s", path);
-        int header_len = strlen(header);
-        if (header_len > E.screencols) header_len = E.screencols;
-        abAppend(&ab, header, header_len);
-        for (int i = header_len; i < E.screencols; i++) abAppend(&ab, " ", 1);
-        abAppend(&ab, "\x1b[m", 3);
-        abAppend(&ab, "\r\n", 2);
+/* client/server */
 
-        int display_rows = E.screenrows - 2;
-        if (selected >= offset + display_rows) offset = selected - display_rows + 1;
-        if (selected < offset) offset = selected;
+/**
+ * @brief Builds the path of the daemon socket: $XDG_RUNTIME_DIR/wee.sock,
+ *        or /tmp/wee-<uid>/wee.sock when XDG_RUNTIME_DIR is not set. The
+ *        directory in /tmp is created private and refused unless it is
+ *        a directory owned by the user that no one else can enter.
+ * @param buf The buffer receiving the path.
+ * @param bufsize The size of the buffer.
+ * @return 0 on success, -1 if the directory cannot be trusted.
+ */
+int editorSocketPath(char *buf, size_t bufsize) {
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  if (dir && *dir) {
+    snprintf(buf, bufsize, "%s/wee.sock", dir);
+    return 0;
+  }
+  char priv[64];
+  struct stat st;
+  snprintf(priv, sizeof(priv), "/tmp/wee-%d", (int)getuid());
+  if (mkdir(priv, 0700) == -1 && errno != EEXIST) return -1;
+  if (lstat(priv, &st) == -1 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+      (st.st_mode & 077)) {
+    errno = EPERM;
+    return -1;
+  }
+  snprintf(buf, bufsize, "%s/wee.sock", priv);
+  return 0;
+}
 
-        for (int i = 0; i < display_rows; i++) {
-            int index = i + offset;
-            if (index >= num_items) break;
+/**
+ * @brief Tells whether the process at the other end of a Unix socket runs
+ *        as the same user.
+ * @param fd The connected socket.
+ * @return 1 if it does, 0 otherwise.
+ */
+int editorPeerIsSelf(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+}
 
-            char *item_path = items[index];
-            char *item_name = strrchr(item_path, '/');
-            item_name = item_name ? item_name + 1 : item_path;
+/**
+ * @brief Connects to the daemon socket. A daemon running as another user
+ *        is ignored: the working directory and paths are not sent to it.
+ * @return The connected socket, or -1 if no daemon of the user is running.
+ */
+int editorConnectDaemon() {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (editorSocketPath(addr.sun_path, sizeof(addr.sun_path)) == -1) return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || !editorPeerIsSelf(fd)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
 
-            struct stat st;
-            stat(item_path, &st);
+/**
+ * @brief Ends the session of the attached client. Prompts and lists open
+ *        at that point read Esc and unwind normally, then the daemon goes
+ *        back to its accept loop. Buffers, the syntax registry and all
+ *        other state stay in memory for the next client.
+ */
+void editorDetach() {
+  write(E.ofd, "\x1b[2J\x1b[H", 7);
+  E.detaching = 1;
+}
 
-            char display_str[256];
-            snprintf(display_str, sizeof(display_str), "%s%s", item_name, S_ISDIR(st.st_mode) ? "/" : "");
+/**
+ * @brief Stops the daemon on request of a client, unless a buffer has
+ *        unsaved changes. The recent-files list and the session are
+ *        saved first.
+ * @param fd The client socket; "OK" or "DIRTY" is sent back.
+ * @return -1 if the daemon keeps running (it exits otherwise).
+ */
+int editorDaemonStop(int fd) {
+  if (editorAnyDirty()) {
+    write(fd, "DIRTY\n", 6);
+    return -1;
+  }
+  editorRecentRememberAll();
+  editorSessionSave();
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  if (editorSocketPath(path, sizeof(path)) == 0) unlink(path);
+  write(fd, "OK\n", 3);
+  exit(0);
+}
 
-            int len = strlen(display_str);
-            if (len > E.screencols) len = E.screencols;
+/**
+ * @brief Reads the handshake of a new client and sets the editor up for it.
+ *        The handshake is "WEE <rows> <cols>" followed by one absolute path
+ *        per line and an empty line, or "STOP" and an empty line to stop
+ *        the daemon. A client that does not complete it within
+ *        DAEMON_HANDSHAKE_NS is dropped.
+ * @param fd The client socket.
+ * @return 0 on success, -1 if the handshake is malformed or incomplete.
+ */
+int editorAttach(int fd) {
+  char header[8192];
+  size_t len = 0;
+  long long deadline = editorNow() + DAEMON_HANDSHAKE_NS;
+  while (len < 2 || header[len - 1] != '\n' || header[len - 2] != '\n') {
+    long long left = (deadline - editorNow()) / 1000000;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    // Bytes are read one at a time: the keys typed next must stay queued
+    if (len == sizeof(header) - 1 || left <= 0 || poll(&pfd, 1, (int)left) != 1 ||
+        read(fd, &header[len], 1) != 1)
+      return -1;
+    len++;
+  }
+  header[len] = '\0';
+  if (!strcmp(header, "STOP\n\n")) return editorDaemonStop(fd);
+
+  int rows, cols;
+  if (sscanf(header, "WEE %d %d", &rows, &cols) != 2 || rows < 4 || cols < 10) return -1;
+
+  E.ifd = fd;
+  E.ofd = fd;
+  E.attached = 1;
+  E.detaching = 0;
+  // The first bytes tell the client it was let in, before any file loads
+  write(E.ofd, "\x1b[2J", 4);
+  E.termrows = rows - 2;
+  E.termcols = cols;
+  editorLayoutWindows();
+
+  char *path = strchr(header, '\n');
+  while (path && *++path != '\n' && *path) {
+    char *end = strchr(path, '\n');
+    *end = '\0';
+    editorOpenBuffer(path);
+    path = end;
+  }
+  return 0;
+}
 
-            if (index == selected) abAppend(&ab, "\x1b[7m", 4);
-            abAppend(&ab, display_str, len);
-            if (index == selected) abAppend(&ab, "\x1b[m", 3);
-            abAppend(&ab, "\x1b[K", 3);
-            abAppend(&ab, "\r\n", 2);
-        }
+/**
+ * @brief Turns away clients connecting while one is attached: each gets
+ *        "BUSY" instead of waiting unanswered in the listen backlog.
+ */
+void editorDaemonRefuse() {
+  struct pollfd pfd = { E.listen_fd, POLLIN, 0 };
+  while (poll(&pfd, 1, 0) == 1) {
+    int fd = accept4(E.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1) return;
+    if (editorPeerIsSelf(fd)) write(fd, "BUSY\n", 5);
+    close(fd);
+  }
+}
 
-        write(STDOUT_FILENO, ab.b, ab.len);
-        abFree(&ab);
+/**
+ * @brief Runs the editor as a daemon listening on a Unix domain socket.
+ *        Clients attach one at a time, others are refused while one is
+ *        attached; the daemon renders frames into the socket and reads keys
+ *        from it, the client only relays its terminal.
+ * @return 1 on error (the daemon itself never returns on success).
+ */
+int editorDaemon() {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (editorSocketPath(addr.sun_path, sizeof(addr.sun_path)) == -1) {
+    perror("wee: daemon socket directory");
+    return 1;
+  }
 
-        int c = editorReadKey();
+  int probe = editorConnectDaemon();
+  if (probe != -1) {
+    close(probe);
+    fprintf(stderr, "wee: a daemon is already listening on %s\n", addr.sun_path);
+    return 1;
+  }
+  struct stat st;
+  if (lstat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(addr.sun_path);
+
+  int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (lfd == -1 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(lfd, 4) == -1) {
+    perror("wee: daemon socket");
+    return 1;
+  }
+  chmod(addr.sun_path, 0600);
 
-        // Get selected_path before freeing items
-        char *current_selected_path = NULL;
-        if (c == '\r' && selected < num_items) {
-            current_selected_path = realpath(items[selected], NULL);
-        }
+  E.notty = 1;
+  initEditor();
+  editorLoadSyntaxRegistry();
+  E.listen_fd = lfd;
 
-        for (int i = 0; i < num_items; i++) free(items[i]);
-        free(items);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("wee: fork");
+    return 1;
+  }
+  if (pid > 0) {
+    printf("wee: daemon started on %s\n", addr.sun_path);
+    return 0;
+  }
+  setsid();
+  signal(SIGPIPE, SIG_IGN);
+  int devnull = open("/dev/null", O_RDWR);
+  if (devnull != -1) {
+    dup2(devnull, STDIN_FILENO);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+    if (devnull > STDERR_FILENO) close(devnull);
+  }
 
-        switch (c) {
-            case '\r': {
-                if (current_selected_path) {
-                    struct stat st;
-                    stat(current_selected_path, &st);
-                    if (S_ISDIR(st.st_mode)) {
-                        free(path);
-                        path = current_selected_path;
-                        selected = 0;
-                        offset = 0;
-                    } else {
-                        free(path);
-                        return current_selected_path;
-                    }
-                } else {
-                    // Handle case where realpath failed or selected was out of bounds
-                    editorSetStatusMessage("Error: Could not resolve path.");
-                }
-                break;
-            }
-            case ARROW_UP:
-                if (selected > 0) selected--;
-                break;
-            case ARROW_DOWN:
-                if (selected < num_items - 1) selected++;
-                break;
-            case '\x1b':
-                free(path);
-                return NULL;
-        }
+  while (1) {
+    int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1) continue;
+    if (editorPeerIsSelf(fd) && editorAttach(fd) == 0) {
+      while (!E.detaching) {
+        editorRefreshScreen();
+        editorProcessKeypress();
+      }
     }
+    editorWindowStash();
+    close(fd);
+    E.ifd = STDIN_FILENO;
+    E.ofd = STDOUT_FILENO;
+    E.attached = 0;
+    E.detaching = 0;
+  }
 }
 
-void editorShowHelp() {
-    // Create a temporary buffer to hold the help text
-    const char *help_text[] = {
-        "Wee Editor Help",
-        "",
-        "Ctrl-S: Save",
-        "Ctrl-Y: Save As",
-        "Ctrl-Q: Quit",
-        "Ctrl-F: Find",
-        "Ctrl-O: Open File Browser",
-        "Ctrl-N: Toggle Line Numbers",
-        "Ctrl-T: New File",
-        "Ctrl-G: Show this Help",
-        "",
-        "Ctrl-J: Jump to Line",
-        "",
-        "Ctrl-B: Start Selection",
-        "Ctrl-E: End Selection & Enter Selection Mode",
-        "Ctrl-A: Select All",
-        "ESC (in Sel. Mode): Cancel Selection",
-        "Ctrl-W (in Sel. Mode): Copy Selection",
-        "Ctrl-K (in Sel. Mode): Cut Selection",
-        "DEL (in Sel. Mode): Delete Selection",
-        "Arrows (in Sel. Mode): Move Selection (Up/Down/Left/Right)",
-        "",
-        "Ctrl-W: Copy Line",
-        "Ctrl-K: Cut Line",
-        "Ctrl-U: Paste",
-        NULL
-    };
-
-    struct abuf ab = ABUF_INIT;
-    abAppend(&ab, "\x1b[2J", 4); // Clear screen
-    abAppend(&ab, "\x1b[H", 3);  // Go to home
+/**
+ * @brief Asks the running daemon to stop (wee --stop).
+ * @return 0 if it stopped, 1 if none is running or it has unsaved changes.
+ */
+int editorStopDaemon() {
+  int fd = editorConnectDaemon();
+  if (fd == -1) {
+    fprintf(stderr, "wee: no daemon is running\n");
+    return 1;
+  }
+  char reply[16];
+  ssize_t n = 0;
+  if (write(fd, "STOP\n\n", 6) == 6) n = read(fd, reply, sizeof(reply) - 1);
+  close(fd);
+  reply[n > 0 ? n : 0] = '\0';
+  if (!strcmp(reply, "OK\n")) {
+    printf("wee: daemon stopped\n");
+    return 0;
+  }
+  if (!strcmp(reply, "DIRTY\n")) fprintf(stderr, "wee: the daemon has unsaved changes; attach and save them first\n");
+  else if (!strcmp(reply, "BUSY\n")) fprintf(stderr, "wee: a client is attached to the daemon; detach it first\n");
+  else fprintf(stderr, "wee: the daemon did not answer\n");
+  return 1;
+}
 
-    int y = 0;
-    for (y = 0; help_text[y] != NULL; y++) {
-        abAppend(&ab, help_text[y], strlen(help_text[y]));
-        abAppend(&ab, "\r\n", 2);
+/**
+ * @brief Attaches to a running daemon and relays the terminal to it: keys
+ *        are forwarded to the daemon and the frames it sends are written out.
+ *        The terminal enters raw mode only once the daemon answered within
+ *        DAEMON_HANDSHAKE_NS; a daemon serving another client answers "BUSY".
+ * @param nfiles The number of files to open.
+ * @param files The files to open, relative to the current directory.
+ * @return 0 after the session ended, 1 if the daemon refused or did not
+ *         answer (an error is printed), -1 if no daemon is running.
+ */
+int editorClient(int nfiles, char **files) {
+  int fd = editorConnectDaemon();
+  if (fd == -1) return -1;
+
+  int rows, cols;
+  if (getWindowSize(&rows, &cols) == -1) die("getWindowSize");
+
+  struct abuf hs = ABUF_INIT;
+  char line[64];
+  int len = snprintf(line, sizeof(line), "WEE %d %d\n", rows, cols);
+  abAppend(&hs, line, len);
+  char cwd[1024];
+  if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
+  for (int i = 0; i < nfiles; i++) {
+    if (files[i][0] != '/') {
+      abAppend(&hs, cwd, strlen(cwd));
+      abAppend(&hs, "/", 1);
     }
-
-    // Add a prompt to press any key to continue
-    const char *prompt = "Press any key to continue...";
-    int padding = (E.screencols - strlen(prompt)) / 2;
-    for (int i = 0; i < padding; i++) abAppend(&ab, " ", 1);
-    abAppend(&ab, prompt, strlen(prompt));
-
-    write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
-
-    // Wait for a keypress before returning to the editor
-    editorReadKey();
+    abAppend(&hs, files[i], strlen(files[i]));
+    abAppend(&hs, "\n", 1);
+  }
+  abAppend(&hs, "\n", 1);
+  write(fd, hs.b, hs.len);
+  abFree(&hs);
+
+  struct pollfd pfd[2] = { { STDIN_FILENO, POLLIN, 0 }, { fd, POLLIN, 0 } };
+  char buf[65536];
+  ssize_t first = -1;
+  if (poll(&pfd[1], 1, (int)(DAEMON_HANDSHAKE_NS / 1000000)) == 1) first = read(fd, buf, sizeof(buf));
+  int busy = first == 5 && !memcmp(buf, "BUSY\n", 5);
+  if (first <= 0 || busy) {
+    close(fd);
+    if (busy) fprintf(stderr, "wee: another client is attached to the daemon\n");
+    else fprintf(stderr, "wee: the daemon did not answer\n");
+    return 1;
+  }
+  enableRawMode();
+  write(STDOUT_FILENO, buf, first);
+  while (1) {
+    if (poll(pfd, 2, -1) == -1) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (pfd[0].revents & POLLIN) {
+      ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+      if (n > 0 && write(fd, buf, n) != n) break;
+    }
+    if (pfd[1].revents & (POLLIN | POLLHUP)) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0) break;
+      if (write(STDOUT_FILENO, buf, n) != n) break;
+    }
+  }
+  close(fd);
+  return 0;
 }
 
 
@@ -2339,6 +9160,7 @@ void initEditor() {
   E.statusmsg[0] = '\0';
   E.statusmsg_time = 0;
   E.dirty = 0;
+  memset(&E.saved, 0, sizeof(E.saved));
   E.linenumbers = 1;
   E.clipboard = NULL;
   E.clipboard_len = 0;
@@ -2352,25 +9174,183 @@ void initEditor() {
   E.selection_end_cy = -1;
   E.selection_active = 0;
   E.mode = NORMAL_MODE;
-
-  if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
-  E.screenrows -= 2;
+  E.outline = NULL;
+  E.json_check = NULL;
+  E.marks = NULL;
+  E.autosave = NULL;
+  E.recent = NULL;
+  E.numrecent = 0;
+  E.buffers = NULL;
+  E.numbuffers = 0;
+  E.curbuf = 0;
+  E.syntaxes = NULL;
+  E.numsyntaxes = 0;
+  E.syntaxes_loaded = 0;
+  editorAddBuffer(NULL);
+  editorRecentLoad();
+
+  E.ifd = STDIN_FILENO;
+  E.ofd = STDOUT_FILENO;
+  E.attached = 0;
+  E.listen_fd = -1;
+  E.last_query = NULL;
+  E.session = NULL;
+  E.session_map = NULL;
+  E.session_len = 0;
+  E.background_load = 0;
+  E.idle_busy = 0;
+  E.idle_redraw = 0;
+  E.key_wait = 0;
+  E.tasks = NULL;
+  E.snap_gen = 0;
+  E.snap_oldest = NULL;
+  E.snap_newest = NULL;
+  E.retired = NULL;
+  E.retired_tail = NULL;
+  E.format_buf = NULL;
+  E.format_cap = 0;
+  E.perf_hud = 0;
+  E.trace_rings = NULL;
+#ifdef WEE_PROFILE
+  E.perf_allocs_mark = 0;
+#endif
+  memset(E.mem, 0, sizeof(E.mem));
+  memset(&E.stats, 0, sizeof(E.stats));
+  E.key_ns = 0;
+  E.stats_path = NULL;
+  cJSON_Hooks hooks = { syntaxMalloc, syntaxFree };
+  cJSON_InitHooks(&hooks);
+  if (E.notty) {
+    E.termrows = 24;
+    E.termcols = 80;
+  } else if (getWindowSize(&E.termrows, &E.termcols) == -1) die("getWindowSize");
+  E.termrows -= 2;
+  editorInitWindows();
 }
 
 /**
  * @brief Main function of the program.
+ *        With --daemon the editor runs in the background and later
+ *        invocations attach to it as thin clients; --local skips the daemon.
+ *        --session <name> restores (and on quit saves) a named session.
+ *        --script <keys> runs headless: keys are read from the script, frames
+ *        are written to --output (default /dev/null) at --size ROWSxCOLS,
+ *        and timing statistics are printed on exit.
+ *        --trace <file> records a Chrome trace written on exit.
+ *        --stats <socket> serves live counters as JSON on a Unix socket.
+ *        --pool-bench JOBS[xWORKERS] stress-tests the job pool and exits.
  * @param argc Number of command-line arguments.
  * @param argv Array of command-line arguments.
  * @return 0 on success, 1 on error.
  */
 int main(int argc, char *argv[]) {
-  enableRawMode();
-  initEditor();
-  if (argc >= 2) {
-    editorOpen(argv[1]);
+  int daemon_mode = 0, local = 0, nfiles = 0;
+  char *session = NULL, *script = NULL, *output = "/dev/null", *trace = NULL;
+  char *stats = NULL;
+  int rows = 24, cols = 80, pool_bench = 0, pool_workers = 0, diff = 0;
+  double autosave = 0;
+  char *autosave_to = NULL;
+  char **files = malloc(sizeof(char *) * argc);
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--daemon")) daemon_mode = 1;
+    else if (!strcmp(argv[i], "--stop")) return editorStopDaemon();
+    else if (!strcmp(argv[i], "--local")) local = 1;
+    else if (!strcmp(argv[i], "-d")) diff = 1;
+    else if (!strcmp(argv[i], "--autosave") && i + 1 < argc) {
+      char *spec = argv[++i], *end;
+      autosave = strtod(spec, &end);
+      if (autosave <= 0 || (*end && *end != ':') || (*end == ':' && !end[1])) {
+        fprintf(stderr, "wee: invalid --autosave %s (expected SECONDS[:inplace|:DIR])\n", spec);
+        return 1;
+      }
+      autosave_to = *end ? end + 1 : NULL;
+    }
+    else if (!strcmp(argv[i], "--session") && i + 1 < argc) session = argv[++i];
+    else if (!strcmp(argv[i], "--script") && i + 1 < argc) script = argv[++i];
+    else if (!strcmp(argv[i], "--output") && i + 1 < argc) output = argv[++i];
+    else if (!strcmp(argv[i], "--trace") && i + 1 < argc) trace = argv[++i];
+    else if (!strcmp(argv[i], "--stats") && i + 1 < argc) stats = argv[++i];
+    else if (!strcmp(argv[i], "--pool-bench") && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &pool_bench, &pool_workers) < 1 || pool_bench < 1) {
+        fprintf(stderr, "wee: invalid --pool-bench %s (expected JOBS[xWORKERS])\n", argv[i]);
+        return 1;
+      }
+    }
+    else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &rows, &cols) != 2 || rows < 4 || cols < 10) {
+        fprintf(stderr, "wee: invalid --size %s (expected ROWSxCOLS)\n", argv[i]);
+        return 1;
+      }
+    }
+    else files[nfiles++] = argv[i];
+  }
+
+  if (pool_bench) return editorPoolBench(pool_bench, pool_workers);
+  if (diff && (nfiles != 2 || session)) {
+    fprintf(stderr, "wee: -d takes two files and no session\n");
+    return 1;
+  }
+  if (daemon_mode) return editorDaemon();
+
+  if (script) {
+    // Headless: keys come from the script, frames go to a null or capture file
+    long long start = editorNow();
+    if (editorScriptLoad(script) == -1) return 1;
+    E.script->start_ns = start;
+    E.notty = 1;
+    initEditor();
+    E.termrows = rows - 2;
+    E.termcols = cols;
+    editorLayoutWindows();
+    E.ofd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (E.ofd == -1) {
+      perror(output);
+      return 1;
+    }
+    atexit(editorScriptReport);
+  } else {
+    int client = local || session || diff ? -1 : editorClient(nfiles, files);
+    if (client >= 0) return client;
+    enableRawMode();
+    initEditor();
+  }
+  if (autosave > 0) {
+    E.autosave_ns = (long long)(autosave * 1e9);
+    E.autosave_next = editorNow() + E.autosave_ns;
+    if (autosave_to && !strcmp(autosave_to, "inplace")) E.autosave_inplace = 1;
+    else E.autosave_dir = autosave_to;
+  }
+
+  if (trace) {
+    E.trace_path = trace;
+    E.trace_start_ns = editorNow();
+    atexit(traceWrite);
+  }
+
+  if (session) {
+    E.session = session;
+    int restored = editorSessionRestore(session) == 0;
+    for (int i = 0; i < nfiles; i++) {
+      if (restored || i > 0) editorAddBuffer(files[i]);
+      else {
+        editorOpen(files[0]);
+        E.buffers[0].loaded = 1;
+      }
+    }
+    if (!restored) editorSetStatusMessage("New session: %s", session);
+  } else if (nfiles >= 1) {
+    editorOpen(files[0]);
+    E.buffers[0].loaded = 1;
+    for (int i = 1; i < nfiles; i++) editorAddBuffer(files[i]);
+    if (diff) editorDiffStart();
   } else {
     editorSetStatusMessage("HELP: Ctrl-G = show help | Ctrl-S = save | Ctrl-Q = quit | Ctrl-O = open file");
   }
+  free(files);
+  // After opening the files, whose status message would hide the error
+  if (stats && editorStatsStart(stats) == -1)
+    editorSetStatusMessage("Cannot start the stats endpoint on %s: %s", stats, strerror(errno));
+  if (E.script) E.script->open_ns = editorNow();
 
   while (1) {
     editorRefreshScreen();